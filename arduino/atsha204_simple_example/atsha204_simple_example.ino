@@ -22,7 +22,6 @@ SHA204SWI sha204;
 
 void setup()
 {
-  sha204.power_up();
   Serial.begin(115200);
   Serial.println("Sending a Wakup Command. Response should be:\r\n4 11 33 43:");
   Serial.println("Response is:");
@@ -0,0 +1,194 @@
+/*
+ * BinaryProtocol.c
+ * (c) 2014 flabbergast
+ *  Binary mode v2: length-prefixed frames over the USB serial.
+ */
+
+#include "BinaryProtocol.h"
+#include "LufaLayer.h"
+#include "Timer.h"
+#include "SHA204/SHA204CRC.h"
+
+#define BINARY_RX_IDLE        0
+#define BINARY_RX_LENGTH_LOW  1
+#define BINARY_RX_LENGTH_HIGH 2
+#define BINARY_RX_ID          3
+#define BINARY_RX_TYPE        4
+#define BINARY_RX_PAYLOAD     5
+#define BINARY_RX_CRC_LOW     6
+#define BINARY_RX_CRC_HIGH    7
+#define BINARY_RX_SKIP        8
+
+#define BINARY_FRAME_ERRORS (BINARY_STATUS_PARAM_ERROR - BINARY_STATUS_FRAME_CRC + 1)
+static uint32_t frame_errors[BINARY_FRAME_ERRORS];
+static uint32_t dropped_bytes;
+
+void binary_frame_init(binary_frame_t *frame) {
+  frame->state = BINARY_RX_IDLE;
+}
+
+void binary_frame_start(binary_frame_t *frame) {
+  frame->state = BINARY_RX_LENGTH_LOW;
+  frame->request_id = 0;
+  frame->crc = sha204_crc_init();
+  frame->started_at = micros();
+}
+
+uint8_t binary_frame_active(binary_frame_t *frame) {
+  return frame->state != BINARY_RX_IDLE;
+}
+
+uint8_t binary_frame_receive(binary_frame_t *frame) {
+  uint8_t c;
+  uint8_t crc[2];
+
+  while(frame->state != BINARY_RX_IDLE) {
+    if(usb_serial_available() == 0) {
+      if(frame->state == BINARY_RX_SKIP) {
+        if(micros() - frame->started_at >= BINARY_FRAME_QUIET_US)
+          frame->state = BINARY_RX_IDLE;
+      } else if(micros() - frame->started_at >= BINARY_FRAME_TIMEOUT_US) {
+        frame->state = BINARY_RX_IDLE;
+        return BINARY_STATUS_FRAME_TIMEOUT;
+      }
+      break;
+    }
+    c = (uint8_t)usb_serial_getchar();
+    if(frame->state < BINARY_RX_CRC_LOW)
+      frame->crc = sha204_crc_update_byte(frame->crc, c);
+
+    switch(frame->state) {
+      case BINARY_RX_LENGTH_LOW:
+        frame->length = c;
+        frame->state = BINARY_RX_LENGTH_HIGH;
+        break;
+      case BINARY_RX_LENGTH_HIGH:
+        frame->length |= (uint16_t)c << 8;
+        if(frame->length > BINARY_FRAME_MAX_PAYLOAD) {
+          // the rest can't be trusted to be this frame: drop it
+          frame->state = BINARY_RX_SKIP;
+          frame->started_at = micros();
+          return BINARY_STATUS_FRAME_LENGTH;
+        }
+        frame->state = BINARY_RX_ID;
+        break;
+      case BINARY_RX_ID:
+        frame->request_id = c;
+        frame->state = BINARY_RX_TYPE;
+        break;
+      case BINARY_RX_TYPE:
+        frame->type = c;
+        frame->data[0] = (uint8_t)frame->length;
+        frame->count = 0;
+        frame->state = (frame->length > 0) ? BINARY_RX_PAYLOAD : BINARY_RX_CRC_LOW;
+        break;
+      case BINARY_RX_PAYLOAD:
+        frame->data[1 + frame->count++] = c;
+        if(frame->count == frame->length)
+          frame->state = BINARY_RX_CRC_LOW;
+        break;
+      case BINARY_RX_CRC_LOW:
+        frame->crc_low = c;
+        frame->state = BINARY_RX_CRC_HIGH;
+        break;
+      case BINARY_RX_CRC_HIGH:
+        frame->state = BINARY_RX_IDLE;
+        sha204_crc_final(frame->crc, crc);
+        if(crc[0] != frame->crc_low || crc[1] != c)
+          return BINARY_STATUS_FRAME_CRC;
+        return BINARY_STATUS_OK;
+      case BINARY_RX_SKIP:
+        frame->started_at = micros();
+        break;
+    }
+  }
+  return BINARY_FRAME_INCOMPLETE;
+}
+
+void binary_queue_init(binary_queue_t *queue) {
+  uint8_t i;
+
+  for(i=0; i<BINARY_QUEUE_DEPTH; i++)
+    binary_frame_init(&queue->frames[i]);
+  queue->head = 0;
+  queue->count = 0;
+}
+
+binary_frame_t *binary_queue_tail(binary_queue_t *queue) {
+  uint8_t i;
+
+  if(queue->count == BINARY_QUEUE_DEPTH)
+    return 0;
+  i = queue->head + queue->count;
+  if(i >= BINARY_QUEUE_DEPTH)
+    i -= BINARY_QUEUE_DEPTH;
+  return &queue->frames[i];
+}
+
+void binary_queue_push(binary_queue_t *queue) {
+  queue->count++;
+}
+
+binary_frame_t *binary_queue_head(binary_queue_t *queue) {
+  if(queue->count == 0)
+    return 0;
+  return &queue->frames[queue->head];
+}
+
+void binary_queue_pop(binary_queue_t *queue) {
+  if(++queue->head == BINARY_QUEUE_DEPTH)
+    queue->head = 0;
+  queue->count--;
+}
+
+void binary_frame_send(uint8_t request_id, uint8_t status, const uint8_t *payload, uint16_t length) {
+  uint8_t header[5];
+  uint8_t crc[2];
+
+  if(status >= BINARY_STATUS_FRAME_CRC && status <= BINARY_STATUS_PARAM_ERROR)
+    frame_errors[status - BINARY_STATUS_FRAME_CRC]++;
+  header[0] = BINARY_FRAME_SOF;
+  header[1] = (uint8_t)length;
+  header[2] = (uint8_t)(length >> 8);
+  header[3] = request_id;
+  header[4] = status;
+  sha204_crc_final(sha204_crc_update(sha204_crc_update(sha204_crc_init(), header+1, 4), payload, length), crc);
+
+  usb_serial_write_bytes(header, 5);
+  usb_serial_write_bytes(payload, length);
+  usb_serial_write_bytes(crc, 2);
+  usb_serial_flush_output(); // the host is waiting for it
+}
+
+uint32_t binary_frame_errors(uint8_t status) {
+  if(status < BINARY_STATUS_FRAME_CRC || status > BINARY_STATUS_PARAM_ERROR)
+    return 0;
+  return frame_errors[status - BINARY_STATUS_FRAME_CRC];
+}
+
+void binary_frame_dropped(void) {
+  dropped_bytes++;
+}
+
+uint32_t binary_dropped_bytes(void) {
+  return dropped_bytes;
+}
+
+void binary_reset_frame_errors(void) {
+  uint8_t i;
+
+  for(i=0; i<BINARY_FRAME_ERRORS; i++)
+    frame_errors[i] = 0;
+  dropped_bytes = 0;
+}
+
+int16_t binary_getchar_timeout(uint32_t timeout_us) {
+  uint32_t start = micros();
+
+  while(usb_serial_available() == 0) {
+    if(micros() - start >= timeout_us)
+      return -1;
+    usb_tasks();
+  }
+  return usb_serial_getchar();
+}
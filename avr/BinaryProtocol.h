@@ -0,0 +1,151 @@
+/*
+ * BinaryProtocol.h
+ * (c) 2014 flabbergast
+ *  Binary mode v2: length-prefixed frames over the USB serial.
+ *
+ *  Frame (both directions):
+ *    0xFC | length (2 bytes, LSB first) | request id | type | payload | CRC (2 bytes)
+ *  The CRC is the ATSHA204 one (SHA204CRC.h), over everything between
+ *  the 0xFC and the CRC. A response has the request id of its request
+ *  and a status byte in place of the type.
+ *
+ *  Receiving is a state machine: the main loop hands over the start byte
+ *  (binary_frame_start()) and then calls binary_frame_receive() on every
+ *  pass; it takes whatever bytes are there and never waits for more.
+ *
+ *  Complete requests wait in a small ring (binary_queue_t), so that the
+ *  host can keep several of them in flight: the next ones are received
+ *  while the oldest one executes. While the ring is full nothing is read
+ *  from USB, so the host is held off by the USB flow control.
+ */
+
+#ifndef _BINARY_PROTOCOL_H_
+#define _BINARY_PROTOCOL_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#define BINARY_FRAME_SOF 0xFC
+#define BINARY_PROTOCOL_VERSION 7 // 3: zone read/write, 4: stats, 5: ping, 6: stats pages, 7: trace
+
+#define BINARY_FRAME_MAX_PAYLOAD 99
+#ifndef BINARY_QUEUE_DEPTH
+#define BINARY_QUEUE_DEPTH 2 // requests in flight (each takes sizeof(binary_frame_t), 114 bytes, of RAM)
+#endif
+#define BINARY_FRAME_TIMEOUT_US 100000UL // the whole frame must arrive within this after 0xFC
+#define BINARY_FRAME_QUIET_US 20000UL    // after a bad header: drop bytes until none came for this long
+
+// request types
+#define BINARY_FRAME_HELLO 0x01       // -> version, max payload (2 bytes, LSB first), queue depth
+#define BINARY_FRAME_TRANSACTION 0x02 // flags, opcode, param1, param2 (2), [len, data] x 0..3
+                                      //  (as in binary mode v1) -> the ATSHA204 response packet
+#define BINARY_FRAME_ZONE_READ 0x03   // flags, zone, address (2), length (2) -> the bytes
+#define BINARY_FRAME_ZONE_WRITE 0x04  // flags, zone, address (2), the bytes -> nothing
+                                      //  (address, length: in bytes, multiples of 4)
+#define BINARY_ZONE_MAX (BINARY_FRAME_MAX_PAYLOAD & ~3) // bytes in one zone read/write
+#define BINARY_FRAME_STATS 0x05       // [page, [flags]] -> one page of the statistics (LSB first):
+                                      //  0 (also without payload): 4-byte counters: read cache hits,
+                                      //   misses, governor acquires, wakes, wakes avoided, idles, sleeps,
+                                      //   wake failures, send retries, receive retries, CRC errors,
+                                      //   command CRC errors, resyncs, resyncs with wake-up, resync
+                                      //   failures, framing errors 0x10-0x14 (5 counters), bytes
+                                      //   dropped between frames, stack bytes never used (since boot)
+                                      //  1: 2-byte histograms (see SHA204Stats.h): wake time, polls
+                                      //  2-15: op-code (latency slot page-2), 2 bytes each: commands,
+                                      //   failures, latency histogram
+                                      //  (SHA204_STATS_BUCKETS per histogram, 8 by default: the host
+                                      //   tells the number from the length of page 1)
+#define BINARY_STATS_PAGES 16
+#define BINARY_STATS_RESET 0x01       // flags: zero all the counters after this page
+#define BINARY_FRAME_PING 0x06        // -> as HELLO, then the interface (BINARY_INTERFACE_*) and the
+                                      //  serial number (9 bytes, read at boot; zeros if that failed)
+#define BINARY_PING_SIZE 14
+#define BINARY_FRAME_TRACE 0x07       // [from (2)] -> the number of the first entry returned (2), of the
+                                      //  next one to be recorded (2), then the recorded bus transactions
+                                      //  (SHA204Trace.h) from there on, as many as fit: time (4), event,
+                                      //  op-code, length, return code; without from (or if it is gone):
+                                      //  from the oldest one (unknown type: firmware without SHA204_TRACE)
+#define BINARY_TRACE_ENTRY_SIZE 8
+
+// the ATSHA204 interface of the firmware (PING)
+#define BINARY_INTERFACE_SWI 0
+#define BINARY_INTERFACE_SWI_UART 1
+#define BINARY_INTERFACE_TWI 2
+
+// transaction flags (the first byte; v1 too, and zone reads/writes)
+#define BINARY_TRANSACTION_IDLE 0x01          // afterwards idle, not sleep
+#define BINARY_TRANSACTION_SESSION_BEGIN 0x02 // start a wake session with this command
+#define BINARY_TRANSACTION_SESSION_END 0x04   // end the wake session after this command
+
+// response status
+#define BINARY_STATUS_OK 0x00
+// framing errors: the request was not understood, nothing was sent to the ATSHA204
+#define BINARY_STATUS_FRAME_CRC 0x10
+#define BINARY_STATUS_FRAME_LENGTH 0x11
+#define BINARY_STATUS_FRAME_TIMEOUT 0x12
+#define BINARY_STATUS_UNKNOWN_TYPE 0x13
+#define BINARY_STATUS_PARAM_ERROR 0x14
+// device error: the command failed, the payload is the SHA204 library return code
+#define BINARY_STATUS_DEVICE_ERROR 0x20
+
+// binary_frame_receive(): no complete frame yet
+#define BINARY_FRAME_INCOMPLETE 0xFF
+
+typedef struct {
+  uint8_t state;
+  uint8_t request_id;
+  uint8_t type;
+  uint16_t length;
+  uint16_t count;
+  uint16_t crc;
+  uint8_t crc_low;
+  uint32_t started_at; // micros(); while dropping bytes: of the last one
+  uint8_t data[1 + BINARY_FRAME_MAX_PAYLOAD]; // data[0] = length, then the payload
+} binary_frame_t;
+
+typedef struct {
+  binary_frame_t frames[BINARY_QUEUE_DEPTH];
+  uint8_t head;  // oldest complete request
+  uint8_t count; // complete requests
+} binary_queue_t;
+
+void binary_frame_init(binary_frame_t *frame);
+// the start byte was received
+void binary_frame_start(binary_frame_t *frame);
+// is a frame being received (or a bad one dropped)?
+uint8_t binary_frame_active(binary_frame_t *frame);
+// BINARY_FRAME_INCOMPLETE, BINARY_STATUS_OK (the frame is in data) or a framing error
+uint8_t binary_frame_receive(binary_frame_t *frame);
+
+void binary_queue_init(binary_queue_t *queue);
+// the slot to receive the next request into (0 if the queue is full)
+binary_frame_t *binary_queue_tail(binary_queue_t *queue);
+// the tail slot holds a complete request now
+void binary_queue_push(binary_queue_t *queue);
+// the oldest complete request (0 if none)
+binary_frame_t *binary_queue_head(binary_queue_t *queue);
+void binary_queue_pop(binary_queue_t *queue);
+
+void binary_frame_send(uint8_t request_id, uint8_t status, const uint8_t *payload, uint16_t length);
+
+// framing error responses sent (status: BINARY_STATUS_FRAME_CRC .. BINARY_STATUS_PARAM_ERROR)
+uint32_t binary_frame_errors(uint8_t status);
+// While requests are pending only frames are expected, and whatever comes
+// between them (up to the next BINARY_FRAME_SOF) is dropped without an
+// answer, since there is no request id to answer to; it is counted here
+// instead (reset with the framing errors).
+void binary_frame_dropped(void);
+uint32_t binary_dropped_bytes(void);
+void binary_reset_frame_errors(void);
+
+// next byte from the USB serial, or -1 if none came in timeout_us (keeps USB going)
+int16_t binary_getchar_timeout(uint32_t timeout_us);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
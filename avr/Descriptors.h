@@ -61,8 +61,8 @@
 		/** Size in bytes of the CDC device-to-host notification IN endpoint. */
 		#define CDC_NOTIFICATION_EPSIZE        8
 
-		/** Size in bytes of the CDC data IN and OUT endpoints. */
-		#define CDC_TXRX_EPSIZE                16
+		/** Size in bytes of the CDC data IN and OUT endpoints (double banked, see LufaLayer.c). */
+		#define CDC_TXRX_EPSIZE                64
 
 		/** Endpoint address of the Keyboard HID reporting IN endpoint. */
 		#define KEYBOARD_EPADDR                (ENDPOINT_DIR_IN  | 1)
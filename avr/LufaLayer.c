@@ -45,6 +45,7 @@
 #include <avr/power.h>
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
+#include <avr/sleep.h>
 #include <string.h>
 
 #include "Descriptors.h"
@@ -69,13 +70,13 @@ USB_ClassInfo_CDC_Device_t VirtualSerial_CDC_Interface =
           {
             .Address                = CDC_TX_EPADDR,
             .Size                   = CDC_TXRX_EPSIZE,
-            .Banks                  = 1,
+            .Banks                  = 2,
           },
         .DataOUTEndpoint                =
           {
             .Address                = CDC_RX_EPADDR,
             .Size                   = CDC_TXRX_EPSIZE,
-            .Banks                  = 1,
+            .Banks                  = 2,
           },
         .NotificationEndpoint           =
           {
@@ -109,6 +110,46 @@ USB_ClassInfo_HID_Device_t Keyboard_HID_Interface =
       },
   };
 
+/* Buffered usb_serial output: bytes are collected here and handed to the
+ * CDC driver a block at a time - when the buffer is full, on every
+ * usb_tasks() and on usb_serial_flush_output().
+ */
+static uint8_t serial_out_buffer[CDC_TXRX_EPSIZE];
+static uint8_t serial_out_count = 0;
+
+/* Received bytes are moved from the CDC endpoint into this ring by the
+ * SOF interrupt (every millisecond), so they are there without polling.
+ * Single producer (the interrupt, head) and single consumer (the main
+ * code, tail): no locking needed. While the ring is full, the bytes stay
+ * in the endpoint and the host is NAKed.
+ */
+#define SERIAL_IN_RING_SIZE 128 // power of 2, at most 128
+static uint8_t serial_in_ring[SERIAL_IN_RING_SIZE];
+static volatile uint8_t serial_in_head = 0;
+static volatile uint8_t serial_in_tail = 0;
+
+static void usb_serial_fill_input(void)
+{
+  uint8_t head = serial_in_head;
+  int16_t c;
+
+  while((uint8_t)(head - serial_in_tail) < SERIAL_IN_RING_SIZE) {
+    if((c = CDC_Device_ReceiveByte(&VirtualSerial_CDC_Interface)) < 0)
+      break;
+    serial_in_ring[head & (SERIAL_IN_RING_SIZE-1)] = (uint8_t)c;
+    head++;
+  }
+  serial_in_head = head;
+}
+
+static void usb_serial_drain_output(void)
+{
+  if(serial_out_count > 0) {
+    CDC_Device_SendData(&VirtualSerial_CDC_Interface, serial_out_buffer, serial_out_count);
+    serial_out_count = 0;
+  }
+}
+
 /* by flabbergast:
  * implementation of exported functions
  * ** basic functions **
@@ -120,8 +161,22 @@ void init(void)
     GlobalInterruptEnable();
 }
 
+void sleep_until_interrupt(void)
+{
+  cli();
+  if(serial_in_head == serial_in_tail) {
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    sleep_enable();
+    sei(); // the next instruction still runs before any interrupt
+    sleep_cpu();
+    sleep_disable();
+  }
+  sei();
+}
+
 void usb_tasks(void)
 {
+    usb_serial_drain_output();
     CDC_Device_USBTask(&VirtualSerial_CDC_Interface);
     HID_Device_USBTask(&Keyboard_HID_Interface);
     USB_USBTask();
@@ -133,12 +188,19 @@ void usb_tasks(void)
 
 uint16_t usb_serial_available(void)
 {
-  return CDC_Device_BytesReceived(&VirtualSerial_CDC_Interface);
+  return (uint8_t)(serial_in_head - serial_in_tail);
 }
 
 int16_t usb_serial_getchar(void)
 {
-  return CDC_Device_ReceiveByte(&VirtualSerial_CDC_Interface);
+  uint8_t tail = serial_in_tail;
+  uint8_t c;
+
+  if(tail == serial_in_head)
+    return -1;
+  c = serial_in_ring[tail & (SERIAL_IN_RING_SIZE-1)];
+  serial_in_tail = tail + 1;
+  return c;
 }
 
 void usb_serial_wait_for_key(void)
@@ -146,37 +208,64 @@ void usb_serial_wait_for_key(void)
   while(usb_serial_available() == 0) {
     usb_tasks();
     service_button();
-    _delay_ms(10);
+    sleep_until_interrupt();
   }
 }
 
 void usb_serial_flush_input(void)
 {
   int16_t i;
-  int16_t bufsize = CDC_Device_BytesReceived(&VirtualSerial_CDC_Interface);
+  int16_t bufsize;
+  uint8_t sreg = SREG;
+
+  cli(); // keep the SOF interrupt out of the endpoint meanwhile
+  bufsize = CDC_Device_BytesReceived(&VirtualSerial_CDC_Interface);
   for(i=0; i<bufsize; i++)
     CDC_Device_ReceiveByte(&VirtualSerial_CDC_Interface);
+  serial_in_tail = serial_in_head;
+  SREG = sreg;
 }
 
 void usb_serial_putchar(uint8_t ch)
 {
-  CDC_Device_SendByte(&VirtualSerial_CDC_Interface, ch);
+  serial_out_buffer[serial_out_count++] = ch;
+  if(serial_out_count == sizeof(serial_out_buffer))
+    usb_serial_drain_output();
+}
+
+void usb_serial_write_bytes(const uint8_t *data, uint16_t length)
+{
+  uint8_t n;
+
+  while(length > 0) {
+    n = sizeof(serial_out_buffer) - serial_out_count;
+    if(n > length)
+      n = length;
+    memcpy(serial_out_buffer + serial_out_count, data, n);
+    serial_out_count += n;
+    data += n;
+    length -= n;
+    if(serial_out_count == sizeof(serial_out_buffer))
+      usb_serial_drain_output();
+  }
 }
 
 void usb_serial_write(const char* const buffer)
 {
-  CDC_Device_SendString(&VirtualSerial_CDC_Interface, buffer);
+  usb_serial_write_bytes((const uint8_t *)buffer, strlen(buffer));
 }
 
 void usb_serial_write_P(const char* data)
 {
-  while(pgm_read_byte(data) != 0)
-    usb_serial_putchar(pgm_read_byte(data++));
+  uint8_t c;
+
+  while((c = pgm_read_byte(data++)) != 0)
+    usb_serial_putchar(c);
 }
 
 void usb_serial_writeln(const char* const buffer)
 {
-  CDC_Device_SendString(&VirtualSerial_CDC_Interface, buffer);
+  usb_serial_write(buffer);
   usb_serial_write_P(PSTR("\r\n"));
 }
 
@@ -188,6 +277,7 @@ void usb_serial_writeln_P(const char* data)
 
 void usb_serial_flush_output(void)
 {
+  usb_serial_drain_output();
   CDC_Device_Flush(&VirtualSerial_CDC_Interface);
 }
 
@@ -241,7 +331,7 @@ uint16_t usb_serial_readline(char *buffer, const uint16_t buffer_size, const boo
     }
     usb_tasks();
     service_button();
-    _delay_ms(10);
+    sleep_until_interrupt();
   }
   return 0; // never reached
 }
@@ -344,7 +434,12 @@ void EVENT_USB_Device_ControlRequest(void)
 /** Event handler for the USB device Start Of Frame event. */
 void EVENT_USB_Device_StartOfFrame(void)
 {
+  // (interrupt context) the main code may be in the middle of using another endpoint
+  uint8_t PrevEndpoint = Endpoint_GetCurrentEndpoint();
+
   HID_Device_MillisecondElapsed(&Keyboard_HID_Interface);
+  usb_serial_fill_input();
+  Endpoint_SelectEndpoint(PrevEndpoint);
 }
 
 /* by flabbergast:
@@ -61,17 +61,19 @@ extern "C"{
     // basic functions
     void init(void);
     void usb_tasks(void);
+    void sleep_until_interrupt(void); // SLEEP_MODE_IDLE until the next interrupt (USB SOF, timer), unless input is waiting
     // usb_serial
-    uint16_t usb_serial_available(void); // number of getchars guaranteed to succeed immediately
+    uint16_t usb_serial_available(void); // number of getchars guaranteed to succeed immediately (filled from the USB SOF interrupt)
     int16_t usb_serial_getchar(void); // negative values mean error in receiving (not connected or no input)
     void usb_serial_flush_input(void);
-    void usb_serial_putchar(uint8_t ch);
+    void usb_serial_putchar(uint8_t ch); // output is buffered: sent when 64 bytes are collected, on usb_tasks() or flush_output
+    void usb_serial_write_bytes(const uint8_t *data, uint16_t length);
     void usb_serial_wait_for_key(void); // BLOCKING (takes care of _tasks)
     void usb_serial_write(const char* const buffer);
     void usb_serial_write_P(const char* data);
     void usb_serial_writeln(const char* const buffer);
     void usb_serial_writeln_P(const char* data);
-    void usb_serial_flush_output(void);
+    void usb_serial_flush_output(void); // send the buffered output right away
     uint16_t usb_serial_readline(char *buffer, const uint16_t buffer_size, const bool obscure_input); // BLOCKING (takes care of _tasks)
     bool usb_serial_dtr(void);
     // usb_keyboard
@@ -18,37 +18,227 @@ limitations under the License.
 #define SHA204_Library_h
 
 #include <stdint.h>
+#include "SHA204Definitions.h"
+#include "SHA204ReadCache.h"
+#include "SHA204Stats.h"
+#include "SHA204Trace.h"
+#include "SHA204Commands.h"
 
-class SHA204 {
+// idle/sleep governor policies (see acquire() / release())
+#define SHA204_GOVERNOR_IMMEDIATE 0 // idle/sleep at every release()
+#define SHA204_GOVERNOR_ADAPTIVE  1 // stay awake between requests which come in bursts
+
+typedef struct {
+  uint32_t acquires;
+  uint32_t wakes;         // wake-ups sent (wakeup(), also by resync())
+  uint32_t wakes_avoided; // acquire() found the chip still awake
+  uint32_t idles;
+  uint32_t sleeps;
+} sha204_governor_stats_t;
+
+// a part of a command, sent from where it is (see begin_send_fragments())
+typedef struct {
+  const uint8_t *data;
+  uint8_t length;
+} sha204_fragment_t;
+
+#define SHA204_FRAGMENTS_MAX 5 // the header, up to three data parts, the CRC
+
+// SHA204_STATIC_TRANSPORT: a transport is a SHA204Core of its own (calls
+//  into it are direct, and can be inlined) instead of a SHA204 (virtual
+//  calls, one copy of the library code for any number of transports)
+#ifdef SHA204_STATIC_TRANSPORT
+#define SHA204_TRANSPORT_BASE(transport) SHA204Core<transport>
+#else
+#define SHA204_TRANSPORT_BASE(transport) SHA204
+#endif
+
+// the transports are final where the compiler knows it (C++11): their
+//  calls to themselves are direct then
+#if defined(__cplusplus) && __cplusplus >= 201103L
+#define SHA204_FINAL final
+#else
+#define SHA204_FINAL
+#endif
+
+// The library, on top of a transport (CRTP: Transport derives from
+//  SHA204Core<Transport>). It calls the transport's SHA204_RESPONSE_TIMEOUT(),
+//  receive_response(), send_command(), send_command_fragments(),
+//  chip_wakeup(), sleep(), idle() and resync(); they can be private if
+//  SHA204Core<Transport> is a friend. The member definitions are in
+//  SHA204Core.h.
+template <class Transport>
+class SHA204Core {
 private:
-  virtual uint16_t SHA204_RESPONSE_TIMEOUT() = 0;
+  Transport *bus(void) { return static_cast<Transport *>(this); }
+
+  static int8_t latency_slot(uint8_t op_code);
+  static void wake_response(uint8_t *response); // what the chip sends after a wake-up
+  // delays and response size of a command (for execute())
+  static uint8_t execute_timing(uint8_t op_code, uint8_t param1, uint8_t rx_size, uint8_t *poll_delay, uint8_t *poll_timeout);
+
+  // learned execution time per op-code (us, 0 = nothing learned yet)
+  uint16_t latency_estimate[SHA204_LATENCY_SLOTS];
+  void learn_latency(uint8_t op_code, uint32_t measured_us);
+  uint32_t first_poll_delay(uint8_t op_code, uint8_t execution_delay);
+
+  // command in progress (see begin_send_and_receive() / poll())
+  struct {
+    uint8_t state;
+    uint8_t *tx_buffer;
+    uint8_t *rx_buffer;
+    uint8_t rx_size;
+    uint8_t execution_delay;
+    uint8_t execution_timeout;
+    uint8_t n_retries_send;
+    uint8_t n_retries_receive;
+    uint8_t learn;
+    uint8_t polls;
+    uint8_t ret_code;
+    uint32_t sent_at;
+    uint32_t polled_at;
+    uint32_t deadline;
+    uint32_t next_poll;
+    uint8_t packet[SHA204_CMD_SIZE_MIN]; // of a fixed command, or header and CRC of a
+                                         //  scattered one (tx_buffer points here)
+    sha204_fragment_t fragments[SHA204_FRAGMENTS_MAX];
+    uint8_t n_fragments;                 // 0: tx_buffer is the whole command
+  } cmd;
+  uint8_t begin_command(uint8_t *tx_buffer, uint8_t rx_size, uint8_t *rx_buffer, uint8_t execution_delay, uint8_t execution_timeout);
+  uint8_t finish(uint8_t ret_code);
+  uint8_t resync_and_retry(uint8_t ret_code);
+  uint8_t recover(void);
+
+  // idle/sleep governor
+  struct {
+    uint8_t policy;
+    uint8_t state;        // of the chip, as far as we know
+    uint8_t park_idle;    // what the last release() asked for
+    uint8_t holding;      // kept awake until hold_until
+    uint8_t released;     // released_at is valid
+    uint8_t session;      // in a wake session: release() keeps the chip awake
+    uint32_t awake_since; // the watchdog runs from here
+    uint32_t released_at;
+    uint32_t hold_until;
+    uint32_t gap;         // learned time from release() to the next acquire() (us, 0 = nothing learned yet)
+  } gov;
+  sha204_governor_stats_t gov_stats;
+  void learn_gap(uint32_t now);
+
+  SHA204ReadCache *read_cache;
+  SHA204Stats *stats;
+#ifdef SHA204_TRACE
+  SHA204Trace *trace;
+#endif
+
+protected:
   void calculate_crc(uint8_t length, uint8_t *data, uint8_t *crc);
   uint8_t check_crc(uint8_t *response);
-  virtual uint8_t receive_bytes(uint8_t count, uint8_t *buffer) = 0;
-  virtual uint8_t send_bytes(uint8_t count, uint8_t *buffer) = 0;
-  virtual uint8_t send_byte(uint8_t value) = 0;
-  virtual uint8_t receive_response(uint8_t size, uint8_t *response) = 0;
-  virtual uint8_t send_command(uint8_t count, uint8_t * command) = 0;
-  virtual uint8_t chip_wakeup() = 0; // Called this because wakeup() was causing method lookup issues with wakeup(*response)
-
+  // the parts one after the other, as if put together: for transports
+  //  which can't stream them, this does just that and calls send_command()
+  uint8_t send_command_fragments(uint8_t count, const sha204_fragment_t *fragments, uint8_t n_fragments);
 
 public:
-  virtual uint8_t sleep() = 0;
-  virtual uint8_t idle() = 0;
+  SHA204Core(void);
   uint8_t wakeup(uint8_t *response);
 
+  // idle/sleep governor: acquire() instead of wakeup() before a command,
+  //  release() instead of idle()/sleep() after it. Depending on the policy,
+  //  release() keeps the chip awake for a while if the requests come in
+  //  quick succession, and acquire() then skips the wake-up (response gets
+  //  the usual 04 11 33 43). governor_service() has to be called now and
+  //  then to put a held chip away; it returns the time (us) until it wants
+  //  to be called again, 0 if the chip is not held.
+  uint8_t acquire(uint8_t *response);
+  uint8_t release(uint8_t idle);
+  uint8_t park(uint8_t idle); // idle/sleep right away
+  uint32_t governor_service(void);
+  void set_governor_policy(uint8_t policy);
+  void get_governor_stats(sha204_governor_stats_t *stats);
+  void reset_governor_stats(void);
+
+  // wake session: one wake-up for a sequence of commands (TempKey survives
+  //  in between). In a session acquire() is session_check() and release()
+  //  does nothing; a wake-up about to run into the watchdog is renewed
+  //  through idle, and SHA204_WAKE_EXPIRED is returned (once) if the chip
+  //  may have gone to sleep. See also SHA204WakeSession.
+  uint8_t begin_session(uint8_t *response);
+  uint8_t session_check(uint8_t *response);
+  uint8_t end_session(uint8_t idle);
+  uint8_t in_session(void); // a session is open (it may have expired unnoticed)
+
   uint8_t execute(uint8_t op_code, uint8_t param1, uint16_t param2,
                   uint8_t datalen1, uint8_t *data1, uint8_t datalen2, uint8_t *data2, uint8_t datalen3, uint8_t *data3,
                   uint8_t tx_size, uint8_t *tx_buffer, uint8_t rx_size, uint8_t *rx_buffer);
+  uint8_t begin_execute(uint8_t op_code, uint8_t param1, uint16_t param2,
+                  uint8_t datalen1, uint8_t *data1, uint8_t datalen2, uint8_t *data2, uint8_t datalen3, uint8_t *data3,
+                  uint8_t tx_size, uint8_t *tx_buffer, uint8_t rx_size, uint8_t *rx_buffer);
   uint8_t check_parameters(uint8_t op_code, uint8_t param1, uint16_t param2,
                   uint8_t datalen1, uint8_t *data1, uint8_t datalen2, uint8_t *data2, uint8_t datalen3, uint8_t *data3,
                   uint8_t tx_size, uint8_t *tx_buffer, uint8_t rx_size, uint8_t *rx_buffer);
+  // the same without tx_buffer: the data goes onto the bus from where it
+  //  is (begin_send_fragments()), so it has to stay valid until the
+  //  command is done
+  uint8_t execute(uint8_t op_code, uint8_t param1, uint16_t param2,
+                  uint8_t datalen1, const uint8_t *data1, uint8_t datalen2, const uint8_t *data2,
+                  uint8_t datalen3, const uint8_t *data3, uint8_t rx_size, uint8_t *rx_buffer);
+  uint8_t begin_execute(uint8_t op_code, uint8_t param1, uint16_t param2,
+                  uint8_t datalen1, const uint8_t *data1, uint8_t datalen2, const uint8_t *data2,
+                  uint8_t datalen3, const uint8_t *data3, uint8_t rx_size, uint8_t *rx_buffer);
 
   uint8_t send_and_receive(uint8_t *tx_buffer, uint8_t rx_size, uint8_t *rx_buffer, uint8_t execution_delay, uint8_t execution_timeout);
-  virtual uint8_t resync(uint8_t size, uint8_t *response) = 0;
+  // non-blocking version: begin_*() return SHA204_SUCCESS if the command
+  //  was started (or an error), then call poll() until it stops returning
+  //  SHA204_CMD_PENDING. Buffers have to stay valid until then.
+  //  One command at a time (begin_*() return SHA204_FUNC_FAIL when busy,
+  //  after having marshaled into their tx_buffer, so don't share it).
+  uint8_t begin_send_and_receive(uint8_t *tx_buffer, uint8_t rx_size, uint8_t *rx_buffer, uint8_t execution_delay, uint8_t execution_timeout);
+  uint8_t poll(void);
+  uint8_t busy(void);
+  uint32_t poll_wait(void);
+  uint8_t wait(void);
+  uint8_t complete(uint8_t ret_code);
+  // a command built at compile time (SHA204Commands.h, in flash): no
+  //  marshaling, no CRC, no tx_buffer; otherwise as begin_*() and the
+  //  blocking ones
+  uint8_t begin_fixed(const sha204_fixed_command_t *command, uint8_t *rx_buffer);
+  uint8_t fixed(const sha204_fixed_command_t *command, uint8_t *rx_buffer);
+  // scatter-gather: a command whose data is in up to three places; the
+  //  header and the CRC (worked out over the parts where they are) are
+  //  kept here, the transport streams the parts onto the bus one after
+  //  the other. The parts have to stay valid until the command is done.
+  uint8_t begin_send_fragments(uint8_t op_code, uint8_t param1, uint16_t param2,
+                  const sha204_fragment_t *data, uint8_t n_data,
+                  uint8_t rx_size, uint8_t *rx_buffer, uint8_t execution_delay, uint8_t execution_timeout);
+
+  // answer the reads of locked zones from RAM (0: no cache)
+  void set_read_cache(SHA204ReadCache *cache);
+  // count the commands, retries and latencies (0: don't)
+  void set_stats(SHA204Stats *counters);
+#ifdef SHA204_TRACE
+  // record the bus transactions (0: don't)
+  void set_trace(SHA204Trace *ring);
+#endif
+
+  // learned execution times, e.g. for keeping them in EEPROM
+  //  (arrays of SHA204_LATENCY_SLOTS entries, in us)
+  void get_latency_estimates(uint16_t *estimates);
+  void set_latency_estimates(const uint16_t *estimates);
+  void reset_latency_estimates(void);
 
   uint8_t serialNumber(uint8_t *response);
 
+  // whole zones (or parts): length bytes from/to address (both multiples
+  //  of 4), with 32-byte accesses wherever they fit and 4-byte ones for the
+  //  rest; writes are unencrypted. The chip has to be awake (acquire() or
+  //  a session around the call); they block until done.
+  uint16_t zone_size(uint8_t zone);
+  uint8_t read_zone(uint8_t zone, uint16_t address, uint16_t length, uint8_t *data);
+  // read_zone() from the read cache alone: 1 if it had all of it. Nothing
+  //  goes onto the bus, so ask before acquire() and skip the wake-up.
+  uint8_t read_zone_cached(uint8_t zone, uint16_t address, uint16_t length, uint8_t *data);
+  uint8_t write_zone(uint8_t zone, uint16_t address, uint16_t length, const uint8_t *data);
+
   uint8_t check_mac(uint8_t *tx_buffer, uint8_t *rx_buffer, uint8_t mode, uint8_t key_id, uint8_t *client_challenge, uint8_t *client_response, uint8_t *other_data);
   uint8_t derive_key(uint8_t *tx_buffer, uint8_t *rx_buffer, uint8_t random, uint8_t target_key, uint8_t *mac);
   uint8_t dev_rev(uint8_t *tx_buffer, uint8_t *rx_buffer);
@@ -63,6 +253,68 @@ public:
   uint8_t update_extra(uint8_t *tx_buffer, uint8_t *rx_buffer, uint8_t mode, uint8_t new_value);
   uint8_t write(uint8_t *tx_buffer, uint8_t *rx_buffer, uint8_t zone, uint16_t address, uint8_t *value, uint8_t *mac);
   uint8_t sha(uint8_t *tx_buffer, uint8_t *rx_buffer, uint8_t mode, uint8_t *message);
+
+  uint8_t begin_check_mac(uint8_t *tx_buffer, uint8_t *rx_buffer, uint8_t mode, uint8_t key_id, uint8_t *client_challenge, uint8_t *client_response, uint8_t *other_data);
+  uint8_t begin_derive_key(uint8_t *tx_buffer, uint8_t *rx_buffer, uint8_t random, uint8_t target_key, uint8_t *mac);
+  uint8_t begin_dev_rev(uint8_t *tx_buffer, uint8_t *rx_buffer);
+  uint8_t begin_gen_dig(uint8_t *tx_buffer, uint8_t *rx_buffer, uint8_t zone, uint8_t key_id, uint8_t *other_data);
+  uint8_t begin_hmac(uint8_t *tx_buffer, uint8_t *rx_buffer, uint8_t mode, uint16_t key_id);
+  uint8_t begin_lock(uint8_t *tx_buffer, uint8_t *rx_buffer, uint8_t zone, uint16_t summary);
+  uint8_t begin_mac(uint8_t *tx_buffer, uint8_t *rx_buffer, uint8_t mode, uint16_t key_id, uint8_t *challenge);
+  uint8_t begin_nonce(uint8_t *tx_buffer, uint8_t *rx_buffer, uint8_t mode, uint8_t *numin);
+  uint8_t begin_pause(uint8_t *tx_buffer, uint8_t *rx_buffer, uint8_t selector);
+  uint8_t begin_random(uint8_t *tx_buffer, uint8_t *rx_buffer, uint8_t mode);
+  uint8_t begin_read(uint8_t *tx_buffer, uint8_t *rx_buffer, uint8_t zone, uint16_t address);
+  uint8_t begin_update_extra(uint8_t *tx_buffer, uint8_t *rx_buffer, uint8_t mode, uint8_t new_value);
+  uint8_t begin_write(uint8_t *tx_buffer, uint8_t *rx_buffer, uint8_t zone, uint16_t address, uint8_t *value, uint8_t *mac);
+  uint8_t begin_sha(uint8_t *tx_buffer, uint8_t *rx_buffer, uint8_t mode, uint8_t *message);
+};
+
+// The library with the transport behind virtual calls: the transports
+//  derive from this unless SHA204_STATIC_TRANSPORT is defined, as do
+//  those which are only ever used this way (SHA204Emu).
+class SHA204 : public SHA204Core<SHA204> {
+  friend class SHA204Core<SHA204>;
+
+private:
+  virtual uint16_t SHA204_RESPONSE_TIMEOUT() = 0;
+  virtual uint8_t receive_bytes(uint8_t count, uint8_t *buffer) = 0;
+  virtual uint8_t send_bytes(uint8_t count, uint8_t *buffer) = 0;
+  virtual uint8_t send_byte(uint8_t value) = 0;
+  // reads only the count byte and the rest of the response, checks its CRC
+  virtual uint8_t receive_response(uint8_t size, uint8_t *response) = 0;
+  virtual uint8_t send_command(uint8_t count, uint8_t * command) = 0;
+  virtual uint8_t chip_wakeup() = 0; // Called this because wakeup() was causing method lookup issues with wakeup(*response)
+  virtual uint8_t send_command_fragments(uint8_t count, const sha204_fragment_t *fragments, uint8_t n_fragments);
+
+public:
+  virtual uint8_t sleep() = 0;
+  virtual uint8_t idle() = 0;
+  virtual uint8_t resync(uint8_t size, uint8_t *response) = 0;
+};
+
+// Wake session for the lifetime of the object: the constructor wakes the
+//  chip up, check() goes before every command, the destructor puts the
+//  chip to idle or sleep. Device is the transport class (or SHA204).
+template <class Device>
+class SHA204WakeSession {
+private:
+  Device &device;
+  uint8_t to_idle;
+  uint8_t ret_code;
+  SHA204WakeSession(const SHA204WakeSession &);            // not copyable
+  SHA204WakeSession &operator=(const SHA204WakeSession &);
+
+public:
+  SHA204WakeSession(Device &device, uint8_t *response, uint8_t idle = 0)
+    : device(device), to_idle(idle) {
+    ret_code = device.begin_session(response);
+  }
+  ~SHA204WakeSession() {
+    (void) device.end_session(to_idle);
+  }
+  uint8_t status(void) { return ret_code; } // of the wake-up in the constructor
+  uint8_t check(uint8_t *response) { return device.session_check(response); }
 };
 
 #endif
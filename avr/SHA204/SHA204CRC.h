@@ -0,0 +1,92 @@
+/*
+ * SHA204CRC.h
+ * (c) 2014 flabbergast
+ *  CRC-16 of the ATSHA204 command and response packets
+ *  (polynomial 0x8005, initial value 0, data bits fed LSB first).
+ *
+ *  The engine keeps the register bit-reversed (that is the "reflected"
+ *  form with polynomial 0xA001, also known as CRC-16/ARC), so that whole
+ *  bytes can be processed without reversing them; sha204_crc_final()
+ *  turns it back into the two bytes the chip sends (LSB first).
+ *
+ *  Usage:
+ *    uint16_t crc = sha204_crc_init();
+ *    crc = sha204_crc_update(crc, data, length); // as often as needed
+ *    sha204_crc_final(crc, out);
+ *
+ *  Three implementations, selected with SHA204_CRC_VARIANT:
+ *    SHA204_CRC_TABLE   - 256 entry table in flash (512 bytes), default
+ *    SHA204_CRC_NIBBLE  - 16 entry table in flash (32 bytes)
+ *    SHA204_CRC_BITWISE - no table, one bit at a time
+ *  All of them are available under their own names as well (the unused
+ *  ones are dropped by the linker).
+ *
+ *  For packets known at compile time, sha204_crc_static() (C++11) works
+ *  out the same CRC as a constant expression, one bit at a time the way
+ *  the datasheet has it; low byte first, as sha204_crc_final() puts it:
+ *    crc = sha204_crc_static(0, 0x07, 0x30, 0x00, 0x00, 0x00); // DevRev
+ */
+
+#ifndef SHA204_CRC_h
+#define SHA204_CRC_h
+
+#include <stdint.h>
+
+#define SHA204_CRC_TABLE   1
+#define SHA204_CRC_NIBBLE  2
+#define SHA204_CRC_BITWISE 3
+
+#ifndef SHA204_CRC_VARIANT
+#define SHA204_CRC_VARIANT SHA204_CRC_TABLE
+#endif
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+uint16_t sha204_crc_update_table(uint16_t crc, const uint8_t *data, uint16_t length);
+uint16_t sha204_crc_update_nibble(uint16_t crc, const uint8_t *data, uint16_t length);
+uint16_t sha204_crc_update_bitwise(uint16_t crc, const uint8_t *data, uint16_t length);
+void sha204_crc_final(uint16_t crc, uint8_t *out);
+
+#ifdef __cplusplus
+}
+#endif
+
+static inline uint16_t sha204_crc_init(void) {
+  return 0;
+}
+
+static inline uint16_t sha204_crc_update(uint16_t crc, const uint8_t *data, uint16_t length) {
+#if SHA204_CRC_VARIANT == SHA204_CRC_NIBBLE
+  return sha204_crc_update_nibble(crc, data, length);
+#elif SHA204_CRC_VARIANT == SHA204_CRC_BITWISE
+  return sha204_crc_update_bitwise(crc, data, length);
+#else
+  return sha204_crc_update_table(crc, data, length);
+#endif
+}
+
+static inline uint16_t sha204_crc_update_byte(uint16_t crc, uint8_t value) {
+  return sha204_crc_update(crc, &value, 1);
+}
+
+#if defined(__cplusplus) && __cplusplus >= 201103L
+constexpr uint16_t sha204_crc_static_bits(uint16_t crc, uint8_t value, uint8_t bit) {
+  return (bit == 8) ? crc
+         : sha204_crc_static_bits((uint16_t) ((crc << 1) ^ ((((value >> bit) & 1) != (crc >> 15)) ? 0x8005 : 0)),
+                                  value, bit + 1);
+}
+
+constexpr uint16_t sha204_crc_static(uint16_t crc) {
+  return crc;
+}
+
+template <typename... Bytes>
+constexpr uint16_t sha204_crc_static(uint16_t crc, uint8_t value, Bytes... rest) {
+  return sha204_crc_static(sha204_crc_static_bits(crc, value, 0), rest...);
+}
+#endif
+
+#endif
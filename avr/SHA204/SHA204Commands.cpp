@@ -0,0 +1,37 @@
+/*
+ * SHA204Commands.cpp
+ * (c) 2014 flabbergast
+ *  The fixed commands the library uses, in flash.
+ */
+
+#include "SHA204Commands.h"
+
+// their CRCs, for compilers without constexpr (checked against the
+//  builders by those which have it)
+#define DEV_REV_CRC     0x5D03
+#define RANDOM_CRC      0xCD24 // seed update
+#define READ_SERIAL_CRC 0xAD09
+
+#if defined(__cplusplus) && __cplusplus >= 201103L
+const sha204_fixed_command_t sha204_cmd_dev_rev PROGMEM = sha204_fixed_dev_rev();
+const sha204_fixed_command_t sha204_cmd_random PROGMEM = sha204_fixed_random(RANDOM_SEED_UPDATE);
+const sha204_fixed_command_t sha204_cmd_read_serial PROGMEM =
+  sha204_fixed_read(SHA204_ZONE_CONFIG | READ_ZONE_MODE_32_BYTES, 0);
+
+// the DevRev packet from the datasheet: 07 30 00 00 00 03 5D
+static_assert(sha204_fixed_crc(SHA204_DEVREV, 0, 0) == DEV_REV_CRC, "sha204_crc_static() is off");
+static_assert(sha204_fixed_crc(SHA204_RANDOM, RANDOM_SEED_UPDATE, 0) == RANDOM_CRC, "RANDOM_CRC is off");
+static_assert(sha204_fixed_crc(SHA204_READ, SHA204_ZONE_CONFIG | READ_ZONE_MODE_32_BYTES, 0) == READ_SERIAL_CRC,
+              "READ_SERIAL_CRC is off");
+#else
+const sha204_fixed_command_t sha204_cmd_dev_rev PROGMEM = {
+  { SHA204_CMD_SIZE_MIN, SHA204_DEVREV, 0, 0, 0, DEV_REV_CRC & 0xFF, DEV_REV_CRC >> 8 },
+  DEVREV_RSP_SIZE, DEVREV_DELAY, DEVREV_EXEC_MAX - DEVREV_DELAY };
+const sha204_fixed_command_t sha204_cmd_random PROGMEM = {
+  { SHA204_CMD_SIZE_MIN, SHA204_RANDOM, RANDOM_SEED_UPDATE, 0, 0, RANDOM_CRC & 0xFF, RANDOM_CRC >> 8 },
+  RANDOM_RSP_SIZE, RANDOM_DELAY, RANDOM_EXEC_MAX - RANDOM_DELAY };
+const sha204_fixed_command_t sha204_cmd_read_serial PROGMEM = {
+  { SHA204_CMD_SIZE_MIN, SHA204_READ, SHA204_ZONE_CONFIG | READ_ZONE_MODE_32_BYTES, 0, 0,
+    READ_SERIAL_CRC & 0xFF, READ_SERIAL_CRC >> 8 },
+  READ_32_RSP_SIZE, READ_DELAY, READ_EXEC_MAX - READ_DELAY };
+#endif
@@ -0,0 +1,70 @@
+/*
+ * SHA204Commands.h
+ * (c) 2014 flabbergast
+ *  Commands whose packets are known at compile time (no data, constant
+ *  parameters), built complete with their CRC by the compiler and kept
+ *  in flash. SHA204::fixed() / begin_fixed() send them without marshaling
+ *  or a CRC, and the caller needs no tx_buffer.
+ *
+ *  The library has the ones it uses itself; others are one line (the
+ *  builders need C++11 for constexpr, without it they are left out and
+ *  the packet has to be written out, CRC included):
+ *    const sha204_fixed_command_t pause_0x20 PROGMEM = sha204_fixed_pause(0x20);
+ *    ...
+ *    ret_code = sha204.fixed(&pause_0x20, rx_buffer);
+ */
+
+#ifndef SHA204_Library_Commands_h
+#define SHA204_Library_Commands_h
+
+#include <stdint.h>
+#include "SHA204Definitions.h"
+#include "SHA204CRC.h"
+#include "SHA204HAL.h"
+
+typedef struct {
+  uint8_t packet[SHA204_CMD_SIZE_MIN]; // count, op-code, param1, param2 (LSB first), CRC
+  uint8_t rx_size;
+  uint8_t execution_delay;             // ms, as for send_and_receive()
+  uint8_t execution_timeout;
+} sha204_fixed_command_t;
+
+// in flash
+extern const sha204_fixed_command_t sha204_cmd_dev_rev PROGMEM;
+extern const sha204_fixed_command_t sha204_cmd_random PROGMEM;      // with seed update
+extern const sha204_fixed_command_t sha204_cmd_read_serial PROGMEM; // config zone bytes 0-31
+
+#if defined(__cplusplus) && __cplusplus >= 201103L
+constexpr uint16_t sha204_fixed_crc(uint8_t op_code, uint8_t param1, uint16_t param2) {
+  return sha204_crc_static(0, SHA204_CMD_SIZE_MIN, op_code, param1, (uint8_t) param2, (uint8_t) (param2 >> 8));
+}
+
+constexpr sha204_fixed_command_t sha204_fixed_command(uint8_t op_code, uint8_t param1, uint16_t param2,
+                                                      uint8_t rx_size, uint8_t execution_delay, uint8_t execution_max) {
+  return { { SHA204_CMD_SIZE_MIN, op_code, param1, (uint8_t) param2, (uint8_t) (param2 >> 8),
+             (uint8_t) sha204_fixed_crc(op_code, param1, param2),
+             (uint8_t) (sha204_fixed_crc(op_code, param1, param2) >> 8) },
+           rx_size, execution_delay, (uint8_t) (execution_max - execution_delay) };
+}
+
+constexpr sha204_fixed_command_t sha204_fixed_dev_rev(void) {
+  return sha204_fixed_command(SHA204_DEVREV, 0, 0, DEVREV_RSP_SIZE, DEVREV_DELAY, DEVREV_EXEC_MAX);
+}
+
+constexpr sha204_fixed_command_t sha204_fixed_random(uint8_t mode) {
+  return sha204_fixed_command(SHA204_RANDOM, mode, 0, RANDOM_RSP_SIZE, RANDOM_DELAY, RANDOM_EXEC_MAX);
+}
+
+// address in bytes, as for read(); not checked here
+constexpr sha204_fixed_command_t sha204_fixed_read(uint8_t zone, uint16_t address) {
+  return sha204_fixed_command(SHA204_READ, zone, address >> 2,
+                              (zone & READ_ZONE_MODE_32_BYTES) ? READ_32_RSP_SIZE : READ_4_RSP_SIZE,
+                              READ_DELAY, READ_EXEC_MAX);
+}
+
+constexpr sha204_fixed_command_t sha204_fixed_pause(uint8_t selector) {
+  return sha204_fixed_command(SHA204_PAUSE, selector, 0, PAUSE_RSP_SIZE, PAUSE_DELAY, PAUSE_EXEC_MAX);
+}
+#endif
+
+#endif
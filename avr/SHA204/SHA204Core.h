@@ -0,0 +1,1604 @@
+/*
+Copyright 2013 Nusku Networks
+
+Licensed under the Apache License, Version 2.0 (the "License");
+you may not use this file except in compliance with the License.
+You may obtain a copy of the License at
+
+http://www.apache.org/licenses/LICENSE-2.0
+
+Unless required by applicable law or agreed to in writing, software
+distributed under the License is distributed on an "AS IS" BASIS,
+WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+See the License for the specific language governing permissions and
+limitations under the License.
+*/
+
+/*
+ * The member definitions of SHA204Core, for the files which instantiate
+ *  it: SHA204.cpp for the virtual SHA204, and with SHA204_STATIC_TRANSPORT
+ *  each transport for itself (so its calls are direct, and the compiler
+ *  sees both sides). Not for including anywhere else.
+ */
+
+#ifndef SHA204_Library_Core_h
+#define SHA204_Library_Core_h
+
+#include "SHA204.h"
+#include "SHA204ReturnCodes.h"
+#include "SHA204Definitions.h"
+#include "SHA204HAL.h"
+#include "SHA204CRC.h"
+#include <string.h>
+
+#ifdef SHA204_TRACE
+#define SHA204_TRACE_EVENT(time, event, op_code, length, ret_code) \
+  do { if (trace) trace->record((time), (event), (op_code), (length), (ret_code)); } while (0)
+#else
+#define SHA204_TRACE_EVENT(time, event, op_code, length, ret_code) do { } while (0)
+#endif
+
+/*  Puts a the ATSHA204's unique, 9-byte serial number in the response array
+  (one read of the first 32 bytes of the config zone)
+  returns an SHA204 Return code */
+template <class Transport>
+uint8_t SHA204Core<Transport>::serialNumber(uint8_t * response) {
+  uint8_t readResponse[READ_32_RSP_SIZE];
+
+  uint8_t returnCode = fixed(&sha204_cmd_read_serial, readResponse);
+  if (!returnCode)  // should return 0 if successful
+  {
+    memcpy(response, readResponse + SHA204_BUFFER_POS_DATA + ADDRESS_SN03, 4);
+    memcpy(response + 4, readResponse + SHA204_BUFFER_POS_DATA + ADDRESS_SN47, 4);
+    response[8] = readResponse[SHA204_BUFFER_POS_DATA + ADDRESS_SN8]; // Byte 8 of SN should always be 0xEE
+  }
+
+  return returnCode;
+}
+
+/* Zones */
+
+template <class Transport>
+uint16_t SHA204Core<Transport>::zone_size(uint8_t zone) {
+  switch (zone & SHA204_ZONE_MASK)
+  {
+    case SHA204_ZONE_CONFIG: return SHA204_ZONE_SIZE_CONFIG;
+    case SHA204_ZONE_OTP:    return SHA204_ZONE_SIZE_OTP;
+    case SHA204_ZONE_DATA:   return SHA204_ZONE_SIZE_DATA;
+  }
+  return 0;
+}
+
+// A 32-byte read is worth it as soon as two words of a block are wanted;
+//  the last block of the config zone is short and only has 4-byte reads.
+template <class Transport>
+uint8_t SHA204Core<Transport>::read_zone(uint8_t zone, uint16_t address, uint16_t length, uint8_t *data) {
+  uint8_t tx_buffer[READ_COUNT];
+  uint8_t rx_buffer[READ_32_RSP_SIZE];
+  uint16_t block, offset, count;
+  uint8_t ret_code;
+
+  zone &= SHA204_ZONE_MASK;
+  if (!data || ((address | length) & (SHA204_ZONE_ACCESS_4 - 1))
+      || (uint32_t) address + length > zone_size(zone))
+    return SHA204_BAD_PARAM;
+
+  while (length > 0)
+  {
+    block = address & ~(SHA204_ZONE_ACCESS_32 - 1);
+    offset = address - block;
+    count = SHA204_ZONE_ACCESS_32 - offset;
+    if (count > length)
+      count = length;
+    if (count > SHA204_ZONE_ACCESS_4 && block + SHA204_ZONE_ACCESS_32 <= zone_size(zone))
+    {
+      ret_code = read(tx_buffer, rx_buffer, zone | READ_ZONE_MODE_32_BYTES, block);
+    }
+    else
+    {
+      offset = 0;
+      count = SHA204_ZONE_ACCESS_4;
+      ret_code = read(tx_buffer, rx_buffer, zone, address);
+    }
+    if (ret_code != SHA204_SUCCESS)
+      return ret_code;
+    memcpy(data, rx_buffer + SHA204_BUFFER_POS_DATA + offset, count);
+    data += count;
+    address += count;
+    length -= count;
+  }
+  return SHA204_SUCCESS;
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::read_zone_cached(uint8_t zone, uint16_t address, uint16_t length, uint8_t *data) {
+  if (!read_cache || !data || (uint32_t) address + length > zone_size(zone))
+    return 0;
+  return read_cache->lookup_zone(zone, address, length, data);
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::write_zone(uint8_t zone, uint16_t address, uint16_t length, const uint8_t *data) {
+  uint8_t tx_buffer[WRITE_COUNT_LONG];
+  uint8_t rx_buffer[WRITE_RSP_SIZE];
+  uint8_t value[SHA204_ZONE_ACCESS_32];
+  uint8_t count;
+  uint8_t ret_code;
+
+  zone &= SHA204_ZONE_MASK;
+  if (!data || ((address | length) & (SHA204_ZONE_ACCESS_4 - 1))
+      || (uint32_t) address + length > zone_size(zone))
+    return SHA204_BAD_PARAM;
+
+  while (length > 0)
+  {
+    count = (!(address & (SHA204_ZONE_ACCESS_32 - 1)) && length >= SHA204_ZONE_ACCESS_32)
+            ? SHA204_ZONE_ACCESS_32 : SHA204_ZONE_ACCESS_4;
+    memcpy(value, data, count);
+    ret_code = write(tx_buffer, rx_buffer, zone | (count == SHA204_ZONE_ACCESS_32 ? SHA204_ZONE_COUNT_FLAG : 0),
+                     address, value, NULL);
+    if (ret_code != SHA204_SUCCESS)
+      return ret_code;
+    data += count;
+    address += count;
+    length -= count;
+  }
+  return SHA204_SUCCESS;
+}
+
+/* Communication functions */
+
+#define SHA204_GOV_STATE_UNKNOWN 0 // a wake pulse might be ignored: idle first
+#define SHA204_GOV_STATE_ASLEEP  1
+#define SHA204_GOV_STATE_IDLE    2
+#define SHA204_GOV_STATE_AWAKE   3
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::wakeup(uint8_t *response) {
+  uint32_t woken_at = sha204_hal_micros();
+  uint8_t ret_code = bus()->chip_wakeup();
+
+  gov_stats.wakes++;
+  gov.state = SHA204_GOV_STATE_UNKNOWN;
+  if (ret_code == SHA204_SUCCESS)
+    ret_code = bus()->receive_response(SHA204_RSP_SIZE_MIN, response);
+  if (ret_code != SHA204_SUCCESS)
+  {
+    if (stats)
+      stats->wake(ret_code, 0);
+    SHA204_TRACE_EVENT(woken_at, SHA204_TRACE_WAKEUP, 0, 0, ret_code);
+    return ret_code;
+  }
+
+  // Verify status response.
+  if (response[SHA204_BUFFER_POS_COUNT] != SHA204_RSP_SIZE_MIN)
+    ret_code = SHA204_INVALID_SIZE;
+  else if (response[SHA204_BUFFER_POS_STATUS] != SHA204_STATUS_BYTE_WAKEUP)
+    ret_code = SHA204_COMM_FAIL;
+  else
+  {
+    if ((response[SHA204_RSP_SIZE_MIN - SHA204_CRC_SIZE] != 0x33)
+      || (response[SHA204_RSP_SIZE_MIN + 1 - SHA204_CRC_SIZE] != 0x43))
+      ret_code = SHA204_BAD_CRC;
+  }
+  if (stats)
+    stats->wake(ret_code, sha204_hal_micros() - woken_at);
+  SHA204_TRACE_EVENT(woken_at, SHA204_TRACE_WAKEUP, 0, response[SHA204_BUFFER_POS_COUNT], ret_code);
+  if (ret_code != SHA204_SUCCESS)
+    SHA204_DELAY_MS(SHA204_COMMAND_EXEC_MAX);
+  else
+  {
+    gov.state = SHA204_GOV_STATE_AWAKE;
+    gov.awake_since = woken_at;
+  }
+
+  return ret_code;
+}
+
+/* Command state machine
+ *
+ *  begin_send_and_receive() records the command and sends it; every poll()
+ *  then does at most one bus transaction (re-send the command or poll for
+ *  the response) and returns SHA204_CMD_PENDING until the command has
+ *  completed, when it returns the same code the blocking functions do.
+ *  The retry / resync logic is the same as in Atmel's original
+ *  sha204c_send_and_receive; resync() itself still blocks (it may have to
+ *  wake the chip up).
+ */
+
+#define SHA204_CMD_STATE_IDLE    0 // nothing to do, last result in cmd.ret_code
+#define SHA204_CMD_STATE_SEND    1 // (re)send the command
+#define SHA204_CMD_STATE_RECEIVE 2 // start a response receive attempt
+#define SHA204_CMD_STATE_POLL    3 // poll for the response at cmd.next_poll
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::begin_send_and_receive(uint8_t *tx_buffer, uint8_t rx_size, uint8_t *rx_buffer, uint8_t execution_delay, uint8_t execution_timeout) {
+  uint8_t count = tx_buffer[SHA204_BUFFER_POS_COUNT];
+
+  if (cmd.state != SHA204_CMD_STATE_IDLE)
+    return SHA204_FUNC_FAIL;
+
+  // Append CRC.
+  calculate_crc(count - SHA204_CRC_SIZE, tx_buffer, tx_buffer + count - SHA204_CRC_SIZE);
+
+  cmd.n_fragments = 0;
+  return begin_command(tx_buffer, rx_size, rx_buffer, execution_delay, execution_timeout);
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::begin_fixed(const sha204_fixed_command_t *command, uint8_t *rx_buffer) {
+  if (!command || !rx_buffer)
+    return SHA204_BAD_PARAM;
+  if (cmd.state != SHA204_CMD_STATE_IDLE)
+    return SHA204_FUNC_FAIL;
+
+  memcpy_P(cmd.packet, command->packet, SHA204_CMD_SIZE_MIN);
+  cmd.n_fragments = 0;
+  return begin_command(cmd.packet, pgm_read_byte(&command->rx_size), rx_buffer,
+                       pgm_read_byte(&command->execution_delay), pgm_read_byte(&command->execution_timeout));
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::fixed(const sha204_fixed_command_t *command, uint8_t *rx_buffer) {
+  return complete(begin_fixed(command, rx_buffer));
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::begin_send_fragments(uint8_t op_code, uint8_t param1, uint16_t param2,
+      const sha204_fragment_t *data, uint8_t n_data,
+      uint8_t rx_size, uint8_t *rx_buffer, uint8_t execution_delay, uint8_t execution_timeout) {
+  uint8_t *header = cmd.packet;
+  uint8_t *crc = cmd.packet + SHA204_CMD_SIZE_MIN - SHA204_CRC_SIZE;
+  uint16_t count = SHA204_CMD_SIZE_MIN;
+  uint16_t crc_register;
+  uint8_t i;
+
+  if (!rx_buffer || n_data > SHA204_FRAGMENTS_MAX - 2)
+    return SHA204_BAD_PARAM;
+  for (i = 0; i < n_data; i++)
+    count += data[i].length;
+  if (count > SHA204_CMD_SIZE_MAX)
+    return SHA204_BAD_PARAM;
+  if (cmd.state != SHA204_CMD_STATE_IDLE)
+    return SHA204_FUNC_FAIL;
+
+  header[SHA204_COUNT_IDX] = count;
+  header[SHA204_OPCODE_IDX] = op_code;
+  header[SHA204_PARAM1_IDX] = param1;
+  header[SHA204_PARAM2_IDX] = param2 & 0xFF;
+  header[SHA204_PARAM2_IDX + 1] = param2 >> 8;
+
+  // the CRC over the parts where they are
+  crc_register = sha204_crc_update(sha204_crc_init(), header, SHA204_CMD_SIZE_MIN - SHA204_CRC_SIZE);
+  cmd.fragments[0].data = header;
+  cmd.fragments[0].length = SHA204_CMD_SIZE_MIN - SHA204_CRC_SIZE;
+  for (i = 0; i < n_data; i++)
+  {
+    crc_register = sha204_crc_update(crc_register, data[i].data, data[i].length);
+    cmd.fragments[i + 1] = data[i];
+  }
+  sha204_crc_final(crc_register, crc);
+  cmd.fragments[i + 1].data = crc;
+  cmd.fragments[i + 1].length = SHA204_CRC_SIZE;
+  cmd.n_fragments = n_data + 2;
+
+  return begin_command(header, rx_size, rx_buffer, execution_delay, execution_timeout);
+}
+
+// Transports which can't stream the parts: put them together first.
+template <class Transport>
+uint8_t SHA204Core<Transport>::send_command_fragments(uint8_t count, const sha204_fragment_t *fragments, uint8_t n_fragments) {
+  uint8_t command[SHA204_CMD_SIZE_MAX];
+  uint8_t *p = command;
+  uint8_t i;
+
+  for (i = 0; i < n_fragments; i++)
+  {
+    memcpy(p, fragments[i].data, fragments[i].length);
+    p += fragments[i].length;
+  }
+  return bus()->send_command(count, command);
+}
+
+// The command is complete with its CRC; not busy.
+template <class Transport>
+uint8_t SHA204Core<Transport>::begin_command(uint8_t *tx_buffer, uint8_t rx_size, uint8_t *rx_buffer, uint8_t execution_delay, uint8_t execution_timeout) {
+  cmd.tx_buffer = tx_buffer;
+  cmd.rx_buffer = rx_buffer;
+  cmd.rx_size = rx_size;
+  cmd.execution_delay = execution_delay;
+  cmd.execution_timeout = execution_timeout;
+  cmd.ret_code = SHA204_FUNC_FAIL;
+  cmd.polls = 0;
+  if (read_cache && tx_buffer[SHA204_OPCODE_IDX] == SHA204_READ
+      && read_cache->lookup(tx_buffer, rx_size, rx_buffer))
+  {
+    cmd.ret_code = SHA204_SUCCESS; // no bus traffic at all
+    return SHA204_SUCCESS;
+  }
+  // Retry loop for sending a command and receiving a response.
+  cmd.n_retries_send = SHA204_RETRY_COUNT + 1;
+  cmd.state = SHA204_CMD_STATE_SEND;
+
+  // Send it right away; whatever happens, the result comes from poll().
+  poll();
+  return SHA204_SUCCESS;
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::finish(uint8_t ret_code) {
+  // no answer: maybe the watchdog sent the chip to sleep
+  if (ret_code == SHA204_COMM_FAIL || ret_code == SHA204_TIMEOUT
+      || ret_code == SHA204_RX_FAIL || ret_code == SHA204_RX_NO_RESPONSE)
+    gov.state = SHA204_GOV_STATE_UNKNOWN;
+  cmd.state = SHA204_CMD_STATE_IDLE;
+  cmd.ret_code = ret_code;
+  if (read_cache)
+    read_cache->observe(cmd.tx_buffer, cmd.rx_buffer, ret_code);
+  if (stats)
+    stats->command(latency_slot(cmd.tx_buffer[SHA204_OPCODE_IDX]), ret_code, cmd.polls);
+  return ret_code;
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::recover(void) {
+#ifdef SHA204_TRACE
+  uint32_t started_at = sha204_hal_micros();
+#endif
+  uint8_t ret_code = bus()->resync(cmd.rx_size, cmd.rx_buffer);
+
+  if (stats)
+    stats->resync(ret_code);
+  SHA204_TRACE_EVENT(started_at, SHA204_TRACE_RESYNC, cmd.tx_buffer[SHA204_OPCODE_IDX], 0, ret_code);
+  return ret_code;
+}
+
+// After a bad response: try to receive it again if resync didn't need a
+//  wakeup, re-send the command if it did, give up otherwise.
+template <class Transport>
+uint8_t SHA204Core<Transport>::resync_and_retry(uint8_t ret_code) {
+  uint8_t ret_code_resync = recover();
+
+  cmd.ret_code = ret_code;
+  if (ret_code_resync == SHA204_SUCCESS)
+  {
+    // We did not have to wake up the device. Try receiving response again.
+    cmd.learn = 0;
+    cmd.deadline = sha204_hal_micros() + (uint32_t) cmd.execution_timeout * 1000 + bus()->SHA204_RESPONSE_TIMEOUT();
+    cmd.next_poll = sha204_hal_micros();
+    cmd.state = SHA204_CMD_STATE_RECEIVE;
+    return SHA204_CMD_PENDING;
+  }
+  if (ret_code_resync == SHA204_RESYNC_WITH_WAKEUP)
+  {
+    // We could re-synchronize, but only after waking up the device.
+    // Re-send command.
+    cmd.state = SHA204_CMD_STATE_SEND;
+    return SHA204_CMD_PENDING;
+  }
+  // We failed to re-synchronize.
+  return finish(ret_code);
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::poll(void) {
+  uint8_t ret_code;
+  uint8_t i;
+  uint8_t status_byte;
+  uint8_t *rx_buffer = cmd.rx_buffer;
+
+  switch (cmd.state)
+  {
+    case SHA204_CMD_STATE_IDLE:
+      return cmd.ret_code;
+
+    case SHA204_CMD_STATE_SEND:
+      if ((cmd.n_retries_send == 0) || (cmd.ret_code == SHA204_SUCCESS))
+        return finish(cmd.ret_code);
+      if (stats && cmd.n_retries_send <= SHA204_RETRY_COUNT)
+        stats->send_retries++;
+      cmd.n_retries_send--;
+
+      // Send command.
+      if (cmd.n_fragments)
+        ret_code = bus()->send_command_fragments(cmd.tx_buffer[SHA204_BUFFER_POS_COUNT], cmd.fragments, cmd.n_fragments);
+      else
+        ret_code = bus()->send_command(cmd.tx_buffer[SHA204_BUFFER_POS_COUNT], cmd.tx_buffer);
+      cmd.sent_at = sha204_hal_micros();
+      SHA204_TRACE_EVENT(cmd.sent_at, SHA204_TRACE_SEND, cmd.tx_buffer[SHA204_OPCODE_IDX],
+            cmd.tx_buffer[SHA204_BUFFER_POS_COUNT], ret_code);
+      if (ret_code != SHA204_SUCCESS)
+      {
+        cmd.ret_code = ret_code;
+        if (recover() == SHA204_RX_NO_RESPONSE)
+          return finish(ret_code); // The device seems to be dead in the water.
+        return SHA204_CMD_PENDING;
+      }
+
+      // Wait until the command is expected to finish (a bit less, so that
+      // the estimate can also move down) and then start polling for a response.
+      cmd.next_poll = cmd.sent_at + first_poll_delay(cmd.tx_buffer[SHA204_OPCODE_IDX], cmd.execution_delay);
+      cmd.deadline = cmd.sent_at + ((uint32_t) cmd.execution_delay + cmd.execution_timeout) * 1000 + bus()->SHA204_RESPONSE_TIMEOUT();
+      cmd.learn = 1;
+      cmd.n_retries_receive = SHA204_RETRY_COUNT + 1;
+      cmd.state = SHA204_CMD_STATE_RECEIVE;
+      return SHA204_CMD_PENDING;
+
+    case SHA204_CMD_STATE_RECEIVE:
+      // Retry loop for receiving a response.
+      if (cmd.n_retries_receive == 0)
+      {
+        cmd.state = SHA204_CMD_STATE_SEND;
+        return SHA204_CMD_PENDING;
+      }
+      if (stats && cmd.n_retries_receive <= SHA204_RETRY_COUNT)
+        stats->receive_retries++;
+      cmd.n_retries_receive--;
+
+      // Reset response buffer.
+      for (i = 0; i < cmd.rx_size; i++)
+        rx_buffer[i] = 0;
+      cmd.state = SHA204_CMD_STATE_POLL;
+      // fall through
+
+    case SHA204_CMD_STATE_POLL:
+      // Poll for response until the deadline.
+      if (!sha204_hal_time_reached(cmd.next_poll))
+        return SHA204_CMD_PENDING;
+      cmd.polled_at = sha204_hal_micros();
+      if (cmd.polls != 0xFF)
+        cmd.polls++;
+      ret_code = bus()->receive_response(cmd.rx_size, rx_buffer);
+      if ((ret_code == SHA204_RX_NO_RESPONSE) && !sha204_hal_time_reached(cmd.deadline))
+      {
+        cmd.next_poll = sha204_hal_micros() + SHA204_POLL_INTERVAL_US;
+        return SHA204_CMD_PENDING;
+      }
+      SHA204_TRACE_EVENT(cmd.polled_at, SHA204_TRACE_RECEIVE, cmd.tx_buffer[SHA204_OPCODE_IDX],
+            rx_buffer[SHA204_BUFFER_POS_COUNT], ret_code);
+      break;
+
+    default:
+      return finish(SHA204_FUNC_FAIL);
+  }
+
+  if (ret_code == SHA204_RX_NO_RESPONSE)
+  {
+    // We did not receive a response. Re-synchronize and send command again.
+    cmd.ret_code = ret_code;
+    if (recover() == SHA204_RX_NO_RESPONSE)
+      // The device seems to be dead in the water.
+      return finish(ret_code);
+    cmd.state = SHA204_CMD_STATE_SEND;
+    return SHA204_CMD_PENDING;
+  }
+
+  // Check whether we received a valid response.
+  if (ret_code == SHA204_INVALID_SIZE)
+  {
+    // We see 0xFF for the count when communication got out of sync.
+    if (stats)
+      stats->crc_errors++;
+    return resync_and_retry(ret_code);
+  }
+
+  // We received a response of valid size, the transport has already
+  // checked its CRC.
+  if (ret_code != SHA204_SUCCESS)
+  {
+    // Received response with incorrect CRC (or it broke off).
+    if (stats)
+      stats->crc_errors++;
+    return resync_and_retry(ret_code);
+  }
+
+  // Only a clean first response says how long the command took
+  // (error responses come back early).
+  if (cmd.learn && (rx_buffer[SHA204_BUFFER_POS_COUNT] > SHA204_RSP_SIZE_MIN
+                    || rx_buffer[SHA204_BUFFER_POS_STATUS] == SHA204_SUCCESS))
+  {
+    learn_latency(cmd.tx_buffer[SHA204_OPCODE_IDX], cmd.polled_at - cmd.sent_at);
+    if (stats)
+      stats->latency(latency_slot(cmd.tx_buffer[SHA204_OPCODE_IDX]), cmd.polled_at - cmd.sent_at);
+  }
+
+  // Received valid response.
+  if (rx_buffer[SHA204_BUFFER_POS_COUNT] > SHA204_RSP_SIZE_MIN)
+    // Received non-status response. We are done.
+    return finish(ret_code);
+
+  // Received status response.
+  status_byte = rx_buffer[SHA204_BUFFER_POS_STATUS];
+
+  // Translate the three possible device status error codes
+  // into library return codes.
+  if (status_byte == SHA204_STATUS_BYTE_PARSE)
+    return finish(SHA204_PARSE_ERROR);
+  if (status_byte == SHA204_STATUS_BYTE_EXEC)
+    return finish(SHA204_CMD_FAIL);
+  if (status_byte == SHA204_STATUS_BYTE_COMM)
+  {
+    // In case of the device status byte indicating a communication
+    // error we leave the receive retry loop and go for the overall
+    // retry loop (send command / receive response).
+    if (stats)
+      stats->command_crc_errors++;
+    cmd.ret_code = SHA204_STATUS_CRC;
+    cmd.state = SHA204_CMD_STATE_SEND;
+    return SHA204_CMD_PENDING;
+  }
+
+  // Received status response from CheckMAC, DeriveKey, GenDig,
+  // Lock, Nonce, Pause, UpdateExtra, or Write command.
+  return finish(ret_code);
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::busy(void) {
+  return cmd.state != SHA204_CMD_STATE_IDLE;
+}
+
+// Microseconds until poll() has something to do again: the time left
+// before the next poll of the response, 0 if it is due (or idle).
+template <class Transport>
+uint32_t SHA204Core<Transport>::poll_wait(void) {
+  int32_t remaining;
+
+  if (cmd.state != SHA204_CMD_STATE_POLL)
+    return 0;
+  remaining = (int32_t) (cmd.next_poll - sha204_hal_micros());
+  return (remaining > 0) ? (uint32_t) remaining : 0;
+}
+
+// Blocking: poll, sleeping until the next poll is due.
+template <class Transport>
+uint8_t SHA204Core<Transport>::wait(void) {
+  uint8_t ret_code;
+  int32_t remaining;
+
+  while ((ret_code = poll()) == SHA204_CMD_PENDING)
+  {
+    if (cmd.state != SHA204_CMD_STATE_POLL)
+      continue;
+    remaining = (int32_t) (cmd.next_poll - sha204_hal_micros());
+    if (remaining > 0)
+      sha204_hal_delay_us(remaining);
+  }
+  return ret_code;
+}
+
+// Wait for a command if it has been started.
+template <class Transport>
+uint8_t SHA204Core<Transport>::complete(uint8_t ret_code) {
+  return (ret_code == SHA204_SUCCESS) ? wait() : ret_code;
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::send_and_receive(uint8_t *tx_buffer, uint8_t rx_size, uint8_t *rx_buffer, uint8_t execution_delay, uint8_t execution_timeout) {
+  return complete(begin_send_and_receive(tx_buffer, rx_size, rx_buffer, execution_delay, execution_timeout));
+}
+
+
+/* Learned execution times */
+
+template <class Transport>
+SHA204Core<Transport>::SHA204Core(void) {
+  cmd.state = SHA204_CMD_STATE_IDLE;
+  cmd.ret_code = SHA204_SUCCESS;
+  reset_latency_estimates();
+  read_cache = NULL;
+  stats = NULL;
+  cmd.n_fragments = 0;
+#ifdef SHA204_TRACE
+  trace = NULL;
+#endif
+  memset(&gov, 0, sizeof(gov));
+  gov.policy = SHA204_GOVERNOR_IMMEDIATE;
+  gov.state = SHA204_GOV_STATE_UNKNOWN;
+  reset_governor_stats();
+}
+
+template <class Transport>
+int8_t SHA204Core<Transport>::latency_slot(uint8_t op_code) {
+  switch (op_code)
+  {
+    case SHA204_CHECKMAC:     return 0;
+    case SHA204_DERIVE_KEY:   return 1;
+    case SHA204_DEVREV:       return 2;
+    case SHA204_GENDIG:       return 3;
+    case SHA204_HMAC:         return 4;
+    case SHA204_LOCK:         return 5;
+    case SHA204_MAC:          return 6;
+    case SHA204_NONCE:        return 7;
+    case SHA204_PAUSE:        return 8;
+    case SHA204_RANDOM:       return 9;
+    case SHA204_READ:         return 10;
+    case SHA204_UPDATE_EXTRA: return 11;
+    case SHA204_WRITE:        return 12;
+    case SHA204_SHA:          return 13;
+  }
+  return -1;
+}
+
+// EWMA of the measured execution times; the first sample is taken as is.
+template <class Transport>
+void SHA204Core<Transport>::learn_latency(uint8_t op_code, uint32_t measured_us) {
+  int8_t slot = latency_slot(op_code);
+  int32_t estimate;
+
+  if (slot < 0)
+    return;
+  if (measured_us > 0xFFFF)
+    measured_us = 0xFFFF;
+
+  estimate = latency_estimate[slot];
+  if (estimate == 0)
+    estimate = measured_us;
+  else
+    estimate += ((int32_t) measured_us - estimate) >> SHA204_LATENCY_EWMA_SHIFT;
+  latency_estimate[slot] = estimate ? (uint16_t) estimate : 1;
+}
+
+// Until something is learned, the datasheet's typical time is used.
+template <class Transport>
+uint32_t SHA204Core<Transport>::first_poll_delay(uint8_t op_code, uint8_t execution_delay) {
+  int8_t slot = latency_slot(op_code);
+  uint32_t estimate = (uint32_t) execution_delay * 1000;
+
+  if (slot >= 0 && latency_estimate[slot] != 0)
+    estimate = latency_estimate[slot];
+  return estimate - (estimate >> SHA204_LATENCY_EARLY_SHIFT);
+}
+
+template <class Transport>
+void SHA204Core<Transport>::set_read_cache(SHA204ReadCache *cache) {
+  read_cache = cache;
+}
+
+template <class Transport>
+void SHA204Core<Transport>::set_stats(SHA204Stats *counters) {
+  stats = counters;
+}
+
+#ifdef SHA204_TRACE
+template <class Transport>
+void SHA204Core<Transport>::set_trace(SHA204Trace *ring) {
+  trace = ring;
+}
+#endif
+
+template <class Transport>
+void SHA204Core<Transport>::get_latency_estimates(uint16_t *estimates) {
+  memcpy(estimates, latency_estimate, sizeof(latency_estimate));
+}
+
+template <class Transport>
+void SHA204Core<Transport>::set_latency_estimates(const uint16_t *estimates) {
+  memcpy(latency_estimate, estimates, sizeof(latency_estimate));
+}
+
+template <class Transport>
+void SHA204Core<Transport>::reset_latency_estimates(void) {
+  memset(latency_estimate, 0, sizeof(latency_estimate));
+}
+
+/* Idle/sleep governor
+ *
+ *  The chip is kept awake after release() for twice the learned gap
+ *  between requests, unless that is over SHA204_GOVERNOR_HOLD_MAX_MS.
+ *  A wake-up is only reused while the longest command still finishes
+ *  within SHA204_WATCHDOG_MIN_MS of it, before the earliest the watchdog
+ *  can put the chip to sleep (and throw TempKey away). After that it is
+ *  idled and woken up again, since an awake chip ignores the wake pulse.
+ */
+
+#define SHA204_GOVERNOR_AWAKE_US ((uint32_t) SHA204_WATCHDOG_MIN_MS * 1000)
+#define SHA204_GOVERNOR_REUSE_US (((uint32_t) SHA204_WATCHDOG_MIN_MS - SHA204_COMMAND_EXEC_MAX) * 1000)
+
+// what the chip sends after a wake-up
+template <class Transport>
+void SHA204Core<Transport>::wake_response(uint8_t *response) {
+  response[SHA204_BUFFER_POS_COUNT] = SHA204_RSP_SIZE_MIN;
+  response[SHA204_BUFFER_POS_STATUS] = SHA204_STATUS_BYTE_WAKEUP;
+  response[2] = 0x33;
+  response[3] = 0x43;
+}
+
+// EWMA of the time between release() and the next acquire()
+template <class Transport>
+void SHA204Core<Transport>::learn_gap(uint32_t now) {
+  uint32_t gap = now - gov.released_at;
+
+  if (gap > SHA204_GOVERNOR_AWAKE_US)
+    gap = SHA204_GOVERNOR_AWAKE_US;
+  if (gov.gap == 0)
+    gov.gap = gap;
+  else
+    gov.gap += ((int32_t) gap - (int32_t) gov.gap) >> SHA204_GOVERNOR_GAP_SHIFT;
+  if (gov.gap == 0)
+    gov.gap = 1;
+  gov.released = 0;
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::acquire(uint8_t *response) {
+  uint32_t now = sha204_hal_micros();
+
+  gov_stats.acquires++;
+  if (gov.session)
+    return session_check(response);
+  if (gov.released)
+    learn_gap(now);
+  gov.holding = 0;
+
+  if (gov.state == SHA204_GOV_STATE_AWAKE && (now - gov.awake_since) < SHA204_GOVERNOR_REUSE_US)
+  {
+    gov_stats.wakes_avoided++;
+    wake_response(response);
+    return SHA204_SUCCESS;
+  }
+  if (gov.state == SHA204_GOV_STATE_AWAKE || gov.state == SHA204_GOV_STATE_UNKNOWN)
+    (void) park(1);
+  return wakeup(response);
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::release(uint8_t to_idle) {
+  uint32_t now = sha204_hal_micros();
+  uint32_t limit;
+
+  if (gov.session)
+    return SHA204_SUCCESS;
+  gov.park_idle = to_idle;
+  gov.released = 1;
+  gov.released_at = now;
+  if (gov.policy != SHA204_GOVERNOR_ADAPTIVE || gov.state != SHA204_GOV_STATE_AWAKE
+      || gov.gap == 0 || gov.gap > (uint32_t) SHA204_GOVERNOR_HOLD_MAX_MS * 1000)
+    return park(to_idle);
+
+  gov.hold_until = now + 2 * gov.gap;
+  limit = gov.awake_since + SHA204_GOVERNOR_REUSE_US;
+  if ((int32_t) (gov.hold_until - limit) > 0)
+    gov.hold_until = limit;
+  if (sha204_hal_time_reached(gov.hold_until))
+    return park(to_idle);
+  gov.holding = 1;
+  return SHA204_SUCCESS;
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::park(uint8_t to_idle) {
+  uint8_t ret_code;
+#ifdef SHA204_TRACE
+  uint32_t started_at = sha204_hal_micros();
+#endif
+
+  gov.holding = 0;
+  if (to_idle)
+  {
+    gov_stats.idles++;
+    ret_code = bus()->idle();
+    gov.state = SHA204_GOV_STATE_IDLE;
+    SHA204_TRACE_EVENT(started_at, SHA204_TRACE_IDLE, 0, 0, ret_code);
+  }
+  else
+  {
+    gov_stats.sleeps++;
+    ret_code = bus()->sleep();
+    gov.state = SHA204_GOV_STATE_ASLEEP;
+    SHA204_TRACE_EVENT(started_at, SHA204_TRACE_SLEEP, 0, 0, ret_code);
+  }
+  if (ret_code != SHA204_SUCCESS)
+    gov.state = SHA204_GOV_STATE_UNKNOWN;
+  return ret_code;
+}
+
+template <class Transport>
+uint32_t SHA204Core<Transport>::governor_service(void) {
+  int32_t remaining;
+
+  if (!gov.holding)
+    return 0;
+  remaining = (int32_t) (gov.hold_until - sha204_hal_micros());
+  if (remaining > 0)
+    return remaining;
+  (void) park(gov.park_idle);
+  return 0;
+}
+
+template <class Transport>
+void SHA204Core<Transport>::set_governor_policy(uint8_t policy) {
+  gov.policy = policy;
+  if (policy != SHA204_GOVERNOR_ADAPTIVE && gov.holding)
+    (void) park(gov.park_idle);
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::begin_session(uint8_t *response) {
+  uint8_t ret_code;
+
+  gov.session = 0;
+  ret_code = acquire(response);
+  if (ret_code == SHA204_SUCCESS)
+    gov.session = 1;
+  return ret_code;
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::session_check(uint8_t *response) {
+  uint32_t elapsed = sha204_hal_micros() - gov.awake_since;
+
+  if (!gov.session)
+    return acquire(response);
+  if (gov.state != SHA204_GOV_STATE_AWAKE || elapsed >= SHA204_GOVERNOR_AWAKE_US)
+  {
+    // the session is over: the next command runs on a new wake-up
+    gov.session = 0;
+    return SHA204_WAKE_EXPIRED;
+  }
+  if (elapsed >= SHA204_GOVERNOR_REUSE_US)
+  {
+    // idle keeps TempKey, and the next wake-up restarts the watchdog
+    (void) park(1);
+    return wakeup(response);
+  }
+  gov_stats.wakes_avoided++;
+  wake_response(response);
+  return SHA204_SUCCESS;
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::end_session(uint8_t to_idle) {
+  gov.session = 0;
+  return release(to_idle);
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::in_session(void) {
+  return gov.session;
+}
+
+template <class Transport>
+void SHA204Core<Transport>::get_governor_stats(sha204_governor_stats_t *stats) {
+  memcpy(stats, &gov_stats, sizeof(gov_stats));
+}
+
+template <class Transport>
+void SHA204Core<Transport>::reset_governor_stats(void) {
+  memset(&gov_stats, 0, sizeof(gov_stats));
+}
+
+/* Marshaling functions */
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::begin_random(uint8_t * tx_buffer, uint8_t * rx_buffer, uint8_t mode) {
+  if (!tx_buffer || !rx_buffer || (mode > RANDOM_NO_SEED_UPDATE))
+    return SHA204_BAD_PARAM;
+
+  tx_buffer[SHA204_COUNT_IDX] = RANDOM_COUNT;
+  tx_buffer[SHA204_OPCODE_IDX] = SHA204_RANDOM;
+  tx_buffer[RANDOM_MODE_IDX] = mode & RANDOM_SEED_UPDATE;
+
+  tx_buffer[RANDOM_PARAM2_IDX] =
+    tx_buffer[RANDOM_PARAM2_IDX + 1] = 0;
+
+  return begin_send_and_receive(&tx_buffer[0], RANDOM_RSP_SIZE, &rx_buffer[0], RANDOM_DELAY, RANDOM_EXEC_MAX - RANDOM_DELAY);
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::random(uint8_t * tx_buffer, uint8_t * rx_buffer, uint8_t mode) {
+  return complete(begin_random(tx_buffer, rx_buffer, mode));
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::begin_dev_rev(uint8_t *tx_buffer, uint8_t *rx_buffer) {
+  if (!tx_buffer || !rx_buffer)
+    return SHA204_BAD_PARAM;
+
+  tx_buffer[SHA204_COUNT_IDX] = DEVREV_COUNT;
+  tx_buffer[SHA204_OPCODE_IDX] = SHA204_DEVREV;
+
+  // Parameters are 0.
+  tx_buffer[DEVREV_PARAM1_IDX] =
+    tx_buffer[DEVREV_PARAM2_IDX] =
+    tx_buffer[DEVREV_PARAM2_IDX + 1] = 0;
+
+  return begin_send_and_receive(&tx_buffer[0], DEVREV_RSP_SIZE, &rx_buffer[0],
+  DEVREV_DELAY, DEVREV_EXEC_MAX - DEVREV_DELAY);
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::dev_rev(uint8_t *tx_buffer, uint8_t *rx_buffer) {
+  return complete(begin_dev_rev(tx_buffer, rx_buffer));
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::begin_read(uint8_t *tx_buffer, uint8_t *rx_buffer, uint8_t zone, uint16_t address) {
+  uint8_t rx_size;
+
+  if (!tx_buffer || !rx_buffer || ((zone & ~READ_ZONE_MASK) != 0)
+    || ((zone & READ_ZONE_MODE_32_BYTES) && (zone == SHA204_ZONE_OTP)))
+    return SHA204_BAD_PARAM;
+
+  address >>= 2;
+  if ((zone & SHA204_ZONE_MASK) == SHA204_ZONE_CONFIG)
+  {
+    if (address > SHA204_ADDRESS_MASK_CONFIG)
+      return SHA204_BAD_PARAM;
+  }
+  else if ((zone & SHA204_ZONE_MASK) == SHA204_ZONE_OTP)
+  {
+    if (address > SHA204_ADDRESS_MASK_OTP)
+      return SHA204_BAD_PARAM;
+  }
+  else if ((zone & SHA204_ZONE_MASK) == SHA204_ZONE_DATA)
+  {
+    if (address > SHA204_ADDRESS_MASK)
+      return SHA204_BAD_PARAM;
+  }
+
+  tx_buffer[SHA204_COUNT_IDX] = READ_COUNT;
+  tx_buffer[SHA204_OPCODE_IDX] = SHA204_READ;
+  tx_buffer[READ_ZONE_IDX] = zone;
+  tx_buffer[READ_ADDR_IDX] = (uint8_t) (address & SHA204_ADDRESS_MASK);
+  tx_buffer[READ_ADDR_IDX + 1] = 0;
+
+  rx_size = (zone & SHA204_ZONE_COUNT_FLAG) ? READ_32_RSP_SIZE : READ_4_RSP_SIZE;
+
+  return begin_send_and_receive(&tx_buffer[0], rx_size, &rx_buffer[0], READ_DELAY, READ_EXEC_MAX - READ_DELAY);
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::read(uint8_t *tx_buffer, uint8_t *rx_buffer, uint8_t zone, uint16_t address) {
+  return complete(begin_read(tx_buffer, rx_buffer, zone, address));
+}
+
+// delays and response size of a command (for execute())
+template <class Transport>
+uint8_t SHA204Core<Transport>::execute_timing(uint8_t op_code, uint8_t param1, uint8_t rx_size, uint8_t *poll_delay, uint8_t *poll_timeout) {
+  switch (op_code)
+  {
+    case SHA204_CHECKMAC:
+      *poll_delay = CHECKMAC_DELAY;
+      *poll_timeout = CHECKMAC_EXEC_MAX - CHECKMAC_DELAY;
+      return CHECKMAC_RSP_SIZE;
+
+    case SHA204_DERIVE_KEY:
+      *poll_delay = DERIVE_KEY_DELAY;
+      *poll_timeout = DERIVE_KEY_EXEC_MAX - DERIVE_KEY_DELAY;
+      return DERIVE_KEY_RSP_SIZE;
+
+    case SHA204_DEVREV:
+      *poll_delay = DEVREV_DELAY;
+      *poll_timeout = DEVREV_EXEC_MAX - DEVREV_DELAY;
+      return DEVREV_RSP_SIZE;
+
+    case SHA204_GENDIG:
+      *poll_delay = GENDIG_DELAY;
+      *poll_timeout = GENDIG_EXEC_MAX - GENDIG_DELAY;
+      return GENDIG_RSP_SIZE;
+
+    case SHA204_HMAC:
+      *poll_delay = HMAC_DELAY;
+      *poll_timeout = HMAC_EXEC_MAX - HMAC_DELAY;
+      return HMAC_RSP_SIZE;
+
+    case SHA204_LOCK:
+      *poll_delay = LOCK_DELAY;
+      *poll_timeout = LOCK_EXEC_MAX - LOCK_DELAY;
+      return LOCK_RSP_SIZE;
+
+    case SHA204_MAC:
+      *poll_delay = MAC_DELAY;
+      *poll_timeout = MAC_EXEC_MAX - MAC_DELAY;
+      return MAC_RSP_SIZE;
+
+    case SHA204_NONCE:
+      *poll_delay = NONCE_DELAY;
+      *poll_timeout = NONCE_EXEC_MAX - NONCE_DELAY;
+      return param1 == NONCE_MODE_PASSTHROUGH
+                ? NONCE_RSP_SIZE_SHORT : NONCE_RSP_SIZE_LONG;
+
+    case SHA204_PAUSE:
+      *poll_delay = PAUSE_DELAY;
+      *poll_timeout = PAUSE_EXEC_MAX - PAUSE_DELAY;
+      return PAUSE_RSP_SIZE;
+
+    case SHA204_RANDOM:
+      *poll_delay = RANDOM_DELAY;
+      *poll_timeout = RANDOM_EXEC_MAX - RANDOM_DELAY;
+      return RANDOM_RSP_SIZE;
+
+    case SHA204_READ:
+      *poll_delay = READ_DELAY;
+      *poll_timeout = READ_EXEC_MAX - READ_DELAY;
+      return (param1 & SHA204_ZONE_COUNT_FLAG)
+                ? READ_32_RSP_SIZE : READ_4_RSP_SIZE;
+
+    case SHA204_UPDATE_EXTRA:
+      *poll_delay = UPDATE_DELAY;
+      *poll_timeout = UPDATE_EXEC_MAX - UPDATE_DELAY;
+      return UPDATE_RSP_SIZE;
+
+    case SHA204_WRITE:
+      *poll_delay = WRITE_DELAY;
+      *poll_timeout = WRITE_EXEC_MAX - WRITE_DELAY;
+      return WRITE_RSP_SIZE;
+
+    case SHA204_SHA:
+      *poll_delay = SHA_DELAY;
+      *poll_timeout = SHA_EXEC_MAX - SHA_DELAY;
+      return (param1 & SHA_MODE_MASK)
+                ? SHA_RSP_SIZE_LONG : SHA_RSP_SIZE_SHORT;
+
+    default:
+      *poll_delay = 0;
+      *poll_timeout = SHA204_COMMAND_EXEC_MAX;
+      return rx_size;
+  }
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::begin_execute(uint8_t op_code, uint8_t param1, uint16_t param2,
+      uint8_t datalen1, uint8_t *data1, uint8_t datalen2, uint8_t *data2, uint8_t datalen3, uint8_t *data3,
+      uint8_t tx_size, uint8_t *tx_buffer, uint8_t rx_size, uint8_t *rx_buffer) {
+  uint8_t poll_delay, poll_timeout, response_size;
+  uint8_t *p_buffer;
+  uint8_t len;
+
+  uint8_t ret_code = check_parameters(op_code, param1, param2,
+        datalen1, data1, datalen2, data2, datalen3, data3,
+        tx_size, tx_buffer, rx_size, rx_buffer);
+  if (ret_code != SHA204_SUCCESS)
+    return ret_code;
+
+  response_size = execute_timing(op_code, param1, rx_size, &poll_delay, &poll_timeout);
+
+  // Assemble command.
+  len = datalen1 + datalen2 + datalen3 + SHA204_CMD_SIZE_MIN;
+  p_buffer = tx_buffer;
+  *p_buffer++ = len;
+  *p_buffer++ = op_code;
+  *p_buffer++ = param1;
+  *p_buffer++ = param2 & 0xFF;
+  *p_buffer++ = param2 >> 8;
+
+  if (datalen1 > 0) {
+    memcpy(p_buffer, data1, datalen1);
+    p_buffer += datalen1;
+  }
+  if (datalen2 > 0) {
+    memcpy(p_buffer, data2, datalen2);
+    p_buffer += datalen2;
+  }
+  if (datalen3 > 0) {
+    memcpy(p_buffer, data3, datalen3);
+    p_buffer += datalen3;
+  }
+
+  // Send command and receive response (the CRC is appended there).
+  return begin_send_and_receive(&tx_buffer[0], response_size,
+        &rx_buffer[0],  poll_delay, poll_timeout);
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::execute(uint8_t op_code, uint8_t param1, uint16_t param2,
+      uint8_t datalen1, uint8_t *data1, uint8_t datalen2, uint8_t *data2, uint8_t datalen3, uint8_t *data3,
+      uint8_t tx_size, uint8_t *tx_buffer, uint8_t rx_size, uint8_t *rx_buffer) {
+  return complete(begin_execute(op_code, param1, param2,
+        datalen1, data1, datalen2, data2, datalen3, data3,
+        tx_size, tx_buffer, rx_size, rx_buffer));
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::begin_execute(uint8_t op_code, uint8_t param1, uint16_t param2,
+      uint8_t datalen1, const uint8_t *data1, uint8_t datalen2, const uint8_t *data2,
+      uint8_t datalen3, const uint8_t *data3, uint8_t rx_size, uint8_t *rx_buffer) {
+  uint8_t poll_delay, poll_timeout, response_size;
+  sha204_fragment_t data[3];
+  uint8_t n_data = 0;
+
+  // Nothing is put together, but the size is checked as for a tx_buffer.
+  uint8_t ret_code = check_parameters(op_code, param1, param2,
+        datalen1, (uint8_t *) data1, datalen2, (uint8_t *) data2, datalen3, (uint8_t *) data3,
+        SHA204_CMD_SIZE_MAX, cmd.packet, rx_size, rx_buffer);
+  if (ret_code != SHA204_SUCCESS)
+    return ret_code;
+
+  response_size = execute_timing(op_code, param1, rx_size, &poll_delay, &poll_timeout);
+
+  if (datalen1 > 0) {
+    data[n_data].data = data1;
+    data[n_data++].length = datalen1;
+  }
+  if (datalen2 > 0) {
+    data[n_data].data = data2;
+    data[n_data++].length = datalen2;
+  }
+  if (datalen3 > 0) {
+    data[n_data].data = data3;
+    data[n_data++].length = datalen3;
+  }
+
+  return begin_send_fragments(op_code, param1, param2, data, n_data,
+        response_size, rx_buffer, poll_delay, poll_timeout);
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::execute(uint8_t op_code, uint8_t param1, uint16_t param2,
+      uint8_t datalen1, const uint8_t *data1, uint8_t datalen2, const uint8_t *data2,
+      uint8_t datalen3, const uint8_t *data3, uint8_t rx_size, uint8_t *rx_buffer) {
+  return complete(begin_execute(op_code, param1, param2,
+        datalen1, data1, datalen2, data2, datalen3, data3, rx_size, rx_buffer));
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::check_parameters(uint8_t op_code, uint8_t param1, uint16_t param2,
+      uint8_t datalen1, uint8_t *data1, uint8_t datalen2, uint8_t *data2, uint8_t datalen3, uint8_t *data3,
+      uint8_t tx_size, uint8_t *tx_buffer, uint8_t rx_size, uint8_t *rx_buffer) {
+#ifdef SHA204_CHECK_PARAMETERS
+
+  uint8_t len = datalen1 + datalen2 + datalen3 + SHA204_CMD_SIZE_MIN;
+  if (!tx_buffer || tx_size < len || rx_size < SHA204_RSP_SIZE_MIN || !rx_buffer)
+    return SHA204_BAD_PARAM;
+
+  if ((datalen1 > 0 && !data1) || (datalen2 > 0 && !data2) || (datalen3 > 0 && !data3))
+    return SHA204_BAD_PARAM;
+
+  // Check parameters depending on op-code.
+  switch (op_code)
+  {
+    case SHA204_CHECKMAC:
+      if (
+          // no null pointers allowed
+          !data1 || !data2
+          // No reserved bits should be set.
+          || (param1 | CHECKMAC_MODE_MASK) != CHECKMAC_MODE_MASK
+          // key_id > 15 not allowed
+          || param2 > SHA204_KEY_ID_MAX
+        )
+        return SHA204_BAD_PARAM;
+      break;
+
+    case SHA204_DERIVE_KEY:
+      if (param2 > SHA204_KEY_ID_MAX)
+        return SHA204_BAD_PARAM;
+      break;
+
+    case SHA204_DEVREV:
+      break;
+
+    case SHA204_GENDIG:
+      if ((param1 != GENDIG_ZONE_OTP) && (param1 != GENDIG_ZONE_DATA))
+        return SHA204_BAD_PARAM;
+      break;
+
+    case SHA204_HMAC:
+      if ((param1 & ~HMAC_MODE_MASK) != 0)
+        return SHA204_BAD_PARAM;
+      break;
+
+    case SHA204_LOCK:
+      if (((param1 & ~LOCK_ZONE_MASK) != 0)
+            || ((param1 & LOCK_ZONE_NO_CRC) && (param2 != 0)))
+        return SHA204_BAD_PARAM;
+      break;
+
+    case SHA204_MAC:
+      if (((param1 & ~MAC_MODE_MASK) != 0)
+            || (((param1 & MAC_MODE_BLOCK2_TEMPKEY) == 0) && !data1))
+        return SHA204_BAD_PARAM;
+      break;
+
+    case SHA204_NONCE:
+      if (  !data1
+          || (param1 > NONCE_MODE_PASSTHROUGH)
+          || (param1 == NONCE_MODE_INVALID)
+        )
+        return SHA204_BAD_PARAM;
+      break;
+
+    case SHA204_PAUSE:
+      break;
+
+    case SHA204_RANDOM:
+      if (param1 > RANDOM_NO_SEED_UPDATE)
+        return SHA204_BAD_PARAM;
+      break;
+
+    case SHA204_READ:
+      if (((param1 & ~READ_ZONE_MASK) != 0)
+            || ((param1 & READ_ZONE_MODE_32_BYTES) && (param1 == SHA204_ZONE_OTP)))
+        return SHA204_BAD_PARAM;
+      break;
+
+    case SHA204_TEMPSENSE:
+      break;
+
+    case SHA204_UPDATE_EXTRA:
+      if (param1 > UPDATE_CONFIG_BYTE_86)
+        return SHA204_BAD_PARAM;
+      break;
+
+    case SHA204_WRITE:
+      if (!data1 || ((param1 & ~WRITE_ZONE_MASK) != 0))
+        return SHA204_BAD_PARAM;
+      break;
+
+    case SHA204_SHA:
+      if (((param1 & ~SHA_MODE_MASK) != 0)
+          || ((param1 & SHA_MODE_MASK) && (!data)))
+        return SHA204_BAD_PARAM;
+      break;
+
+    default:
+      // unknown op-code
+      return SHA204_BAD_PARAM;
+  }
+
+  return SHA204_SUCCESS;
+
+#else
+  return SHA204_SUCCESS;
+#endif
+}
+
+/* CRC Calculator and Checker */
+
+template <class Transport>
+void SHA204Core<Transport>::calculate_crc(uint8_t length, uint8_t *data, uint8_t *crc)  {
+  sha204_crc_final(sha204_crc_update(sha204_crc_init(), data, length), crc);
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::check_crc(uint8_t *response) {
+  uint8_t crc[SHA204_CRC_SIZE];
+  uint8_t count = response[SHA204_BUFFER_POS_COUNT];
+
+  count -= SHA204_CRC_SIZE;
+  calculate_crc(count, response, crc);
+
+  return (crc[0] == response[count] && crc[1] == response[count + 1])
+    ? SHA204_SUCCESS : SHA204_BAD_CRC;
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::begin_check_mac(uint8_t *tx_buffer, uint8_t *rx_buffer,
+      uint8_t mode, uint8_t key_id, uint8_t *client_challenge, uint8_t *client_response, uint8_t *other_data) {
+  if (
+      // no null pointers allowed
+      !tx_buffer || !rx_buffer || !client_response || !other_data
+      // No reserved bits should be set.
+      || (mode | CHECKMAC_MODE_MASK) != CHECKMAC_MODE_MASK
+      // key_id > 15 not allowed
+      || key_id > SHA204_KEY_ID_MAX
+    )
+    return SHA204_BAD_PARAM;
+
+  tx_buffer[SHA204_COUNT_IDX] = CHECKMAC_COUNT;
+  tx_buffer[SHA204_OPCODE_IDX] = SHA204_CHECKMAC;
+  tx_buffer[CHECKMAC_MODE_IDX] = mode & CHECKMAC_MODE_MASK;
+  tx_buffer[CHECKMAC_KEYID_IDX]= key_id;
+  tx_buffer[CHECKMAC_KEYID_IDX + 1] = 0;
+  if (client_challenge == NULL)
+    memset(&tx_buffer[CHECKMAC_CLIENT_CHALLENGE_IDX], 0, CHECKMAC_CLIENT_CHALLENGE_SIZE);
+  else
+    memcpy(&tx_buffer[CHECKMAC_CLIENT_CHALLENGE_IDX], client_challenge, CHECKMAC_CLIENT_CHALLENGE_SIZE);
+
+  memcpy(&tx_buffer[CHECKMAC_CLIENT_RESPONSE_IDX], client_response, CHECKMAC_CLIENT_RESPONSE_SIZE);
+  memcpy(&tx_buffer[CHECKMAC_DATA_IDX], other_data, CHECKMAC_OTHER_DATA_SIZE);
+
+  return begin_send_and_receive(&tx_buffer[0], CHECKMAC_RSP_SIZE, &rx_buffer[0],
+        CHECKMAC_DELAY, CHECKMAC_EXEC_MAX - CHECKMAC_DELAY);
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::check_mac(uint8_t *tx_buffer, uint8_t *rx_buffer,
+      uint8_t mode, uint8_t key_id, uint8_t *client_challenge, uint8_t *client_response, uint8_t *other_data) {
+  return complete(begin_check_mac(tx_buffer, rx_buffer, mode, key_id, client_challenge, client_response, other_data));
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::begin_derive_key(uint8_t *tx_buffer, uint8_t *rx_buffer,
+      uint8_t random, uint8_t target_key, uint8_t *mac) {
+  if (!tx_buffer || !rx_buffer || ((random & ~DERIVE_KEY_RANDOM_FLAG) != 0)
+         || (target_key > SHA204_KEY_ID_MAX))
+    return SHA204_BAD_PARAM;
+
+  tx_buffer[SHA204_OPCODE_IDX] = SHA204_DERIVE_KEY;
+  tx_buffer[DERIVE_KEY_RANDOM_IDX] = random;
+  tx_buffer[DERIVE_KEY_TARGETKEY_IDX] = target_key;
+  tx_buffer[DERIVE_KEY_TARGETKEY_IDX + 1] = 0;
+  if (mac != NULL)
+  {
+    memcpy(&tx_buffer[DERIVE_KEY_MAC_IDX], mac, DERIVE_KEY_MAC_SIZE);
+    tx_buffer[SHA204_COUNT_IDX] = DERIVE_KEY_COUNT_LARGE;
+  }
+  else
+    tx_buffer[SHA204_COUNT_IDX] = DERIVE_KEY_COUNT_SMALL;
+
+  return begin_send_and_receive(&tx_buffer[0], DERIVE_KEY_RSP_SIZE, &rx_buffer[0],
+        DERIVE_KEY_DELAY, DERIVE_KEY_EXEC_MAX - DERIVE_KEY_DELAY);
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::derive_key(uint8_t *tx_buffer, uint8_t *rx_buffer,
+      uint8_t random, uint8_t target_key, uint8_t *mac) {
+  return complete(begin_derive_key(tx_buffer, rx_buffer, random, target_key, mac));
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::begin_gen_dig(uint8_t *tx_buffer, uint8_t *rx_buffer,
+      uint8_t zone, uint8_t key_id, uint8_t *other_data) {
+  if (!tx_buffer || !rx_buffer || (zone > GENDIG_ZONE_DATA))
+    return SHA204_BAD_PARAM;
+
+  if (((zone == GENDIG_ZONE_OTP) && (key_id > SHA204_OTP_BLOCK_MAX))
+        || ((zone == GENDIG_ZONE_DATA) && (key_id > SHA204_KEY_ID_MAX)))
+    return SHA204_BAD_PARAM;
+
+  tx_buffer[SHA204_OPCODE_IDX] = SHA204_GENDIG;
+  tx_buffer[GENDIG_ZONE_IDX] = zone;
+  tx_buffer[GENDIG_KEYID_IDX] = key_id;
+  tx_buffer[GENDIG_KEYID_IDX + 1] = 0;
+  if (other_data != NULL)
+  {
+    memcpy(&tx_buffer[GENDIG_DATA_IDX], other_data, GENDIG_OTHER_DATA_SIZE);
+    tx_buffer[SHA204_COUNT_IDX] = GENDIG_COUNT_DATA;
+  }
+  else
+    tx_buffer[SHA204_COUNT_IDX] = GENDIG_COUNT;
+
+  return begin_send_and_receive(&tx_buffer[0], GENDIG_RSP_SIZE, &rx_buffer[0],
+        GENDIG_DELAY, GENDIG_EXEC_MAX - GENDIG_DELAY);
+
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::gen_dig(uint8_t *tx_buffer, uint8_t *rx_buffer,
+      uint8_t zone, uint8_t key_id, uint8_t *other_data) {
+  return complete(begin_gen_dig(tx_buffer, rx_buffer, zone, key_id, other_data));
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::begin_hmac(uint8_t *tx_buffer, uint8_t *rx_buffer, uint8_t mode, uint16_t key_id) {
+  if (!tx_buffer || !rx_buffer || ((mode & ~HMAC_MODE_MASK) != 0))
+    return SHA204_BAD_PARAM;
+
+  tx_buffer[SHA204_COUNT_IDX] = HMAC_COUNT;
+  tx_buffer[SHA204_OPCODE_IDX] = SHA204_HMAC;
+  tx_buffer[HMAC_MODE_IDX] = mode;
+
+  // Although valid key identifiers are only
+  // from 0 to 15, all 16 bits are used in the HMAC message.
+  tx_buffer[HMAC_KEYID_IDX] = key_id & 0xFF;
+  tx_buffer[HMAC_KEYID_IDX + 1] = key_id >> 8;
+
+  return begin_send_and_receive(&tx_buffer[0], HMAC_RSP_SIZE, &rx_buffer[0],
+        HMAC_DELAY, HMAC_EXEC_MAX - HMAC_DELAY);
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::hmac(uint8_t *tx_buffer, uint8_t *rx_buffer, uint8_t mode, uint16_t key_id) {
+  return complete(begin_hmac(tx_buffer, rx_buffer, mode, key_id));
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::begin_lock(uint8_t *tx_buffer, uint8_t *rx_buffer, uint8_t zone, uint16_t summary) {
+  if (!tx_buffer || !rx_buffer || ((zone & ~LOCK_ZONE_MASK) != 0)
+        || ((zone & LOCK_ZONE_NO_CRC) && (summary != 0)))
+    return SHA204_BAD_PARAM;
+
+  tx_buffer[SHA204_COUNT_IDX] = LOCK_COUNT;
+  tx_buffer[SHA204_OPCODE_IDX] = SHA204_LOCK;
+  tx_buffer[LOCK_ZONE_IDX] = zone & LOCK_ZONE_MASK;
+  tx_buffer[LOCK_SUMMARY_IDX]= summary & 0xFF;
+  tx_buffer[LOCK_SUMMARY_IDX + 1]= summary >> 8;
+  return begin_send_and_receive(&tx_buffer[0], LOCK_RSP_SIZE, &rx_buffer[0],
+        LOCK_DELAY, LOCK_EXEC_MAX - LOCK_DELAY);
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::lock(uint8_t *tx_buffer, uint8_t *rx_buffer, uint8_t zone, uint16_t summary) {
+  return complete(begin_lock(tx_buffer, rx_buffer, zone, summary));
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::begin_mac(uint8_t *tx_buffer, uint8_t *rx_buffer,
+      uint8_t mode, uint16_t key_id, uint8_t *challenge) {
+  if (!tx_buffer || !rx_buffer || ((mode & ~MAC_MODE_MASK) != 0)
+        || (((mode & MAC_MODE_BLOCK2_TEMPKEY) == 0) && !challenge))
+    return SHA204_BAD_PARAM;
+
+  tx_buffer[SHA204_COUNT_IDX] = MAC_COUNT_SHORT;
+  tx_buffer[SHA204_OPCODE_IDX] = SHA204_MAC;
+  tx_buffer[MAC_MODE_IDX] = mode;
+  tx_buffer[MAC_KEYID_IDX] = key_id & 0xFF;
+  tx_buffer[MAC_KEYID_IDX + 1] = key_id >> 8;
+  if ((mode & MAC_MODE_BLOCK2_TEMPKEY) == 0)
+  {
+    memcpy(&tx_buffer[MAC_CHALLENGE_IDX], challenge, MAC_CHALLENGE_SIZE);
+    tx_buffer[SHA204_COUNT_IDX] = MAC_COUNT_LONG;
+  }
+
+  return begin_send_and_receive(&tx_buffer[0], MAC_RSP_SIZE, &rx_buffer[0],
+        MAC_DELAY, MAC_EXEC_MAX - MAC_DELAY);
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::mac(uint8_t *tx_buffer, uint8_t *rx_buffer,
+      uint8_t mode, uint16_t key_id, uint8_t *challenge) {
+  return complete(begin_mac(tx_buffer, rx_buffer, mode, key_id, challenge));
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::begin_nonce(uint8_t *tx_buffer, uint8_t *rx_buffer, uint8_t mode, uint8_t *numin) {
+  uint8_t rx_size;
+
+  if (!tx_buffer || !rx_buffer || !numin
+        || (mode > NONCE_MODE_PASSTHROUGH) || (mode == NONCE_MODE_INVALID))
+    return SHA204_BAD_PARAM;
+
+  tx_buffer[SHA204_OPCODE_IDX] = SHA204_NONCE;
+  tx_buffer[NONCE_MODE_IDX] = mode;
+
+  // 2. parameter is 0.
+  tx_buffer[NONCE_PARAM2_IDX] =
+  tx_buffer[NONCE_PARAM2_IDX + 1] = 0;
+
+  if (mode != NONCE_MODE_PASSTHROUGH)
+  {
+    memcpy(&tx_buffer[NONCE_INPUT_IDX], numin, NONCE_NUMIN_SIZE);
+    tx_buffer[SHA204_COUNT_IDX] = NONCE_COUNT_SHORT;
+    rx_size = NONCE_RSP_SIZE_LONG;
+  }
+  else
+  {
+    memcpy(&tx_buffer[NONCE_INPUT_IDX], numin, NONCE_NUMIN_SIZE_PASSTHROUGH);
+    tx_buffer[SHA204_COUNT_IDX] = NONCE_COUNT_LONG;
+    rx_size = NONCE_RSP_SIZE_SHORT;
+  }
+
+  return begin_send_and_receive(&tx_buffer[0], rx_size, &rx_buffer[0],
+        NONCE_DELAY, NONCE_EXEC_MAX - NONCE_DELAY);
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::nonce(uint8_t *tx_buffer, uint8_t *rx_buffer, uint8_t mode, uint8_t *numin) {
+  return complete(begin_nonce(tx_buffer, rx_buffer, mode, numin));
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::begin_pause(uint8_t *tx_buffer, uint8_t *rx_buffer, uint8_t selector) {
+  if (!tx_buffer || !rx_buffer)
+    return SHA204_BAD_PARAM;
+
+  tx_buffer[SHA204_COUNT_IDX] = PAUSE_COUNT;
+  tx_buffer[SHA204_OPCODE_IDX] = SHA204_PAUSE;
+  tx_buffer[PAUSE_SELECT_IDX] = selector;
+
+  // 2. parameter is 0.
+  tx_buffer[PAUSE_PARAM2_IDX] =
+  tx_buffer[PAUSE_PARAM2_IDX + 1] = 0;
+
+  return begin_send_and_receive(&tx_buffer[0], PAUSE_RSP_SIZE, &rx_buffer[0],
+        PAUSE_DELAY, PAUSE_EXEC_MAX - PAUSE_DELAY);
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::pause(uint8_t *tx_buffer, uint8_t *rx_buffer, uint8_t selector) {
+  return complete(begin_pause(tx_buffer, rx_buffer, selector));
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::begin_update_extra(uint8_t *tx_buffer, uint8_t *rx_buffer, uint8_t mode, uint8_t new_value) {
+  if (!tx_buffer || !rx_buffer || (mode > UPDATE_CONFIG_BYTE_86))
+    return SHA204_BAD_PARAM;
+
+  tx_buffer[SHA204_COUNT_IDX] = UPDATE_COUNT;
+  tx_buffer[SHA204_OPCODE_IDX] = SHA204_UPDATE_EXTRA;
+  tx_buffer[UPDATE_MODE_IDX] = mode;
+  tx_buffer[UPDATE_VALUE_IDX] = new_value;
+  tx_buffer[UPDATE_VALUE_IDX + 1] = 0;
+
+  return begin_send_and_receive(&tx_buffer[0], UPDATE_RSP_SIZE, &rx_buffer[0],
+        UPDATE_DELAY, UPDATE_EXEC_MAX - UPDATE_DELAY);
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::update_extra(uint8_t *tx_buffer, uint8_t *rx_buffer, uint8_t mode, uint8_t new_value) {
+  return complete(begin_update_extra(tx_buffer, rx_buffer, mode, new_value));
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::begin_write(uint8_t *tx_buffer, uint8_t *rx_buffer,
+      uint8_t zone, uint16_t address, uint8_t *new_value, uint8_t *mac) {
+  uint8_t *p_command;
+  uint8_t count;
+
+  if (!tx_buffer || !rx_buffer || !new_value || ((zone & ~WRITE_ZONE_MASK) != 0))
+    return SHA204_BAD_PARAM;
+
+  address >>= 2;
+  if ((zone & SHA204_ZONE_MASK) == SHA204_ZONE_CONFIG) {
+    if (address > SHA204_ADDRESS_MASK_CONFIG)
+      return SHA204_BAD_PARAM;
+  }
+  else if ((zone & SHA204_ZONE_MASK) == SHA204_ZONE_OTP) {
+    if (address > SHA204_ADDRESS_MASK_OTP)
+      return SHA204_BAD_PARAM;
+  }
+  else if ((zone & SHA204_ZONE_MASK) == SHA204_ZONE_DATA) {
+    if (address > SHA204_ADDRESS_MASK)
+      return SHA204_BAD_PARAM;
+  }
+
+  p_command = &tx_buffer[SHA204_OPCODE_IDX];
+  *p_command++ = SHA204_WRITE;
+  *p_command++ = zone;
+  *p_command++ = (uint8_t) (address & SHA204_ADDRESS_MASK);
+  *p_command++ = 0;
+
+  count = (zone & SHA204_ZONE_COUNT_FLAG) ? SHA204_ZONE_ACCESS_32 : SHA204_ZONE_ACCESS_4;
+  memcpy(p_command, new_value, count);
+  p_command += count;
+
+  if (mac != NULL)
+  {
+    memcpy(p_command, mac, WRITE_MAC_SIZE);
+    p_command += WRITE_MAC_SIZE;
+  }
+
+  // Supply count.
+  tx_buffer[SHA204_COUNT_IDX] = (uint8_t) (p_command - &tx_buffer[0] + SHA204_CRC_SIZE);
+
+  return begin_send_and_receive(&tx_buffer[0], WRITE_RSP_SIZE, &rx_buffer[0],
+        WRITE_DELAY, WRITE_EXEC_MAX - WRITE_DELAY);
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::write(uint8_t *tx_buffer, uint8_t *rx_buffer,
+      uint8_t zone, uint16_t address, uint8_t *new_value, uint8_t *mac) {
+  return complete(begin_write(tx_buffer, rx_buffer, zone, address, new_value, mac));
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::begin_sha(uint8_t *tx_buffer, uint8_t *rx_buffer,
+    uint8_t mode, uint8_t *message) {
+  uint8_t rx_size;
+  if (!tx_buffer || !rx_buffer || ((mode & ~SHA_MODE_MASK) != 0)
+        || ((mode & SHA_MODE_MASK) && !message))
+    return SHA204_BAD_PARAM;
+
+  tx_buffer[SHA204_OPCODE_IDX] = SHA204_SHA;
+  tx_buffer[SHA_MODE_IDX] = mode;
+
+  // 2. parameter is 0.
+  tx_buffer[SHA_PARAM2_IDX] =
+  tx_buffer[SHA_PARAM2_IDX + 1] = 0;
+
+  if (mode == SHA_MODE_MASK)
+  { // mode = compute
+    memcpy(&tx_buffer[SHA_MESSAGE_IDX], message, SHA_MESSAGE_SIZE);
+    tx_buffer[SHA204_COUNT_IDX] = SHA_COUNT_LONG;
+    rx_size = SHA_RSP_SIZE_LONG;
+  } else { // mode = init
+    tx_buffer[SHA204_COUNT_IDX] = SHA_COUNT_SHORT;
+    rx_size = SHA_RSP_SIZE_SHORT;
+  }
+
+  return begin_send_and_receive(&tx_buffer[0], rx_size, &rx_buffer[0],
+        SHA_DELAY, SHA_EXEC_MAX - SHA_DELAY);
+}
+
+template <class Transport>
+uint8_t SHA204Core<Transport>::sha(uint8_t *tx_buffer, uint8_t *rx_buffer,
+    uint8_t mode, uint8_t *message) {
+  return complete(begin_sha(tx_buffer, rx_buffer, mode, message));
+}
+
+#undef SHA204_TRACE_EVENT
+#undef SHA204_GOVERNOR_AWAKE_US
+#undef SHA204_GOVERNOR_REUSE_US
+
+#endif
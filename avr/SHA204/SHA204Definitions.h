@@ -70,6 +70,9 @@ limitations under the License.
 #define SHA204_ADDRESS_MASK_CONFIG      (         0x001F)      //!< Address bits 5 to 7 are 0 for Configuration zone.
 #define SHA204_ADDRESS_MASK_OTP         (         0x000F)      //!< Address bits 4 to 7 are 0 for OTP zone.
 #define SHA204_ADDRESS_MASK             (         0x007F)      //!< Address bit 7 to 15 are always 0.
+#define SHA204_ZONE_SIZE_CONFIG         (             88)      //!< Configuration zone size (bytes)
+#define SHA204_ZONE_SIZE_OTP            (             64)      //!< OTP zone size (bytes)
+#define SHA204_ZONE_SIZE_DATA           (            512)      //!< Data zone size (bytes)
 
 // CheckMAC command definitions
 #define CHECKMAC_MODE_IDX               SHA204_PARAM1_IDX      //!< CheckMAC command index for mode
@@ -283,5 +286,13 @@ limitations under the License.
 #define CPU_CLOCK_DEVIATION_POSITIVE   (1.01)
 #define CPU_CLOCK_DEVIATION_NEGATIVE   (0.99)
 #define SHA204_RETRY_COUNT           (1)
+#define SHA204_POLL_INTERVAL_US      ((uint16_t) 250)  //! pause between two polls of a busy device
+#define SHA204_LATENCY_SLOTS         (14)  //! number of op-codes with a learned execution time
+#define SHA204_LATENCY_EWMA_SHIFT    (3)   //! weight of a new sample in the learned execution time: 1/8
+#define SHA204_LATENCY_EARLY_SHIFT   (3)   //! first poll this fraction (1/8) before the learned time
+#define SHA204_WATCHDOG_MS           (1300)  //! the chip goes back to sleep this long after a wake-up (typical)
+#define SHA204_WATCHDOG_MIN_MS       (700)   //! ... but it can be as early as this (minimum)
+#define SHA204_GOVERNOR_HOLD_MAX_MS  (100)   //! requests further apart than this don't keep the chip awake
+#define SHA204_GOVERNOR_GAP_SHIFT    (2)     //! weight of a new sample in the learned gap between requests: 1/4
 
 #endif
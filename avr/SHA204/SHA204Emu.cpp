@@ -0,0 +1,863 @@
+/*
+ * SHA204Emu.cpp
+ * (c) 2014 flabbergast
+ *  Software model of an ATSHA204 behind the SHA204 transport interface:
+ *  Main file: extends the generic SHA204 class and implements the device.
+ *
+ */
+
+#include "SHA204.h"
+#include "SHA204ReturnCodes.h"
+#include "SHA204Definitions.h"
+#include "SHA204Emu.h"
+#include "SHA204HAL.h"
+#include "SHA204CRC.h"
+#include <string.h>
+
+// config zone layout
+#define EMU_CONFIG_SLOT_CONFIG  20  // 16 x 2 bytes, little endian
+#define EMU_CONFIG_USER_EXTRA   84
+#define EMU_CONFIG_SELECTOR     85
+#define EMU_CONFIG_LOCK_VALUE   86  // data and OTP zones
+#define EMU_CONFIG_LOCK_CONFIG  87
+#define EMU_UNLOCKED            0x55
+
+// OTP modes
+#define EMU_OTP_MODE_READ_ONLY  0xAA
+#define EMU_OTP_MODE_CONSUMPTION 0x55
+
+// SlotConfig bits
+#define EMU_SLOT_IS_SECRET      0x0080
+#define EMU_SLOT_ENCRYPT_READ   0x0040
+#define EMU_SLOT_WRITE_KEY(c)   (((c) >> 8) & 0x0F)
+#define EMU_SLOT_WRITE_CONFIG(c) (((c) >> 12) & 0x0F)
+#define EMU_WRITE_CONFIG_ALWAYS  0x0
+#define EMU_WRITE_CONFIG_DERIVE  0x2 // DeriveKey allowed
+#define EMU_WRITE_CONFIG_CREATE  0x1 // DeriveKey from WriteKey instead of the target
+#define EMU_WRITE_CONFIG_ENCRYPT 0x8 // encrypted writes / authorizing MAC
+
+// status byte of a CheckMac miscompare
+#define EMU_STATUS_CHECKMAC_FAIL 0x01
+
+uint16_t SHA204Emu::SHA204_RESPONSE_TIMEOUT() {
+  return SHA204_EMU_POLL_US;
+}
+
+// SHA204Emu Constructor
+// factory fresh chip, typical timing and watchdog
+SHA204Emu::SHA204Emu() {
+  timing = SHA204_EMU_TIMING_TYPICAL;
+  watchdog = SHA204_EMU_WATCHDOG_US;
+  factory_reset();
+}
+
+void SHA204Emu::factory_reset(void) {
+  uint8_t i;
+
+  memset(config, 0, sizeof(config));
+  // SN[0:3], RevNum, SN[4:8]
+  config[0] = 0x01; config[1] = 0x23; config[2] = 0x45; config[3] = 0x67;
+  config[4] = 0x00; config[5] = 0x09; config[6] = 0x04; config[7] = 0x00;
+  config[8] = 0x89; config[9] = 0xAB; config[10] = 0xCD; config[11] = 0xEF;
+  config[ADDRESS_SN8] = 0xEE;
+  config[13] = 0x55;
+  config[ADDRESS_I2CEN] = 0x01;
+  config[ADDRESS_I2CADD] = 0xC8;
+  config[ADDRESS_OTPMODE] = EMU_OTP_MODE_CONSUMPTION;
+  config[ADDRESS_SELECTOR] = 0x00;
+  for (i = 0; i < SHA204_EMU_SLOT_COUNT; i++) {
+    config[EMU_CONFIG_SLOT_CONFIG + 2*i] = 0x8F;
+    config[EMU_CONFIG_SLOT_CONFIG + 2*i + 1] = 0x80;
+  }
+  for (i = 52; i < 68; i += 2) { // UseFlag, UpdateCount
+    config[i] = 0xFF;
+    config[i+1] = 0x00;
+  }
+  memset(config + 68, 0xFF, 16); // LastKeyUse
+  config[EMU_CONFIG_LOCK_VALUE] = EMU_UNLOCKED;
+  config[EMU_CONFIG_LOCK_CONFIG] = EMU_UNLOCKED;
+
+  memset(otp, 0xFF, sizeof(otp));
+  memset(data, 0xFF, sizeof(data));
+
+  for (i = 0; i < sizeof(rng_seed); i++)
+    rng_seed[i] = i;
+  rng_counter = 0;
+  sha256_init(&sha_ctx);
+
+  memset(&tempkey, 0, sizeof(tempkey));
+  state = SHA204_EMU_STATE_SLEEP;
+  response_valid = 0;
+  idle_after_read = 0;
+  ready_time = wake_time = sha204_hal_micros();
+  commands_executed = 0;
+  bad_responses = 0;
+}
+
+void SHA204Emu::set_timing(uint8_t model) {
+  timing = model;
+}
+
+void SHA204Emu::set_watchdog(uint32_t us) {
+  watchdog = us;
+}
+
+uint8_t SHA204Emu::get_state(void) {
+  check_watchdog();
+  return state;
+}
+
+uint8_t SHA204Emu::config_locked(void) {
+  return config[EMU_CONFIG_LOCK_CONFIG] != EMU_UNLOCKED;
+}
+
+uint8_t SHA204Emu::data_locked(void) {
+  return config[EMU_CONFIG_LOCK_VALUE] != EMU_UNLOCKED;
+}
+
+/* Device state */
+
+void SHA204Emu::check_watchdog(void) {
+  if (state == SHA204_EMU_STATE_AWAKE
+      && timing != SHA204_EMU_TIMING_INSTANT
+      && sha204_hal_time_reached(wake_time + watchdog)) {
+    state = SHA204_EMU_STATE_SLEEP;
+    tempkey.valid = 0;
+    response_valid = 0;
+  }
+}
+
+uint32_t SHA204Emu::execution_time(uint8_t op_code) {
+  uint8_t typical, max;
+  uint32_t us;
+
+  switch (op_code) {
+    case SHA204_CHECKMAC:     typical = CHECKMAC_DELAY;   max = CHECKMAC_EXEC_MAX;   break;
+    case SHA204_DERIVE_KEY:   typical = DERIVE_KEY_DELAY; max = DERIVE_KEY_EXEC_MAX; break;
+    case SHA204_DEVREV:       typical = DEVREV_DELAY;     max = DEVREV_EXEC_MAX;     break;
+    case SHA204_GENDIG:       typical = GENDIG_DELAY;     max = GENDIG_EXEC_MAX;     break;
+    case SHA204_HMAC:         typical = HMAC_DELAY;       max = HMAC_EXEC_MAX;       break;
+    case SHA204_LOCK:         typical = LOCK_DELAY;       max = LOCK_EXEC_MAX;       break;
+    case SHA204_MAC:          typical = MAC_DELAY;        max = MAC_EXEC_MAX;        break;
+    case SHA204_NONCE:        typical = NONCE_DELAY;      max = NONCE_EXEC_MAX;      break;
+    case SHA204_PAUSE:        typical = PAUSE_DELAY;      max = PAUSE_EXEC_MAX;      break;
+    case SHA204_RANDOM:       typical = RANDOM_DELAY;     max = RANDOM_EXEC_MAX;     break;
+    case SHA204_READ:         typical = READ_DELAY;       max = READ_EXEC_MAX;       break;
+    case SHA204_UPDATE_EXTRA: typical = UPDATE_DELAY;     max = UPDATE_EXEC_MAX;     break;
+    case SHA204_WRITE:        typical = WRITE_DELAY;      max = WRITE_EXEC_MAX;      break;
+    case SHA204_SHA:          typical = SHA_DELAY;        max = SHA_EXEC_MAX;        break;
+    default:                  typical = 0;                max = 0;
+  }
+
+  if (timing == SHA204_EMU_TIMING_INSTANT)
+    return 0;
+  us = (uint32_t) (timing == SHA204_EMU_TIMING_MAX ? max : typical) * 1000;
+  return us < SHA204_EMU_EXEC_MIN_US ? SHA204_EMU_EXEC_MIN_US : us;
+}
+
+void SHA204Emu::respond_status(uint8_t status) {
+  response[SHA204_BUFFER_POS_COUNT] = SHA204_RSP_SIZE_MIN;
+  response[SHA204_BUFFER_POS_STATUS] = status;
+  calculate_crc(SHA204_RSP_SIZE_MIN - SHA204_CRC_SIZE, response, response + SHA204_RSP_SIZE_MIN - SHA204_CRC_SIZE);
+  response_valid = 1;
+}
+
+void SHA204Emu::respond_data(uint8_t length, const uint8_t *payload) {
+  uint8_t count = length + 1 + SHA204_CRC_SIZE;
+
+  response[SHA204_BUFFER_POS_COUNT] = count;
+  memcpy(response + SHA204_BUFFER_POS_DATA, payload, length);
+  calculate_crc(count - SHA204_CRC_SIZE, response, response + count - SHA204_CRC_SIZE);
+  response_valid = 1;
+}
+
+// The RNG only starts working after the config zone has been locked;
+//  before that it returns the fixed pattern of a fresh chip.
+void SHA204Emu::generate_random(uint8_t *output) {
+  sha256_ctx ctx;
+  uint8_t i;
+
+  if (!config_locked()) {
+    for (i = 0; i < 32; i += 4) {
+      output[i] = output[i+1] = 0xFF;
+      output[i+2] = output[i+3] = 0x00;
+    }
+    return;
+  }
+
+  sha256_init(&ctx);
+  sha256_update(&ctx, rng_seed, sizeof(rng_seed));
+  sha256_update(&ctx, (uint8_t *) &rng_counter, sizeof(rng_counter));
+  sha256_final(&ctx, output);
+  rng_counter++;
+}
+
+// The last 20 bytes of the MAC and HMAC messages:
+//  OTP[0:7], OTP[8:10], SN[8], SN[4:7], SN[0:1], SN[2:3]
+void SHA204Emu::add_serial_and_otp(uint8_t *message, uint8_t mode) {
+  memset(message, 0, 20);
+  if (mode & MAC_MODE_INCLUDE_OTP_88)
+    memcpy(message, otp, 11);
+  else if (mode & MAC_MODE_INCLUDE_OTP_64)
+    memcpy(message, otp, 8);
+  message[11] = config[ADDRESS_SN8];
+  if (mode & MAC_MODE_INCLUDE_SN)
+    memcpy(message + 12, config + ADDRESS_SN47, 4);
+  message[16] = config[0];
+  message[17] = config[1];
+  if (mode & MAC_MODE_INCLUDE_SN) {
+    message[18] = config[2];
+    message[19] = config[3];
+  }
+}
+
+uint8_t *SHA204Emu::slot(uint8_t key_id) {
+  return data[key_id & SHA204_KEY_ID_MAX];
+}
+
+uint16_t SHA204Emu::slot_config(uint8_t key_id) {
+  key_id &= SHA204_KEY_ID_MAX;
+  return config[EMU_CONFIG_SLOT_CONFIG + 2*key_id] | ((uint16_t) config[EMU_CONFIG_SLOT_CONFIG + 2*key_id + 1] << 8);
+}
+
+/* Transport (I2C flavour) */
+
+uint8_t SHA204Emu::chip_wakeup() {
+  if (timing != SHA204_EMU_TIMING_INSTANT) {
+    SHA204_DELAY_US(SHA204_WAKEUP_PULSE_WIDTH);
+    SHA204_DELAY_MS(SHA204_WAKEUP_DELAY);
+  }
+
+  check_watchdog();
+  // a wake pulse is ignored by an awake chip
+  if (state != SHA204_EMU_STATE_AWAKE) {
+    state = SHA204_EMU_STATE_AWAKE;
+    wake_time = ready_time = sha204_hal_micros();
+    idle_after_read = 0;
+    respond_status(SHA204_STATUS_BYTE_WAKEUP);
+  }
+
+  return SHA204_SUCCESS;
+}
+
+uint8_t SHA204Emu::sleep() {
+  return send_byte(SHA204_EMU_SLEEP_CMD);
+}
+
+uint8_t SHA204Emu::idle() {
+  return send_byte(SHA204_EMU_IDLE_CMD);
+}
+
+uint8_t SHA204Emu::resync(uint8_t size, uint8_t *response) {
+  uint8_t ret_code;
+
+  ret_code = send_byte(SHA204_EMU_RESET_ADDRESS_COUNTER_CMD);
+  if (ret_code == SHA204_SUCCESS)
+    return SHA204_SUCCESS;
+
+  ret_code = receive_response(size, response);
+  if (ret_code == SHA204_SUCCESS)
+    return ret_code;
+
+  (void) sleep();
+  ret_code = wakeup(response);
+
+  return (ret_code == SHA204_SUCCESS ? SHA204_RESYNC_WITH_WAKEUP : ret_code);
+}
+
+// A sleeping, idle or busy chip NACKs its address: this costs one poll.
+uint8_t SHA204Emu::send_bytes(uint8_t count, uint8_t *buffer) {
+  check_watchdog();
+  if (state != SHA204_EMU_STATE_AWAKE || !sha204_hal_time_reached(ready_time)) {
+    if (timing != SHA204_EMU_TIMING_INSTANT)
+      sha204_hal_delay_us(SHA204_EMU_POLL_US);
+    return SHA204_TIMEOUT;
+  }
+  if (count == 0)
+    return SHA204_SUCCESS;
+
+  switch (buffer[0]) {
+    case SHA204_EMU_RESET_ADDRESS_COUNTER_CMD:
+      return SHA204_SUCCESS;
+
+    case SHA204_EMU_SLEEP_CMD:
+      state = SHA204_EMU_STATE_SLEEP;
+      tempkey.valid = 0;
+      response_valid = 0;
+      return SHA204_SUCCESS;
+
+    case SHA204_EMU_IDLE_CMD:
+      state = SHA204_EMU_STATE_IDLE;
+      response_valid = 0;
+      return SHA204_SUCCESS;
+
+    case SHA204_EMU_COMMAND_CMD:
+      return accept_command(count - 1, buffer + 1);
+  }
+
+  return SHA204_COMM_FAIL;
+}
+
+uint8_t SHA204Emu::send_byte(uint8_t value) {
+  return send_bytes(1, &value);
+}
+
+uint8_t SHA204Emu::receive_bytes(uint8_t count, uint8_t *buffer) {
+  uint8_t length;
+
+  check_watchdog();
+  if (state != SHA204_EMU_STATE_AWAKE || !response_valid || !sha204_hal_time_reached(ready_time)) {
+    if (timing != SHA204_EMU_TIMING_INSTANT)
+      sha204_hal_delay_us(SHA204_EMU_POLL_US);
+    return SHA204_TIMEOUT;
+  }
+
+  // the chip clocks out 0xFF after the end of the response
+  length = response[SHA204_BUFFER_POS_COUNT];
+  if (length > count)
+    length = count;
+  memcpy(buffer, response, length);
+  memset(buffer + length, 0xFF, count - length);
+  if (bad_responses && length > 0) {
+    buffer[length - 1] ^= 0x01;
+    bad_responses--;
+  }
+
+  if (idle_after_read) {
+    state = SHA204_EMU_STATE_IDLE;
+    idle_after_read = 0;
+  }
+  return SHA204_SUCCESS;
+}
+
+uint8_t SHA204Emu::receive_response(uint8_t size, uint8_t *response) {
+  uint8_t count_byte;
+  uint8_t i;
+  uint8_t ret_code;
+
+  for (i = 0; i < size; i++)
+    response[i] = 0;
+
+  ret_code = receive_bytes(size, response);
+  if (ret_code == SHA204_SUCCESS) {
+    count_byte = response[SHA204_BUFFER_POS_COUNT];
+    if ((count_byte < SHA204_RSP_SIZE_MIN) || (count_byte > size))
+      return SHA204_INVALID_SIZE;
+
+    // like the real transports, check the CRC on the way in
+    return check_crc(response);
+  }
+
+  return SHA204_RX_NO_RESPONSE;
+}
+
+uint8_t SHA204Emu::send_command(uint8_t count, uint8_t * command) {
+  check_watchdog();
+  if (state != SHA204_EMU_STATE_AWAKE || !sha204_hal_time_reached(ready_time)) {
+    if (timing != SHA204_EMU_TIMING_INSTANT)
+      sha204_hal_delay_us(SHA204_EMU_POLL_US);
+    return SHA204_COMM_FAIL;
+  }
+
+  return accept_command(count, command);
+}
+
+// Frame checks, then run the command and start the busy period.
+uint8_t SHA204Emu::accept_command(uint8_t count, uint8_t *command) {
+  uint8_t crc[SHA204_CRC_SIZE];
+
+  ready_time = sha204_hal_micros();
+  if (count < SHA204_CMD_SIZE_MIN || count > SHA204_CMD_SIZE_MAX
+      || command[SHA204_COUNT_IDX] != count) {
+    respond_status(SHA204_STATUS_BYTE_COMM);
+    return SHA204_SUCCESS;
+  }
+
+  calculate_crc(count - SHA204_CRC_SIZE, command, crc);
+  if (crc[0] != command[count - 2] || crc[1] != command[count - 1]) {
+    respond_status(SHA204_STATUS_BYTE_COMM);
+    return SHA204_SUCCESS;
+  }
+
+  execute_command(command);
+  ready_time += execution_time(command[SHA204_OPCODE_IDX]);
+  commands_executed++;
+
+  return SHA204_SUCCESS;
+}
+
+void SHA204Emu::execute_command(uint8_t *command) {
+  uint8_t status;
+
+  switch (command[SHA204_OPCODE_IDX]) {
+    case SHA204_CHECKMAC:     status = cmd_check_mac(command);    break;
+    case SHA204_DERIVE_KEY:   status = cmd_derive_key(command);   break;
+    case SHA204_DEVREV:       status = cmd_dev_rev(command);      break;
+    case SHA204_GENDIG:       status = cmd_gen_dig(command);      break;
+    case SHA204_HMAC:         status = cmd_hmac(command);         break;
+    case SHA204_LOCK:         status = cmd_lock(command);         break;
+    case SHA204_MAC:          status = cmd_mac(command);          break;
+    case SHA204_NONCE:        status = cmd_nonce(command);        break;
+    case SHA204_PAUSE:        status = cmd_pause(command);        break;
+    case SHA204_RANDOM:       status = cmd_random(command);       break;
+    case SHA204_READ:         status = cmd_read(command);         break;
+    case SHA204_UPDATE_EXTRA: status = cmd_update_extra(command); break;
+    case SHA204_WRITE:        status = cmd_write(command);        break;
+    case SHA204_SHA:          status = cmd_sha(command);          break;
+    default:                  status = SHA204_STATUS_BYTE_PARSE;
+  }
+
+  // The cmd_* functions prepare the response themselves when successful.
+  if (status != SHA204_SUCCESS)
+    respond_status(status);
+}
+
+/* Commands */
+
+uint8_t SHA204Emu::cmd_check_mac(uint8_t *command) {
+  uint8_t mode = command[CHECKMAC_MODE_IDX];
+  uint8_t key_id = command[CHECKMAC_KEYID_IDX];
+  uint8_t *other_data = command + CHECKMAC_DATA_IDX;
+  uint8_t message[88];
+  uint8_t digest[32];
+
+  if (command[SHA204_COUNT_IDX] != CHECKMAC_COUNT
+      || (mode & ~CHECKMAC_MODE_MASK) || command[CHECKMAC_KEYID_IDX + 1] || key_id > SHA204_KEY_ID_MAX)
+    return SHA204_STATUS_BYTE_PARSE;
+  if ((mode & (MAC_MODE_BLOCK1_TEMPKEY | MAC_MODE_BLOCK2_TEMPKEY))
+      && (!tempkey.valid || ((mode & MAC_MODE_SOURCE_FLAG_MATCH) ? 1 : 0) != tempkey.source_flag))
+    return SHA204_STATUS_BYTE_EXEC;
+
+  memcpy(message, (mode & MAC_MODE_BLOCK1_TEMPKEY) ? tempkey.value : slot(key_id), 32);
+  memcpy(message + 32, (mode & MAC_MODE_BLOCK2_TEMPKEY) ? tempkey.value : command + CHECKMAC_CLIENT_CHALLENGE_IDX, 32);
+  memcpy(message + 64, other_data, 4);
+  memset(message + 68, 0, 8);
+  if (mode & MAC_MODE_INCLUDE_OTP_64)
+    memcpy(message + 68, otp, 8);
+  memcpy(message + 76, other_data + 4, 3);
+  message[79] = config[ADDRESS_SN8];
+  memcpy(message + 80, other_data + 7, 4);
+  message[84] = config[0];
+  message[85] = config[1];
+  memcpy(message + 86, other_data + 11, 2);
+  sha256(message, sizeof(message), digest);
+
+  tempkey.valid = 0;
+  respond_status(memcmp(digest, command + CHECKMAC_CLIENT_RESPONSE_IDX, 32) ? EMU_STATUS_CHECKMAC_FAIL : SHA204_SUCCESS);
+  return SHA204_SUCCESS;
+}
+
+uint8_t SHA204Emu::cmd_derive_key(uint8_t *command) {
+  uint8_t count = command[SHA204_COUNT_IDX];
+  uint8_t random = command[DERIVE_KEY_RANDOM_IDX];
+  uint8_t target = command[DERIVE_KEY_TARGETKEY_IDX];
+  uint16_t target_config;
+  uint8_t *parent;
+  uint8_t message[96];
+
+  if ((count != DERIVE_KEY_COUNT_SMALL && count != DERIVE_KEY_COUNT_LARGE)
+      || (random & ~DERIVE_KEY_RANDOM_FLAG) || command[DERIVE_KEY_TARGETKEY_IDX + 1] || target > SHA204_KEY_ID_MAX)
+    return SHA204_STATUS_BYTE_PARSE;
+
+  target_config = slot_config(target);
+  if (!data_locked() || !tempkey.valid
+      || ((random & DERIVE_KEY_RANDOM_FLAG) ? 0 : 1) != tempkey.source_flag
+      || !(EMU_SLOT_WRITE_CONFIG(target_config) & EMU_WRITE_CONFIG_DERIVE))
+    return SHA204_STATUS_BYTE_EXEC;
+
+  parent = slot((EMU_SLOT_WRITE_CONFIG(target_config) & EMU_WRITE_CONFIG_CREATE)
+                ? EMU_SLOT_WRITE_KEY(target_config) : target);
+
+  // authorizing MAC = SHA-256(parent key, opcode, param1, param2, SN[8], SN[0:1])
+  memcpy(message, parent, 32);
+  memcpy(message + 32, command + SHA204_OPCODE_IDX, 4);
+  message[36] = config[ADDRESS_SN8];
+  message[37] = config[0];
+  message[38] = config[1];
+  if (EMU_SLOT_WRITE_CONFIG(target_config) & EMU_WRITE_CONFIG_ENCRYPT) {
+    uint8_t mac[32];
+    if (count != DERIVE_KEY_COUNT_LARGE)
+      return SHA204_STATUS_BYTE_EXEC;
+    sha256(message, 39, mac);
+    if (memcmp(mac, command + DERIVE_KEY_MAC_IDX, DERIVE_KEY_MAC_SIZE))
+      return SHA204_STATUS_BYTE_EXEC;
+  }
+
+  // new key = SHA-256(parent key, opcode, param1, param2, SN[8], SN[0:1], 25 zeros, TempKey)
+  memset(message + 39, 0, 25);
+  memcpy(message + 64, tempkey.value, 32);
+  sha256(message, sizeof(message), slot(target));
+
+  tempkey.valid = 0;
+  respond_status(SHA204_SUCCESS);
+  return SHA204_SUCCESS;
+}
+
+uint8_t SHA204Emu::cmd_dev_rev(uint8_t *command) {
+  static const uint8_t revision[4] = { 0x00, 0x00, 0x00, 0x04 };
+
+  if (command[SHA204_COUNT_IDX] != DEVREV_COUNT)
+    return SHA204_STATUS_BYTE_PARSE;
+
+  respond_data(sizeof(revision), revision);
+  return SHA204_SUCCESS;
+}
+
+uint8_t SHA204Emu::cmd_gen_dig(uint8_t *command) {
+  uint8_t count = command[SHA204_COUNT_IDX];
+  uint8_t zone = command[GENDIG_ZONE_IDX];
+  uint8_t key_id = command[GENDIG_KEYID_IDX];
+  uint8_t message[96];
+
+  if ((count != GENDIG_COUNT && count != GENDIG_COUNT_DATA) || command[GENDIG_KEYID_IDX + 1])
+    return SHA204_STATUS_BYTE_PARSE;
+
+  memset(message, 0, 32);
+  switch (zone) {
+    case GENDIG_ZONE_CONFIG:
+      if (key_id > 2)
+        return SHA204_STATUS_BYTE_PARSE;
+      memcpy(message, config + 32*key_id, key_id == 2 ? SHA204_EMU_CONFIG_SIZE - 64 : 32);
+      break;
+    case GENDIG_ZONE_OTP:
+      if (key_id > SHA204_OTP_BLOCK_MAX)
+        return SHA204_STATUS_BYTE_PARSE;
+      memcpy(message, otp + 32*key_id, 32);
+      break;
+    case GENDIG_ZONE_DATA:
+      if (key_id > SHA204_KEY_ID_MAX)
+        return SHA204_STATUS_BYTE_PARSE;
+      memcpy(message, slot(key_id), 32);
+      break;
+    default:
+      return SHA204_STATUS_BYTE_PARSE;
+  }
+  if (!tempkey.valid)
+    return SHA204_STATUS_BYTE_EXEC;
+
+  // SHA-256(value, opcode, param1, param2, SN[8], SN[0:1], 25 zeros, TempKey)
+  memcpy(message + 32, command + SHA204_OPCODE_IDX, 4);
+  message[36] = config[ADDRESS_SN8];
+  message[37] = config[0];
+  message[38] = config[1];
+  memset(message + 39, 0, 25);
+  memcpy(message + 64, tempkey.value, 32);
+  sha256(message, sizeof(message), tempkey.value);
+
+  tempkey.gen_data = (zone == GENDIG_ZONE_DATA);
+  tempkey.key_id = key_id;
+  respond_status(SHA204_SUCCESS);
+  return SHA204_SUCCESS;
+}
+
+uint8_t SHA204Emu::cmd_hmac(uint8_t *command) {
+  uint8_t mode = command[HMAC_MODE_IDX];
+  uint8_t key_id = command[HMAC_KEYID_IDX];
+  uint8_t message[88];
+  uint8_t digest[32];
+
+  if (command[SHA204_COUNT_IDX] != HMAC_COUNT
+      || (mode & ~HMAC_MODE_MASK) || command[HMAC_KEYID_IDX + 1] || key_id > SHA204_KEY_ID_MAX)
+    return SHA204_STATUS_BYTE_PARSE;
+  if (!tempkey.valid || ((mode & MAC_MODE_SOURCE_FLAG_MATCH) ? 1 : 0) != tempkey.source_flag)
+    return SHA204_STATUS_BYTE_EXEC;
+
+  // 32 zeros, TempKey, opcode, mode, param2, OTP/SN bits
+  memset(message, 0, 32);
+  memcpy(message + 32, tempkey.value, 32);
+  memcpy(message + 64, command + SHA204_OPCODE_IDX, 4);
+  add_serial_and_otp(message + 68, mode);
+  hmac_sha256(slot(key_id), 32, message, sizeof(message), digest);
+
+  respond_data(sizeof(digest), digest);
+  return SHA204_SUCCESS;
+}
+
+uint8_t SHA204Emu::cmd_lock(uint8_t *command) {
+  uint8_t zone = command[LOCK_ZONE_IDX];
+  uint16_t crc = sha204_crc_init();
+  uint8_t summary[SHA204_CRC_SIZE];
+
+  if (command[SHA204_COUNT_IDX] != LOCK_COUNT || (zone & ~LOCK_ZONE_MASK))
+    return SHA204_STATUS_BYTE_PARSE;
+
+  if (zone & LOCK_ZONE_NO_CONFIG) {
+    if (!config_locked() || data_locked())
+      return SHA204_STATUS_BYTE_EXEC;
+    crc = sha204_crc_update(crc, data[0], sizeof(data));
+    crc = sha204_crc_update(crc, otp, sizeof(otp));
+  } else {
+    if (config_locked())
+      return SHA204_STATUS_BYTE_EXEC;
+    crc = sha204_crc_update(crc, config, sizeof(config));
+  }
+  sha204_crc_final(crc, summary);
+
+  if (!(zone & LOCK_ZONE_NO_CRC)
+      && (command[LOCK_SUMMARY_IDX] != summary[0] || command[LOCK_SUMMARY_IDX + 1] != summary[1]))
+    return SHA204_STATUS_BYTE_EXEC;
+
+  config[(zone & LOCK_ZONE_NO_CONFIG) ? EMU_CONFIG_LOCK_VALUE : EMU_CONFIG_LOCK_CONFIG] = 0x00;
+  respond_status(SHA204_SUCCESS);
+  return SHA204_SUCCESS;
+}
+
+uint8_t SHA204Emu::cmd_mac(uint8_t *command) {
+  uint8_t count = command[SHA204_COUNT_IDX];
+  uint8_t mode = command[MAC_MODE_IDX];
+  uint8_t key_id = command[MAC_KEYID_IDX];
+  uint8_t message[88];
+  uint8_t digest[32];
+
+  if ((count != MAC_COUNT_SHORT && count != MAC_COUNT_LONG)
+      || (mode & ~MAC_MODE_MASK) || command[MAC_KEYID_IDX + 1] || key_id > SHA204_KEY_ID_MAX
+      || (!(mode & MAC_MODE_BLOCK2_TEMPKEY) && count != MAC_COUNT_LONG))
+    return SHA204_STATUS_BYTE_PARSE;
+  if ((mode & (MAC_MODE_BLOCK1_TEMPKEY | MAC_MODE_BLOCK2_TEMPKEY))
+      && (!tempkey.valid || ((mode & MAC_MODE_SOURCE_FLAG_MATCH) ? 1 : 0) != tempkey.source_flag))
+    return SHA204_STATUS_BYTE_EXEC;
+
+  // key, challenge, opcode, mode, param2, OTP/SN bits
+  memcpy(message, (mode & MAC_MODE_BLOCK1_TEMPKEY) ? tempkey.value : slot(key_id), 32);
+  memcpy(message + 32, (mode & MAC_MODE_BLOCK2_TEMPKEY) ? tempkey.value : command + MAC_CHALLENGE_IDX, 32);
+  memcpy(message + 64, command + SHA204_OPCODE_IDX, 4);
+  add_serial_and_otp(message + 68, mode);
+  sha256(message, sizeof(message), digest);
+
+  respond_data(sizeof(digest), digest);
+  return SHA204_SUCCESS;
+}
+
+uint8_t SHA204Emu::cmd_nonce(uint8_t *command) {
+  uint8_t count = command[SHA204_COUNT_IDX];
+  uint8_t mode = command[NONCE_MODE_IDX];
+  uint8_t message[55];
+
+  if ((mode & ~NONCE_MODE_MASK) || mode == NONCE_MODE_INVALID)
+    return SHA204_STATUS_BYTE_PARSE;
+
+  if (mode == NONCE_MODE_PASSTHROUGH) {
+    if (count != NONCE_COUNT_LONG)
+      return SHA204_STATUS_BYTE_PARSE;
+    memcpy(tempkey.value, command + NONCE_INPUT_IDX, NONCE_NUMIN_SIZE_PASSTHROUGH);
+    tempkey.source_flag = 1;
+    respond_status(SHA204_SUCCESS);
+  } else {
+    if (count != NONCE_COUNT_SHORT)
+      return SHA204_STATUS_BYTE_PARSE;
+    // TempKey = SHA-256(RandOut, NumIn, opcode, mode, 0x00)
+    generate_random(message);
+    memcpy(message + 32, command + NONCE_INPUT_IDX, NONCE_NUMIN_SIZE);
+    message[52] = SHA204_NONCE;
+    message[53] = mode;
+    message[54] = 0x00;
+    sha256(message, sizeof(message), tempkey.value);
+    tempkey.source_flag = 0;
+    if (mode == NONCE_MODE_SEED_UPDATE)
+      sha256(message, sizeof(message), rng_seed);
+    respond_data(32, message);
+  }
+
+  tempkey.valid = 1;
+  tempkey.gen_data = 0;
+  return SHA204_SUCCESS;
+}
+
+uint8_t SHA204Emu::cmd_pause(uint8_t *command) {
+  if (command[SHA204_COUNT_IDX] != PAUSE_COUNT)
+    return SHA204_STATUS_BYTE_PARSE;
+
+  if (command[PAUSE_SELECT_IDX] != config[EMU_CONFIG_SELECTOR])
+    idle_after_read = 1;
+  respond_status(SHA204_SUCCESS);
+  return SHA204_SUCCESS;
+}
+
+uint8_t SHA204Emu::cmd_random(uint8_t *command) {
+  uint8_t output[32];
+
+  if (command[SHA204_COUNT_IDX] != RANDOM_COUNT || command[RANDOM_MODE_IDX] > RANDOM_NO_SEED_UPDATE)
+    return SHA204_STATUS_BYTE_PARSE;
+
+  generate_random(output);
+  if (command[RANDOM_MODE_IDX] == RANDOM_SEED_UPDATE && config_locked())
+    sha256(output, sizeof(output), rng_seed);
+
+  respond_data(sizeof(output), output);
+  return SHA204_SUCCESS;
+}
+
+uint8_t SHA204Emu::cmd_read(uint8_t *command) {
+  uint8_t zone = command[READ_ZONE_IDX];
+  uint8_t address = command[READ_ADDR_IDX];
+  uint8_t size = (zone & READ_ZONE_MODE_32_BYTES) ? SHA204_ZONE_ACCESS_32 : SHA204_ZONE_ACCESS_4;
+  uint16_t offset = (size == SHA204_ZONE_ACCESS_32) ? (address >> 3) * 32 : address * 4;
+  uint16_t config_bits;
+
+  if (command[SHA204_COUNT_IDX] != READ_COUNT || (zone & ~READ_ZONE_MASK)
+      || command[READ_ADDR_IDX + 1] || address > SHA204_ADDRESS_MASK)
+    return SHA204_STATUS_BYTE_PARSE;
+
+  switch (zone & SHA204_ZONE_MASK) {
+    case SHA204_ZONE_CONFIG:
+      if (offset + size > SHA204_EMU_CONFIG_SIZE)
+        return SHA204_STATUS_BYTE_PARSE;
+      respond_data(size, config + offset);
+      return SHA204_SUCCESS;
+
+    case SHA204_ZONE_OTP:
+      if (offset + size > SHA204_EMU_OTP_SIZE)
+        return SHA204_STATUS_BYTE_PARSE;
+      if (!data_locked())
+        return SHA204_STATUS_BYTE_EXEC;
+      respond_data(size, otp + offset);
+      return SHA204_SUCCESS;
+
+    case SHA204_ZONE_DATA:
+      config_bits = slot_config(address >> 3);
+      if (!data_locked() || (config_bits & (EMU_SLOT_IS_SECRET | EMU_SLOT_ENCRYPT_READ)))
+        return SHA204_STATUS_BYTE_EXEC;
+      respond_data(size, data[0] + offset);
+      return SHA204_SUCCESS;
+  }
+
+  return SHA204_STATUS_BYTE_PARSE;
+}
+
+uint8_t SHA204Emu::cmd_update_extra(uint8_t *command) {
+  uint8_t mode = command[UPDATE_MODE_IDX];
+  uint8_t index = mode ? EMU_CONFIG_SELECTOR : EMU_CONFIG_USER_EXTRA;
+
+  if (command[SHA204_COUNT_IDX] != UPDATE_COUNT || mode > UPDATE_CONFIG_BYTE_86)
+    return SHA204_STATUS_BYTE_PARSE;
+  // the selector can be changed any time if SelectorMode is 0
+  if (!config_locked()
+      || (config[index] != 0 && !(mode && config[ADDRESS_SELECTOR] == 0)))
+    return SHA204_STATUS_BYTE_EXEC;
+
+  config[index] = command[UPDATE_VALUE_IDX];
+  respond_status(SHA204_SUCCESS);
+  return SHA204_SUCCESS;
+}
+
+// Only the Always (0000) and Encrypt (1xxx) write configs are modelled,
+//  everything else behaves like Never after the data zone is locked.
+uint8_t SHA204Emu::cmd_write(uint8_t *command) {
+  uint8_t count = command[SHA204_COUNT_IDX];
+  uint8_t zone = command[WRITE_ZONE_IDX];
+  uint8_t address = command[WRITE_ADDR_IDX];
+  uint8_t size = (zone & SHA204_ZONE_COUNT_FLAG) ? SHA204_ZONE_ACCESS_32 : SHA204_ZONE_ACCESS_4;
+  uint8_t has_mac = (count == SHA204_CMD_SIZE_MIN + size + WRITE_MAC_SIZE);
+  uint16_t offset = (size == SHA204_ZONE_ACCESS_32) ? (address >> 3) * 32 : address * 4;
+  uint8_t *value = command + WRITE_VALUE_IDX;
+  uint8_t plain[32];
+  uint8_t i;
+
+  if ((count != SHA204_CMD_SIZE_MIN + size && !has_mac)
+      || (zone & ~WRITE_ZONE_MASK) || command[WRITE_ADDR_IDX + 1] || address > SHA204_ADDRESS_MASK
+      || ((zone & WRITE_ZONE_WITH_MAC) && !has_mac))
+    return SHA204_STATUS_BYTE_PARSE;
+
+  switch (zone & SHA204_ZONE_MASK) {
+    case SHA204_ZONE_CONFIG:
+      if (offset + size > SHA204_EMU_CONFIG_SIZE || (zone & WRITE_ZONE_WITH_MAC))
+        return SHA204_STATUS_BYTE_PARSE;
+      // bytes 0-15 and 84-87 are not writable
+      if (config_locked() || offset < ADDRESS_I2CADD || offset + size > EMU_CONFIG_USER_EXTRA)
+        return SHA204_STATUS_BYTE_EXEC;
+      memcpy(config + offset, value, size);
+      break;
+
+    case SHA204_ZONE_OTP:
+      if (offset + size > SHA204_EMU_OTP_SIZE || (zone & WRITE_ZONE_WITH_MAC))
+        return SHA204_STATUS_BYTE_PARSE;
+      if (!config_locked())
+        return SHA204_STATUS_BYTE_EXEC;
+      if (!data_locked()) {
+        memcpy(otp + offset, value, size);
+      } else {
+        // after locking, bits can only be cleared (and only in consumption mode)
+        if (config[ADDRESS_OTPMODE] != EMU_OTP_MODE_CONSUMPTION)
+          return SHA204_STATUS_BYTE_EXEC;
+        for (i = 0; i < size; i++)
+          otp[offset + i] &= value[i];
+      }
+      break;
+
+    case SHA204_ZONE_DATA:
+      if (!config_locked())
+        return SHA204_STATUS_BYTE_EXEC;
+      if (!data_locked()) {
+        if (zone & WRITE_ZONE_WITH_MAC)
+          return SHA204_STATUS_BYTE_EXEC;
+        memcpy(data[0] + offset, value, size);
+        break;
+      }
+
+      {
+        uint16_t config_bits = slot_config(address >> 3);
+        uint8_t write_config = EMU_SLOT_WRITE_CONFIG(config_bits);
+        uint8_t message[96];
+        uint8_t mac[32];
+
+        if (write_config == EMU_WRITE_CONFIG_ALWAYS && !(zone & WRITE_ZONE_WITH_MAC)) {
+          memcpy(data[0] + offset, value, size);
+          break;
+        }
+        if (!(write_config & EMU_WRITE_CONFIG_ENCRYPT) || !(zone & WRITE_ZONE_WITH_MAC)
+            || size != SHA204_ZONE_ACCESS_32)
+          return SHA204_STATUS_BYTE_EXEC;
+
+        // input is encrypted with TempKey, which must come from GenDig over WriteKey
+        if (!tempkey.valid || !tempkey.gen_data || tempkey.key_id != EMU_SLOT_WRITE_KEY(config_bits))
+          return SHA204_STATUS_BYTE_EXEC;
+        for (i = 0; i < 32; i++)
+          plain[i] = value[i] ^ tempkey.value[i];
+
+        // MAC = SHA-256(TempKey, opcode, param1, param2, SN[8], SN[0:1], 25 zeros, plain text)
+        memcpy(message, tempkey.value, 32);
+        memcpy(message + 32, command + SHA204_OPCODE_IDX, 4);
+        message[36] = config[ADDRESS_SN8];
+        message[37] = config[0];
+        message[38] = config[1];
+        memset(message + 39, 0, 25);
+        memcpy(message + 64, plain, 32);
+        sha256(message, sizeof(message), mac);
+        tempkey.valid = 0;
+        if (memcmp(mac, value + size, WRITE_MAC_SIZE))
+          return SHA204_STATUS_BYTE_EXEC;
+
+        memcpy(data[0] + offset, plain, size);
+      }
+      break;
+
+    default:
+      return SHA204_STATUS_BYTE_PARSE;
+  }
+
+  respond_status(SHA204_SUCCESS);
+  return SHA204_SUCCESS;
+}
+
+uint8_t SHA204Emu::cmd_sha(uint8_t *command) {
+  uint8_t count = command[SHA204_COUNT_IDX];
+  uint8_t mode = command[SHA_MODE_IDX];
+  uint8_t digest[32];
+
+  if (mode & ~SHA_MODE_MASK)
+    return SHA204_STATUS_BYTE_PARSE;
+
+  if (mode == 0) {
+    if (count != SHA_COUNT_SHORT)
+      return SHA204_STATUS_BYTE_PARSE;
+    sha256_init(&sha_ctx);
+    respond_status(SHA204_SUCCESS);
+  } else {
+    if (count != SHA_COUNT_LONG)
+      return SHA204_STATUS_BYTE_PARSE;
+    sha256_block(&sha_ctx, command + SHA_MESSAGE_IDX, digest);
+    respond_data(sizeof(digest), digest);
+  }
+
+  return SHA204_SUCCESS;
+}
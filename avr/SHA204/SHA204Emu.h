@@ -0,0 +1,144 @@
+/*
+ * SHA204Emu.h
+ * (c) 2014 flabbergast
+ *  Software model of an ATSHA204 behind the SHA204 transport interface:
+ *  Main header file.
+ *
+ *  The model keeps the config, OTP and data zones, TempKey and the lock
+ *  bytes in RAM and executes the commands with real SHA-256, so that the
+ *  upper layers (and whatever is sitting on top of them) can be exercised
+ *  and load-tested without chips attached. It follows the I2C flavour of
+ *  the chip: busy or sleeping device NACKs, word address byte in front of
+ *  every write.
+ *
+ *  Timing: the command latency is taken from the *_DELAY / *_EXEC_MAX
+ *  tables in SHA204Definitions.h and measured on sha204_hal_micros(), so
+ *  the emulator runs "in real time" on whatever clock the HAL provides
+ *  (on the host: simulated by default, wall clock after
+ *  sha204_hal_host_set_realtime(1)). SHA204_EMU_TIMING_INSTANT turns
+ *  all of that off. The watchdog fires after the typical 1.3 s;
+ *  set_watchdog() moves it, e.g. to the datasheet minimum of 0.7 s.
+ *
+ *  Faults: with bad_responses set, that many of the following response
+ *  reads come back with a bit flipped in the CRC, as if it had been lost
+ *  on the bus (the chip still has the response and sends it again).
+ *
+ *  Not modelled: UseFlag/UpdateCount/LastKeyUse, encrypted reads,
+ *  the CheckOnly / single use key restrictions and the TempSense command.
+ */
+
+#ifndef SHA204_Library_Emu_h
+#define SHA204_Library_Emu_h
+
+#include "SHA204.h"
+#include "SHA204Definitions.h"
+#include "sha256.h"
+
+// timing models
+#define SHA204_EMU_TIMING_INSTANT  0 // no delays at all
+#define SHA204_EMU_TIMING_TYPICAL  1 // *_DELAY (typical execution time)
+#define SHA204_EMU_TIMING_MAX      2 // *_EXEC_MAX (worst case)
+
+// word address byte in front of the I2C writes (same as SHA204TWI)
+#define SHA204_EMU_RESET_ADDRESS_COUNTER_CMD 0x00
+#define SHA204_EMU_SLEEP_CMD 0x01
+#define SHA204_EMU_IDLE_CMD 0x02
+#define SHA204_EMU_COMMAND_CMD 0x03
+
+// device states
+#define SHA204_EMU_STATE_SLEEP 0
+#define SHA204_EMU_STATE_IDLE  1
+#define SHA204_EMU_STATE_AWAKE 2
+
+// the watchdog puts the chip to sleep this long after wake-up (typical;
+//  see set_watchdog())
+#define SHA204_EMU_WATCHDOG_US ((uint32_t) SHA204_WATCHDOG_MS * 1000)
+// time spent by one (NACKed) poll of a busy device
+#define SHA204_EMU_POLL_US 50
+// shortest execution time (the tables round the 0.4 ms ones down to 0)
+#define SHA204_EMU_EXEC_MIN_US 400
+
+// zone sizes
+#define SHA204_EMU_CONFIG_SIZE 88
+#define SHA204_EMU_OTP_SIZE 64
+#define SHA204_EMU_SLOT_COUNT 16
+#define SHA204_EMU_SLOT_SIZE 32
+
+class SHA204Emu : public SHA204 {
+private:
+  uint16_t SHA204_RESPONSE_TIMEOUT();
+  uint8_t receive_bytes(uint8_t count, uint8_t *buffer);
+  uint8_t send_bytes(uint8_t count, uint8_t *buffer);
+  uint8_t send_byte(uint8_t value);
+  uint8_t chip_wakeup();
+  uint8_t receive_response(uint8_t size, uint8_t *response);
+  uint8_t send_command(uint8_t count, uint8_t * command);
+
+  uint8_t timing;
+  uint8_t state;
+  uint32_t wake_time;  // start of the watchdog period
+  uint32_t watchdog;   // length of it, in us
+  uint32_t ready_time; // end of the command being executed
+  uint8_t response[SHA204_RSP_SIZE_MAX];
+  uint8_t response_valid;
+  uint8_t idle_after_read; // Pause with a non matching selector
+
+  struct {
+    uint8_t value[32];
+    uint8_t valid;
+    uint8_t source_flag; // 0 = random, 1 = input
+    uint8_t gen_data;    // set by GenDig
+    uint8_t key_id;      // slot used by GenDig
+  } tempkey;
+
+  uint8_t rng_seed[32];
+  uint32_t rng_counter;
+  sha256_ctx sha_ctx; // state of the SHA command
+
+  void check_watchdog(void);
+  uint8_t accept_command(uint8_t count, uint8_t *command);
+  void execute_command(uint8_t *command);
+  uint32_t execution_time(uint8_t op_code);
+  void respond_status(uint8_t status);
+  void respond_data(uint8_t length, const uint8_t *payload);
+  void generate_random(uint8_t *output);
+  void add_serial_and_otp(uint8_t *message, uint8_t mode);
+  uint8_t *slot(uint8_t key_id);
+  uint16_t slot_config(uint8_t key_id);
+
+  uint8_t cmd_check_mac(uint8_t *command);
+  uint8_t cmd_derive_key(uint8_t *command);
+  uint8_t cmd_dev_rev(uint8_t *command);
+  uint8_t cmd_gen_dig(uint8_t *command);
+  uint8_t cmd_hmac(uint8_t *command);
+  uint8_t cmd_lock(uint8_t *command);
+  uint8_t cmd_mac(uint8_t *command);
+  uint8_t cmd_nonce(uint8_t *command);
+  uint8_t cmd_pause(uint8_t *command);
+  uint8_t cmd_random(uint8_t *command);
+  uint8_t cmd_read(uint8_t *command);
+  uint8_t cmd_update_extra(uint8_t *command);
+  uint8_t cmd_write(uint8_t *command);
+  uint8_t cmd_sha(uint8_t *command);
+
+public:
+  uint8_t config[SHA204_EMU_CONFIG_SIZE];
+  uint8_t otp[SHA204_EMU_OTP_SIZE];
+  uint8_t data[SHA204_EMU_SLOT_COUNT][SHA204_EMU_SLOT_SIZE];
+  uint32_t commands_executed;
+  uint8_t bad_responses; // fault injection: the next ones are read with a bad CRC
+
+  SHA204Emu(void);
+  void factory_reset(void);
+  void set_timing(uint8_t model);
+  void set_watchdog(uint32_t us);
+  uint8_t get_state(void);
+  uint8_t config_locked(void);
+  uint8_t data_locked(void);
+
+  uint8_t sleep(void);
+  uint8_t idle(void);
+  uint8_t resync(uint8_t size, uint8_t *response);
+};
+
+#endif
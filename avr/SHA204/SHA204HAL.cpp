@@ -0,0 +1,89 @@
+/*
+ * SHA204HAL.cpp
+ * (c) 2014 flabbergast
+ *  Thin hardware abstraction layer for the SHA204 library:
+ *  implementation for AVR8/XMEGA and for the host build.
+ */
+
+#include "SHA204HAL.h"
+
+#if defined(__AVR__)
+
+#if defined(ARDUINO)
+#include <Arduino.h>
+#endif
+
+// time spent in the variable delays, used by the fallback timebase
+static volatile uint32_t sha204_hal_clock_us;
+
+void sha204_hal_delay_ms(uint16_t ms) {
+  sha204_hal_clock_us += (uint32_t) ms * 1000;
+  while (ms--)
+    _delay_ms(1);
+}
+
+void sha204_hal_delay_us(uint32_t us) {
+  sha204_hal_clock_us += us;
+  while (us >= 10) {
+    _delay_us(10);
+    us -= 10;
+  }
+  while (us--)
+    _delay_us(1);
+}
+
+#if defined(ARDUINO)
+uint32_t sha204_hal_micros(void) {
+  return micros();
+}
+#else
+__attribute__((weak)) uint32_t sha204_hal_micros(void) {
+  return sha204_hal_clock_us;
+}
+#endif
+
+__attribute__((weak)) void sha204_hal_yield(void) {
+}
+
+#else // host
+
+#include <time.h>
+#include <errno.h>
+
+static uint8_t sha204_hal_realtime = 0;
+static uint32_t sha204_hal_clock_us = 0;
+
+void sha204_hal_host_set_realtime(uint8_t realtime) {
+  sha204_hal_realtime = realtime;
+}
+
+void sha204_hal_delay_us(uint32_t us) {
+  if (!sha204_hal_realtime) {
+    sha204_hal_clock_us += us;
+    return;
+  }
+
+  struct timespec ts;
+  ts.tv_sec = us / 1000000;
+  ts.tv_nsec = (long) (us % 1000000) * 1000;
+  while (nanosleep(&ts, &ts) == -1 && errno == EINTR)
+    ;
+}
+
+void sha204_hal_delay_ms(uint16_t ms) {
+  sha204_hal_delay_us((uint32_t) ms * 1000);
+}
+
+uint32_t sha204_hal_micros(void) {
+  if (!sha204_hal_realtime)
+    return sha204_hal_clock_us;
+
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint32_t) ((uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+void sha204_hal_yield(void) {
+}
+
+#endif
@@ -0,0 +1,79 @@
+/*
+ * SHA204HAL.h
+ * (c) 2014 flabbergast
+ *  Thin hardware abstraction layer for the SHA204 library: delays,
+ *  critical sections and a microsecond timebase.
+ *
+ *  On AVR8/XMEGA (and Arduino) this maps onto avr-libc. On anything else
+ *  (the host build in ../host) it maps onto POSIX, so that the protocol
+ *  layer in SHA204.cpp can be compiled and profiled natively.
+ */
+
+#ifndef SHA204_HAL_h
+#define SHA204_HAL_h
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// delays with a run-time argument
+void sha204_hal_delay_ms(uint16_t ms);
+void sha204_hal_delay_us(uint32_t us);
+
+// free running microsecond timebase (wraps around after ~71 minutes).
+// On AVR the library only provides a weak fallback which counts the time
+//  spent in the delays above; the application should override it with
+//  a real timer (see Timer.c in the firmware).
+uint32_t sha204_hal_micros(void);
+
+// wrap-around safe "has sha204_hal_micros() passed the deadline yet?"
+static inline uint8_t sha204_hal_time_reached(uint32_t deadline) {
+  return (int32_t) (sha204_hal_micros() - deadline) >= 0;
+}
+
+// called while waiting for the bus (e.g. an interrupt driven I2C transfer);
+//  the default does nothing, the application may override it to do
+//  something useful in the meantime (like servicing USB)
+void sha204_hal_yield(void);
+
+#if !defined(__AVR__)
+// host only: sleep for real (1) or just advance a simulated clock (0, default)
+void sha204_hal_host_set_realtime(uint8_t realtime);
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#if defined(__AVR__)
+  #include <util/delay.h>
+  #include <avr/interrupt.h>
+  #include <avr/pgmspace.h>
+
+  // delays with a compile-time constant argument (bit-banging)
+  #define SHA204_DELAY_US(us) _delay_us(us)
+  #define SHA204_DELAY_MS(ms) _delay_ms(ms)
+
+  // enter/exit must be used in the same block
+  #define SHA204_CRITICAL_ENTER() uint8_t sha204_sreg_save = SREG; cli()
+  #define SHA204_CRITICAL_EXIT()  SREG = sha204_sreg_save
+#else
+  #define SHA204_DELAY_US(us) sha204_hal_delay_us((uint32_t) (us))
+  #define SHA204_DELAY_MS(ms) sha204_hal_delay_us((uint32_t) ((ms) * 1000.0))
+
+  #define SHA204_CRITICAL_ENTER() do {} while (0)
+  #define SHA204_CRITICAL_EXIT()  do {} while (0)
+
+  // flash is just memory on the host
+  #include <string.h>
+  #define PROGMEM
+  #define PSTR(s) (s)
+  #define memcpy_P(dest, src, n) memcpy((dest), (src), (n))
+  #define pgm_read_byte(p) (*(const uint8_t *) (p))
+  #define pgm_read_word(p) (*(const uint16_t *) (p))
+#endif
+
+#endif
@@ -0,0 +1,170 @@
+/*
+ * SHA204ReadCache.cpp
+ * (c) 2014 flabbergast
+ *  Cache for the Read command results which can't change any more.
+ */
+
+#include "SHA204ReadCache.h"
+#include "SHA204ReturnCodes.h"
+#include "SHA204Definitions.h"
+#include "SHA204CRC.h"
+#include <string.h>
+
+#define CACHE_UNUSED          0xFF
+#define CACHE_WORD_LOCKS      21     // bytes 84-87: UserExtra, Selector, LockValue, LockConfig
+#define CACHE_SLOT_CONFIG     20     // config zone: 16 x 2 bytes, little endian
+#define CACHE_SLOT_IS_SECRET  0x80   // in the first SlotConfig byte
+#define CACHE_UNLOCKED        0x55
+
+SHA204ReadCache::SHA204ReadCache(void) {
+  invalidate();
+  config_locked = 0;
+  data_locked = 0;
+  hits = 0;
+  misses = 0;
+}
+
+void SHA204ReadCache::invalidate(void) {
+  uint8_t i;
+
+  for (i = 0; i < SHA204_CACHE_BLOCKS; i++)
+    entry[i].zone = CACHE_UNUSED;
+  next_victim = 0;
+}
+
+int8_t SHA204ReadCache::find(uint8_t zone, uint8_t block) {
+  uint8_t i;
+
+  for (i = 0; i < SHA204_CACHE_BLOCKS; i++)
+    if (entry[i].zone == zone && entry[i].block == block)
+      return i;
+  return -1;
+}
+
+// address: in words, as in the Read command
+uint8_t SHA204ReadCache::cacheable(uint8_t zone, uint8_t address) {
+  uint8_t slot_config;
+  int8_t i;
+
+  switch (zone)
+  {
+    case SHA204_ZONE_CONFIG:
+      return config_locked && address != CACHE_WORD_LOCKS;
+    case SHA204_ZONE_OTP:
+      return data_locked;
+    case SHA204_ZONE_DATA:
+      if (!data_locked)
+        return 0;
+      // the slot's IsSecret bit, if the config zone has it
+      slot_config = CACHE_SLOT_CONFIG + 2 * (address >> 3);
+      i = find(SHA204_ZONE_CONFIG, slot_config >> 5);
+      if (i < 0 || !(entry[i].words & (1 << ((slot_config & 31) >> 2))))
+        return 0;
+      return !(entry[i].data[slot_config & 31] & CACHE_SLOT_IS_SECRET);
+  }
+  return 0;
+}
+
+uint8_t SHA204ReadCache::lookup(const uint8_t *command, uint8_t rx_size, uint8_t *response) {
+  uint8_t zone = command[READ_ZONE_IDX];
+  uint8_t address = command[READ_ADDR_IDX];
+  uint8_t size = (zone & READ_ZONE_MODE_32_BYTES) ? SHA204_ZONE_ACCESS_32 : SHA204_ZONE_ACCESS_4;
+  uint8_t mask = (size == SHA204_ZONE_ACCESS_32) ? 0xFF : 1 << (address & 7);
+  uint8_t offset = (size == SHA204_ZONE_ACCESS_32) ? 0 : (address & 7) * 4;
+  int8_t i;
+
+  zone &= SHA204_ZONE_MASK;
+  if (rx_size < size + SHA204_CRC_SIZE + 1 || !cacheable(zone, address)
+      || (i = find(zone, address >> 3)) < 0 || (entry[i].words & mask) != mask)
+  {
+    misses++;
+    return 0;
+  }
+  hits++;
+  response[SHA204_BUFFER_POS_COUNT] = size + SHA204_CRC_SIZE + 1;
+  memcpy(response + SHA204_BUFFER_POS_DATA, entry[i].data + offset, size);
+  sha204_crc_final(sha204_crc_update(sha204_crc_init(), response, size + 1), response + size + 1);
+  return 1;
+}
+
+uint8_t SHA204ReadCache::lookup_zone(uint8_t zone, uint16_t address, uint16_t length, uint8_t *data) {
+  uint16_t first = address >> 2;
+  uint16_t end = (address + length) >> 2;
+  uint16_t word;
+  uint8_t blocks = 0;
+  int8_t i;
+
+  zone &= SHA204_ZONE_MASK;
+  if (length == 0 || ((address | length) & 3) || end > 0x100)
+    return 0;
+  for (word = first; word < end; word++, data += 4)
+  {
+    if (!cacheable(zone, word) || (i = find(zone, word >> 3)) < 0
+        || !(entry[i].words & (1 << (word & 7))))
+      return 0;
+    memcpy(data, entry[i].data + (word & 7) * 4, 4);
+    if (word == first || !(word & 7))
+      blocks++;
+  }
+  hits += blocks;
+  return 1;
+}
+
+void SHA204ReadCache::observe(const uint8_t *command, const uint8_t *response, uint8_t ret_code) {
+  uint8_t zone, address, size, offset;
+  int8_t i;
+
+  switch (command[SHA204_OPCODE_IDX])
+  {
+    case SHA204_READ:
+      break;
+    case SHA204_WRITE:
+    case SHA204_LOCK:
+    case SHA204_UPDATE_EXTRA:
+    case SHA204_DERIVE_KEY:
+      // whether they went through or not
+      invalidate();
+      return;
+    default:
+      return;
+  }
+  if (ret_code != SHA204_SUCCESS)
+    return;
+
+  zone = command[READ_ZONE_IDX];
+  address = command[READ_ADDR_IDX];
+  size = (zone & READ_ZONE_MODE_32_BYTES) ? SHA204_ZONE_ACCESS_32 : SHA204_ZONE_ACCESS_4;
+  zone &= SHA204_ZONE_MASK;
+  if (zone == SHA204_ZONE_CONFIG && address == CACHE_WORD_LOCKS && size == SHA204_ZONE_ACCESS_4)
+  {
+    // locking is for good
+    if (response[SHA204_BUFFER_POS_DATA + 3] != CACHE_UNLOCKED)
+      config_locked = 1;
+    if (response[SHA204_BUFFER_POS_DATA + 2] != CACHE_UNLOCKED)
+      data_locked = 1;
+    return;
+  }
+  if (!cacheable(zone, address))
+    return;
+
+  if ((i = find(zone, address >> 3)) < 0)
+  {
+    i = next_victim;
+    if (++next_victim == SHA204_CACHE_BLOCKS)
+      next_victim = 0;
+    entry[i].zone = zone;
+    entry[i].block = address >> 3;
+    entry[i].words = 0;
+  }
+  if (size == SHA204_ZONE_ACCESS_32)
+  {
+    memcpy(entry[i].data, response + SHA204_BUFFER_POS_DATA, size);
+    entry[i].words = 0xFF;
+  }
+  else
+  {
+    offset = (address & 7) * 4;
+    memcpy(entry[i].data + offset, response + SHA204_BUFFER_POS_DATA, size);
+    entry[i].words |= 1 << (address & 7);
+  }
+}
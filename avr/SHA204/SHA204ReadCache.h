@@ -0,0 +1,60 @@
+/*
+ * SHA204ReadCache.h
+ * (c) 2014 flabbergast
+ *  Cache for the Read command results which can't change any more.
+ *
+ *  Once the config zone is locked (LockConfig, byte 87, != 0x55) it is
+ *  read-only, except for UserExtra and Selector (bytes 84/85, changed by
+ *  UpdateExtra); once the data and OTP zones are locked (LockValue, byte
+ *  86), so are the OTP zone and the slots which are not secret (modulo
+ *  Write/DeriveKey, which are seen by the cache). Such reads are answered
+ *  from RAM without any bus traffic.
+ *
+ *  Attach it with SHA204::set_read_cache(); it sees every command that
+ *  goes through the library: Read results are kept (per 32-byte block,
+ *  word by word), Write, Lock, UpdateExtra and DeriveKey throw everything
+ *  away. The lock state is learnt from reads of bytes 84-87 (which are
+ *  themselves never cached), and the secret bits of the slots from the
+ *  cached config zone: nothing is cached before they are known.
+ */
+
+#ifndef SHA204_Library_ReadCache_h
+#define SHA204_Library_ReadCache_h
+
+#include <stdint.h>
+
+#ifndef SHA204_CACHE_BLOCKS
+#define SHA204_CACHE_BLOCKS 5 // 32-byte blocks (the config zone takes 3)
+#endif
+
+class SHA204ReadCache {
+private:
+  struct {
+    uint8_t zone;  // 0xFF: unused
+    uint8_t block;
+    uint8_t words; // bit i: word i of the block is valid
+    uint8_t data[32];
+  } entry[SHA204_CACHE_BLOCKS];
+  uint8_t next_victim;
+  uint8_t config_locked;
+  uint8_t data_locked;
+
+  uint8_t cacheable(uint8_t zone, uint8_t address);
+  int8_t find(uint8_t zone, uint8_t block);
+
+public:
+  uint32_t hits;
+  uint32_t misses;
+
+  SHA204ReadCache(void);
+  void invalidate(void);
+  // A Read command: returns 1 (and the response) if it is cached.
+  uint8_t lookup(const uint8_t *command, uint8_t rx_size, uint8_t *response);
+  // length bytes of a zone from address (in bytes, both multiples of 4):
+  //  returns 1 (and the bytes) if all of them are cached, one hit per block.
+  uint8_t lookup_zone(uint8_t zone, uint16_t address, uint16_t length, uint8_t *data);
+  // A command went through the library.
+  void observe(const uint8_t *command, const uint8_t *response, uint8_t ret_code);
+};
+
+#endif
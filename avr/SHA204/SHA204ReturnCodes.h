@@ -41,6 +41,8 @@
 #define SHA204_RX_FAIL              ((uint8_t)  0xE6) //!< Timed out while waiting for response. Number of bytes received is > 0.
 #define SHA204_RX_NO_RESPONSE       ((uint8_t)  0xE7) //!< Not an error while the Command layer is polling for a command response.
 #define SHA204_RESYNC_WITH_WAKEUP   ((uint8_t)  0xE8) //!< re-synchronization succeeded, but only after generating a Wake-up
+#define SHA204_CMD_PENDING          ((uint8_t)  0xE9) //!< Command started with a begin_ function has not completed yet (poll() again).
+#define SHA204_WAKE_EXPIRED         ((uint8_t)  0xEA) //!< The watchdog may have put the device to sleep during a wake session (TempKey is lost).
 
 #define SHA204_COMM_FAIL            ((uint8_t)  0xF0) //!< Communication with device failed. Same as in hardware dependent modules.
 #define SHA204_TIMEOUT              ((uint8_t)  0xF1) //!< Timed out while waiting for response. Number of bytes received is 0.
@@ -30,8 +30,11 @@ limitations under the License.
 #include "SHA204ReturnCodes.h"
 #include "SHA204Definitions.h"
 #include "SHA204SWI.h"
-#include <util/delay.h>
-#include <avr/interrupt.h>
+#include "SHA204HAL.h"
+#ifdef SHA204_STATIC_TRANSPORT
+#include "SHA204Core.h"
+#endif
+#include "SHA204CRC.h"
 
 uint16_t SHA204SWI::SHA204_RESPONSE_TIMEOUT() {
   return SHA204_RESPONSE_TIMEOUT_VALUE;
@@ -47,9 +50,9 @@ SHA204SWI::SHA204SWI() {
 uint8_t SHA204SWI::chip_wakeup() {
   S_PIN_DIR_OUT;
   S_PIN_LOW;
-  _delay_us(SHA204_WAKEUP_PULSE_WIDTH);
+  SHA204_DELAY_US(SHA204_WAKEUP_PULSE_WIDTH);
   S_PIN_HIGH;
-  _delay_ms(SHA204_WAKEUP_DELAY);
+  SHA204_DELAY_MS(SHA204_WAKEUP_DELAY);
 
   return SHA204_SUCCESS;
 }
@@ -65,7 +68,7 @@ uint8_t SHA204SWI::idle() {
 uint8_t SHA204SWI::resync(uint8_t size, uint8_t *response) {
   // Try to re-synchronize without sending a Wake token
   // (step 1 of the re-synchronization process).
-  _delay_ms(SHA204_SYNC_TIMEOUT);
+  SHA204_DELAY_MS(SHA204_SYNC_TIMEOUT);
   uint8_t ret_code = receive_response(size, response);
   if (ret_code == SHA204_SUCCESS)
     return ret_code;
@@ -82,39 +85,45 @@ uint8_t SHA204SWI::resync(uint8_t size, uint8_t *response) {
   return (ret_code == SHA204_SUCCESS ? SHA204_RESYNC_WITH_WAKEUP : ret_code);
 }
 
+// Send one byte; interrupts have to be off and the pin an output.
+static void swi_send_byte(uint8_t value) {
+  uint8_t bit_mask;
+
+  for (bit_mask = 1; bit_mask > 0; bit_mask <<= 1) {
+    if (bit_mask & value) {
+      S_PIN_LOW;
+      SHA204_DELAY_US(BIT_DELAY);  //BIT_DELAY_1;
+      S_PIN_HIGH;
+      SHA204_DELAY_US(7*BIT_DELAY);  //BIT_DELAY_7;
+    } else {
+      // Send a zero bit.
+      S_PIN_LOW;
+      SHA204_DELAY_US(BIT_DELAY);  //BIT_DELAY_1;
+      S_PIN_HIGH;
+      SHA204_DELAY_US(BIT_DELAY);  //BIT_DELAY_1;
+      S_PIN_LOW;
+      SHA204_DELAY_US(BIT_DELAY);  //BIT_DELAY_1;
+      S_PIN_HIGH;
+      SHA204_DELAY_US(5*BIT_DELAY);  //BIT_DELAY_5;
+    }
+    SHA204_DELAY_US(2); // since 8*BIT_DELAY < 37 us (datasheet / Table 7-3)
+  }
+}
+
 uint8_t SHA204SWI::send_bytes(uint8_t count, uint8_t *buffer) {
-  uint8_t i, bit_mask;
+  uint8_t i;
 
   // Disable interrupts while sending.
-  cli();
+  SHA204_CRITICAL_ENTER();
 
   S_PIN_DIR_OUT;
 
   // Wait turn around time.
-  _delay_us(RX_TX_DELAY);
+  SHA204_DELAY_US(RX_TX_DELAY);
 
-  for (i = 0; i < count; i++) {
-    for (bit_mask = 1; bit_mask > 0; bit_mask <<= 1) {
-      if (bit_mask & buffer[i]) {
-        S_PIN_LOW;
-        _delay_us(BIT_DELAY);  //BIT_DELAY_1;
-        S_PIN_HIGH;
-        _delay_us(7*BIT_DELAY);  //BIT_DELAY_7;
-      } else {
-        // Send a zero bit.
-        S_PIN_LOW;
-        _delay_us(BIT_DELAY);  //BIT_DELAY_1;
-        S_PIN_HIGH;
-        _delay_us(BIT_DELAY);  //BIT_DELAY_1;
-        S_PIN_LOW;
-        _delay_us(BIT_DELAY);  //BIT_DELAY_1;
-        S_PIN_HIGH;
-        _delay_us(5*BIT_DELAY);  //BIT_DELAY_5;
-      }
-      _delay_us(2); // since 8*BIT_DELAY < 37 us (datasheet / Table 7-3)
-    }
-  }
-  sei();  // enable_interrupts();
+  for (i = 0; i < count; i++)
+    swi_send_byte(buffer[i]);
+  SHA204_CRITICAL_EXIT();
   return SWI_FUNCTION_RETCODE_SUCCESS;
 }
 
@@ -122,89 +131,92 @@ uint8_t SHA204SWI::send_byte(uint8_t value) {
   return send_bytes(1, &value);
 }
 
-uint8_t SHA204SWI::receive_bytes(uint8_t count, uint8_t *buffer)  {
-  uint8_t status = SWI_FUNCTION_RETCODE_SUCCESS;
-  uint8_t i;
+// Receive one byte; interrupts have to be off and the pin an input.
+//  *value has to be zero on entry (only the "one" bits are set).
+static inline uint8_t swi_receive_byte(uint8_t *value) {
   uint8_t bit_mask;
   uint8_t pulse_count;
   uint16_t timeout_count;
 
-  // Disable interrupts while receiving.
-  cli();
+  for (bit_mask = 1; bit_mask > 0; bit_mask <<= 1) {
+    pulse_count = 0;
 
-  // Configure signal pin as input.
-  S_PIN_DIR_IN;
+    // Make sure that the variable below is big enough.
+    // Change it to uint16_t if 255 is too small, but be aware that
+    // the loop resolution decreases on an 8-bit controller in that case.
+    timeout_count = START_PULSE_TIME_OUT;
 
-  // Receive bits and store in buffer.
-  for (i = 0; i < count; i++) {
-    for (bit_mask = 1; bit_mask > 0; bit_mask <<= 1) {
-      pulse_count = 0;
-
-      // Make sure that the variable below is big enough.
-      // Change it to uint16_t if 255 is too small, but be aware that
-      // the loop resolution decreases on an 8-bit controller in that case.
-      timeout_count = START_PULSE_TIME_OUT;
-
-      // Detect start bit.
-      while (--timeout_count > 0) {
-        // Wait for falling edge.
-        if ((S_PIN_IS_HIGH) == 0)
-          break;
-      }
+    // Detect start bit.
+    while (--timeout_count > 0) {
+      // Wait for falling edge.
+      if ((S_PIN_IS_HIGH) == 0)
+        break;
+    }
+
+    if (timeout_count == 0)
+      return SWI_FUNCTION_RETCODE_TIMEOUT;
 
-      if (timeout_count == 0) {
-        status = SWI_FUNCTION_RETCODE_TIMEOUT;
+    do {
+      // Wait for rising edge.
+      if (S_PIN_IS_HIGH) {
+        // For an Atmel microcontroller this might be faster than "pulse_count++".
+        pulse_count = 1;
         break;
       }
+    } while (--timeout_count > 0);
+
+    if (pulse_count == 0)
+      return SWI_FUNCTION_RETCODE_TIMEOUT;
+
+    // Trying to measure the time of start bit and calculating the timeout
+    // for zero bit detection is not accurate enough for an 8 MHz 8-bit CPU.
+    // (NB by flabbergast: running now on 32MHz XMEGA. so maybe...)
+    // So let's just wait the maximum time for the falling edge of a zero bit
+    // to arrive after we have detected the rising edge of the start bit.
+    timeout_count = ZERO_PULSE_TIME_OUT;
+
+    // Detect possible edge indicating zero bit.
+    do {
+      if ((S_PIN_IS_HIGH) == 0) {
+        // For an Atmel microcontroller this might be faster than "pulse_count++".
+        pulse_count = 2;
+        break;
+      }
+    } while (--timeout_count > 0);
 
+    // Wait for rising edge of zero pulse before returning. Otherwise we might interpret
+    // its rising edge as the next start pulse.
+    if (pulse_count == 2) {
       do {
-        // Wait for rising edge.
-        if (S_PIN_IS_HIGH) {
-          // For an Atmel microcontroller this might be faster than "pulse_count++".
-          pulse_count = 1;
+        if (S_PIN_IS_HIGH)
           break;
-        }
-      } while (--timeout_count > 0);
+      } while (timeout_count-- > 0);
+    }
 
-      if (pulse_count == 0) {
-        status = SWI_FUNCTION_RETCODE_TIMEOUT;
-        break;
-      }
+    // Update byte at current buffer index.
+    else
+      *value |= bit_mask;  // received "one" bit
+  }
+  return SWI_FUNCTION_RETCODE_SUCCESS;
+}
 
-      // Trying to measure the time of start bit and calculating the timeout
-      // for zero bit detection is not accurate enough for an 8 MHz 8-bit CPU.
-      // (NB by flabbergast: running now on 32MHz XMEGA. so maybe...)
-      // So let's just wait the maximum time for the falling edge of a zero bit
-      // to arrive after we have detected the rising edge of the start bit.
-      timeout_count = ZERO_PULSE_TIME_OUT;
+uint8_t SHA204SWI::receive_bytes(uint8_t count, uint8_t *buffer)  {
+  uint8_t status = SWI_FUNCTION_RETCODE_SUCCESS;
+  uint8_t i;
 
-      // Detect possible edge indicating zero bit.
-      do {
-        if ((S_PIN_IS_HIGH) == 0) {
-          // For an Atmel microcontroller this might be faster than "pulse_count++".
-          pulse_count = 2;
-          break;
-        }
-      } while (--timeout_count > 0);
-
-      // Wait for rising edge of zero pulse before returning. Otherwise we might interpret
-      // its rising edge as the next start pulse.
-      if (pulse_count == 2) {
-        do {
-          if (S_PIN_IS_HIGH)
-            break;
-        } while (timeout_count-- > 0);
-      }
+  // Disable interrupts while receiving.
+  SHA204_CRITICAL_ENTER();
 
-      // Update byte at current buffer index.
-      else
-        buffer[i] |= bit_mask;  // received "one" bit
-    }
+  // Configure signal pin as input.
+  S_PIN_DIR_IN;
 
+  // Receive bits and store in buffer.
+  for (i = 0; i < count; i++) {
+    status = swi_receive_byte(buffer + i);
     if (status != SWI_FUNCTION_RETCODE_SUCCESS)
       break;
   }
-  sei(); // enable_interrupts();
+  SHA204_CRITICAL_EXIT();
 
   if (status == SWI_FUNCTION_RETCODE_TIMEOUT) {
     if (i > 0)
@@ -218,28 +230,49 @@ uint8_t SHA204SWI::receive_response(uint8_t size, uint8_t *response) {
   uint8_t count_byte;
   uint8_t i;
   uint8_t ret_code;
+  uint16_t crc = sha204_crc_init();
+  uint8_t crc_bytes[SHA204_CRC_SIZE];
 
   for (i = 0; i < size; i++)
     response[i] = 0;
 
   (void) send_byte(SHA204_SWI_FLAG_TX);
 
-  ret_code = receive_bytes(size, response);
-  if (ret_code == SWI_FUNCTION_RETCODE_SUCCESS || ret_code == SWI_FUNCTION_RETCODE_RX_FAIL) {
-    count_byte = response[SHA204_BUFFER_POS_COUNT];
-    if ((count_byte < SHA204_RSP_SIZE_MIN) || (count_byte > size))
-      return SHA204_INVALID_SIZE;
-
-    return SHA204_SUCCESS;
+  // Read the count byte first and then only the rest of the response
+  // (instead of waiting for a timeout after a short one), updating the
+  // CRC between bytes. The device doesn't wait for us, so this is all
+  // one critical section.
+  SHA204_CRITICAL_ENTER();
+  S_PIN_DIR_IN;
+  ret_code = swi_receive_byte(response);
+  count_byte = response[SHA204_BUFFER_POS_COUNT];
+  i = 0;
+  if ((ret_code == SWI_FUNCTION_RETCODE_SUCCESS) && (count_byte >= SHA204_RSP_SIZE_MIN) && (count_byte <= size)) {
+    crc = sha204_crc_update_byte(crc, count_byte);
+    for (i = 1; i < count_byte; i++) {
+      ret_code = swi_receive_byte(response + i);
+      if (ret_code != SWI_FUNCTION_RETCODE_SUCCESS)
+        break;
+      if (i < count_byte - SHA204_CRC_SIZE)
+        crc = sha204_crc_update_byte(crc, response[i]);
+    }
   }
+  SHA204_CRITICAL_EXIT();
 
   // Translate error so that the Communication layer
   // can distinguish between a real error or the
   // device being busy executing a command.
   if (ret_code == SWI_FUNCTION_RETCODE_TIMEOUT)
-    return SHA204_RX_NO_RESPONSE;
-  else
-    return SHA204_RX_FAIL;
+    return (i > 0) ? SHA204_RX_FAIL : SHA204_RX_NO_RESPONSE;
+
+  if ((count_byte < SHA204_RSP_SIZE_MIN) || (count_byte > size))
+    return SHA204_INVALID_SIZE;
+
+  sha204_crc_final(crc, crc_bytes);
+  if ((crc_bytes[0] != response[count_byte - SHA204_CRC_SIZE]) || (crc_bytes[1] != response[count_byte - 1]))
+    return SHA204_BAD_CRC;
+
+  return SHA204_SUCCESS;
 }
 
 uint8_t SHA204SWI::send_command(uint8_t count, uint8_t * command) {
@@ -249,3 +282,25 @@ uint8_t SHA204SWI::send_command(uint8_t count, uint8_t * command) {
 
   return send_bytes(count, command);
 }
+
+// The parts in one go, as send_bytes() sends a buffer.
+uint8_t SHA204SWI::send_command_fragments(uint8_t count, const sha204_fragment_t *fragments, uint8_t n_fragments) {
+  uint8_t i, j;
+  uint8_t ret_code = send_byte(SHA204_SWI_FLAG_CMD);
+  if (ret_code != SWI_FUNCTION_RETCODE_SUCCESS)
+    return SHA204_COMM_FAIL;
+
+  SHA204_CRITICAL_ENTER();
+  S_PIN_DIR_OUT;
+  SHA204_DELAY_US(RX_TX_DELAY);
+  for (i = 0; i < n_fragments; i++)
+    for (j = 0; j < fragments[i].length; j++)
+      swi_send_byte(fragments[i].data[j]);
+  SHA204_CRITICAL_EXIT();
+  return SWI_FUNCTION_RETCODE_SUCCESS;
+}
+
+#ifdef SHA204_STATIC_TRANSPORT
+// the library for this transport alone
+template class SHA204Core<SHA204SWI>;
+#endif
@@ -69,7 +69,9 @@ limitations under the License.
 #define SWI_US_PER_BYTE           ((uint16_t) 313)  //! It takes 312.5 us to send a byte (9 single-wire bits / 230400 Baud * 8 flag bits).
 #define SHA204_SYNC_TIMEOUT       ((uint8_t) 85)//! delay before sending a transmit flag in the synchronization routine
 
-class SHA204SWI : public SHA204 {
+class SHA204SWI SHA204_FINAL : public SHA204_TRANSPORT_BASE(SHA204SWI) {
+  friend class SHA204Core<SHA204SWI>;
+
 private:
   const static uint16_t SHA204_RESPONSE_TIMEOUT_VALUE = ((uint16_t) SWI_RECEIVE_TIME_OUT + SWI_US_PER_BYTE);  //! SWI response timeout is the sum of receive timeout and the time it takes to send the TX flag.
 
@@ -80,6 +82,7 @@ private:
   uint8_t chip_wakeup();
   uint8_t receive_response(uint8_t size, uint8_t *response);
   uint8_t send_command(uint8_t count, uint8_t * command);
+  uint8_t send_command_fragments(uint8_t count, const sha204_fragment_t *fragments, uint8_t n_fragments);
 
 public:
   SHA204SWI(void);
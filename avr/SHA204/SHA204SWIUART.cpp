@@ -0,0 +1,353 @@
+/*
+ * SHA204SWIUART.cpp
+ * (c) 2014 flabbergast
+ *  Communicate with ATSHA204 using Single-Wire Interface through a USART:
+ *  Main file: extends the generic SHA204 class and implements the hardware protocol.
+ *
+ *  Only built with SHA204_SWIUART defined (for the whole library): it
+ *  takes over a USART and its interrupt vectors, which would clash with
+ *  the application's own use of them (e.g. Arduino's Serial1).
+ */
+
+#ifdef SHA204_SWIUART
+
+#include "SHA204.h"
+#include "SHA204ReturnCodes.h"
+#include "SHA204Definitions.h"
+#include "SHA204SWIUART.h"
+#include "SHA204HAL.h"
+#ifdef SHA204_STATIC_TRANSPORT
+#include "SHA204Core.h"
+#endif
+#include "SHA204CRC.h"
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+/* USART access */
+
+#if defined(__AVR_ATxmega128A3U__) || defined(__AVR_ATxmega128A4U__)
+  #define HW_DATA SWIUART_USART.DATA
+  #define HW_RX_ON() SWIUART_USART.CTRLB |= USART_RXEN_bm
+  #define HW_RX_OFF() SWIUART_USART.CTRLB &= ~USART_RXEN_bm
+  #define HW_DRE_INT_ON() SWIUART_USART.CTRLA = (SWIUART_USART.CTRLA & ~USART_DREINTLVL_gm) | USART_DREINTLVL_LO_gc
+  #define HW_DRE_INT_OFF() SWIUART_USART.CTRLA &= ~USART_DREINTLVL_gm
+
+  // fractional baud rate generator (BSCALE = -7): <0.1% error at 16/32MHz
+  #define SWIUART_BAUD_SETTING(baud) ((uint16_t) ((F_CPU * 8) / (baud) - 128))
+  static void hw_set_baud(uint16_t bsel) {
+    SWIUART_USART.BAUDCTRLA = (uint8_t) bsel;
+    SWIUART_USART.BAUDCTRLB = (uint8_t) (0x90 | (bsel >> 8));
+  }
+#else // AVR8
+  #define HW_DATA SWIUART_UDR
+  #define HW_RX_ON() SWIUART_UCSRB |= (1 << RXEN1)
+  #define HW_RX_OFF() SWIUART_UCSRB &= ~(1 << RXEN1)
+  #define HW_DRE_INT_ON() SWIUART_UCSRB |= (1 << UDRIE1)
+  #define HW_DRE_INT_OFF() SWIUART_UCSRB &= ~(1 << UDRIE1)
+
+  // double speed mode; 230.4k is -3.5% off at 16MHz, which 9 bit
+  //  characters still tolerate
+  #define SWIUART_BAUD_SETTING(baud) ((uint16_t) ((F_CPU + 4 * (baud)) / (8 * (baud)) - 1))
+  static void hw_set_baud(uint16_t ubrr) {
+    SWIUART_UBRR = ubrr;
+  }
+#endif
+
+/* Interrupts: one character per single-wire bit */
+
+static sha204_swiuart_rings_t *active_rings;
+
+static inline void swiuart_tx_next(void) {
+  sha204_swiuart_rings_t *r = active_rings;
+
+  if (r->tx_mask == 0) {
+    if (r->tx_tail == r->tx_head) {
+      HW_DRE_INT_OFF();
+      return;
+    }
+    r->tx_byte = r->tx_ring[r->tx_tail];
+    r->tx_tail = (r->tx_tail + 1) & (SWIUART_TX_RING_SIZE - 1);
+    r->tx_mask = 1;
+  }
+  HW_DATA = (r->tx_byte & r->tx_mask) ? SWIUART_CHAR_ONE : SWIUART_CHAR_ZERO;
+  r->tx_mask <<= 1;
+}
+
+// the last character has left: listen (our own echo is not received)
+static inline void swiuart_tx_complete(void) {
+  sha204_swiuart_rings_t *r = active_rings;
+
+  if ((r->tx_tail == r->tx_head) && (r->tx_mask == 0)) {
+    HW_RX_ON();
+    r->tx_busy = 0;
+  }
+}
+
+static inline void swiuart_rx(uint8_t c) {
+  sha204_swiuart_rings_t *r = active_rings;
+  uint8_t next;
+
+  // a one is a single low pulse: 0x7F (or 0x7E if it was a bit long)
+  if ((uint8_t) (c ^ SWIUART_CHAR_ONE) < 2)
+    r->rx_byte |= r->rx_mask;
+  r->rx_mask <<= 1;
+  if (r->rx_mask == 0) {
+    next = (r->rx_head + 1) & (SWIUART_RX_RING_SIZE - 1);
+    if (next != r->rx_tail) {
+      r->rx_ring[r->rx_head] = r->rx_byte;
+      r->rx_head = next;
+    }
+    r->rx_byte = 0;
+    r->rx_mask = 1;
+  }
+}
+
+#if defined(__AVR_ATxmega128A3U__) || defined(__AVR_ATxmega128A4U__)
+ISR(SWIUART_DRE_vect) {
+  swiuart_tx_next();
+}
+
+ISR(SWIUART_TXC_vect) {
+  swiuart_tx_complete();
+}
+
+ISR(SWIUART_RXC_vect) {
+  swiuart_rx(HW_DATA);
+}
+#else
+ISR(SWIUART_UDRE_vect) {
+  swiuart_tx_next();
+}
+
+ISR(SWIUART_TX_vect) {
+  swiuart_tx_complete();
+}
+
+ISR(SWIUART_RX_vect) {
+  swiuart_rx(HW_DATA);
+}
+#endif
+
+/* SHA204SWIUART */
+
+uint16_t SHA204SWIUART::SHA204_RESPONSE_TIMEOUT() {
+  return SHA204_RESPONSE_TIMEOUT_VALUE;
+}
+
+SHA204SWIUART::SHA204SWIUART() {
+  rings.tx_head = rings.tx_tail = 0;
+  rings.tx_mask = 0;
+  rings.tx_busy = 0;
+  rings.rx_head = rings.rx_tail = 0;
+  rings.rx_byte = 0;
+  rings.rx_mask = 1;
+}
+
+// set up the USART (7N1, 230.4 kbaud) and its pins
+void SHA204SWIUART::init_uart(void) {
+  active_rings = &rings;
+  hw_set_baud(SWIUART_BAUD_SETTING(SWIUART_BAUD));
+#if defined(__AVR_ATxmega128A3U__) || defined(__AVR_ATxmega128A4U__)
+  SWIUART_TX_PINCTRL = PORT_OPC_WIREDAND_gc;
+  SWIUART_PORT.OUTSET = SWIUART_TX_BIT;
+  SWIUART_PORT.DIRSET = SWIUART_TX_BIT;
+  SWIUART_PORT.DIRCLR = SWIUART_RX_BIT;
+  SWIUART_USART.CTRLC = USART_CMODE_ASYNCHRONOUS_gc | USART_PMODE_DISABLED_gc | USART_CHSIZE_7BIT_gc;
+  SWIUART_USART.CTRLA = USART_RXCINTLVL_LO_gc | USART_TXCINTLVL_LO_gc;
+  SWIUART_USART.CTRLB = USART_TXEN_bm | USART_RXEN_bm;
+#else
+  SWIUART_DDR |= SWIUART_TX_BIT;
+  SWIUART_UCSRA = (1 << U2X1);
+  SWIUART_UCSRC = (1 << UCSZ11); // 7N1
+  SWIUART_UCSRB = (1 << RXCIE1) | (1 << TXCIE1) | (1 << RXEN1) | (1 << TXEN1);
+#endif
+}
+
+/* Ring buffer helpers */
+
+void SHA204SWIUART::wait_tx_done(void) {
+  while (rings.tx_busy)
+    sha204_hal_yield();
+}
+
+// stop listening and forget whatever was received
+void SHA204SWIUART::begin_tx(void) {
+  wait_tx_done();
+  HW_RX_OFF();
+  rings.rx_head = rings.rx_tail = 0;
+  rings.rx_byte = 0;
+  rings.rx_mask = 1;
+}
+
+void SHA204SWIUART::queue_byte(uint8_t value) {
+  uint8_t next = (rings.tx_head + 1) & (SWIUART_TX_RING_SIZE - 1);
+
+  if (next == rings.tx_tail) { // longer than the ring: has to go already
+    start_tx();
+    while (next == rings.tx_tail)
+      ;
+  }
+  rings.tx_ring[rings.tx_head] = value;
+  rings.tx_head = next;
+}
+
+void SHA204SWIUART::start_tx(void) {
+  rings.tx_busy = 1;
+  HW_DRE_INT_ON();
+}
+
+uint8_t SHA204SWIUART::receive_byte(uint8_t *value, uint16_t timeout_us) {
+  uint32_t deadline = sha204_hal_micros() + timeout_us;
+
+  while (rings.rx_head == rings.rx_tail) {
+    if (sha204_hal_time_reached(deadline))
+      return SWIUART_FUNCTION_RETCODE_TIMEOUT;
+    sha204_hal_yield();
+  }
+  *value = rings.rx_ring[rings.rx_tail];
+  rings.rx_tail = (rings.rx_tail + 1) & (SWIUART_RX_RING_SIZE - 1);
+  return SWIUART_FUNCTION_RETCODE_SUCCESS;
+}
+
+/* SWI functions */
+
+uint8_t SHA204SWIUART::chip_wakeup() {
+  begin_tx();
+  // 0x00 at the lower speed: start bit + 7 zeros = 69 us low
+  hw_set_baud(SWIUART_BAUD_SETTING(SWIUART_WAKE_BAUD));
+  rings.tx_busy = 1;
+  HW_DATA = 0x00;
+  wait_tx_done();
+  hw_set_baud(SWIUART_BAUD_SETTING(SWIUART_BAUD));
+  SHA204_DELAY_MS(SHA204_WAKEUP_DELAY);
+
+  return SHA204_SUCCESS;
+}
+
+uint8_t SHA204SWIUART::sleep() {
+  return send_byte(SHA204_SWIUART_FLAG_SLEEP);
+}
+
+uint8_t SHA204SWIUART::idle() {
+  return send_byte(SHA204_SWIUART_FLAG_IDLE);
+}
+
+uint8_t SHA204SWIUART::resync(uint8_t size, uint8_t *response) {
+  // Try to re-synchronize without sending a Wake token
+  // (step 1 of the re-synchronization process).
+  SHA204_DELAY_MS(SWIUART_SYNC_TIMEOUT);
+  uint8_t ret_code = receive_response(size, response);
+  if (ret_code == SHA204_SUCCESS)
+    return ret_code;
+
+  // We lost communication. Send a Wake pulse and try
+  // to receive a response (steps 2 and 3 of the
+  // re-synchronization process).
+  (void) sleep();
+  ret_code = wakeup(response);
+
+  // Translate a return value of success into one
+  // that indicates that the device had to be woken up
+  // and might have lost its TempKey.
+  return (ret_code == SHA204_SUCCESS ? SHA204_RESYNC_WITH_WAKEUP : ret_code);
+}
+
+// queued for the interrupt, returns before the bits are out
+uint8_t SHA204SWIUART::send_bytes(uint8_t count, uint8_t *buffer) {
+  uint8_t i;
+
+  begin_tx();
+  for (i = 0; i < count; i++)
+    queue_byte(buffer[i]);
+  start_tx();
+
+  return SWIUART_FUNCTION_RETCODE_SUCCESS;
+}
+
+uint8_t SHA204SWIUART::send_byte(uint8_t value) {
+  return send_bytes(1, &value);
+}
+
+uint8_t SHA204SWIUART::receive_bytes(uint8_t count, uint8_t *buffer) {
+  uint8_t i;
+
+  wait_tx_done();
+  for (i = 0; i < count; i++)
+    if (receive_byte(buffer + i, i ? SWIUART_BYTE_TIMEOUT_US : SWIUART_RX_TIMEOUT_US) != SWIUART_FUNCTION_RETCODE_SUCCESS)
+      return SWIUART_FUNCTION_RETCODE_TIMEOUT;
+
+  return SWIUART_FUNCTION_RETCODE_SUCCESS;
+}
+
+uint8_t SHA204SWIUART::receive_response(uint8_t size, uint8_t *response) {
+  uint8_t count_byte;
+  uint8_t i;
+  uint16_t crc;
+  uint8_t crc_bytes[SHA204_CRC_SIZE];
+
+  for (i = 0; i < size; i++)
+    response[i] = 0;
+
+  (void) send_byte(SHA204_SWIUART_FLAG_TX);
+  wait_tx_done();
+
+  // Read the count byte first and then only the rest of the response,
+  // updating the CRC as the bytes come in.
+  // Translate a timeout so that the Communication layer
+  // can distinguish between a real error or the
+  // device being busy executing a command.
+  if (receive_byte(response, SWIUART_RX_TIMEOUT_US) != SWIUART_FUNCTION_RETCODE_SUCCESS)
+    return SHA204_RX_NO_RESPONSE;
+
+  count_byte = response[SHA204_BUFFER_POS_COUNT];
+  if ((count_byte < SHA204_RSP_SIZE_MIN) || (count_byte > size))
+    return SHA204_INVALID_SIZE;
+
+  crc = sha204_crc_update_byte(sha204_crc_init(), count_byte);
+  for (i = 1; i < count_byte; i++) {
+    if (receive_byte(response + i, SWIUART_BYTE_TIMEOUT_US) != SWIUART_FUNCTION_RETCODE_SUCCESS)
+      return SHA204_RX_FAIL;
+    if (i < count_byte - SHA204_CRC_SIZE)
+      crc = sha204_crc_update_byte(crc, response[i]);
+  }
+
+  sha204_crc_final(crc, crc_bytes);
+  if ((crc_bytes[0] != response[count_byte - SHA204_CRC_SIZE]) || (crc_bytes[1] != response[count_byte - 1]))
+    return SHA204_BAD_CRC;
+
+  return SHA204_SUCCESS;
+}
+
+// the flag and the command go out in one stream
+uint8_t SHA204SWIUART::send_command(uint8_t count, uint8_t * command) {
+  uint8_t i;
+
+  begin_tx();
+  queue_byte(SHA204_SWIUART_FLAG_CMD);
+  for (i = 0; i < count; i++)
+    queue_byte(command[i]);
+  start_tx();
+
+  return SHA204_SUCCESS;
+}
+
+uint8_t SHA204SWIUART::send_command_fragments(uint8_t count, const sha204_fragment_t *fragments, uint8_t n_fragments) {
+  uint8_t i, j;
+
+  begin_tx();
+  queue_byte(SHA204_SWIUART_FLAG_CMD);
+  for (i = 0; i < n_fragments; i++)
+    for (j = 0; j < fragments[i].length; j++)
+      queue_byte(fragments[i].data[j]);
+  start_tx();
+
+  return SHA204_SUCCESS;
+}
+
+#ifdef SHA204_STATIC_TRANSPORT
+// the library for this transport alone
+template class SHA204Core<SHA204SWIUART>;
+#endif
+
+#endif // SHA204_SWIUART
@@ -0,0 +1,90 @@
+/*
+ * SHA204SWIUART.h
+ * (c) 2014 flabbergast
+ *  Communicate with ATSHA204 using Single-Wire Interface through a USART:
+ *  Main header file.
+ *
+ *  Every single-wire bit is one 7N1 character at 230.4 kbaud (0x7F is
+ *  a one, 0x7D a zero), moved by the USART interrupts from/to two ring
+ *  buffers. So unlike SHA204SWI there is no bit-banging, interrupts are
+ *  never disabled and nothing depends on F_CPU specific loop counts.
+ *  Wiring: see SHA204SWIUART_hardware_config.h.
+ */
+
+#ifndef SHA204_Library_SWIUART_h
+#define SHA204_Library_SWIUART_h
+
+#include "SHA204.h"
+#include "SHA204SWIUART_hardware_config.h"
+
+#define SWIUART_BAUD      230400UL
+#define SWIUART_WAKE_BAUD 115200UL // 0x00 is then 69 us low: the wake token
+
+#define SWIUART_CHAR_ONE  0x7F
+#define SWIUART_CHAR_ZERO 0x7D
+
+// ring buffer sizes (in bytes, not characters; powers of 2)
+#define SWIUART_TX_RING_SIZE 128 // a whole command, so sending never waits
+#define SWIUART_RX_RING_SIZE 64  // a whole response
+
+// timeouts
+#define SWIUART_US_PER_BYTE     ((uint16_t) 313) // 8 characters of 9 bits at 230.4 kbaud
+#define SWIUART_RX_TIMEOUT_US   ((uint16_t) (163 + SWIUART_US_PER_BYTE)) // turnaround + first byte
+#define SWIUART_BYTE_TIMEOUT_US ((uint16_t) (2 * SWIUART_US_PER_BYTE))   // between response bytes
+#define SWIUART_SYNC_TIMEOUT    ((uint8_t) 85) // ms, before a transmit flag when resyncing
+
+// flags (same as SHA204SWI)
+#define SHA204_SWIUART_FLAG_CMD   ((uint8_t) 0x77) //!< flag preceding a command
+#define SHA204_SWIUART_FLAG_TX    ((uint8_t) 0x88) //!< flag requesting a response
+#define SHA204_SWIUART_FLAG_IDLE  ((uint8_t) 0xBB) //!< flag requesting to go into Idle mode
+#define SHA204_SWIUART_FLAG_SLEEP ((uint8_t) 0xCC) //!< flag requesting to go into Sleep mode
+
+#define SWIUART_FUNCTION_RETCODE_SUCCESS ((uint8_t) 0x00)
+#define SWIUART_FUNCTION_RETCODE_TIMEOUT ((uint8_t) 0xF1)
+
+// shared with the USART interrupts
+typedef struct {
+  uint8_t tx_ring[SWIUART_TX_RING_SIZE];
+  volatile uint8_t tx_head;
+  volatile uint8_t tx_tail;
+  uint8_t tx_byte; // byte being sent ...
+  uint8_t tx_mask; // ... and its next bit (0: take the next byte)
+  volatile uint8_t tx_busy;
+  uint8_t rx_ring[SWIUART_RX_RING_SIZE];
+  volatile uint8_t rx_head;
+  volatile uint8_t rx_tail;
+  uint8_t rx_byte; // byte being received ...
+  uint8_t rx_mask; // ... and its next bit
+} sha204_swiuart_rings_t;
+
+class SHA204SWIUART SHA204_FINAL : public SHA204_TRANSPORT_BASE(SHA204SWIUART) {
+  friend class SHA204Core<SHA204SWIUART>;
+
+private:
+  const static uint16_t SHA204_RESPONSE_TIMEOUT_VALUE = SWIUART_RX_TIMEOUT_US;
+
+  uint16_t SHA204_RESPONSE_TIMEOUT();
+  uint8_t receive_bytes(uint8_t count, uint8_t *buffer);
+  uint8_t send_bytes(uint8_t count, uint8_t *buffer);
+  uint8_t send_byte(uint8_t value);
+  uint8_t chip_wakeup();
+  uint8_t receive_response(uint8_t size, uint8_t *response);
+  uint8_t send_command(uint8_t count, uint8_t * command);
+  uint8_t send_command_fragments(uint8_t count, const sha204_fragment_t *fragments, uint8_t n_fragments);
+
+  sha204_swiuart_rings_t rings;
+  void begin_tx(void);
+  void queue_byte(uint8_t value);
+  void start_tx(void);
+  void wait_tx_done(void);
+  uint8_t receive_byte(uint8_t *value, uint16_t timeout_us);
+
+public:
+  SHA204SWIUART(void);
+  void init_uart(void);
+  uint8_t sleep();
+  uint8_t idle();
+  uint8_t resync(uint8_t size, uint8_t *response);
+};
+
+#endif
@@ -0,0 +1,53 @@
+/*
+ * SHA204SWIUART_hardware_config.h
+ * (c) 2014 flabbergast
+ *  Define the USART used for the Single Wire interface.
+ *
+ *  EDIT THIS FILE TO MATCH YOUR HARDWARE CONFIG!
+ *
+ *  Both RXD and TXD are connected to the SDA pin of ATSHA204 (which needs
+ *  a pull-up). TXD must not drive the line high: on XMEGAs it is set up
+ *  as wired-AND (open drain) here; on AVR8s put a small signal diode
+ *  between TXD (cathode) and SDA (anode).
+ *
+ *  SHA204SWIUART is only built with SHA204_SWIUART defined.
+ */
+
+#ifndef SHA204SWIUART_hardware_config_h
+#define SHA204SWIUART_hardware_config_h
+
+/*************************\
+ **** FOR XMEGA CHIPS ****
+\*************************/
+#if defined(__AVR_ATxmega128A3U__) || defined(__AVR_ATxmega128A4U__)
+  #define SWIUART_USART USARTC0
+  #define SWIUART_PORT PORTC
+  #define SWIUART_RX_BIT (1 << 2)
+  #define SWIUART_TX_BIT (1 << 3)
+  #define SWIUART_TX_PINCTRL PORTC.PIN3CTRL
+
+  #define SWIUART_RXC_vect USARTC0_RXC_vect
+  #define SWIUART_DRE_vect USARTC0_DRE_vect
+  #define SWIUART_TXC_vect USARTC0_TXC_vect
+
+/********************************\
+ **** FOR AVR8/Arduino CHIPS ****
+\********************************/
+#elif defined(__AVR_ATmega32U4__)
+  // USART1 (the bit names in SHA204SWIUART.cpp are USART1's too)
+  #define SWIUART_UDR UDR1
+  #define SWIUART_UBRR UBRR1
+  #define SWIUART_UCSRA UCSR1A
+  #define SWIUART_UCSRB UCSR1B
+  #define SWIUART_UCSRC UCSR1C
+  #define SWIUART_DDR DDRD
+  #define SWIUART_TX_BIT (1 << 3)
+
+  #define SWIUART_RX_vect USART1_RX_vect
+  #define SWIUART_UDRE_vect USART1_UDRE_vect
+  #define SWIUART_TX_vect USART1_TX_vect
+#elif defined(SHA204_SWIUART)
+  #error "Define the USART for your atmega!"
+#endif
+
+#endif
@@ -0,0 +1,76 @@
+/*
+ * SHA204Stats.cpp
+ * (c) 2014 flabbergast
+ *  Counters and latency histograms of the commands going through the
+ *  library.
+ */
+
+#include "SHA204Stats.h"
+#include "SHA204ReturnCodes.h"
+#include <string.h>
+
+static void count(uint16_t *counter) {
+  if (*counter != 0xFFFF)
+    (*counter)++;
+}
+
+SHA204Stats::SHA204Stats(void) {
+  reset();
+}
+
+void SHA204Stats::reset(void) {
+  memset(opcode, 0, sizeof(opcode));
+  memset(wake_time, 0, sizeof(wake_time));
+  memset(polls, 0, sizeof(polls));
+  wake_failures = 0;
+  send_retries = 0;
+  receive_retries = 0;
+  crc_errors = 0;
+  command_crc_errors = 0;
+  resyncs = 0;
+  resyncs_with_wakeup = 0;
+  resync_failures = 0;
+}
+
+// floor(log2(value)) - shift, within 0..SHA204_STATS_BUCKETS-1
+uint8_t SHA204Stats::bucket(uint32_t value, uint8_t shift) {
+  uint8_t b = 0;
+
+  value >>= shift;
+  while (value > 1 && b < SHA204_STATS_BUCKETS - 1)
+  {
+    value >>= 1;
+    b++;
+  }
+  return b;
+}
+
+void SHA204Stats::command(int8_t slot, uint8_t ret_code, uint8_t n_polls) {
+  count(&polls[bucket(n_polls, 0)]);
+  if (slot < 0)
+    return;
+  count(&opcode[slot].commands);
+  if (ret_code != SHA204_SUCCESS)
+    count(&opcode[slot].failures);
+}
+
+void SHA204Stats::latency(int8_t slot, uint32_t us) {
+  if (slot >= 0)
+    count(&opcode[slot].latency[bucket(us, SHA204_STATS_TIME_SHIFT)]);
+}
+
+void SHA204Stats::wake(uint8_t ret_code, uint32_t us) {
+  if (ret_code == SHA204_SUCCESS)
+    count(&wake_time[bucket(us, SHA204_STATS_TIME_SHIFT)]);
+  else
+    wake_failures++;
+}
+
+void SHA204Stats::resync(uint8_t ret_code) {
+  if (ret_code == SHA204_SUCCESS)
+    resyncs++;
+  else if (ret_code == SHA204_RESYNC_WITH_WAKEUP)
+    resyncs_with_wakeup++;
+  else
+    resync_failures++;
+}
@@ -0,0 +1,64 @@
+/*
+ * SHA204Stats.h
+ * (c) 2014 flabbergast
+ *  Counters and latency histograms of the commands going through the
+ *  library, for telling bus problems from slow commands.
+ *
+ *  Attach it with SHA204::set_stats(). Per op-code (in the order of the
+ *  learned latencies: CheckMac, DeriveKey, DevRev, GenDig, HMAC, Lock,
+ *  MAC, Nonce, Pause, Random, Read, UpdateExtra, Write, SHA) it counts
+ *  the commands, the failed ones, and how long the chip took from the
+ *  command to the response. For the bus as a whole: how long the wake-ups
+ *  took, how many times each command polled for its response, the
+ *  retries, the broken responses and what resync() made of them.
+ *
+ *  The histograms have SHA204_STATS_BUCKETS log2 buckets: times from
+ *  under 512 us (bucket 0) to over 32 ms (bucket 7), counts from 1 (bucket
+ *  0) to over 127 (bucket 7). The counters stop at their maximum.
+ *
+ *  With 8 buckets it takes 344 bytes of RAM (on AVR), each bucket left out
+ *  saves 32 (16 histograms of 2 bytes); the last bucket then takes all the
+ *  rest (with 4: from 2 ms and from 8 polls on, in 216 bytes).
+ */
+
+#ifndef SHA204_Library_Stats_h
+#define SHA204_Library_Stats_h
+
+#include <stdint.h>
+#include "SHA204Definitions.h"
+
+#ifndef SHA204_STATS_BUCKETS
+#define SHA204_STATS_BUCKETS 8 // at least 1
+#endif
+#define SHA204_STATS_TIME_SHIFT 8 // bucket 0: under 2 << 8 us
+
+class SHA204Stats {
+public:
+  struct {
+    uint16_t commands;
+    uint16_t failures;
+    uint16_t latency[SHA204_STATS_BUCKETS]; // command sent to response received
+  } opcode[SHA204_LATENCY_SLOTS];
+  uint16_t wake_time[SHA204_STATS_BUCKETS]; // wake pulse to wake response
+  uint16_t polls[SHA204_STATS_BUCKETS];     // receive_response() calls per command
+  uint32_t wake_failures;
+  uint32_t send_retries;       // command sent again
+  uint32_t receive_retries;    // response read again
+  uint32_t crc_errors;         // response broken (bad CRC or size)
+  uint32_t command_crc_errors; // the chip got the command broken
+  uint32_t resyncs;            // resync() without a wake-up
+  uint32_t resyncs_with_wakeup;
+  uint32_t resync_failures;
+
+  SHA204Stats(void);
+  void reset(void);
+  static uint8_t bucket(uint32_t value, uint8_t shift);
+
+  // called by SHA204 (slot: as latency_slot(), -1 for others)
+  void command(int8_t slot, uint8_t ret_code, uint8_t n_polls);
+  void latency(int8_t slot, uint32_t us);
+  void wake(uint8_t ret_code, uint32_t us);
+  void resync(uint8_t ret_code);
+};
+
+#endif
@@ -10,9 +10,13 @@
 #include "SHA204ReturnCodes.h"
 #include "SHA204Definitions.h"
 #include "SHA204TWI.h"
-#include <util/delay.h>
-#include <avr/interrupt.h>
+#include "SHA204HAL.h"
+#ifdef SHA204_STATIC_TRANSPORT
+#include "SHA204Core.h"
+#endif
+#include "SHA204CRC.h"
 #include "i2c_master.h"
+#include "i2c_async.h"
 
 uint16_t SHA204TWI::SHA204_RESPONSE_TIMEOUT() {
   return SHA204_RESPONSE_TIMEOUT_VALUE;
@@ -39,9 +43,9 @@ uint8_t SHA204TWI::chip_wakeup() {
   // pull SDA down manually
   SDA_PIN_DIR_OUT;
   SDA_PIN_LOW;
-  _delay_us(SHA204_WAKEUP_PULSE_WIDTH);
+  SHA204_DELAY_US(SHA204_WAKEUP_PULSE_WIDTH);
   SDA_PIN_HIGH;
-  _delay_ms(SHA204_WAKEUP_DELAY);
+  SHA204_DELAY_MS(SHA204_WAKEUP_DELAY);
   i2c_on(); // enable I2C back
 
   return SHA204_SUCCESS;
@@ -80,21 +84,46 @@ uint8_t SHA204TWI::resync(uint8_t size, uint8_t *response) {
   return (ret_code == SHA204_SUCCESS ? SHA204_RESYNC_WITH_WAKEUP : ret_code);
 }
 
-uint8_t SHA204TWI::send_bytes(uint8_t count, uint8_t *buffer) {
-  uint8_t i;
+// Run an interrupt driven transfer; the application gets the CPU
+// (sha204_hal_yield) while the bytes move on the bus.
+static uint8_t twi_transfer(i2c_async_transfer_t *transfer) {
+  uint8_t status;
+
+  transfer->callback = 0;
+  if (i2c_async_start(transfer, SHA204_TWI_TIMEOUT_MS * 1000U) != I2C_ERROR_NoError)
+    return I2C_ERROR_BusFault;
+  while ((status = i2c_async_poll(transfer)) == I2C_ASYNC_BUSY)
+    sha204_hal_yield();
+  return status;
+}
 
-  if(i2c_start(SHA204_TWI_WR, SHA204_TWI_TIMEOUT_MS) == I2C_ERROR_NoError) {
-    for(i=0; i<count; i++) {
-      if(!i2c_write(buffer[i])) {
-        i2c_stop();
-        return TWI_FUNCTION_RETCODE_TX_FAIL;
-      }
-    }
-    i2c_stop();
-    return TWI_FUNCTION_RETCODE_SUCCESS;
-  }
+// A transfer of a few bytes (not the command or the response): retried
+// while the chip NACKs its address, as i2c_start() did, for up to
+// SHA204_TWI_TIMEOUT_MS. Every try is bounded by i2c_async's timeout, so a
+// stuck bus can't hang the caller.
+static uint8_t twi_transfer_retry(i2c_async_transfer_t *transfer) {
+  uint32_t deadline = sha204_hal_micros() + SHA204_TWI_TIMEOUT_MS * 1000UL;
+  uint8_t status;
+
+  while ((status = twi_transfer(transfer)) == I2C_ERROR_SlaveNotReady
+         && !sha204_hal_time_reached(deadline))
+    sha204_hal_yield();
+  return status;
+}
 
-  i2c_stop();
+uint8_t SHA204TWI::send_bytes(uint8_t count, uint8_t *buffer) {
+  i2c_async_transfer_t transfer;
+  uint8_t status;
+
+  transfer.address = SHA204_TWI_WR;
+  transfer.flags = 0;
+  transfer.buffer = buffer;
+  transfer.length = count;
+  status = twi_transfer_retry(&transfer);
+  if (status == I2C_ERROR_NoError)
+    return TWI_FUNCTION_RETCODE_SUCCESS;
+  if (status == I2C_ERROR_SlaveNAK || transfer.count)
+    return TWI_FUNCTION_RETCODE_TX_FAIL;
   return TWI_FUNCTION_RETCODE_TIMEOUT;
 }
 
@@ -103,68 +132,99 @@ uint8_t SHA204TWI::send_byte(uint8_t value) {
 }
 
 uint8_t SHA204TWI::receive_bytes(uint8_t count, uint8_t *buffer)  {
-  uint8_t i;
+  i2c_async_transfer_t transfer;
+  uint8_t status;
 
-  if(i2c_start(SHA204_TWI_RE, SHA204_TWI_TIMEOUT_MS) == I2C_ERROR_NoError) {
-    for(i=0; i<count-1; i++) {
-      if(!i2c_read(buffer+i, false)) {
-        i2c_stop();
-        return TWI_FUNCTION_RETCODE_RX_FAIL;
-      }
-    }
-    if(!i2c_read(buffer+count-1,true)) {
-      i2c_stop();
-      return TWI_FUNCTION_RETCODE_RX_FAIL;
-    }
-    i2c_stop();
+  if (count == 0)
     return TWI_FUNCTION_RETCODE_SUCCESS;
-  }
-  i2c_stop();
+  transfer.address = SHA204_TWI_RE;
+  transfer.flags = 0;
+  transfer.buffer = buffer;
+  transfer.length = count;
+  status = twi_transfer_retry(&transfer);
+  if (status == I2C_ERROR_NoError)
+    return TWI_FUNCTION_RETCODE_SUCCESS;
+  if (transfer.count)
+    return TWI_FUNCTION_RETCODE_RX_FAIL;
   return TWI_FUNCTION_RETCODE_TIMEOUT;
 }
 
 uint8_t SHA204TWI::receive_response(uint8_t size, uint8_t *response) {
+  i2c_async_transfer_t transfer;
   uint8_t count_byte;
+  uint8_t crc_bytes[SHA204_CRC_SIZE];
   uint8_t i;
-  uint8_t ret_code;
+  uint8_t status;
 
   for (i = 0; i < size; i++)
     response[i] = 0;
 
-  ret_code = receive_bytes(size, response);
-  if (ret_code == TWI_FUNCTION_RETCODE_SUCCESS || ret_code == TWI_FUNCTION_RETCODE_RX_FAIL) {
-    count_byte = response[SHA204_BUFFER_POS_COUNT];
-    if ((count_byte < SHA204_RSP_SIZE_MIN) || (count_byte > size))
-      return SHA204_INVALID_SIZE;
-
-    return SHA204_SUCCESS;
-  }
+  // Read the count byte first and then only the rest of the response;
+  // the interrupt updates the CRC as the bytes arrive.
+  transfer.address = SHA204_TWI_RE;
+  transfer.flags = I2C_ASYNC_LENGTH_FROM_FIRST | I2C_ASYNC_CRC;
+  transfer.buffer = response;
+  transfer.length = size;
+  status = twi_transfer(&transfer);
 
   // Translate error so that the Communication layer
   // can distinguish between a real error or the
   // device being busy executing a command.
-  if (ret_code == TWI_FUNCTION_RETCODE_TIMEOUT)
+  if (transfer.count == 0)
     return SHA204_RX_NO_RESPONSE;
-  else
+
+  count_byte = response[SHA204_BUFFER_POS_COUNT];
+  if ((count_byte < SHA204_RSP_SIZE_MIN) || (count_byte > size))
+    return SHA204_INVALID_SIZE;
+
+  if (status != I2C_ERROR_NoError)
     return SHA204_RX_FAIL;
+
+  sha204_crc_final(transfer.crc, crc_bytes);
+  if ((crc_bytes[0] != response[count_byte - SHA204_CRC_SIZE]) || (crc_bytes[1] != response[count_byte - 1]))
+    return SHA204_BAD_CRC;
+
+  return SHA204_SUCCESS;
 }
 
 uint8_t SHA204TWI::send_command(uint8_t count, uint8_t * command) {
+  i2c_async_transfer_t transfer;
+
+  transfer.address = SHA204_TWI_WR;
+  transfer.flags = I2C_ASYNC_PREFIX;
+  transfer.prefix = SHA204_TWI_COMMAND_CMD;
+  transfer.buffer = command;
+  transfer.length = count;
+  if (twi_transfer(&transfer) != I2C_ERROR_NoError)
+    return SHA204_COMM_FAIL;
+
+  return SHA204_SUCCESS;
+}
+
+// The parts go out of the interrupt one after the other, in one transfer.
+uint8_t SHA204TWI::send_command_fragments(uint8_t count, const sha204_fragment_t *fragments, uint8_t n_fragments) {
+  i2c_async_fragment_t parts[SHA204_FRAGMENTS_MAX];
+  i2c_async_transfer_t transfer;
   uint8_t i;
 
-  if(i2c_start(SHA204_TWI_WR, SHA204_TWI_TIMEOUT_MS) == I2C_ERROR_NoError) {
-    if(i2c_write(SHA204_TWI_COMMAND_CMD)) {
-      for(i=0; i<count; i++) {
-        if(!i2c_write(command[i])) {
-          i2c_stop();
-          return SHA204_COMM_FAIL;
-        }
-      }
-      i2c_stop();
-      return SHA204_SUCCESS;
-    }
+  for (i = 0; i < n_fragments; i++) {
+    parts[i].data = fragments[i].data;
+    parts[i].length = fragments[i].length;
   }
+  transfer.address = SHA204_TWI_WR;
+  transfer.flags = I2C_ASYNC_PREFIX | I2C_ASYNC_FRAGMENTS;
+  transfer.prefix = SHA204_TWI_COMMAND_CMD;
+  transfer.buffer = 0;
+  transfer.length = 0;
+  transfer.fragments = parts;
+  transfer.n_fragments = n_fragments;
+  if (twi_transfer(&transfer) != I2C_ERROR_NoError)
+    return SHA204_COMM_FAIL;
 
-  i2c_stop();
-  return SHA204_COMM_FAIL;
+  return SHA204_SUCCESS;
 }
+
+#ifdef SHA204_STATIC_TRANSPORT
+// the library for this transport alone
+template class SHA204Core<SHA204TWI>;
+#endif
@@ -26,7 +26,9 @@
 #define SHA204_TWI_IDLE_CMD 0x02
 #define SHA204_TWI_COMMAND_CMD 0x03
 
-class SHA204TWI : public SHA204 {
+class SHA204TWI SHA204_FINAL : public SHA204_TRANSPORT_BASE(SHA204TWI) {
+  friend class SHA204Core<SHA204TWI>;
+
 private:
   const static uint16_t SHA204_RESPONSE_TIMEOUT_VALUE = 0;
 
@@ -37,6 +39,7 @@ private:
   uint8_t chip_wakeup();
   uint8_t receive_response(uint8_t size, uint8_t *response);
   uint8_t send_command(uint8_t count, uint8_t * command);
+  uint8_t send_command_fragments(uint8_t count, const sha204_fragment_t *fragments, uint8_t n_fragments);
 
 public:
   SHA204TWI(void);
@@ -0,0 +1,30 @@
+/*
+ * SHA204Trace.cpp
+ * (c) 2014 flabbergast
+ *  The last bus transactions in a ring.
+ */
+
+#include "SHA204Trace.h"
+#include <string.h>
+
+SHA204Trace::SHA204Trace(void) {
+  clear();
+}
+
+void SHA204Trace::clear(void) {
+  memset(entries, 0, sizeof(entries));
+  count = 0;
+}
+
+uint16_t SHA204Trace::oldest(void) {
+  return count - SHA204_TRACE_ENTRIES; // those before the first ones are empty
+}
+
+const sha204_trace_entry_t *SHA204Trace::entry(uint16_t n) {
+  const sha204_trace_entry_t *e = &entries[n & (SHA204_TRACE_ENTRIES - 1)];
+
+  // within the last SHA204_TRACE_ENTRIES (wrap-around safe), and recorded
+  if ((uint16_t) (count - 1 - n) >= SHA204_TRACE_ENTRIES || e->event == 0)
+    return 0;
+  return e;
+}
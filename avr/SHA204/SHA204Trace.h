@@ -0,0 +1,74 @@
+/*
+ * SHA204Trace.h
+ * (c) 2014 flabbergast
+ *  The last bus transactions in a ring, for finding out afterwards what
+ *  went on before something failed.
+ *
+ *  Only built into the library with SHA204_TRACE defined (for all of its
+ *  files: it changes the SHA204 class); attach it with
+ *  SHA204::set_trace(). An entry is a timestamp (sha204_hal_micros()), the
+ *  event, the op-code of the command in progress (0 if none), a length
+ *  and the return code:
+ *    WAKEUP  when the wake pulse started; length of the wake response
+ *    SEND    when the command was out; its length
+ *    RECEIVE when the poll which ended the wait started (a response, or
+ *            the last try); length of the response
+ *    RESYNC, IDLE, SLEEP  when they started
+ *
+ *  Recording is a few stores, the caller has the timestamp already. The
+ *  entries are numbered in the order they were recorded (wrapping at
+ *  0xFFFF); only the last SHA204_TRACE_ENTRIES are kept.
+ */
+
+#ifndef SHA204_Library_Trace_h
+#define SHA204_Library_Trace_h
+
+#include <stdint.h>
+
+#ifndef SHA204_TRACE_ENTRIES
+#define SHA204_TRACE_ENTRIES 8 // a power of 2 (8 bytes each)
+#endif
+
+// events
+#define SHA204_TRACE_WAKEUP  1
+#define SHA204_TRACE_SEND    2
+#define SHA204_TRACE_RECEIVE 3
+#define SHA204_TRACE_RESYNC  4
+#define SHA204_TRACE_IDLE    5
+#define SHA204_TRACE_SLEEP   6
+
+typedef struct {
+  uint32_t time;
+  uint8_t event;
+  uint8_t op_code;
+  uint8_t length;
+  uint8_t ret_code;
+} sha204_trace_entry_t;
+
+class SHA204Trace {
+public:
+  uint16_t count; // entries recorded: the number of the next one
+
+  SHA204Trace(void);
+  void clear(void);
+  // number of the oldest entry kept (it may be empty yet)
+  uint16_t oldest(void);
+  // entry number n (0 if it is not kept anymore, or not recorded yet)
+  const sha204_trace_entry_t *entry(uint16_t n);
+
+  void record(uint32_t time, uint8_t event, uint8_t op_code, uint8_t length, uint8_t ret_code) {
+    sha204_trace_entry_t *e = &entries[count & (SHA204_TRACE_ENTRIES - 1)];
+
+    e->time = time;
+    e->event = event;
+    e->op_code = op_code;
+    e->length = length;
+    e->ret_code = ret_code;
+    count++;
+  }
+
+private:
+  sha204_trace_entry_t entries[SHA204_TRACE_ENTRIES];
+};
+
+#endif
@@ -0,0 +1,220 @@
+/*
+ * i2c_async.c
+ * (c) 2014 flabbergast
+ *  Interrupt driven I2C (TWI) master for AVR8 and XMEGA chips.
+ */
+
+#include "i2c_async.h"
+#include "SHA204HAL.h"
+#include "SHA204CRC.h"
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <util/twi.h>
+
+static i2c_async_transfer_t * volatile current = 0;
+static volatile uint8_t prefix_pending;
+static volatile uint8_t slave_acked;
+
+static void hw_start(uint8_t address);
+static void hw_stop(void);
+
+static void finish(uint8_t status) {
+  i2c_async_transfer_t *transfer = current;
+
+  hw_stop();
+  current = 0;
+  transfer->status = status;
+  if (transfer->callback)
+    transfer->callback(transfer);
+}
+
+static inline void store_byte(i2c_async_transfer_t *transfer, uint8_t value) {
+  uint8_t index = transfer->count;
+
+  transfer->buffer[transfer->count++] = value;
+  if ((index == 0) && (transfer->flags & I2C_ASYNC_LENGTH_FROM_FIRST)) {
+    if (value == 0)
+      value = 1;
+    if (value < transfer->length)
+      transfer->length = value;
+  }
+  if ((transfer->flags & I2C_ASYNC_CRC) && (index + 2 < transfer->length)) // not the CRC itself
+    transfer->crc = sha204_crc_update_byte(transfer->crc, transfer->buffer[index]);
+}
+
+// the next byte to write: the prefix, the buffer, then the fragments
+//  (0: none left)
+static inline uint8_t next_byte(i2c_async_transfer_t *transfer, uint8_t *value) {
+  if (prefix_pending) {
+    prefix_pending = 0;
+    *value = transfer->prefix;
+    return 1;
+  }
+  while (transfer->count >= transfer->length) {
+    if (!(transfer->flags & I2C_ASYNC_FRAGMENTS) || transfer->n_fragments == 0)
+      return 0;
+    transfer->buffer = (uint8_t *) transfer->fragments->data;
+    transfer->length = transfer->fragments->length;
+    transfer->count = 0;
+    transfer->fragments++;
+    transfer->n_fragments--;
+  }
+  *value = transfer->buffer[transfer->count++];
+  return 1;
+}
+
+uint8_t i2c_async_start(i2c_async_transfer_t *transfer, uint16_t timeout_us) {
+  if (current)
+    return I2C_ERROR_BusFault;
+
+  transfer->count = 0;
+  transfer->crc = sha204_crc_init();
+  transfer->status = I2C_ASYNC_BUSY;
+  transfer->deadline = sha204_hal_micros() + timeout_us;
+  prefix_pending = (transfer->flags & I2C_ASYNC_PREFIX) && !(transfer->address & I2C_READ);
+  slave_acked = 0;
+  current = transfer;
+  hw_start(transfer->address);
+  return I2C_ERROR_NoError;
+}
+
+uint8_t i2c_async_poll(i2c_async_transfer_t *transfer) {
+  uint8_t sreg;
+
+  if ((transfer->status == I2C_ASYNC_BUSY) && sha204_hal_time_reached(transfer->deadline)) {
+    sreg = SREG;
+    cli();
+    if (current == transfer) { // the ISR might have just finished it
+      hw_stop();
+      current = 0;
+      transfer->status = I2C_ASYNC_TIMEOUT;
+    }
+    SREG = sreg;
+  }
+  return transfer->status;
+}
+
+uint8_t i2c_async_busy(void) {
+  return current != 0;
+}
+
+// implementation for xmega
+#if defined(__AVR_ATxmega128A4U__) || defined(__AVR_ATxmega128A3U__)
+
+static void hw_start(uint8_t address) {
+  I2C_TWI_INTERFACE.MASTER.CTRLA = TWI_MASTER_ENABLE_bm | TWI_MASTER_INTLVL_LO_gc
+                                   | TWI_MASTER_RIEN_bm | TWI_MASTER_WIEN_bm;
+  I2C_TWI_INTERFACE.MASTER.ADDR = address; // issue a START condition
+}
+
+// NACK (if reading), STOP, and interrupts off
+static void hw_stop(void) {
+  I2C_TWI_INTERFACE.MASTER.CTRLC = TWI_MASTER_ACKACT_bm | TWI_MASTER_CMD_STOP_gc;
+  I2C_TWI_INTERFACE.MASTER.CTRLA = TWI_MASTER_ENABLE_bm;
+}
+
+ISR(I2C_TWI_MASTER_vect) {
+  i2c_async_transfer_t *transfer = current;
+  uint8_t status = I2C_TWI_INTERFACE.MASTER.STATUS;
+  uint8_t value;
+
+  if (!transfer) {
+    hw_stop();
+    return;
+  }
+
+  if (status & TWI_MASTER_ARBLOST_bm) {
+    I2C_TWI_INTERFACE.MASTER.ADDR = transfer->address; // repeat the START condition
+  } else if (status & TWI_MASTER_BUSERR_bm) {
+    finish(I2C_ERROR_BusFault);
+  } else if (status & TWI_MASTER_WIF_bm) { // address or data byte sent
+    if (status & TWI_MASTER_RXACK_bm)
+      finish(slave_acked ? I2C_ERROR_SlaveNAK : I2C_ERROR_SlaveNotReady);
+    else {
+      slave_acked = 1;
+      if (next_byte(transfer, &value))
+        I2C_TWI_INTERFACE.MASTER.DATA = value;
+      else
+        finish(I2C_ERROR_NoError);
+    }
+  } else if (status & TWI_MASTER_RIF_bm) { // data byte received
+    slave_acked = 1;
+    store_byte(transfer, I2C_TWI_INTERFACE.MASTER.DATA);
+    if (transfer->count < transfer->length)
+      I2C_TWI_INTERFACE.MASTER.CTRLC = TWI_MASTER_CMD_RECVTRANS_gc; // ACK, next byte
+    else
+      finish(I2C_ERROR_NoError); // NACK + STOP
+  }
+}
+
+#elif defined(__AVR_ATmega328P__) || defined(__AVR_ATmega32U4__)
+
+static void hw_start(uint8_t address) {
+  (void) address; // sent from the ISR once the bus is ours
+  TWCR = ((1 << TWINT) | (1 << TWSTA) | (1 << TWEN) | (1 << TWIE)); // issue a START condition
+}
+
+// STOP, and interrupts off
+static void hw_stop(void) {
+  TWCR = ((1 << TWINT) | (1 << TWSTO) | (1 << TWEN));
+}
+
+ISR(TWI_vect) {
+  i2c_async_transfer_t *transfer = current;
+  uint8_t value;
+
+  if (!transfer) {
+    TWCR = (1 << TWEN);
+    return;
+  }
+
+  switch (TWSR & TW_STATUS_MASK) {
+    case TW_START:
+    case TW_REP_START: // got the bus
+      TWDR = transfer->address;
+      TWCR = ((1 << TWINT) | (1 << TWEN) | (1 << TWIE));
+      break;
+    case TW_MT_ARB_LOST: // (same as TW_MR_ARB_LOST)
+      TWCR = ((1 << TWINT) | (1 << TWSTA) | (1 << TWEN) | (1 << TWIE)); // try STARTing again
+      break;
+    case TW_MT_SLA_ACK:
+    case TW_MT_DATA_ACK:
+      if (!next_byte(transfer, &value)) {
+        finish(I2C_ERROR_NoError);
+        break;
+      }
+      TWDR = value;
+      TWCR = ((1 << TWINT) | (1 << TWEN) | (1 << TWIE));
+      break;
+    case TW_MT_SLA_NACK:
+    case TW_MR_SLA_NACK:
+      finish(I2C_ERROR_SlaveNotReady);
+      break;
+    case TW_MT_DATA_NACK:
+      finish(I2C_ERROR_SlaveNAK);
+      break;
+    case TW_MR_DATA_ACK:
+      store_byte(transfer, TWDR);
+      // this one was ACKed, so at least one more byte is coming
+      if (transfer->length <= transfer->count)
+        transfer->length = transfer->count + 1;
+      // fall through
+    case TW_MR_SLA_ACK:
+      // ACK all but the last byte
+      if (transfer->length - transfer->count > 1)
+        TWCR = ((1 << TWINT) | (1 << TWEN) | (1 << TWIE) | (1 << TWEA));
+      else
+        TWCR = ((1 << TWINT) | (1 << TWEN) | (1 << TWIE));
+      break;
+    case TW_MR_DATA_NACK:
+      store_byte(transfer, TWDR);
+      finish(I2C_ERROR_NoError);
+      break;
+    default: // bus error
+      finish(I2C_ERROR_BusFault);
+      break;
+  }
+}
+
+#endif
@@ -0,0 +1,66 @@
+/*
+ * i2c_async.h
+ * (c) 2014 flabbergast
+ *  Interrupt driven I2C (TWI) master for AVR8 and XMEGA chips.
+ *
+ *  Runs a whole transaction (START, address, [prefix byte], N data bytes,
+ *  STOP) from a descriptor in the TWI interrupt; a write can also take its
+ *  bytes from several places (fragments). The caller only starts it
+ *  and then checks i2c_async_poll() (or gets a callback from the ISR).
+ *  Uses the same hardware (and pin config) as i2c_master.h; the blocking
+ *  functions there must not be used while a transfer is running.
+ */
+
+#ifndef I2C_ASYNC_H
+#define I2C_ASYNC_H
+
+#include "i2c_master.h"
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+// transfer status, besides the I2C_ErrorCodes_t from i2c_master.h
+#define I2C_ASYNC_BUSY    0xFF
+#define I2C_ASYNC_TIMEOUT 0xFE // did not complete in time (aborted)
+
+// flags
+#define I2C_ASYNC_PREFIX            0x01 // write: send the prefix byte before the buffer
+#define I2C_ASYNC_LENGTH_FROM_FIRST 0x02 // read: the first byte received is the total length
+                                         //  (clamped to 1..length)
+#define I2C_ASYNC_FRAGMENTS         0x04 // write: after the buffer, the fragments one after the other
+#define I2C_ASYNC_CRC               0x08 // read: the ATSHA204 CRC (SHA204CRC.h) of all but the last
+                                         //  two bytes, worked out in crc as they come in
+
+typedef struct {
+  const uint8_t *data;
+  uint8_t length;
+} i2c_async_fragment_t;
+
+typedef struct i2c_async_transfer {
+  uint8_t address;  // slave address | I2C_READ / I2C_WRITE
+  uint8_t flags;
+  uint8_t prefix;   // e.g. the word address byte
+  uint8_t *buffer;
+  uint8_t length;   // bytes to write / (maximum) bytes to read, reads need >= 1
+  volatile uint8_t count;  // bytes transferred so far (of the current fragment)
+  const i2c_async_fragment_t *fragments; // I2C_ASYNC_FRAGMENTS: the ones still to send
+  uint8_t n_fragments;
+  volatile uint8_t status; // I2C_ASYNC_BUSY while running
+  uint16_t crc;            // I2C_ASYNC_CRC: as sha204_crc_update() leaves it
+  uint32_t deadline;       // sha204_hal_micros() value
+  void (*callback)(struct i2c_async_transfer *transfer); // from the ISR; may be NULL
+} i2c_async_transfer_t;
+
+// start a transfer; returns I2C_ERROR_BusFault if another one is running
+uint8_t i2c_async_start(i2c_async_transfer_t *transfer, uint16_t timeout_us);
+// current status of the transfer; aborts it (STOP) once the timeout expires
+uint8_t i2c_async_poll(i2c_async_transfer_t *transfer);
+uint8_t i2c_async_busy(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
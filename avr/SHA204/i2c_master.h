@@ -18,12 +18,14 @@ extern "C"
 // can use I2C_CONFIGURE_PINS macro to enable internal pull-ups
 #if defined(__AVR_ATxmega128A3U__)
   #define I2C_TWI_INTERFACE TWIE
+  #define I2C_TWI_MASTER_vect TWIE_TWIM_vect // for i2c_async
   #define I2C_TWI_PORT PORTE
   #define I2C_SDA_BIT (1<<0)
   #define I2C_SCL_BIT (1<<1)
   #define I2C_CONFIGURE_PINS I2C_TWI_PORT.DIRSET &= ~(I2C_SDA_BIT|I2C_SCL_BIT)
 #elif defined(__AVR_ATxmega128A4U__)
   #define I2C_TWI_INTERFACE TWIC
+  #define I2C_TWI_MASTER_vect TWIC_TWIM_vect // for i2c_async
   #define I2C_TWI_PORT PORTC
   #define I2C_SDA_BIT (1<<0)
   #define I2C_SCL_BIT (1<<1)
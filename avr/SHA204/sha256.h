@@ -0,0 +1,44 @@
+/*
+ * sha256.h
+ * (c) 2014 flabbergast
+ *  Small, portable SHA-256 (FIPS 180-4) and HMAC/SHA-256 (RFC 2104).
+ *  Used by the SHA204Emu device model.
+ */
+
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#define SHA256_BLOCK_SIZE  64
+#define SHA256_DIGEST_SIZE 32
+
+typedef struct {
+  uint32_t state[8];
+  uint32_t length_low;   // total length in bytes (64 bits)
+  uint32_t length_high;
+  uint8_t buffer[SHA256_BLOCK_SIZE];
+  uint8_t buffer_used;
+} sha256_ctx;
+
+void sha256_init(sha256_ctx *ctx);
+void sha256_update(sha256_ctx *ctx, const uint8_t *data, uint16_t length);
+void sha256_final(sha256_ctx *ctx, uint8_t *digest);
+// run the compression function on one 64-byte block (no padding) and
+//  return the resulting intermediate state, like the SHA command of ATSHA204A
+void sha256_block(sha256_ctx *ctx, const uint8_t *block, uint8_t *state);
+
+void sha256(const uint8_t *data, uint16_t length, uint8_t *digest);
+void hmac_sha256(const uint8_t *key, uint8_t key_length,
+                 const uint8_t *data, uint16_t length, uint8_t *digest);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
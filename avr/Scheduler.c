@@ -0,0 +1,89 @@
+/*
+ * Scheduler.c
+ * (c) 2014 flabbergast
+ *  Cooperative task scheduler for the main loop.
+ */
+
+#include "Scheduler.h"
+#include "Timer.h"
+#include "LufaLayer.h"
+
+typedef struct {
+  scheduler_task_t run;
+  void *arg;
+  uint8_t priority;
+  uint8_t suspended;
+  uint32_t next_run; // micros()
+} scheduler_slot_t;
+
+static scheduler_slot_t tasks[SCHEDULER_MAX_TASKS];
+static uint8_t order[SCHEDULER_MAX_TASKS]; // task ids, by priority
+static uint8_t n_tasks;
+static uint8_t woken; // by a task during this pass
+
+void scheduler_init(void) {
+  n_tasks = 0;
+}
+
+uint8_t scheduler_add(scheduler_task_t task, void *arg, uint8_t priority, uint32_t delay_us) {
+  uint8_t id = n_tasks;
+  uint8_t i;
+
+  if(id == SCHEDULER_MAX_TASKS)
+    return 0xFF;
+  tasks[id].run = task;
+  tasks[id].arg = arg;
+  tasks[id].priority = priority;
+  tasks[id].suspended = 0;
+  tasks[id].next_run = micros() + delay_us;
+  // insert into the priority order (after the ones with the same priority)
+  for(i = n_tasks; i > 0 && tasks[order[i-1]].priority > priority; i--)
+    order[i] = order[i-1];
+  order[i] = id;
+  n_tasks++;
+  return id;
+}
+
+void scheduler_wake(uint8_t id) {
+  if(id >= n_tasks)
+    return;
+  tasks[id].suspended = 0;
+  tasks[id].next_run = micros();
+  woken = 1;
+}
+
+uint32_t scheduler_run_once(void) {
+  uint32_t next = SCHEDULER_SUSPEND;
+  uint32_t now, wait;
+  scheduler_slot_t *task;
+  uint8_t i;
+
+  woken = 0;
+  for(i = 0; i < n_tasks; i++) {
+    task = &tasks[order[i]];
+    if(task->suspended)
+      continue;
+    now = micros();
+    if((int32_t)(now - task->next_run) >= 0) {
+      wait = task->run(task->arg);
+      if(wait == SCHEDULER_SUSPEND) {
+        task->suspended = 1;
+        continue;
+      }
+      now = micros();
+      task->next_run = now + wait;
+    }
+    wait = ((int32_t)(task->next_run - now) > 0) ? task->next_run - now : 0;
+    if(wait < next)
+      next = wait;
+  }
+  return woken ? 0 : next;
+}
+
+void scheduler_run(void) {
+  for(;;) {
+    // woken up by the USB SOF / timer interrupts at least every few ms
+    if(scheduler_run_once() >= SCHEDULER_SLEEP_MIN_US)
+      sleep_until_interrupt();
+  }
+}
@@ -0,0 +1,44 @@
+/*
+ * Scheduler.h
+ * (c) 2014 flabbergast
+ *  Cooperative task scheduler for the main loop.
+ *
+ *  A task is a function which does a bit of work and returns how long
+ *  (in microseconds, on the micros() time base from Timer.c) until it
+ *  wants to run again: 0 means on the next pass, SCHEDULER_SUSPEND means
+ *  only after scheduler_wake(). Each pass runs every task which is due,
+ *  in priority order, so a busy task delays the others by at most one
+ *  of its runs but never starves them. When nothing is due soon, the
+ *  CPU sleeps until the next interrupt.
+ */
+
+#ifndef _SCHEDULER_H_
+#define _SCHEDULER_H_
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
+#define SCHEDULER_MAX_TASKS 8
+#define SCHEDULER_SUSPEND 0xFFFFFFFFUL
+#define SCHEDULER_SLEEP_MIN_US 500UL // closer deadlines are waited for awake
+
+typedef uint32_t (*scheduler_task_t)(void *arg);
+
+void scheduler_init(void);
+// priority: 0 is the highest; the first run is delay_us from now; returns the task id
+uint8_t scheduler_add(scheduler_task_t task, void *arg, uint8_t priority, uint32_t delay_us);
+// make a (possibly suspended) task due right away
+void scheduler_wake(uint8_t id);
+// one pass; returns the time until the next deadline (SCHEDULER_SUSPEND: none)
+uint32_t scheduler_run_once(void);
+// never returns
+void scheduler_run(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -4,6 +4,9 @@
  *  implements Arduino-like millis() function via RTC timer interrupt (on XMEGAs)
  *  Note: the XMEGA version counts in 10/1024 secs, so not exactly tens of milliseconds (2.4% error :)
  *  Note: the AVR8 version counts in 10.24 millisecs (wrong the other way than XMEGA :)
+ *  micros() counts in 64 CPU cycle ticks (TIMER0 on AVR8, TCC1 on XMEGA),
+ *   i.e. 4us resolution at 16MHz, 2us at 32MHz; it also serves as the time
+ *   base of the SHA204 library.
  *
  * Credits:
  *  - XMEGA code from: http://www.jtronics.de/avr-projekte/xmega-tutorial/xmega-tutorial-real-time-counter.html
@@ -12,8 +15,12 @@
 #include <avr/interrupt.h>
 
 #include "Timer.h"
+#include "SHA204/SHA204HAL.h"
 
 volatile uint32_t current_time;
+volatile uint32_t timer_overflows; // for micros()
+
+#define TIMER_MICROS_PER_TICK (64 / (F_CPU / 1000000))
 
 #if (defined(__AVR_ATmega32U4__) || defined(__AVR_ATmega32U2__)) // use TIMER0 compare interrupt to keep track of time
 volatile uint8_t helper_counter;
@@ -34,6 +41,7 @@ void Timer_Init(void) {
   #endif
 // TIMER0 overflow interrupt handler
 ISR(TIMER0_OVF_vect) {
+  timer_overflows++;
   helper_counter++;
   if(helper_counter>=TIMER_HELPER_CONSTANT) {
     current_time++;
@@ -41,9 +49,31 @@ ISR(TIMER0_OVF_vect) {
   }
 }
 
+uint32_t micros(void) {
+  uint32_t overflows;
+  uint8_t count;
+  uint8_t sreg = SREG;
+
+  cli();
+  overflows = timer_overflows;
+  count = TCNT0;
+  // overflow which hasn't been serviced yet
+  if ((TIFR0 & (1 << TOV0)) && count < 255)
+    overflows++;
+  SREG = sreg;
+
+  return ((overflows << 8) + count) * TIMER_MICROS_PER_TICK;
+}
+
 #elif (defined(__AVR_ATxmega128A3U__)) // use internal RTC oscillator to generate interrupts
 void Timer_Init(void) {
   current_time = 0;
+  // free running TCC1 for micros(): F_CPU/64, overflow interrupt every 65536 ticks
+  TCC1.PER = 0xFFFF;
+  TCC1.CNT = 0;
+  TCC1.INTCTRLA = TC_OVFINTLVL_HI_gc;
+  TCC1.CTRLA = TC_CLKSEL_DIV64_gc;
+
   //############################### Clock für RTC aktivieren
   // Unlock access to protected IO register for 4 cycles
   CCP   = CCP_IOREG_gc;
@@ -66,6 +96,26 @@ void Timer_Init(void) {
   //RTC.COMP  = 2; // note: if COMP>PER, no 'compare' interrupt will ever be generated
 }
 
+ISR(TCC1_OVF_vect) {
+  timer_overflows++;
+}
+
+uint32_t micros(void) {
+  uint32_t overflows;
+  uint16_t count;
+  uint8_t sreg = SREG;
+
+  cli();
+  overflows = timer_overflows;
+  count = TCC1.CNT;
+  // overflow which hasn't been serviced yet
+  if ((TCC1.INTFLAGS & TC1_OVFIF_bm) && count < 0xFFFF)
+    overflows++;
+  SREG = sreg;
+
+  return ((overflows << 16) + count) * TIMER_MICROS_PER_TICK;
+}
+
 //################################################## ISR RTC 1Hz
 ISR(RTC_OVF_vect) {
   current_time++;
@@ -82,3 +132,8 @@ uint32_t millis10(void) {
   return current_time;
 }
 
+// time base of the SHA204 library (replaces the weak one in SHA204HAL.cpp)
+uint32_t sha204_hal_micros(void) {
+  return micros();
+}
+
@@ -7,7 +7,18 @@
 #ifndef _PROJECT_TIMER_H_
 #define _PROJECT_TIMER_H_
 
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C"{
+#endif
+
 void Timer_Init(void);
 uint32_t millis10(void);
+uint32_t micros(void);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
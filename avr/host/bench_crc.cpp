@@ -0,0 +1,137 @@
+/*
+ * bench_crc.cpp
+ * (c) 2014 flabbergast
+ *  Host benchmark of the SHA204CRC variants: checks that they all agree
+ *  with the original bit-by-bit loop and prints bytes/cycle for the
+ *  packet sizes the chip actually uses (and a long buffer).
+ *
+ *  The cycle counter is the TSC on x86; elsewhere the nanosecond clock
+ *  is used instead (the column is then bytes/ns).
+ */
+
+#include "SHA204CRC.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define BENCH_UNIT "cycle"
+static inline uint64_t bench_ticks(void) {
+  return __rdtsc();
+}
+#else
+#define BENCH_UNIT "ns"
+static inline uint64_t bench_ticks(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#endif
+
+#define BENCH_BUFFER_SIZE 4096
+#define BENCH_TOTAL_BYTES (16UL * 1024 * 1024)
+
+typedef uint16_t (*crc_update_fn)(uint16_t crc, const uint8_t *data, uint16_t length);
+
+// SHA204::calculate_crc before the table engine (non-reflected register)
+static uint16_t crc_update_reference(uint16_t crc_register, const uint8_t *data, uint16_t length) {
+  uint8_t shift_register;
+  uint8_t data_bit, crc_bit;
+
+  while (length--) {
+    for (shift_register = 0x01; shift_register > 0x00; shift_register <<= 1) {
+      data_bit = (*data & shift_register) ? 1 : 0;
+      crc_bit = crc_register >> 15;
+      crc_register <<= 1;
+      if ((data_bit ^ crc_bit) != 0)
+        crc_register ^= 0x8005;
+    }
+    data++;
+  }
+  return crc_register;
+}
+
+static const struct {
+  const char *name;
+  crc_update_fn update;
+} variants[] = {
+  { "reference", crc_update_reference },
+  { "bitwise",   sha204_crc_update_bitwise },
+  { "nibble",    sha204_crc_update_nibble },
+  { "table",     sha204_crc_update_table },
+};
+#define VARIANT_COUNT (sizeof(variants) / sizeof(variants[0]))
+
+static const uint16_t sizes[] = { 7, 39, 84, BENCH_BUFFER_SIZE };
+#define SIZE_COUNT (sizeof(sizes) / sizeof(sizes[0]))
+
+static uint8_t buffer[BENCH_BUFFER_SIZE];
+static volatile uint16_t sink;
+
+static void crc_bytes(uint8_t v, uint16_t crc, uint8_t *out) {
+  if (v == 0) { // the reference register is not reflected
+    out[0] = (uint8_t) (crc & 0xFF);
+    out[1] = (uint8_t) (crc >> 8);
+  } else {
+    sha204_crc_final(crc, out);
+  }
+}
+
+static int check_variants(void) {
+  uint8_t expected[2], got[2];
+  uint16_t length, split;
+  uint8_t v;
+
+  for (length = 0; length <= 300; length++) {
+    crc_bytes(0, variants[0].update(0, buffer, length), expected);
+    for (v = 1; v < VARIANT_COUNT; v++) {
+      // in two pieces, to exercise the streaming interface
+      split = length / 3;
+      uint16_t crc = variants[v].update(sha204_crc_init(), buffer, split);
+      crc = variants[v].update(crc, buffer + split, length - split);
+      crc_bytes(v, crc, got);
+      if (got[0] != expected[0] || got[1] != expected[1]) {
+        printf("MISMATCH: %s, length %u\n", variants[v].name, length);
+        return 1;
+      }
+    }
+  }
+  return 0;
+}
+
+int main(void) {
+  uint32_t i, rounds;
+  uint64_t start, ticks;
+  uint8_t v, s;
+
+  srand(1);
+  for (i = 0; i < BENCH_BUFFER_SIZE; i++)
+    buffer[i] = (uint8_t) rand();
+
+  if (check_variants())
+    return 1;
+  printf("all variants agree with the reference loop\n\n");
+
+  printf("%-10s", "bytes/" BENCH_UNIT);
+  for (s = 0; s < SIZE_COUNT; s++)
+    printf("%12u", sizes[s]);
+  printf("\n");
+
+  for (v = 0; v < VARIANT_COUNT; v++) {
+    printf("%-10s", variants[v].name);
+    for (s = 0; s < SIZE_COUNT; s++) {
+      rounds = BENCH_TOTAL_BYTES / sizes[s];
+      start = bench_ticks();
+      for (i = 0; i < rounds; i++)
+        sink = variants[v].update(sink, buffer, sizes[s]);
+      ticks = bench_ticks() - start;
+      printf("%12.4f", (double) rounds * sizes[s] / (double) ticks);
+    }
+    printf("\n");
+  }
+
+  return 0;
+}
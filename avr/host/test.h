@@ -0,0 +1,33 @@
+/*
+ * test.h
+ * (c) 2014 flabbergast
+ *  Checks for the host tests (test_*.cpp): CHECK() and CHECK_EQ() print
+ *  what failed and count it, TEST_RESULT() is the exit code of main()
+ *  (non-zero if anything failed), so "make test" stops there.
+ */
+
+#ifndef SHA204_HOST_TEST_H
+#define SHA204_HOST_TEST_H
+
+#include <stdio.h>
+
+static unsigned test_failures;
+
+#define CHECK(e) do { \
+    if (!(e)) { \
+      printf("%s:%d: %s\n", __FILE__, __LINE__, #e); \
+      test_failures++; \
+    } \
+  } while (0)
+
+#define CHECK_EQ(a, b) do { \
+    unsigned long check_a = (unsigned long) (a), check_b = (unsigned long) (b); \
+    if (check_a != check_b) { \
+      printf("%s:%d: %s is 0x%lX, expected %s (0x%lX)\n", __FILE__, __LINE__, #a, check_a, #b, check_b); \
+      test_failures++; \
+    } \
+  } while (0)
+
+#define TEST_RESULT() (printf("%s: %s\n", __FILE__, test_failures ? "FAILED" : "ok"), test_failures != 0)
+
+#endif
@@ -0,0 +1,113 @@
+/*
+ * test_fragments.cpp
+ * (c) 2014 flabbergast
+ *  Host test of the commands sent from where their data is (execute()
+ *  without tx_buffer, begin_send_fragments()) on the emulator: they have
+ *  to get the same answers as the ones marshaled into a tx_buffer, also
+ *  when the data is split and when the command is sent again.
+ */
+
+#include "test.h"
+#include "SHA204Emu.h"
+#include "SHA204ReturnCodes.h"
+
+#include <string.h>
+
+static uint8_t message[64];
+
+static void check_same(const char *what, uint8_t ret_a, const uint8_t *rx_a, uint8_t ret_b, const uint8_t *rx_b) {
+  if (ret_a != ret_b || memcmp(rx_a, rx_b, rx_a[SHA204_BUFFER_POS_COUNT]) != 0) {
+    printf("%s: %02X / %02X, or the responses differ\n", what, ret_a, ret_b);
+    test_failures++;
+  }
+}
+
+static void test_execute(void) {
+  SHA204Emu a, b; // with a tx_buffer, without
+  uint8_t tx[SHA204_CMD_SIZE_MAX], rx_a[SHA204_RSP_SIZE_MAX], rx_b[SHA204_RSP_SIZE_MAX];
+  uint8_t num_in[NONCE_NUMIN_SIZE], other_data[CHECKMAC_OTHER_DATA_SIZE];
+  uint8_t ret_a, ret_b;
+  uint8_t i;
+
+  for (i = 0; i < sizeof(num_in); i++)
+    num_in[i] = i * 7 + 1;
+  memset(other_data, 0, sizeof(other_data));
+  a.acquire(rx_a);
+  b.acquire(rx_b);
+
+  ret_a = a.execute(SHA204_NONCE, NONCE_MODE_PASSTHROUGH, 0, 32, message, 0, 0, 0, 0, sizeof(tx), tx, sizeof(rx_a), rx_a);
+  ret_b = b.execute(SHA204_NONCE, NONCE_MODE_PASSTHROUGH, 0, 32, message, 0, 0, 0, 0, sizeof(rx_b), rx_b);
+  CHECK_EQ(ret_b, SHA204_SUCCESS);
+  check_same("Nonce pass-through", ret_a, rx_a, ret_b, rx_b);
+
+  ret_a = a.execute(SHA204_MAC, MAC_MODE_BLOCK2_TEMPKEY | MAC_MODE_SOURCE_FLAG_MATCH, 0, 32, message + 32, 0, 0, 0, 0,
+                    sizeof(tx), tx, sizeof(rx_a), rx_a);
+  ret_b = b.execute(SHA204_MAC, MAC_MODE_BLOCK2_TEMPKEY | MAC_MODE_SOURCE_FLAG_MATCH, 0, 32, message + 32, 0, 0, 0, 0,
+                    sizeof(rx_b), rx_b);
+  CHECK_EQ(ret_b, SHA204_SUCCESS);
+  CHECK_EQ(rx_b[SHA204_BUFFER_POS_COUNT], MAC_RSP_SIZE);
+  check_same("MAC", ret_a, rx_a, ret_b, rx_b);
+
+  ret_a = a.execute(SHA204_NONCE, NONCE_MODE_SEED_UPDATE, 0, sizeof(num_in), num_in, 0, 0, 0, 0, sizeof(tx), tx, sizeof(rx_a), rx_a);
+  ret_b = b.execute(SHA204_NONCE, NONCE_MODE_SEED_UPDATE, 0, sizeof(num_in), num_in, 0, 0, 0, 0, sizeof(rx_b), rx_b);
+  CHECK_EQ(ret_b, SHA204_SUCCESS);
+  check_same("Nonce", ret_a, rx_a, ret_b, rx_b);
+
+  // three parts: challenge, response, other data
+  ret_a = a.execute(SHA204_CHECKMAC, 0, 0, 32, message, 32, message + 32, sizeof(other_data), other_data,
+                    sizeof(tx), tx, sizeof(rx_a), rx_a);
+  ret_b = b.execute(SHA204_CHECKMAC, 0, 0, 32, message, 32, message + 32, sizeof(other_data), other_data,
+                    sizeof(rx_b), rx_b);
+  check_same("CheckMac", ret_a, rx_a, ret_b, rx_b);
+
+  // a length the chip refuses
+  ret_a = a.execute(SHA204_NONCE, NONCE_MODE_PASSTHROUGH, 0, 31, message, 0, 0, 0, 0, sizeof(tx), tx, sizeof(rx_a), rx_a);
+  ret_b = b.execute(SHA204_NONCE, NONCE_MODE_PASSTHROUGH, 0, 31, message, 0, 0, 0, 0, sizeof(rx_b), rx_b);
+  CHECK_EQ(ret_b, SHA204_PARSE_ERROR);
+  check_same("Nonce of 31 bytes", ret_a, rx_a, ret_b, rx_b);
+  CHECK_EQ(b.execute(SHA204_DEVREV, 0, 0, 0, 0, 0, 0, 0, 0, sizeof(rx_b), rx_b), SHA204_SUCCESS);
+  CHECK_EQ(rx_b[SHA204_BUFFER_POS_COUNT], DEVREV_RSP_SIZE);
+  a.release(0);
+  b.release(0);
+}
+
+static void test_split(void) {
+  SHA204Emu a, b;
+  uint8_t tx[SHA204_CMD_SIZE_MAX], rx_a[SHA204_RSP_SIZE_MAX], rx_b[SHA204_RSP_SIZE_MAX];
+  sha204_fragment_t parts[3] = {{message, 10}, {message + 10, 10}, {message + 20, 12}};
+  uint8_t ret_a, ret_b;
+  uint32_t executed;
+
+  a.acquire(rx_a);
+  b.acquire(rx_b);
+  // TempKey from 32 bytes in one piece and in three
+  ret_a = a.execute(SHA204_NONCE, NONCE_MODE_PASSTHROUGH, 0, 32, message, 0, 0, 0, 0, sizeof(tx), tx, sizeof(rx_a), rx_a);
+  CHECK_EQ(b.begin_send_fragments(SHA204_NONCE, NONCE_MODE_PASSTHROUGH, 0, parts, 3, sizeof(rx_b), rx_b,
+                                  NONCE_DELAY, NONCE_EXEC_MAX - NONCE_DELAY), SHA204_SUCCESS);
+  ret_b = b.wait();
+  check_same("Nonce in 3 parts", ret_a, rx_a, ret_b, rx_b);
+
+  // so the MACs agree; with two broken responses the command is sent
+  //  again, from the fragments
+  b.bad_responses = 2;
+  executed = b.commands_executed;
+  ret_a = a.execute(SHA204_MAC, MAC_MODE_BLOCK2_TEMPKEY | MAC_MODE_SOURCE_FLAG_MATCH, 0, 32, message + 32, 0, 0, 0, 0,
+                    sizeof(tx), tx, sizeof(rx_a), rx_a);
+  ret_b = b.execute(SHA204_MAC, MAC_MODE_BLOCK2_TEMPKEY | MAC_MODE_SOURCE_FLAG_MATCH, 0, 32, message + 32, 0, 0, 0, 0,
+                    sizeof(rx_b), rx_b);
+  CHECK_EQ(ret_b, SHA204_SUCCESS);
+  CHECK_EQ(b.commands_executed - executed, 2);
+  check_same("MAC sent again", ret_a, rx_a, ret_b, rx_b);
+  a.release(0);
+  b.release(0);
+}
+
+int main(void) {
+  uint8_t i;
+
+  for (i = 0; i < sizeof(message); i++)
+    message[i] = i;
+  test_execute();
+  test_split();
+  return TEST_RESULT();
+}
@@ -0,0 +1,200 @@
+/*
+ * test_governor.cpp
+ * (c) 2014 flabbergast
+ *  Host test of the idle/sleep governor and the wake sessions on the
+ *  emulator: wake-ups reused within a burst, the ADAPTIVE hold and
+ *  governor_service(), the limit before the watchdog (also one that
+ *  fires as early as the datasheet allows), and a session renewed
+ *  through idle or ending in SHA204_WAKE_EXPIRED.
+ */
+
+#include "test.h"
+#include "SHA204Emu.h"
+#include "SHA204HAL.h"
+#include "SHA204ReturnCodes.h"
+
+#include <string.h>
+
+static void test_immediate(void) {
+  SHA204Emu chip;
+  uint8_t tx[SHA204_CMD_SIZE_MAX], rx[SHA204_RSP_SIZE_MAX];
+  sha204_governor_stats_t stats;
+  int i;
+
+  chip.set_governor_policy(SHA204_GOVERNOR_IMMEDIATE);
+  for (i = 0; i < 10; i++) {
+    CHECK_EQ(chip.acquire(rx), SHA204_SUCCESS);
+    CHECK_EQ(chip.random(tx, rx, 1), SHA204_SUCCESS);
+    CHECK_EQ(chip.release(i & 1), SHA204_SUCCESS);
+    CHECK_EQ(chip.get_state(), (i & 1) ? SHA204_EMU_STATE_IDLE : SHA204_EMU_STATE_SLEEP);
+    sha204_hal_delay_us(2000);
+  }
+  chip.get_governor_stats(&stats);
+  CHECK_EQ(stats.acquires, 10);
+  CHECK_EQ(stats.wakes, 10);
+  CHECK_EQ(stats.wakes_avoided, 0);
+  CHECK_EQ(stats.idles, 5 + 1); // and before the first wake-up (state unknown)
+  CHECK_EQ(stats.sleeps, 5);
+}
+
+static void test_adaptive(void) {
+  SHA204Emu chip;
+  uint8_t tx[SHA204_CMD_SIZE_MAX], rx[SHA204_RSP_SIZE_MAX];
+  sha204_governor_stats_t stats;
+  uint32_t wait;
+  int i;
+
+  chip.set_governor_policy(SHA204_GOVERNOR_ADAPTIVE);
+  // a burst 2 ms apart: after the first gap is learned, no more wake-ups
+  for (i = 0; i < 10; i++) {
+    CHECK_EQ(chip.acquire(rx), SHA204_SUCCESS);
+    CHECK_EQ(rx[SHA204_BUFFER_POS_COUNT], SHA204_RSP_SIZE_MIN);
+    CHECK_EQ(rx[SHA204_BUFFER_POS_STATUS], SHA204_STATUS_BYTE_WAKEUP);
+    CHECK_EQ(chip.random(tx, rx, 1), SHA204_SUCCESS);
+    chip.release(1);
+    sha204_hal_delay_us(2000);
+    chip.governor_service();
+  }
+  chip.get_governor_stats(&stats);
+  CHECK_EQ(stats.wakes, 2);
+  CHECK_EQ(stats.wakes_avoided, 8);
+
+  // held for about twice the gap, then put away as release() asked
+  CHECK_EQ(chip.get_state(), SHA204_EMU_STATE_AWAKE);
+  wait = chip.governor_service();
+  CHECK(wait > 0 && wait <= 2 * 2000);
+  sha204_hal_delay_us(wait);
+  CHECK_EQ(chip.governor_service(), 0);
+  CHECK_EQ(chip.get_state(), SHA204_EMU_STATE_IDLE);
+
+  // requests too far apart are not held for
+  chip.reset_governor_stats();
+  for (i = 0; i < 3; i++) {
+    chip.acquire(rx);
+    chip.random(tx, rx, 1);
+    chip.release(0);
+    sha204_hal_delay_us((SHA204_GOVERNOR_HOLD_MAX_MS + 50) * 1000UL);
+    chip.governor_service();
+  }
+  chip.get_governor_stats(&stats);
+  CHECK_EQ(stats.wakes, 3);
+  CHECK_EQ(chip.get_state(), SHA204_EMU_STATE_SLEEP);
+
+  // switching the policy off puts a held chip away
+  chip.acquire(rx);
+  chip.release(0);
+  chip.acquire(rx);
+  chip.release(0);
+  CHECK(chip.governor_service() > 0);
+  chip.set_governor_policy(SHA204_GOVERNOR_IMMEDIATE);
+  CHECK_EQ(chip.governor_service(), 0);
+  CHECK_EQ(chip.get_state(), SHA204_EMU_STATE_SLEEP);
+}
+
+static void test_watchdog(void) {
+  SHA204Emu chip;
+  uint8_t tx[SHA204_CMD_SIZE_MAX], rx[SHA204_RSP_SIZE_MAX];
+  sha204_governor_stats_t stats;
+  unsigned failures = 0;
+  int i;
+
+  // a steady stream for 3 s: the wake-up is given up in time, never
+  //  a command lost to the watchdog
+  chip.set_governor_policy(SHA204_GOVERNOR_ADAPTIVE);
+  for (i = 0; i < 300; i++) {
+    if (chip.acquire(rx) != SHA204_SUCCESS || chip.random(tx, rx, 1) != SHA204_SUCCESS)
+      failures++;
+    chip.release(0);
+    sha204_hal_delay_us(10000 - RANDOM_DELAY * 1000);
+    chip.governor_service();
+  }
+  chip.get_governor_stats(&stats);
+  CHECK_EQ(failures, 0);
+  CHECK(stats.wakes >= 3);
+  CHECK(stats.wakes_avoided > 250);
+}
+
+static void test_early_watchdog(void) {
+  SHA204Emu chip;
+  uint8_t tx[SHA204_CMD_SIZE_MAX], rx[SHA204_RSP_SIZE_MAX];
+  sha204_governor_stats_t stats;
+
+  chip.set_watchdog((uint32_t) SHA204_WATCHDOG_MIN_MS * 1000);
+  // a wake-up is not reused this close to the earliest watchdog
+  CHECK_EQ(chip.acquire(rx), SHA204_SUCCESS);
+  sha204_hal_delay_us(((uint32_t) SHA204_WATCHDOG_MIN_MS - 40) * 1000);
+  CHECK_EQ(chip.acquire(rx), SHA204_SUCCESS);
+  chip.get_governor_stats(&stats);
+  CHECK_EQ(stats.wakes_avoided, 0);
+  CHECK_EQ(chip.random(tx, rx, 1), SHA204_SUCCESS);
+  chip.release(0);
+}
+
+// Nonce, a pause, MAC with TempKey: the result of the MAC (or the check)
+static uint8_t session(SHA204Emu &chip, uint32_t pause_us) {
+  uint8_t tx[SHA204_CMD_SIZE_MAX], rx[SHA204_RSP_SIZE_MAX];
+  uint8_t num_in[NONCE_NUMIN_SIZE_PASSTHROUGH], challenge[MAC_CHALLENGE_SIZE];
+  uint8_t ret_code;
+  SHA204WakeSession<SHA204Emu> wake(chip, rx, 1);
+
+  memset(num_in, 1, sizeof(num_in));
+  memset(challenge, 2, sizeof(challenge));
+  if (wake.status() != SHA204_SUCCESS)
+    return wake.status();
+  if (chip.nonce(tx, rx, NONCE_MODE_PASSTHROUGH, num_in) != SHA204_SUCCESS)
+    return SHA204_FUNC_FAIL;
+  chip.release(0); // does nothing in a session
+  sha204_hal_delay_us(pause_us);
+  ret_code = wake.check(rx);
+  if (ret_code != SHA204_SUCCESS)
+    return ret_code;
+  return chip.mac(tx, rx, MAC_MODE_BLOCK2_TEMPKEY | MAC_MODE_SOURCE_FLAG_MATCH, 0, challenge);
+}
+
+static void test_sessions(void) {
+  SHA204Emu chip;
+  uint8_t tx[SHA204_CMD_SIZE_MAX], rx[SHA204_RSP_SIZE_MAX];
+  uint8_t num_in[NONCE_NUMIN_SIZE_PASSTHROUGH], challenge[MAC_CHALLENGE_SIZE];
+  sha204_governor_stats_t stats;
+
+  // (the end of a session is not held for, the counts below are exact)
+  chip.set_governor_policy(SHA204_GOVERNOR_IMMEDIATE);
+  CHECK_EQ(session(chip, 100000), SHA204_SUCCESS);
+  CHECK(!chip.in_session());
+  // close to the watchdog: renewed through idle, TempKey kept
+  chip.reset_governor_stats();
+  CHECK_EQ(session(chip, ((uint32_t) SHA204_WATCHDOG_MIN_MS - 40) * 1000), SHA204_SUCCESS);
+  chip.get_governor_stats(&stats);
+  CHECK_EQ(stats.idles, 2); // the renewal, and the end of the session
+  // past the watchdog: the chip may have slept
+  CHECK_EQ(session(chip, 1200000), SHA204_WAKE_EXPIRED);
+  CHECK(!chip.in_session());
+  // and the next session starts over
+  CHECK_EQ(session(chip, 0), SHA204_SUCCESS);
+
+  // a chip whose watchdog fires at the earliest: past that the session
+  //  has expired, even if this one would still be awake
+  chip.set_watchdog((uint32_t) SHA204_WATCHDOG_MIN_MS * 1000);
+  CHECK_EQ(session(chip, ((uint32_t) SHA204_WATCHDOG_MIN_MS - 40) * 1000), SHA204_SUCCESS);
+  CHECK_EQ(session(chip, ((uint32_t) SHA204_WATCHDOG_MIN_MS + 100) * 1000), SHA204_WAKE_EXPIRED);
+  chip.set_watchdog(SHA204_EMU_WATCHDOG_US);
+
+  // without a session, TempKey doesn't survive a sleep in between
+  memset(num_in, 1, sizeof(num_in));
+  memset(challenge, 2, sizeof(challenge));
+  chip.acquire(rx);
+  CHECK_EQ(chip.nonce(tx, rx, NONCE_MODE_PASSTHROUGH, num_in), SHA204_SUCCESS);
+  chip.release(0);
+  chip.acquire(rx);
+  CHECK_EQ(chip.mac(tx, rx, MAC_MODE_BLOCK2_TEMPKEY | MAC_MODE_SOURCE_FLAG_MATCH, 0, challenge), SHA204_CMD_FAIL);
+  chip.release(0);
+}
+
+int main(void) {
+  test_immediate();
+  test_adaptive();
+  test_watchdog();
+  test_early_watchdog();
+  test_sessions();
+  return TEST_RESULT();
+}
@@ -0,0 +1,121 @@
+/*
+ * test_poll.cpp
+ * (c) 2014 flabbergast
+ *  Host test of the non-blocking command path (begin_*() / poll()) on
+ *  the emulator: the states a command goes through, the time poll_wait()
+ *  asks for, and the receive retries, resyncs and re-sends after broken
+ *  responses (SHA204Emu::bad_responses).
+ */
+
+#include "test.h"
+#include "SHA204Emu.h"
+#include "SHA204HAL.h"
+#include "SHA204ReturnCodes.h"
+
+// poll() until done, sleeping as poll_wait() says; returns the result
+static uint8_t run(SHA204Emu &chip, unsigned *passes) {
+  uint8_t ret_code;
+
+  *passes = 0;
+  while ((ret_code = chip.poll()) == SHA204_CMD_PENDING && ++*passes < 1000)
+    sha204_hal_delay_us(chip.poll_wait());
+  return ret_code;
+}
+
+static void test_states(void) {
+  SHA204Emu chip;
+  uint8_t rx[SHA204_RSP_SIZE_MAX], rx2[SHA204_RSP_SIZE_MAX];
+  uint32_t started_at;
+  unsigned passes;
+
+  CHECK_EQ(chip.acquire(rx), SHA204_SUCCESS);
+  CHECK(!chip.busy());
+  CHECK_EQ(chip.poll_wait(), 0);
+
+  started_at = sha204_hal_micros();
+  CHECK_EQ(chip.begin_fixed(&sha204_cmd_random, rx), SHA204_SUCCESS);
+  CHECK(chip.busy());
+  // one command at a time
+  CHECK_EQ(chip.begin_fixed(&sha204_cmd_dev_rev, rx2), SHA204_FUNC_FAIL);
+  // sent, and nothing to do until the chip may be done
+  CHECK_EQ(chip.poll(), SHA204_CMD_PENDING);
+  CHECK(chip.poll_wait() > 0);
+  CHECK(chip.poll_wait() <= (uint32_t) RANDOM_DELAY * 1000);
+
+  CHECK_EQ(run(chip, &passes), SHA204_SUCCESS);
+  CHECK(passes > 0);
+  CHECK(sha204_hal_micros() - started_at >= (uint32_t) RANDOM_DELAY * 1000);
+  CHECK_EQ(rx[SHA204_BUFFER_POS_COUNT], RANDOM_RSP_SIZE);
+  CHECK(!chip.busy());
+  CHECK_EQ(chip.poll_wait(), 0);
+  // done: poll() keeps returning the result
+  CHECK_EQ(chip.poll(), SHA204_SUCCESS);
+
+  // a status response ends the command too
+  CHECK_EQ(chip.begin_fixed(&sha204_cmd_dev_rev, rx2), SHA204_SUCCESS);
+  CHECK_EQ(run(chip, &passes), SHA204_SUCCESS);
+  CHECK_EQ(rx2[SHA204_BUFFER_POS_COUNT], DEVREV_RSP_SIZE);
+  chip.release(0);
+}
+
+static void test_parse_error(void) {
+  SHA204Emu chip;
+  uint8_t tx[SHA204_CMD_SIZE_MAX], rx[SHA204_RSP_SIZE_MAX];
+
+  chip.acquire(rx);
+  // the chip refuses the address: no retries for that
+  CHECK_EQ(chip.read(tx, rx, SHA204_ZONE_CONFIG, 0x7F), SHA204_PARSE_ERROR);
+  chip.release(0);
+}
+
+static void test_retries(void) {
+  SHA204Emu chip;
+  SHA204Stats stats;
+  uint8_t rx[SHA204_RSP_SIZE_MAX];
+  uint32_t executed;
+
+  chip.set_stats(&stats);
+  chip.acquire(rx);
+
+  // one broken response: resync, read it again
+  executed = chip.commands_executed;
+  chip.bad_responses = 1;
+  CHECK_EQ(chip.fixed(&sha204_cmd_random, rx), SHA204_SUCCESS);
+  CHECK_EQ(rx[SHA204_BUFFER_POS_COUNT], RANDOM_RSP_SIZE);
+  CHECK_EQ(chip.commands_executed - executed, 1);
+  CHECK_EQ(stats.crc_errors, 1);
+  CHECK_EQ(stats.resyncs, 1);
+  CHECK_EQ(stats.receive_retries, 1);
+  CHECK_EQ(stats.send_retries, 0);
+
+  // two: the receive retries are used up, the command is sent again
+  stats.reset();
+  executed = chip.commands_executed;
+  chip.bad_responses = 2;
+  CHECK_EQ(chip.fixed(&sha204_cmd_random, rx), SHA204_SUCCESS);
+  CHECK_EQ(chip.commands_executed - executed, 2);
+  CHECK_EQ(stats.crc_errors, 2);
+  CHECK_EQ(stats.receive_retries, 1);
+  CHECK_EQ(stats.send_retries, 1);
+
+  // always broken: give up after SHA204_RETRY_COUNT re-sends
+  stats.reset();
+  executed = chip.commands_executed;
+  chip.bad_responses = 100;
+  CHECK_EQ(chip.fixed(&sha204_cmd_random, rx), SHA204_BAD_CRC);
+  CHECK_EQ(chip.commands_executed - executed, SHA204_RETRY_COUNT + 1);
+  CHECK_EQ(stats.send_retries, SHA204_RETRY_COUNT);
+  CHECK_EQ(stats.opcode[9].failures, 1); // Random
+  chip.bad_responses = 0;
+
+  // and the next command is fine again
+  CHECK_EQ(chip.fixed(&sha204_cmd_random, rx), SHA204_SUCCESS);
+  chip.release(0);
+}
+
+int main(void) {
+  test_states();
+  test_parse_error();
+  test_retries();
+  return TEST_RESULT();
+}
@@ -0,0 +1,146 @@
+/*
+ * test_zones.cpp
+ * (c) 2014 flabbergast
+ *  Host test of read_zone() / write_zone() and the read cache on the
+ *  emulator: what comes back, how many commands it took, which reads the
+ *  cache answers once the zones are locked (also without the chip), and
+ *  what empties it.
+ */
+
+#include "test.h"
+#include "SHA204Emu.h"
+#include "SHA204ReturnCodes.h"
+
+#include <string.h>
+
+static void test_read_write(void) {
+  SHA204Emu chip;
+  uint8_t rx[SHA204_RSP_SIZE_MAX], buffer[SHA204_EMU_CONFIG_SIZE], serial[9];
+  uint8_t value[68];
+  uint32_t executed;
+  uint8_t i;
+
+  chip.acquire(rx);
+  // the whole config zone: 2 x 32 bytes, 6 x 4
+  executed = chip.commands_executed;
+  CHECK_EQ(chip.read_zone(SHA204_ZONE_CONFIG, 0, SHA204_EMU_CONFIG_SIZE, buffer), SHA204_SUCCESS);
+  CHECK_EQ(chip.commands_executed - executed, 8);
+  CHECK(memcmp(buffer, chip.config, SHA204_EMU_CONFIG_SIZE) == 0);
+
+  // a part of it, across a block boundary: the 3 words in block 0 in
+  //  one 32-byte read, the one in block 1 in a 4-byte read
+  executed = chip.commands_executed;
+  CHECK_EQ(chip.read_zone(SHA204_ZONE_CONFIG, 20, 16, buffer), SHA204_SUCCESS);
+  CHECK_EQ(chip.commands_executed - executed, 2);
+  CHECK(memcmp(buffer, chip.config + 20, 16) == 0);
+
+  // not in words, or past the end of the zone
+  CHECK_EQ(chip.read_zone(SHA204_ZONE_CONFIG, 2, 4, buffer), SHA204_BAD_PARAM);
+  CHECK_EQ(chip.read_zone(SHA204_ZONE_CONFIG, 84, 8, buffer), SHA204_BAD_PARAM);
+
+  // the serial number is one 32-byte read
+  executed = chip.commands_executed;
+  CHECK_EQ(chip.serialNumber(serial), SHA204_SUCCESS);
+  CHECK_EQ(chip.commands_executed - executed, 1);
+  CHECK(memcmp(serial, chip.config, 4) == 0);
+  CHECK(memcmp(serial + 4, chip.config + 8, 5) == 0);
+
+  // writes: 4 words, the whole block 1, 5 words
+  for (i = 0; i < sizeof(value); i++)
+    value[i] = i;
+  executed = chip.commands_executed;
+  CHECK_EQ(chip.write_zone(SHA204_ZONE_CONFIG, 16, sizeof(value), value), SHA204_SUCCESS);
+  CHECK_EQ(chip.commands_executed - executed, 4 + 1 + 5);
+  CHECK(memcmp(chip.config + 16, value, sizeof(value)) == 0);
+  CHECK_EQ(chip.read_zone(SHA204_ZONE_CONFIG, 16, sizeof(value), buffer), SHA204_SUCCESS);
+  CHECK(memcmp(buffer, value, sizeof(value)) == 0);
+  chip.release(0);
+}
+
+static void test_read_cache(void) {
+  SHA204Emu chip;
+  SHA204ReadCache cache;
+  uint8_t tx[SHA204_CMD_SIZE_MAX], rx[SHA204_RSP_SIZE_MAX], buffer[SHA204_EMU_CONFIG_SIZE];
+  uint8_t value[4] = {1, 2, 3, 4};
+  uint32_t executed;
+
+  chip.set_read_cache(&cache);
+  chip.acquire(rx);
+
+  // unlocked: nothing is cached
+  chip.read_zone(SHA204_ZONE_CONFIG, 0, SHA204_EMU_CONFIG_SIZE, buffer);
+  chip.read_zone(SHA204_ZONE_CONFIG, 0, SHA204_EMU_CONFIG_SIZE, buffer);
+  CHECK_EQ(cache.hits, 0);
+  CHECK_EQ(cache.misses, 16);
+
+  // locked, slot 0 readable, slot 1 secret
+  chip.config[86] = 0; // LockValue (data and OTP zones)
+  chip.config[87] = 0; // LockConfig
+  chip.config[20] = 0x0F; // SlotConfig 0
+  chip.config[21] = 0;
+  memset(chip.data[0], 0xA5, SHA204_EMU_SLOT_SIZE);
+  // the first read learns the locks (bytes 84-87 come last), the second
+  //  fills the cache
+  chip.read_zone(SHA204_ZONE_CONFIG, 0, SHA204_EMU_CONFIG_SIZE, buffer);
+  chip.read_zone(SHA204_ZONE_CONFIG, 0, SHA204_EMU_CONFIG_SIZE, buffer);
+  cache.hits = cache.misses = 0;
+
+  // again: only the word with the lock bytes goes to the chip
+  executed = chip.commands_executed;
+  CHECK_EQ(chip.read_zone(SHA204_ZONE_CONFIG, 0, SHA204_EMU_CONFIG_SIZE, buffer), SHA204_SUCCESS);
+  CHECK(memcmp(buffer, chip.config, SHA204_EMU_CONFIG_SIZE) == 0);
+  CHECK_EQ(chip.commands_executed - executed, 1);
+  CHECK_EQ(cache.hits, 7);
+  CHECK_EQ(cache.misses, 1);
+
+  // a readable slot is cached after the first read
+  cache.hits = cache.misses = 0;
+  CHECK_EQ(chip.read_zone(SHA204_ZONE_DATA, 0, SHA204_EMU_SLOT_SIZE, buffer), SHA204_SUCCESS);
+  CHECK_EQ(chip.read_zone(SHA204_ZONE_DATA, 0, SHA204_EMU_SLOT_SIZE, buffer), SHA204_SUCCESS);
+  CHECK(memcmp(buffer, chip.data[0], SHA204_EMU_SLOT_SIZE) == 0);
+  CHECK_EQ(cache.hits, 1);
+  CHECK_EQ(cache.misses, 1);
+
+  // from the cache alone, without waking the chip up
+  chip.release(0);
+  cache.hits = 0;
+  executed = chip.commands_executed;
+  memset(buffer, 0, sizeof(buffer));
+  CHECK(chip.read_zone_cached(SHA204_ZONE_DATA, 0, SHA204_EMU_SLOT_SIZE, buffer));
+  CHECK(memcmp(buffer, chip.data[0], SHA204_EMU_SLOT_SIZE) == 0);
+  CHECK(chip.read_zone_cached(SHA204_ZONE_CONFIG, 4, 76, buffer));
+  CHECK(memcmp(buffer, chip.config + 4, 76) == 0);
+  CHECK_EQ(cache.hits, 1 + 3);
+  // not the lock bytes, nor what was never read
+  CHECK(!chip.read_zone_cached(SHA204_ZONE_CONFIG, 0, SHA204_EMU_CONFIG_SIZE, buffer));
+  CHECK(!chip.read_zone_cached(SHA204_ZONE_DATA, 64, 4, buffer));
+  CHECK(!chip.read_zone_cached(SHA204_ZONE_DATA, 2, 4, buffer));
+  CHECK_EQ(chip.commands_executed - executed, 0);
+  CHECK_EQ(chip.get_state(), SHA204_EMU_STATE_SLEEP);
+  chip.acquire(rx);
+
+  // a secret one is refused by the chip, every time
+  cache.hits = cache.misses = 0;
+  CHECK_EQ(chip.read_zone(SHA204_ZONE_DATA, 32, SHA204_EMU_SLOT_SIZE, buffer), SHA204_CMD_FAIL);
+  CHECK_EQ(chip.read_zone(SHA204_ZONE_DATA, 32, SHA204_EMU_SLOT_SIZE, buffer), SHA204_CMD_FAIL);
+  CHECK_EQ(cache.hits, 0);
+
+  // a hit looks like the chip's answer
+  CHECK_EQ(chip.read(tx, rx, SHA204_ZONE_CONFIG, 0), SHA204_SUCCESS);
+  CHECK_EQ(rx[SHA204_BUFFER_POS_COUNT], READ_4_RSP_SIZE);
+  CHECK(memcmp(rx + SHA204_BUFFER_POS_DATA, chip.config, 4) == 0);
+
+  // a Write empties the cache
+  chip.write(tx, rx, SHA204_ZONE_CONFIG, 16, value, NULL);
+  cache.hits = cache.misses = 0;
+  chip.read_zone(SHA204_ZONE_CONFIG, 0, SHA204_EMU_CONFIG_SIZE, buffer);
+  CHECK_EQ(cache.hits, 0);
+  CHECK_EQ(cache.misses, 8);
+  chip.release(0);
+}
+
+int main(void) {
+  test_read_write();
+  test_read_cache();
+  return TEST_RESULT();
+}
@@ -7,31 +7,61 @@
  *    interface) interactively, over Serial.
  */
 
-// use I2C or single wire interface to ATSHA204?
+// use I2C or single wire interface to ATSHA204? (USE_I2C in the
+//  makefile: it builds SHA204TWI, with SHA204_TWI)
+#ifdef SHA204_TWI
 #define USE_I2C_INTERFACE 1
+#else
+#define USE_I2C_INTERFACE 0
+#endif
+// single wire: through the USART or bit-banged? (USE_SWI_UART in the
+//  makefile: it builds SHA204SWIUART, with SHA204_SWIUART)
+#ifdef SHA204_SWIUART
+#define USE_SWI_UART 1
+#else
+#define USE_SWI_UART 0
+#endif
+// keep the learned ATSHA204 execution times in EEPROM?
+#define SAVE_LATENCY_TO_EEPROM 1
 
 #include "LufaLayer.h"
+#include "Timer.h"
+#include "BinaryProtocol.h"
+#include "Scheduler.h"
+#include <avr/io.h> // SP
+#if (SAVE_LATENCY_TO_EEPROM)
+#include <avr/eeprom.h>
+#endif
 
 #if (USE_I2C_INTERFACE)
 #include "SHA204/SHA204TWI.h"
 #define SHA204CLASS SHA204TWI
+#define BINARY_INTERFACE BINARY_INTERFACE_TWI
+#elif (USE_SWI_UART)
+#include "SHA204/SHA204SWIUART.h"
+#define SHA204CLASS SHA204SWIUART
+#define BINARY_INTERFACE BINARY_INTERFACE_SWI_UART
 #else
 #include "SHA204/SHA204SWI.h"
 #define SHA204CLASS SHA204SWI
+#define BINARY_INTERFACE BINARY_INTERFACE_SWI
 #endif
 #include "SHA204/SHA204Definitions.h" // for constants and such
 #include "SHA204/SHA204ReturnCodes.h" // want messages for return codes
+#include "SHA204/SHA204HAL.h" // for sha204_hal_yield
 
 /*************************************************************************
  * ----------------------- Global variables -----------------------------*
  *************************************************************************/
 
-// when this byte is received, switch to binary mode
+// when this byte is received, switch to binary mode (v1; v2 frames start with BINARY_FRAME_SOF)
 #define BINARY_MODE_CHAR 0xFD
+#define BINARY_MODE_BYTE_TIMEOUT_US 100000UL
 
 #define MAX_BUFFER_SIZE 100
 volatile uint8_t hexprint_separator = ' ';
 volatile uint8_t idle = 0;
+volatile uint8_t adaptive_governor = 1;
 
 #if defined(__AVR_ATxmega128A3U__) || defined(__AVR_ATxmega128A4U__)
   //  -> If you use actual GND and VCC pins for power, ignore the _VCC_ and _GND_ settings
@@ -63,6 +93,15 @@ volatile uint8_t idle = 0;
   // #define SHA204_POWER_UP SHA204_GND_DDR|=SHA204_GND_BIT; SHA204_GND_PORT&=~SHA204_GND_BIT; SHA204_VCC_DDR|=SHA204_VCC_BIT; SHA204_VCC_PORT|=SHA204_VCC_BIT;  // use this if powering from PORT pins
 #endif
 
+#if (SAVE_LATENCY_TO_EEPROM)
+  // layout version; bump when SHA204_LATENCY_SLOTS or the op-code order changes
+  #define LATENCY_EEPROM_MAGIC 0xA1
+  // check for changes every 10 minutes, write only if something moved by >1/8
+  #define LATENCY_SAVE_INTERVAL_US 600000000UL
+  uint8_t EEMEM latency_eeprom_magic;
+  uint16_t EEMEM latency_eeprom[SHA204_LATENCY_SLOTS];
+#endif
+
 /*************************************************************************
  * ----------------------- Helper functions -----------------------------*
  *************************************************************************/
@@ -70,6 +109,7 @@ void hexprint(uint8_t *p, uint16_t length);
 void hexprint_noln(uint8_t *p, uint16_t length);
 void hexprint_byte(uint8_t b);
 void hexprint_byte_sep(uint8_t b);
+void hexprint_32(uint32_t v);
 
 #define W(s) usb_serial_write_P(PSTR(s))
 #define Wl(s) usb_serial_writeln_P(PSTR(s))
@@ -82,450 +122,607 @@ void print_execute_params(uint8_t opcode, uint8_t param1);
 void print_return_code(uint8_t code);
 
 void process_config(uint8_t *config);
+void print_stats(SHA204CLASS *sha204, SHA204ReadCache *cache, SHA204Stats *bus);
 void sleep_or_idle(SHA204CLASS *sha204);
+void load_latency_estimates(SHA204CLASS *sha204);
+void save_latency_estimates(SHA204CLASS *sha204);
 uint8_t receive_serial_binary_transaction(uint8_t *buffer, uint8_t len);
-uint8_t binary_mode_transaction(uint8_t *data, uint8_t rxsize, uint8_t *rx_buffer, SHA204CLASS *sha204);
+uint8_t binary_mode_transaction(uint8_t *data, uint8_t rxsize, uint8_t *rx_buffer, SHA204CLASS *sha204, uint8_t *ret_code);
+uint8_t binary_acquire(uint8_t flags, uint8_t *rx_buffer, SHA204CLASS *sha204);
+uint8_t binary_transaction_begin(uint8_t *data, uint8_t rxsize, uint8_t *rx_buffer, SHA204CLASS *sha204, uint8_t *flags, uint8_t *ret_code);
+uint8_t binary_transaction_end(uint8_t ret_code, uint8_t flags, SHA204CLASS *sha204);
+void binary_queue_service(binary_queue_t *queue, uint8_t *rx_buffer, SHA204CLASS *sha204, SHA204ReadCache *cache, SHA204Stats *bus, SHA204Trace *trace, const uint8_t *serial);
+uint8_t binary_zone_access(binary_frame_t *frame, uint8_t *rx_buffer, SHA204CLASS *sha204, uint16_t *length, uint8_t *ret_code);
+uint16_t binary_stats(uint8_t *payload, uint8_t page, uint8_t flags, SHA204CLASS *sha204, SHA204ReadCache *cache, SHA204Stats *bus);
+uint16_t binary_trace(uint8_t *payload, uint8_t has_from, uint16_t from, SHA204Trace *trace);
+uint8_t *put_16(uint8_t *p, uint16_t value);
+uint8_t *put_32(uint8_t *p, uint32_t value);
+void stack_paint(void);
+uint16_t stack_unused(void);
 #define BINARY_TRANSACTION_OK 0
 #define BINARY_TRANSACTION_RECEIVE_ERROR 1
 #define BINARY_TRANSACTION_PARAM_ERROR 2
 #define BINARY_TRANSACTION_EXECUTE_ERROR 3
 
+/*************************************************************************
+ * ------------------------------ Tasks ---------------------------------*
+ *************************************************************************/
+
+// state shared by the tasks
+typedef struct {
+  SHA204CLASS sha204;
+  SHA204ReadCache read_cache;
+  SHA204Stats stats;
+#ifdef SHA204_TRACE
+  SHA204Trace trace;
+#endif
+  binary_queue_t queue;
+  uint8_t rx_buffer[SHA204_RSP_SIZE_MAX];
+  uint8_t sha204_task; // scheduler id, woken when a request is queued
+  uint8_t serial[9];   // of the ATSHA204, read at boot (for PING)
+} playground_t;
+
+#define USB_TASK_PERIOD_US 1000UL
+#define SERIAL_TASK_PERIOD_US 1000UL // received bytes come in every 1ms USB frame
+#define BUTTON_TASK_PERIOD_US 10000UL
+#define GOVERNOR_TASK_PERIOD_US 10000UL
+
+uint32_t usb_task(void *arg);
+uint32_t sha204_task(void *arg);
+uint32_t governor_task(void *arg);
+uint32_t serial_task(void *arg);
+uint32_t button_task(void *arg);
+uint32_t latency_task(void *arg);
+void menu_command(char c, playground_t *pg);
+
 /** Main program entry point. This routine contains the overall program flow, including initial
- *  setup of all components and the main program loop.
+ *  setup of all components; the work is then done by the tasks below, run by the scheduler.
  */
 int main(void)
 {
-  /* Variables */
-  bool button_press_registered = false;
-  uint32_t button_press_length = 0;
-
-  bool dtr,prev_dtr = false;
-
-  uint8_t rx_buffer[SHA204_RSP_SIZE_MAX];
-  uint8_t tx_buffer[MAX_BUFFER_SIZE];
-  uint8_t configuration_zone[88];
-  uint8_t r;
-  uint8_t param1;
-  uint16_t param2;
-  uint8_t data1[64];
-  uint8_t data2[32];
-  uint8_t data3[14];
-
-  SHA204CLASS sha204;
+  playground_t pg;
+  uint8_t i;
 
   /* Initialisation */
+  stack_paint();
   init();
 
   SHA204_POWER_UP;
 
 #if (USE_I2C_INTERFACE)
-  sha204.init_i2c();
+  pg.sha204.init_i2c();
+#elif (USE_SWI_UART)
+  pg.sha204.init_uart();
+#endif
+#if (SAVE_LATENCY_TO_EEPROM)
+  load_latency_estimates(&pg.sha204);
+#endif
+  pg.sha204.set_governor_policy(SHA204_GOVERNOR_ADAPTIVE);
+  pg.sha204.set_read_cache(&pg.read_cache);
+  pg.sha204.set_stats(&pg.stats);
+#ifdef SHA204_TRACE
+  pg.sha204.set_trace(&pg.trace);
 #endif
 
+  /* The serial number, for answering PING without waiting for the chip */
+  if(pg.sha204.acquire(pg.rx_buffer) != SHA204_SUCCESS || pg.sha204.serialNumber(pg.serial) != SHA204_SUCCESS)
+    for(i=0; i<9; i++)
+      pg.serial[i] = 0;
+  pg.sha204.release(0);
+
   /* Must throw away unused bytes from the host, or it will lock up while waiting for the device */
   usb_serial_flush_input();
+  binary_queue_init(&pg.queue);
 
-  for (;;)
-  {
-    // run the task which checks the state of the button
-    service_button();
-    // for how long was the button pressed?
-    button_press_length = button_pressed_for();
-    // if at least 70ms and we haven't acted on this press yet
-    if( button_press_length >= 7 && !button_press_registered ) {
-      // remember that we've acted on the current button press
-      button_press_registered = true;
-      // announce the button press over the serial
-      Wl("Button pressed.");
-      // maybe do something else...
-    }
-    // was the button released after being pressed?
-    if( button_press_registered && button_press_length < 7 ) {
-      button_press_registered = false;
-    }
+  /* Tasks, in priority order */
+  scheduler_init();
+  scheduler_add(usb_task, &pg, 0, 0);
+  pg.sha204_task = scheduler_add(sha204_task, &pg, 1, 0);
+  scheduler_add(governor_task, &pg, 1, 0);
+  scheduler_add(serial_task, &pg, 2, 0);
+  scheduler_add(button_task, &pg, 3, 0);
+#if (SAVE_LATENCY_TO_EEPROM)
+  scheduler_add(latency_task, &pg, 4, LATENCY_SAVE_INTERVAL_US);
+#endif
 
-    // check dtr
-    dtr = usb_serial_dtr();
-    if( dtr && !prev_dtr ) {
-      _delay_ms(50);
-      W("\n\r");
-      print_help();
-    }
+  scheduler_run(); // never returns
+}
+
+/* USB: IN endpoint, HID, and the help text when a terminal connects */
+uint32_t usb_task(void *arg) {
+  static bool prev_dtr = false;
+  static bool help_pending = false;
+  bool dtr;
+  (void) arg;
+
+  if(help_pending) {
+    help_pending = false;
+    W("\n\r");
+    print_help();
+  }
+  usb_tasks();
+  dtr = usb_serial_dtr();
+  if( dtr && !prev_dtr ) {
     prev_dtr = dtr;
+    help_pending = true;
+    return 50000UL; // let the terminal settle first
+  }
+  prev_dtr = dtr;
+  return USB_TASK_PERIOD_US;
+}
 
-    // main serial processing
-    if(usb_serial_available() > 0) {
-      char c = (char)usb_serial_getchar();
-      if(c==BINARY_MODE_CHAR) { //  handle binary mode for one transaction
-        r = receive_serial_binary_transaction(tx_buffer, MAX_BUFFER_SIZE); // blocking
-        if(r == BINARY_TRANSACTION_OK)
-          r = binary_mode_transaction(tx_buffer, SHA204_RSP_SIZE_MAX, rx_buffer, &sha204); // blocking
-        // transmit the response
-        usb_serial_putchar(r);
-        if(r == BINARY_TRANSACTION_OK)
-          for(r=0; r<rx_buffer[0]; r++)
-            usb_serial_putchar(rx_buffer[r]);
-      } else {
-        if(idle)
-          Wl("--- I ---");
-        else
-          Wl("--- S ---");
-        switch(c) { // yes, code like this sucks
-          case 'i': // serial number
-            Wl("Request serial number.");
-            sha204.wakeup(rx_buffer);
-            r = sha204.serialNumber(rx_buffer);
-            print_executing();
-            print_return_code(r);
-            Wl("Should get:  01 23 xx xx xx xx xx xx EE");
-            W("Received SN: ");
-            hexprint(rx_buffer, 9);
-            if(idle) { sha204.idle(); } else { sha204.sleep(); }
-            break;
-          case 'o': // config zone
-            Wl("Request and display config zone contents.");
-            print_executing();
-            memset(configuration_zone,0,32);
-            if(!(r=sha204.wakeup(rx_buffer))) { // read first 2 32-byte blocks manually
-              if(!(r=sha204.read(tx_buffer,rx_buffer,SHA204_ZONE_CONFIG|READ_ZONE_MODE_32_BYTES,0))) {
-                memcpy(configuration_zone,rx_buffer+1,32);
-                if(!(r=sha204.read(tx_buffer,rx_buffer,SHA204_ZONE_CONFIG|READ_ZONE_MODE_32_BYTES,32))) {
-                  memcpy(configuration_zone+32, rx_buffer+1, 32);
-                  uint8_t addr = 64; // have to read the rest of the zone in 4-byte blocks
-                  while(addr < 88) {
-                    if((r=sha204.read(tx_buffer,rx_buffer,SHA204_ZONE_CONFIG,addr)))
-                      break;
-                    memcpy(configuration_zone+addr, rx_buffer+1, 4);
-                    addr+=4;
-                  }
-                }
-              }
-            }
-            if(idle) { sha204.idle(); } else { sha204.sleep(); }
-            print_return_code(r);
-            if(!r)
-              process_config(configuration_zone);
-            break;
-          case 'c': // check_mac
-            Wl("Calculate and compare MAC (CheckMAC command).");
-            Wl("Enter mode (1 byte; default 0):");
-            param1 = 0;
-            if(1 == get_bytes_serial(tx_buffer, 1))
-              param1 = tx_buffer[0];
-            Wl("Enter Slot ID (1 byte; default 0):");
-            param2 = 0;
-            if(1 == get_bytes_serial(tx_buffer, 1))
-              param2 = tx_buffer[0];
-            Wl("Enter client challenge (32 bytes; default 0):");
-            memset((void *)data1, 0, 32);
-            get_bytes_serial(data1, 32);
-            Wl("Enter client response (32 bytes; default 0):");
-            memset((void *)data2, 0, 32);
-            get_bytes_serial(data2, 32);
-            Wl("Enter other data (13 bytes; default 0):");
-            memset((void *)data3, 0, 13);
-            get_bytes_serial(data3, 13);
-            print_execute_params(SHA204_CHECKMAC,param1);
-            hexprint_byte_sep((uint8_t)param2);
-            W("data1 ");
-            hexprint(data1, 32);
-            W("data2 ");
-            hexprint(data2, 32);
-            W("data3 ");
-            hexprint(data3, 13);
-            print_executing();
-            sha204.wakeup(rx_buffer);
-            r = sha204.check_mac(tx_buffer, rx_buffer, param1, param2, data1, data2, data3);
-            if(idle) { sha204.idle(); } else { sha204.sleep(); }
-            print_return_code(r);
-            print_received_from_sha(rx_buffer);
-            break;
-          case 'd': // derive_key
-            Wl("Combine current key with nonce and store in a key slot (DeriveKey command).");
-            Wl("Enter random (1 byte: 00 or 04; default 0):");
-            param1 = 0;
-            if(1 == get_bytes_serial(tx_buffer, 1))
-              param1 = tx_buffer[0];
-            Wl("Enter Target Slot ID (1 byte; default 0):");
-            param2 = 0;
-            if(1 == get_bytes_serial(tx_buffer, 1))
-              param2 = tx_buffer[0];
-            Wl("Enter MAC for validation (0 or 32 bytes; default 0):");
-            memset((void *)data1, 0, 32);
-            get_bytes_serial(data1, 32);
-            print_execute_params(SHA204_DERIVE_KEY,param1);
-            hexprint_byte_sep((uint8_t)param2);
-            W("data1 ");
-            hexprint(data1, 32);
-            print_executing();
-            sha204.wakeup(rx_buffer);
-            r = sha204.derive_key(tx_buffer, rx_buffer, param1, param2, data1);
-            if(idle) { sha204.idle(); } else { sha204.sleep(); }
-            print_return_code(r);
-            print_received_from_sha(rx_buffer);
-            break;
-          case 'v': // dev_rev
-            Wl("Request device revision.");
-            sha204.wakeup(rx_buffer);
-            r = sha204.dev_rev(tx_buffer, rx_buffer);
-            print_executing();
-            print_return_code(r);
-            print_received_from_sha(rx_buffer);
-            if(idle) { sha204.idle(); } else { sha204.sleep(); }
-            break;
-          case 'g': // gen_dig
-            Wl("Compute SHA-256 from TempKey+stored value, store result in TempKey (GenDig command).");
-            Wl("Enter zone (1 byte: 00/Config or 01/OTP or 02/Data; default 0):");
-            param1 = 0;
-            if(1 == get_bytes_serial(tx_buffer, 1))
-              param1 = tx_buffer[0];
-            Wl("Enter Key ID / OTP slot ID (1 byte; default 0):");
-            param2 = 0;
-            if(1 == get_bytes_serial(tx_buffer, 1))
-              param2 = tx_buffer[0];
-            Wl("Enter other data (4 bytes when CheckKey, otherwise ignored; default 0):");
-            memset((void *)data1, 0, 4);
-            get_bytes_serial(data1, 4);
-            print_execute_params(SHA204_GENDIG,param1);
-            hexprint_byte_sep((uint8_t)param2);
-            W("data1 ");
-            hexprint(data1, 4);
-            print_executing();
-            sha204.wakeup(rx_buffer);
-            r = sha204.gen_dig(tx_buffer, rx_buffer, param1, param2, data1);
-            if(idle) { sha204.idle(); } else { sha204.sleep(); }
-            print_return_code(r);
-            print_received_from_sha(rx_buffer);
-            break;
-          case 'h': // HMAC
-            Wl("Compute HMAC/SHA-256 digest from key + other info on device (HMAC command).");
-            Wl("Enter mode (1 byte; default 0):");
-            param1 = 0;
-            if(1 == get_bytes_serial(tx_buffer, 1))
-              param1 = tx_buffer[0];
-            Wl("Enter Slot ID (2 bytes; default 0):");
-            param2 = 0;
-            if(2 == get_bytes_serial(tx_buffer, 2))
-              param2 = tx_buffer[0]*256 + tx_buffer[1];
-            print_execute_params(SHA204_HMAC,param1);
-            hexprint_byte_sep((uint8_t)(param2>>8));
-            hexprint_byte((uint8_t)param2);
-            W("\n\r");
-            print_executing();
-            sha204.wakeup(rx_buffer);
-            r = sha204.hmac(tx_buffer, rx_buffer, param1, param2);
-            if(idle) { sha204.idle(); } else { sha204.sleep(); }
-            print_return_code(r);
-            print_received_from_sha(rx_buffer);
-            break;
-          case 'm': // mac
-            Wl("Compute SHA-256 from key + challenge + other info on device (MAC command).");
-            Wl("Enter mode (1 byte; default 0):");
-            param1 = 0;
-            if(1 == get_bytes_serial(tx_buffer, 1))
-              param1 = tx_buffer[0];
-            Wl("Enter Slot ID (2 bytes; default 0):");
-            param2 = 0;
-            if(2 == get_bytes_serial(tx_buffer, 2))
-              param2 = tx_buffer[0]*256 + tx_buffer[1];
-            Wl("Enter challenge (32 bytes; default 0):");
-            memset((void *)data1, 0, 32);
-            get_bytes_serial(data1, 32);
-            print_execute_params(SHA204_MAC,param1);
-            hexprint_byte_sep((uint8_t)(param2>>8));
-            hexprint_byte_sep((uint8_t)param2);
-            W("data1 ");
-            hexprint(data1, 32);
-            print_executing();
-            sha204.wakeup(rx_buffer);
-            r = sha204.mac(tx_buffer, rx_buffer, param1, param2, data1);
-            if(idle) { sha204.idle(); } else { sha204.sleep(); }
-            print_return_code(r);
-            print_received_from_sha(rx_buffer);
-            break;
-          case 'n': // nonce
-            Wl("Generate a nonce for subsequent use by other commands (Nonce command).");
-            Wl("Enter mode (00 to 03; default 0):");
-            param1 = 0;
-            if(1 == get_bytes_serial(tx_buffer, 1))
-              param1 = tx_buffer[0];
-            Wl("Enter input value (20 or 32 bytes (dep on mode); default all 0):");
-            memset((void *)data1, 0, 32);
-            get_bytes_serial(data1, 32);
-            print_execute_params(SHA204_NONCE, param1);
-            Wl("none");
-            print_executing();
-            sha204.wakeup(rx_buffer);
-            r = sha204.nonce(tx_buffer,rx_buffer,param1,data1);
-            if(idle) { sha204.idle(); } else { sha204.sleep(); }
-            print_return_code(r);
-            print_received_from_sha(rx_buffer);
-            break;
-          case 'r': // random
-            Wl("Generate a random sequence.");
-            Wl("Enter mode (00 or 01; default 0):");
-            param1 = 0;
-            if(1 == get_bytes_serial(tx_buffer, 1))
-              param1 = tx_buffer[0];
-            print_execute_params(SHA204_RANDOM,param1);
-            Wl("none");
-            print_executing();
-            sha204.wakeup(rx_buffer);
-            r = sha204.random(tx_buffer,rx_buffer,param1);
-            if(idle) { sha204.idle(); } else { sha204.sleep(); }
-            print_return_code(r);
-            print_received_from_sha(rx_buffer);
-            break;
-          case 'e': // read
-            Wl("Read from device.");
-            Wl("Enter zone (1 byte: 00/Config or 01/OTP or 02/Data, +0x80 to read 32 instead of 4 bytes; default 0):");
-            param1 = 0;
-            if(1 == get_bytes_serial(tx_buffer, 1))
-              param1 = tx_buffer[0];
-            Wl("Enter Address (2 bytes; default 0):");
-            param2 = 0;
-            if(2 == get_bytes_serial(tx_buffer, 2))
-              param2 = tx_buffer[0]*256 + tx_buffer[1];
-            print_execute_params(SHA204_READ,param1);
-            hexprint_byte_sep((uint8_t)(param2>>8));
-            hexprint_byte((uint8_t)param2);
-            W("\n\r");
-            print_executing();
-            sha204.wakeup(rx_buffer);
-            r = sha204.read(tx_buffer, rx_buffer, param1, param2);
-            if(idle) { sha204.idle(); } else { sha204.sleep(); }
-            print_return_code(r);
-            print_received_from_sha(rx_buffer);
-            break;
-          case 'w': // write
-            Wl("Write to device.");
-            Wl("Enter zone (1 byte: 00/Config or 01/OTP or 02/Data,");
-            Wl("  +0x80 to write 32 instead of 4 bytes, +0x40 to require encryption; default 0):");
-            param1 = 0;
-            if(1 == get_bytes_serial(tx_buffer, 1))
-              param1 = tx_buffer[0];
-            Wl("Enter Address (2 bytes; default 0):");
-            param2 = 0;
-            if(2 == get_bytes_serial(tx_buffer, 2))
-              param2 = tx_buffer[0]*256 + tx_buffer[1];
-            Wl("Enter data (4 or 32 bytes; default 0):");
-            memset((void *)data1, 0, 32);
-            get_bytes_serial(data1, 32);
-            Wl("Enter MAC to validate address and data (0 or 32 bytes; default 0):");
-            memset((void *)data2, 0, 32);
-            get_bytes_serial(data2, 32);
-            print_execute_params(SHA204_WRITE,param1);
-            hexprint_byte_sep((uint8_t)(param2>>8));
-            hexprint_byte_sep((uint8_t)param2);
-            W("data1 ");
-            hexprint_noln(data1, 32);
-            W("data2 ");
-            hexprint(data2, 32);
-            print_executing();
-            sha204.wakeup(rx_buffer);
-            r = sha204.write(tx_buffer, rx_buffer, param1, param2, data1, data2);
-            if(idle) { sha204.idle(); } else { sha204.sleep(); }
-            print_return_code(r);
-            print_received_from_sha(rx_buffer);
-            break;
-          case 'u': // update_extra
-            Wl("Update 'UserExtra' bytes (84 and 85) in the Conf zone after locking.");
-            Wl("Enter mode (1 byte: 00->update 84, 01->update 85; default 0):");
-            param1 = 0;
-            if(1 == get_bytes_serial(tx_buffer, 1))
-              param1 = tx_buffer[0];
-            Wl("Enter new value (1 byte; default 0):");
-            param2 = 0;
-            if(1 == get_bytes_serial(tx_buffer, 1))
-              param2 = tx_buffer[0];
-            print_execute_params(SHA204_UPDATE_EXTRA,param1);
-            hexprint_byte((uint8_t)param2);
-            W("\n\r");
-            print_executing();
-            sha204.wakeup(rx_buffer);
-            r = sha204.update_extra(tx_buffer, rx_buffer, param1, param2);
-            if(idle) { sha204.idle(); } else { sha204.sleep(); }
-            print_return_code(r);
-            print_received_from_sha(rx_buffer);
-            break;
-          case 's': // SHA
-            Wl("Compute SHA256 of 64 bytes of data.");
-            Wl("Enter message (64 bytes; default 0):");
-            memset((void *)data1, 0, 64);
-            get_bytes_serial(data1, 64);
-            param1=0;
-            print_execute_params(SHA204_SHA, param1);
-            Wl("0x0000");
-            print_executing();
-            sha204.wakeup(rx_buffer);
-            r = sha204.sha(tx_buffer, rx_buffer, param1, NULL);
-            print_return_code(r);
-            print_received_from_sha(rx_buffer);
-            param1 = 1;
-            print_execute_params(SHA204_SHA, param1);
-            W("0x0000 data1 ");
-            hexprint(data1, 64);
-            print_executing();
-            r = sha204.sha(tx_buffer, rx_buffer, param1, data1);
-            if(idle) { sha204.idle(); } else { sha204.sleep(); }
-            print_return_code(r);
-            print_received_from_sha(rx_buffer);
-            break;
-          case 'k': // wake
-            Wl("Test waking up.");
-            print_executing();
-            r = sha204.wakeup(rx_buffer);
-            if(idle) { sha204.idle(); } else { sha204.sleep(); }
-            print_return_code(r);
-            Wl("Should receive:         04 11 33 43");
-            print_received_from_sha(rx_buffer);
-            break;
-          case 'L': // lock
-            Wl("Lock a zone. This is a one time thing! Once you lock a zone, it CAN'T BE UNLOCKED. EVER!");
-            Wl("Enter zone (1 byte: 00/Config or 01/OTP_or_Data, +0x80 for 'force' (CRC ignored); default 0):");
-            param1 = 0;
-            if(1 == get_bytes_serial(tx_buffer, 1))
-              param1 = tx_buffer[0];
-            Wl("Enter Summary / CRC-16 of the zone (2 bytes, should be 0 if 'force'; default 0):");
-            param2 = 0;
-            if(2 == get_bytes_serial(tx_buffer, 2))
-              param2 = tx_buffer[0]*256 + tx_buffer[1];
-            print_execute_params(SHA204_LOCK,param1);
-            hexprint_byte_sep((uint8_t)(param2>>8));
-            hexprint_byte((uint8_t)param2);
-            W("\n\r");
-            print_executing();
-            sha204.wakeup(rx_buffer);
-            r = sha204.lock(tx_buffer, rx_buffer, param1, param2);
-            if(idle) { sha204.idle(); } else { sha204.sleep(); }
-            print_return_code(r);
-            print_received_from_sha(rx_buffer);
-            break;
-          case '\r': // enter
-          case '?': // help
-            print_help();
-            break;
-          case 'I': // switch idle and sleep
-            W("Switching whether the ATSHA should be put to sleep or to idle mode after commands.\n\rCurrent setting: ");
-            if(idle) {
-              idle = 0;
-              Wl("Sleep.");
-            }
-            else {
-              idle = 1;
-              Wl("Idle.");
-            }
-            break;
-          default:
-            break;
-        }
-      }
+/* ATSHA204: the queued binary mode requests (a running command is polled on every pass) */
+uint32_t sha204_task(void *arg) {
+  playground_t *pg = (playground_t *)arg;
+
+#ifdef SHA204_TRACE
+  binary_queue_service(&pg->queue, pg->rx_buffer, &pg->sha204, &pg->read_cache, &pg->stats, &pg->trace, pg->serial);
+#else
+  binary_queue_service(&pg->queue, pg->rx_buffer, &pg->sha204, &pg->read_cache, &pg->stats, 0, pg->serial);
+#endif
+  if(!binary_queue_head(&pg->queue))
+    return SCHEDULER_SUSPEND;
+  // while the chip executes, sleep until the response is due
+  return pg->sha204.busy() ? pg->sha204.poll_wait() : 0;
+}
+
+/* ATSHA204: idle/sleep the chip once it is not kept awake for the next request anymore */
+uint32_t governor_task(void *arg) {
+  uint32_t wait = ((playground_t *)arg)->sha204.governor_service();
+  return (wait && wait < GOVERNOR_TASK_PERIOD_US) ? wait : GOVERNOR_TASK_PERIOD_US;
+}
+
+/* Serial input: binary mode frames (also while earlier requests execute),
+ *  binary mode v1 and the interactive commands */
+uint32_t serial_task(void *arg) {
+  playground_t *pg = (playground_t *)arg;
+  binary_frame_t *frame = binary_queue_tail(&pg->queue);
+  uint8_t tx_buffer[MAX_BUFFER_SIZE];
+  uint8_t ret_code;
+  uint8_t r;
+
+  if(frame && binary_frame_active(frame)) {
+    r = binary_frame_receive(frame);
+    if(r == BINARY_STATUS_OK) {
+      binary_queue_push(&pg->queue);
+      scheduler_wake(pg->sha204_task);
+    } else if(r != BINARY_FRAME_INCOMPLETE)
+      binary_frame_send(frame->request_id, r, 0, 0);
+  } else if(binary_queue_head(&pg->queue)) {
+    // requests pending: only more frames are expected (a full queue waits),
+    //  anything else is dropped and counted
+    if(frame && usb_serial_available() > 0) {
+      if((uint8_t)usb_serial_getchar() == BINARY_FRAME_SOF)
+        binary_frame_start(frame);
+      else
+        binary_frame_dropped();
     }
+  }
+  // main serial processing
+  else if(usb_serial_available() > 0) {
+    char c = (char)usb_serial_getchar();
+    if((uint8_t)c == BINARY_FRAME_SOF) {
+      binary_frame_start(frame);
+    } else if(c==BINARY_MODE_CHAR) { //  handle binary mode for one transaction
+      r = receive_serial_binary_transaction(tx_buffer, MAX_BUFFER_SIZE); // blocking
+      if(r == BINARY_TRANSACTION_OK)
+        r = binary_mode_transaction(tx_buffer, SHA204_RSP_SIZE_MAX, pg->rx_buffer, &pg->sha204, &ret_code); // blocking
+      // transmit the response
+      usb_serial_putchar(r);
+      if(r == BINARY_TRANSACTION_OK)
+        usb_serial_write_bytes(pg->rx_buffer, pg->rx_buffer[0]);
+      usb_serial_flush_output();
+    } else {
+      menu_command(c, pg); // blocking
+    }
+  }
+  return (usb_serial_available() > 0) ? 0 : SERIAL_TASK_PERIOD_US;
+}
+
+/* Button (the period debounces it) */
+uint32_t button_task(void *arg) {
+  static bool button_press_registered = false;
+  uint32_t button_press_length;
+  (void) arg;
+
+  // run the task which checks the state of the button
+  service_button();
+  // for how long was the button pressed?
+  button_press_length = button_pressed_for();
+  // if at least 70ms and we haven't acted on this press yet
+  if( button_press_length >= 7 && !button_press_registered ) {
+    // remember that we've acted on the current button press
+    button_press_registered = true;
+    // announce the button press over the serial
+    Wl("Button pressed.");
+    // maybe do something else...
+  }
+  // was the button released after being pressed?
+  if( button_press_registered && button_press_length < 7 ) {
+    button_press_registered = false;
+  }
+  return BUTTON_TASK_PERIOD_US;
+}
 
-    /* Must throw away unused bytes from the host, or it will lock up while waiting for the device */
-    //usb_serial_flush_input();
+#if (SAVE_LATENCY_TO_EEPROM)
+/* Background: keep the learned execution times */
+uint32_t latency_task(void *arg) {
+  save_latency_estimates(&((playground_t *)arg)->sha204);
+  return LATENCY_SAVE_INTERVAL_US;
+}
+#endif
+
+/* Interactive commands */
+void menu_command(char c, playground_t *pg) {
+  SHA204CLASS &sha204 = pg->sha204;
+  uint8_t *rx_buffer = pg->rx_buffer;
+  uint8_t tx_buffer[MAX_BUFFER_SIZE];
+  uint8_t configuration_zone[SHA204_ZONE_SIZE_CONFIG];
+  uint8_t r;
+  uint8_t param1;
+  uint16_t param2;
+  uint8_t data1[64];
+  uint8_t data2[32];
+  uint8_t data3[14];
 
-    usb_tasks();
+  if(idle)
+    Wl("--- I ---");
+  else
+    Wl("--- S ---");
+  switch(c) { // yes, code like this sucks
+    case 'i': // serial number
+      Wl("Request serial number.");
+      sha204.acquire(rx_buffer);
+      r = sha204.serialNumber(rx_buffer);
+      print_executing();
+      print_return_code(r);
+      Wl("Should get:  01 23 xx xx xx xx xx xx EE");
+      W("Received SN: ");
+      hexprint(rx_buffer, 9);
+      sha204.release(idle);
+      break;
+    case 'o': // config zone
+      Wl("Request and display config zone contents.");
+      print_executing();
+      { // one wake-up for the whole zone
+        SHA204WakeSession<SHA204CLASS> session(sha204, rx_buffer, idle);
+        if(!(r=session.status()))
+          r = sha204.read_zone(SHA204_ZONE_CONFIG, 0, SHA204_ZONE_SIZE_CONFIG, configuration_zone);
+      }
+      print_return_code(r);
+      if(!r)
+        process_config(configuration_zone);
+      break;
+    case 'c': // check_mac
+      Wl("Calculate and compare MAC (CheckMAC command).");
+      Wl("Enter mode (1 byte; default 0):");
+      param1 = 0;
+      if(1 == get_bytes_serial(tx_buffer, 1))
+        param1 = tx_buffer[0];
+      Wl("Enter Slot ID (1 byte; default 0):");
+      param2 = 0;
+      if(1 == get_bytes_serial(tx_buffer, 1))
+        param2 = tx_buffer[0];
+      Wl("Enter client challenge (32 bytes; default 0):");
+      memset((void *)data1, 0, 32);
+      get_bytes_serial(data1, 32);
+      Wl("Enter client response (32 bytes; default 0):");
+      memset((void *)data2, 0, 32);
+      get_bytes_serial(data2, 32);
+      Wl("Enter other data (13 bytes; default 0):");
+      memset((void *)data3, 0, 13);
+      get_bytes_serial(data3, 13);
+      print_execute_params(SHA204_CHECKMAC,param1);
+      hexprint_byte_sep((uint8_t)param2);
+      W("data1 ");
+      hexprint(data1, 32);
+      W("data2 ");
+      hexprint(data2, 32);
+      W("data3 ");
+      hexprint(data3, 13);
+      print_executing();
+      sha204.acquire(rx_buffer);
+      r = sha204.check_mac(tx_buffer, rx_buffer, param1, param2, data1, data2, data3);
+      sha204.release(idle);
+      print_return_code(r);
+      print_received_from_sha(rx_buffer);
+      break;
+    case 'd': // derive_key
+      Wl("Combine current key with nonce and store in a key slot (DeriveKey command).");
+      Wl("Enter random (1 byte: 00 or 04; default 0):");
+      param1 = 0;
+      if(1 == get_bytes_serial(tx_buffer, 1))
+        param1 = tx_buffer[0];
+      Wl("Enter Target Slot ID (1 byte; default 0):");
+      param2 = 0;
+      if(1 == get_bytes_serial(tx_buffer, 1))
+        param2 = tx_buffer[0];
+      Wl("Enter MAC for validation (0 or 32 bytes; default 0):");
+      memset((void *)data1, 0, 32);
+      get_bytes_serial(data1, 32);
+      print_execute_params(SHA204_DERIVE_KEY,param1);
+      hexprint_byte_sep((uint8_t)param2);
+      W("data1 ");
+      hexprint(data1, 32);
+      print_executing();
+      sha204.acquire(rx_buffer);
+      r = sha204.derive_key(tx_buffer, rx_buffer, param1, param2, data1);
+      sha204.release(idle);
+      print_return_code(r);
+      print_received_from_sha(rx_buffer);
+      break;
+    case 'v': // dev_rev
+      Wl("Request device revision.");
+      sha204.acquire(rx_buffer);
+      r = sha204.fixed(&sha204_cmd_dev_rev, rx_buffer);
+      print_executing();
+      print_return_code(r);
+      print_received_from_sha(rx_buffer);
+      sha204.release(idle);
+      break;
+    case 'g': // gen_dig
+      Wl("Compute SHA-256 from TempKey+stored value, store result in TempKey (GenDig command).");
+      Wl("Enter zone (1 byte: 00/Config or 01/OTP or 02/Data; default 0):");
+      param1 = 0;
+      if(1 == get_bytes_serial(tx_buffer, 1))
+        param1 = tx_buffer[0];
+      Wl("Enter Key ID / OTP slot ID (1 byte; default 0):");
+      param2 = 0;
+      if(1 == get_bytes_serial(tx_buffer, 1))
+        param2 = tx_buffer[0];
+      Wl("Enter other data (4 bytes when CheckKey, otherwise ignored; default 0):");
+      memset((void *)data1, 0, 4);
+      get_bytes_serial(data1, 4);
+      print_execute_params(SHA204_GENDIG,param1);
+      hexprint_byte_sep((uint8_t)param2);
+      W("data1 ");
+      hexprint(data1, 4);
+      print_executing();
+      sha204.acquire(rx_buffer);
+      r = sha204.gen_dig(tx_buffer, rx_buffer, param1, param2, data1);
+      sha204.release(idle);
+      print_return_code(r);
+      print_received_from_sha(rx_buffer);
+      break;
+    case 'h': // HMAC
+      Wl("Compute HMAC/SHA-256 digest from key + other info on device (HMAC command).");
+      Wl("Enter mode (1 byte; default 0):");
+      param1 = 0;
+      if(1 == get_bytes_serial(tx_buffer, 1))
+        param1 = tx_buffer[0];
+      Wl("Enter Slot ID (2 bytes; default 0):");
+      param2 = 0;
+      if(2 == get_bytes_serial(tx_buffer, 2))
+        param2 = tx_buffer[0]*256 + tx_buffer[1];
+      print_execute_params(SHA204_HMAC,param1);
+      hexprint_byte_sep((uint8_t)(param2>>8));
+      hexprint_byte((uint8_t)param2);
+      W("\n\r");
+      print_executing();
+      sha204.acquire(rx_buffer);
+      r = sha204.hmac(tx_buffer, rx_buffer, param1, param2);
+      sha204.release(idle);
+      print_return_code(r);
+      print_received_from_sha(rx_buffer);
+      break;
+    case 'm': // mac
+      Wl("Compute SHA-256 from key + challenge + other info on device (MAC command).");
+      Wl("Enter mode (1 byte; default 0):");
+      param1 = 0;
+      if(1 == get_bytes_serial(tx_buffer, 1))
+        param1 = tx_buffer[0];
+      Wl("Enter Slot ID (2 bytes; default 0):");
+      param2 = 0;
+      if(2 == get_bytes_serial(tx_buffer, 2))
+        param2 = tx_buffer[0]*256 + tx_buffer[1];
+      Wl("Enter challenge (32 bytes; default 0):");
+      memset((void *)data1, 0, 32);
+      get_bytes_serial(data1, 32);
+      print_execute_params(SHA204_MAC,param1);
+      hexprint_byte_sep((uint8_t)(param2>>8));
+      hexprint_byte_sep((uint8_t)param2);
+      W("data1 ");
+      hexprint(data1, 32);
+      print_executing();
+      sha204.acquire(rx_buffer);
+      r = sha204.mac(tx_buffer, rx_buffer, param1, param2, data1);
+      sha204.release(idle);
+      print_return_code(r);
+      print_received_from_sha(rx_buffer);
+      break;
+    case 'n': // nonce
+      Wl("Generate a nonce for subsequent use by other commands (Nonce command).");
+      Wl("Enter mode (00 to 03; default 0):");
+      param1 = 0;
+      if(1 == get_bytes_serial(tx_buffer, 1))
+        param1 = tx_buffer[0];
+      Wl("Enter input value (20 or 32 bytes (dep on mode); default all 0):");
+      memset((void *)data1, 0, 32);
+      get_bytes_serial(data1, 32);
+      print_execute_params(SHA204_NONCE, param1);
+      Wl("none");
+      print_executing();
+      sha204.acquire(rx_buffer);
+      r = sha204.nonce(tx_buffer,rx_buffer,param1,data1);
+      sha204.release(idle);
+      print_return_code(r);
+      print_received_from_sha(rx_buffer);
+      break;
+    case 'r': // random
+      Wl("Generate a random sequence.");
+      Wl("Enter mode (00 or 01; default 0):");
+      param1 = 0;
+      if(1 == get_bytes_serial(tx_buffer, 1))
+        param1 = tx_buffer[0];
+      print_execute_params(SHA204_RANDOM,param1);
+      Wl("none");
+      print_executing();
+      sha204.acquire(rx_buffer);
+      r = sha204.random(tx_buffer,rx_buffer,param1);
+      sha204.release(idle);
+      print_return_code(r);
+      print_received_from_sha(rx_buffer);
+      break;
+    case 'e': // read
+      Wl("Read from device.");
+      Wl("Enter zone (1 byte: 00/Config or 01/OTP or 02/Data, +0x80 to read 32 instead of 4 bytes; default 0):");
+      param1 = 0;
+      if(1 == get_bytes_serial(tx_buffer, 1))
+        param1 = tx_buffer[0];
+      Wl("Enter Address (2 bytes; default 0):");
+      param2 = 0;
+      if(2 == get_bytes_serial(tx_buffer, 2))
+        param2 = tx_buffer[0]*256 + tx_buffer[1];
+      print_execute_params(SHA204_READ,param1);
+      hexprint_byte_sep((uint8_t)(param2>>8));
+      hexprint_byte((uint8_t)param2);
+      W("\n\r");
+      print_executing();
+      sha204.acquire(rx_buffer);
+      r = sha204.read(tx_buffer, rx_buffer, param1, param2);
+      sha204.release(idle);
+      print_return_code(r);
+      print_received_from_sha(rx_buffer);
+      break;
+    case 'w': // write
+      Wl("Write to device.");
+      Wl("Enter zone (1 byte: 00/Config or 01/OTP or 02/Data,");
+      Wl("  +0x80 to write 32 instead of 4 bytes, +0x40 to require encryption; default 0):");
+      param1 = 0;
+      if(1 == get_bytes_serial(tx_buffer, 1))
+        param1 = tx_buffer[0];
+      Wl("Enter Address (2 bytes; default 0):");
+      param2 = 0;
+      if(2 == get_bytes_serial(tx_buffer, 2))
+        param2 = tx_buffer[0]*256 + tx_buffer[1];
+      Wl("Enter data (4 or 32 bytes; default 0):");
+      memset((void *)data1, 0, 32);
+      get_bytes_serial(data1, 32);
+      Wl("Enter MAC to validate address and data (0 or 32 bytes; default 0):");
+      memset((void *)data2, 0, 32);
+      get_bytes_serial(data2, 32);
+      print_execute_params(SHA204_WRITE,param1);
+      hexprint_byte_sep((uint8_t)(param2>>8));
+      hexprint_byte_sep((uint8_t)param2);
+      W("data1 ");
+      hexprint_noln(data1, 32);
+      W("data2 ");
+      hexprint(data2, 32);
+      print_executing();
+      sha204.acquire(rx_buffer);
+      r = sha204.write(tx_buffer, rx_buffer, param1, param2, data1, data2);
+      sha204.release(idle);
+      print_return_code(r);
+      print_received_from_sha(rx_buffer);
+      break;
+    case 'u': // update_extra
+      Wl("Update 'UserExtra' bytes (84 and 85) in the Conf zone after locking.");
+      Wl("Enter mode (1 byte: 00->update 84, 01->update 85; default 0):");
+      param1 = 0;
+      if(1 == get_bytes_serial(tx_buffer, 1))
+        param1 = tx_buffer[0];
+      Wl("Enter new value (1 byte; default 0):");
+      param2 = 0;
+      if(1 == get_bytes_serial(tx_buffer, 1))
+        param2 = tx_buffer[0];
+      print_execute_params(SHA204_UPDATE_EXTRA,param1);
+      hexprint_byte((uint8_t)param2);
+      W("\n\r");
+      print_executing();
+      sha204.acquire(rx_buffer);
+      r = sha204.update_extra(tx_buffer, rx_buffer, param1, param2);
+      sha204.release(idle);
+      print_return_code(r);
+      print_received_from_sha(rx_buffer);
+      break;
+    case 's': // SHA
+      Wl("Compute SHA256 of 64 bytes of data.");
+      Wl("Enter message (64 bytes; default 0):");
+      memset((void *)data1, 0, 64);
+      get_bytes_serial(data1, 64);
+      param1=0;
+      print_execute_params(SHA204_SHA, param1);
+      Wl("0x0000");
+      print_executing();
+      sha204.acquire(rx_buffer);
+      r = sha204.sha(tx_buffer, rx_buffer, param1, NULL);
+      print_return_code(r);
+      print_received_from_sha(rx_buffer);
+      param1 = 1;
+      print_execute_params(SHA204_SHA, param1);
+      W("0x0000 data1 ");
+      hexprint(data1, 64);
+      print_executing();
+      r = sha204.sha(tx_buffer, rx_buffer, param1, data1);
+      sha204.release(idle);
+      print_return_code(r);
+      print_received_from_sha(rx_buffer);
+      break;
+    case 'k': // wake
+      Wl("Test waking up.");
+      print_executing();
+      sha204.park(idle); // an awake chip would ignore the wake pulse
+      r = sha204.wakeup(rx_buffer);
+      sha204.release(idle);
+      print_return_code(r);
+      Wl("Should receive:         04 11 33 43");
+      print_received_from_sha(rx_buffer);
+      break;
+    case 'L': // lock
+      Wl("Lock a zone. This is a one time thing! Once you lock a zone, it CAN'T BE UNLOCKED. EVER!");
+      Wl("Enter zone (1 byte: 00/Config or 01/OTP_or_Data, +0x80 for 'force' (CRC ignored); default 0):");
+      param1 = 0;
+      if(1 == get_bytes_serial(tx_buffer, 1))
+        param1 = tx_buffer[0];
+      Wl("Enter Summary / CRC-16 of the zone (2 bytes, should be 0 if 'force'; default 0):");
+      param2 = 0;
+      if(2 == get_bytes_serial(tx_buffer, 2))
+        param2 = tx_buffer[0]*256 + tx_buffer[1];
+      print_execute_params(SHA204_LOCK,param1);
+      hexprint_byte_sep((uint8_t)(param2>>8));
+      hexprint_byte((uint8_t)param2);
+      W("\n\r");
+      print_executing();
+      sha204.acquire(rx_buffer);
+      r = sha204.lock(tx_buffer, rx_buffer, param1, param2);
+      sha204.release(idle);
+      print_return_code(r);
+      print_received_from_sha(rx_buffer);
+      break;
+    case '\r': // enter
+    case '?': // help
+      print_help();
+      break;
+    case 'I': // switch idle and sleep
+      W("Switching whether the ATSHA should be put to sleep or to idle mode after commands.\n\rCurrent setting: ");
+      if(idle) {
+        idle = 0;
+        Wl("Sleep.");
+      }
+      else {
+        idle = 1;
+        Wl("Idle.");
+      }
+      break;
+    case 'S': // statistics
+      print_stats(&sha204, &pg->read_cache, &pg->stats);
+      break;
+    case 'G': // switch the governor policy
+      W("Switching whether the ATSHA is kept awake between commands which come quickly after each other.\n\rCurrent setting: ");
+      if(adaptive_governor) {
+        adaptive_governor = 0;
+        sha204.set_governor_policy(SHA204_GOVERNOR_IMMEDIATE);
+        Wl("Never.");
+      }
+      else {
+        adaptive_governor = 1;
+        sha204.set_governor_policy(SHA204_GOVERNOR_ADAPTIVE);
+        Wl("Adaptive.");
+      }
+      print_stats(&sha204, &pg->read_cache, &pg->stats);
+      break;
+    default:
+      break;
   }
 }
 
@@ -545,6 +742,13 @@ void hexprint_byte_sep(uint8_t b) {
   usb_serial_putchar(hexprint_separator);
 }
 
+void hexprint_32(uint32_t v) {
+  hexprint_byte((uint8_t)(v>>24));
+  hexprint_byte((uint8_t)(v>>16));
+  hexprint_byte((uint8_t)(v>>8));
+  hexprint_byte((uint8_t)v);
+}
+
 void hexprint_noln(uint8_t *p, uint16_t length) {
   for(uint16_t i=0; i<length; i++) {
     hexprint_byte(p[i]);
@@ -571,13 +775,14 @@ void print_help(void) {
   Wl("Raw commands: wa[k]e [c]heckMAC [d]erive_key dev_re[v]ision [g]en_dig [h]MAC");
   Wl("              [m]ac [n]once [r]andom r[e]ad [w]rite [u]date_extra [s]ha");
   Wl("Processed commands: ser[i]al c[o]nfig_zone");
-  Wl("Playground config: [I]dle-or-sleep");
+  Wl("Playground config: [I]dle-or-sleep [G]overnor [S]tatistics");
   Wl("'?' -> this help");
   Wl("Dangerous/one-time only! [L]ock\n\r");
   Wl("Additional comments:");
   Wl(" - Format of ATSHA204 command responses:");
   Wl("    <1byte:packet_size> <msg_byte> <msg_byte> ... <1byte:crc_1> <1byte:crc_2>");
   Wl(" - ATSHA204 is sent to sleep or to idle mode after every command, select via [I].");
+  Wl("    With the governor on [G], it stays awake in between if the commands come in quick succession.");
   Wl(" - The 'sent packet' info does not always match what's actually exactly sent. It's provided");
   Wl("    mainly to check the entered parameters.");
   Wl(" - Input, when requested, is expected in (padded) HEX format, e.g. 'AB01' for two bytes: 171 1.\n\r");
@@ -621,6 +826,48 @@ uint8_t get_bytes_serial(uint8_t *output, uint16_t len) {
   return (input_length/2);
 }
 
+void print_stats(SHA204CLASS *sha204, SHA204ReadCache *cache, SHA204Stats *bus) {
+  sha204_governor_stats_t stats;
+  sha204->get_governor_stats(&stats);
+  W("Read cache hits: ");
+  hexprint_32(cache->hits);
+  W(" misses: ");
+  hexprint_32(cache->misses);
+  W("\n\r");
+  W("Requests: ");
+  hexprint_32(stats.acquires);
+  W(" wakes: ");
+  hexprint_32(stats.wakes);
+  W(" avoided: ");
+  hexprint_32(stats.wakes_avoided);
+  W(" idles: ");
+  hexprint_32(stats.idles);
+  W(" sleeps: ");
+  hexprint_32(stats.sleeps);
+  W("\n\r");
+  W("Retries send: ");
+  hexprint_32(bus->send_retries);
+  W(" receive: ");
+  hexprint_32(bus->receive_retries);
+  W(" CRC errors: ");
+  hexprint_32(bus->crc_errors);
+  W(" command: ");
+  hexprint_32(bus->command_crc_errors);
+  W("\n\r");
+  W("Resyncs: ");
+  hexprint_32(bus->resyncs);
+  W(" with wake-up: ");
+  hexprint_32(bus->resyncs_with_wakeup);
+  W(" failed: ");
+  hexprint_32(bus->resync_failures);
+  W(" wake failures: ");
+  hexprint_32(bus->wake_failures);
+  W("\n\r");
+  W("Stack never used: ");
+  hexprint_32(stack_unused());
+  W("\n\r");
+}
+
 /* Read and Interpret ATSHA204 configuration */
 void process_config(uint8_t *config) {
   // serial number
@@ -720,79 +967,382 @@ void process_config(uint8_t *config) {
   }
 }
 
+// each byte may take up to BINARY_MODE_BYTE_TIMEOUT_US, but no longer than it needs
 uint8_t receive_serial_binary_transaction(uint8_t *buffer, uint8_t len) {
-  _delay_ms(100); // give the transmitting side the chance to push the rest through
-  if( usb_serial_available() == 0 ) {
-    return BINARY_TRANSACTION_RECEIVE_ERROR;
-  }
-  uint8_t n_bytes = usb_serial_getchar();
-  if( n_bytes >= len ) {
+  int16_t c = binary_getchar_timeout(BINARY_MODE_BYTE_TIMEOUT_US);
+  if( c < 0 || (uint8_t)c >= len ) {
     return BINARY_TRANSACTION_RECEIVE_ERROR;
   }
+  uint8_t n_bytes = (uint8_t)c;
   buffer[0] = n_bytes;
   for(uint8_t i=1; i<=n_bytes; i++) {
-    if( usb_serial_available() == 0 ) {
+    if( (c = binary_getchar_timeout(BINARY_MODE_BYTE_TIMEOUT_US)) < 0 ) {
       return BINARY_TRANSACTION_RECEIVE_ERROR;
     }
-    buffer[i] = (uint8_t)usb_serial_getchar();
-    _delay_ms(3);
+    buffer[i] = (uint8_t)c;
   }
   return BINARY_TRANSACTION_OK;
 }
 
-uint8_t binary_mode_transaction(uint8_t *data, uint8_t rxsize, uint8_t *rx_buffer, SHA204CLASS *sha204) {
-  uint8_t i = 0;
+// ret_code: the SHA204 library return code (on BINARY_TRANSACTION_EXECUTE_ERROR)
+uint8_t binary_mode_transaction(uint8_t *data, uint8_t rxsize, uint8_t *rx_buffer, SHA204CLASS *sha204, uint8_t *ret_code) {
+  uint8_t flags;
+  uint8_t r = binary_transaction_begin(data, rxsize, rx_buffer, sha204, &flags, ret_code);
+  if(r != BINARY_TRANSACTION_OK)
+    return r;
+  // keep USB serviced while the chip is busy
+  if(*ret_code == SHA204_SUCCESS)
+    while((*ret_code = sha204->poll()) == SHA204_CMD_PENDING)
+      usb_tasks();
+  return binary_transaction_end(*ret_code, flags, sha204);
+}
+
+// wake the chip up for a request, or start the wake session it asks for
+uint8_t binary_acquire(uint8_t flags, uint8_t *rx_buffer, SHA204CLASS *sha204) {
+  if(flags & BINARY_TRANSACTION_SESSION_BEGIN)
+    return sha204->begin_session(rx_buffer);
+  return sha204->acquire(rx_buffer);
+}
+
+// parse the transaction, wake the chip up and start the command (the response
+//  goes to rx_buffer); *ret_code is SHA204_SUCCESS if it is running now
+uint8_t binary_transaction_begin(uint8_t *data, uint8_t rxsize, uint8_t *rx_buffer, SHA204CLASS *sha204, uint8_t *flags, uint8_t *ret_code) {
   uint8_t len;
-  uint8_t idle;
   uint8_t opcode;
   uint8_t param1;
   uint16_t param2;
   uint8_t datalen1=0;
-  uint8_t data1[64];
+  uint8_t *data1=0;
   uint8_t datalen2=0;
-  uint8_t data2[32];
+  uint8_t *data2=0;
   uint8_t datalen3=0;
-  uint8_t data3[14];
-  // process the input packet
+  uint8_t *data3=0;
+  // process the input packet (the data stays where it is and goes onto
+  //  the bus from there)
   len = data[0];
-  idle = data[1];
+  *flags = data[1];
   if(len<5)
     return BINARY_TRANSACTION_PARAM_ERROR;
   opcode = data[2];
   param1 = data[3];
   param2 = data[4] + 256*data[5];
+  // the data goes onto the bus from here, so it has to be within len
   if(len>5) {
-    if((datalen1=data[6]) > 64)
+    if((datalen1=data[6]) > 64 || 6+datalen1 > len)
       return BINARY_TRANSACTION_PARAM_ERROR;
-    for(i=0; i<datalen1; i++)
-      data1[i] = data[7+i];
+    data1 = data+7;
   }
   if(len>6+datalen1) {
-    if((datalen2=data[7+datalen1]) > 32)
+    if((datalen2=data[7+datalen1]) > 32 || 7+datalen1+datalen2 > len)
       return BINARY_TRANSACTION_PARAM_ERROR;
-    for(i=0; i<datalen2; i++)
-      data2[i] = data[8+datalen1+i];
+    data2 = data+8+datalen1;
   }
   if(len>7+datalen1+datalen2) {
-    if((datalen3=data[8+datalen1+datalen2]) > 13)
+    if((datalen3=data[8+datalen1+datalen2]) > 13 || 8+datalen1+datalen2+datalen3 > len)
       return BINARY_TRANSACTION_PARAM_ERROR;
-    for(i=0; i<datalen3; i++)
-      data3[i] = data[9+datalen1+datalen2+i];
+    data3 = data+9+datalen1+datalen2;
   }
-  // run the transaction
-  sha204->wakeup(data);
-  i = sha204->execute(opcode, param1, param2,
+  // start the transaction
+  *ret_code = binary_acquire(*flags, rx_buffer, sha204);
+  if(*ret_code == SHA204_WAKE_EXPIRED) // TempKey is gone: don't run the command without it
+    return BINARY_TRANSACTION_OK;
+  *ret_code = sha204->begin_execute(opcode, param1, param2,
           datalen1, data1, datalen2, data2, datalen3, data3,
-          len, data, rxsize, rx_buffer);
-  if(idle)
-    sha204->idle();
+          rxsize, rx_buffer);
+  return BINARY_TRANSACTION_OK;
+}
+
+// the command is done: put the chip to idle/sleep (or keep it awake for the next one)
+uint8_t binary_transaction_end(uint8_t ret_code, uint8_t flags, SHA204CLASS *sha204) {
+  if(flags & BINARY_TRANSACTION_SESSION_END)
+    sha204->end_session(flags & BINARY_TRANSACTION_IDLE);
   else
-    sha204->sleep();
-  if(i != SHA204_SUCCESS)
+    sha204->release(flags & BINARY_TRANSACTION_IDLE);
+  if(ret_code != SHA204_SUCCESS)
     return BINARY_TRANSACTION_EXECUTE_ERROR;
   return BINARY_TRANSACTION_OK;
 }
 
+// binary mode v2 zone read/write, in one wake-up (it blocks for the few
+//  commands); the flags open and close wake sessions as for transactions.
+//  The bytes read go to frame->data, *length of them.
+uint8_t binary_zone_access(binary_frame_t *frame, uint8_t *rx_buffer, SHA204CLASS *sha204, uint16_t *length, uint8_t *ret_code) {
+  uint8_t *payload = frame->data + 1;
+  uint8_t flags = payload[0];
+  uint8_t zone = payload[1];
+  uint16_t address = payload[2] + 256*payload[3];
+  uint16_t size;
+
+  *length = 0;
+  if(frame->type == BINARY_FRAME_ZONE_READ) {
+    if(frame->length != 6)
+      return BINARY_TRANSACTION_PARAM_ERROR;
+    size = payload[4] + 256*payload[5];
+  } else {
+    if(frame->length < 4)
+      return BINARY_TRANSACTION_PARAM_ERROR;
+    size = frame->length - 4;
+  }
+  if(size > BINARY_ZONE_MAX)
+    return BINARY_TRANSACTION_PARAM_ERROR;
+
+  // all of it in the read cache: no wake-up, nothing on the bus (unless
+  //  a session is to be opened or closed)
+  if(frame->type == BINARY_FRAME_ZONE_READ
+      && !(flags & (BINARY_TRANSACTION_SESSION_BEGIN | BINARY_TRANSACTION_SESSION_END))
+      && sha204->read_zone_cached(zone, address, size, frame->data)) {
+    *ret_code = SHA204_SUCCESS;
+    *length = size;
+    return BINARY_TRANSACTION_OK;
+  }
+  *ret_code = binary_acquire(flags, rx_buffer, sha204);
+  if(*ret_code != SHA204_WAKE_EXPIRED) { // the session is gone: tell the host instead
+    if(frame->type == BINARY_FRAME_ZONE_READ)
+      *ret_code = sha204->read_zone(zone, address, size, frame->data);
+    else
+      *ret_code = sha204->write_zone(zone, address, size, payload + 4);
+  }
+  (void)binary_transaction_end(*ret_code, flags, sha204);
+  if(*ret_code == SHA204_SUCCESS && frame->type == BINARY_FRAME_ZONE_READ)
+    *length = size;
+  return BINARY_TRANSACTION_OK;
+}
+
+uint8_t *put_16(uint8_t *p, uint16_t value) {
+  p[0] = (uint8_t)value;
+  p[1] = (uint8_t)(value >> 8);
+  return p+2;
+}
+
+uint8_t *put_32(uint8_t *p, uint32_t value) {
+  return put_16(put_16(p, (uint16_t)value), (uint16_t)(value >> 16));
+}
+
+/* Stack high-water mark: the RAM between the end of .bss and the stack is
+ *  painted at boot; what is still painted was never used by the stack.
+ *  (Nothing here uses malloc, so the heap stays empty.) */
+#define STACK_PAINT 0xC5
+extern uint8_t __heap_start; // from the linker script: the end of .bss
+
+void stack_paint(void) {
+  uint8_t *p = &__heap_start;
+
+  while(p < (uint8_t *)SP - 16) // not this function's own frame
+    *p++ = STACK_PAINT;
+}
+
+uint16_t stack_unused(void) {
+  uint8_t *p = &__heap_start;
+
+  while(p < (uint8_t *)SP && *p == STACK_PAINT)
+    p++;
+  return p - &__heap_start;
+}
+
+#if (4 * SHA204_STATS_BUCKETS > BINARY_FRAME_MAX_PAYLOAD)
+#error "SHA204_STATS_BUCKETS: the histograms don't fit in a STATS page"
+#endif
+
+// one page of the STATS answer; returns its length (0: no such page)
+uint16_t binary_stats(uint8_t *payload, uint8_t page, uint8_t flags, SHA204CLASS *sha204, SHA204ReadCache *cache, SHA204Stats *bus) {
+  sha204_governor_stats_t stats;
+  uint8_t *p = payload;
+  uint8_t i;
+
+  if(page == 0) {
+    sha204->get_governor_stats(&stats);
+    p = put_32(p, cache->hits);
+    p = put_32(p, cache->misses);
+    p = put_32(p, stats.acquires);
+    p = put_32(p, stats.wakes);
+    p = put_32(p, stats.wakes_avoided);
+    p = put_32(p, stats.idles);
+    p = put_32(p, stats.sleeps);
+    p = put_32(p, bus->wake_failures);
+    p = put_32(p, bus->send_retries);
+    p = put_32(p, bus->receive_retries);
+    p = put_32(p, bus->crc_errors);
+    p = put_32(p, bus->command_crc_errors);
+    p = put_32(p, bus->resyncs);
+    p = put_32(p, bus->resyncs_with_wakeup);
+    p = put_32(p, bus->resync_failures);
+    for(i=BINARY_STATUS_FRAME_CRC; i<=BINARY_STATUS_PARAM_ERROR; i++)
+      p = put_32(p, binary_frame_errors(i));
+    p = put_32(p, binary_dropped_bytes());
+    p = put_32(p, stack_unused());
+  } else if(page == 1) {
+    for(i=0; i<SHA204_STATS_BUCKETS; i++)
+      p = put_16(p, bus->wake_time[i]);
+    for(i=0; i<SHA204_STATS_BUCKETS; i++)
+      p = put_16(p, bus->polls[i]);
+  } else if(page < BINARY_STATS_PAGES) {
+    p = put_16(p, bus->opcode[page-2].commands);
+    p = put_16(p, bus->opcode[page-2].failures);
+    for(i=0; i<SHA204_STATS_BUCKETS; i++)
+      p = put_16(p, bus->opcode[page-2].latency[i]);
+  } else
+    return 0;
+
+  if(flags & BINARY_STATS_RESET) {
+    cache->hits = 0;
+    cache->misses = 0;
+    sha204->reset_governor_stats();
+    bus->reset();
+    binary_reset_frame_errors();
+  }
+  return p - payload;
+}
+
+// the TRACE answer: entries from "from" on (from the oldest one kept if
+//  it is gone or not given); returns its length
+uint16_t binary_trace(uint8_t *payload, uint8_t has_from, uint16_t from, SHA204Trace *trace) {
+  const sha204_trace_entry_t *e;
+  uint8_t *p = payload + 4;
+
+  if(!has_from || (uint16_t)(trace->count - from) > SHA204_TRACE_ENTRIES)
+    from = trace->oldest();
+  while(from != trace->count && !trace->entry(from)) // not recorded yet
+    from++;
+  put_16(payload, from);
+  put_16(payload+2, trace->count);
+  for(; from != trace->count && p - payload + BINARY_TRACE_ENTRY_SIZE <= BINARY_FRAME_MAX_PAYLOAD; from++) {
+    e = trace->entry(from);
+    p = put_32(p, e->time);
+    *p++ = e->event;
+    *p++ = e->op_code;
+    *p++ = e->length;
+    *p++ = e->ret_code;
+  }
+  return p - payload;
+}
+
+// binary mode v2: answer the request at the head of the queue; a
+//  transaction is polled once per call, so that the main loop can receive
+//  the next requests in the meantime
+void binary_queue_service(binary_queue_t *queue, uint8_t *rx_buffer, SHA204CLASS *sha204, SHA204ReadCache *cache, SHA204Stats *bus, SHA204Trace *trace, const uint8_t *serial) {
+  static uint8_t running = 0;
+  static uint8_t flags;
+  uint8_t ret_code;
+  uint16_t length;
+  binary_frame_t *frame = binary_queue_head(queue);
+
+  if(!frame)
+    return;
+  if(!running) {
+    switch(frame->type) {
+      case BINARY_FRAME_HELLO:
+      case BINARY_FRAME_PING:
+        // a new host: a session the last one left open is over (without
+        //  one, leave the chip and the governor's learned gap alone)
+        if(sha204->in_session())
+          sha204->end_session(0);
+        rx_buffer[0] = BINARY_PROTOCOL_VERSION;
+        rx_buffer[1] = (uint8_t)BINARY_FRAME_MAX_PAYLOAD;
+        rx_buffer[2] = (uint8_t)(BINARY_FRAME_MAX_PAYLOAD >> 8);
+        rx_buffer[3] = BINARY_QUEUE_DEPTH;
+        length = 4;
+        if(frame->type == BINARY_FRAME_PING) {
+          rx_buffer[length++] = BINARY_INTERFACE;
+          while(length < BINARY_PING_SIZE) {
+            rx_buffer[length] = serial[length-5];
+            length++;
+          }
+        }
+        binary_frame_send(frame->request_id, BINARY_STATUS_OK, rx_buffer, length);
+        binary_queue_pop(queue);
+        return;
+      case BINARY_FRAME_TRANSACTION:
+        // frame->data is laid out as a v1 transaction (length first)
+        if(binary_transaction_begin(frame->data, SHA204_RSP_SIZE_MAX, rx_buffer, sha204, &flags, &ret_code) != BINARY_TRANSACTION_OK) {
+          binary_frame_send(frame->request_id, BINARY_STATUS_PARAM_ERROR, 0, 0);
+          binary_queue_pop(queue);
+          return;
+        }
+        if(ret_code == SHA204_SUCCESS) {
+          running = 1;
+          return;
+        }
+        break;
+      case BINARY_FRAME_STATS:
+        // the answer goes in place of the request (the page can be longer than rx_buffer)
+        length = binary_stats(frame->data, (frame->data[0] > 0) ? frame->data[1] : 0,
+                              (frame->data[0] > 1) ? frame->data[2] : 0, sha204, cache, bus);
+        if(length == 0)
+          binary_frame_send(frame->request_id, BINARY_STATUS_PARAM_ERROR, 0, 0);
+        else
+          binary_frame_send(frame->request_id, BINARY_STATUS_OK, frame->data, length);
+        binary_queue_pop(queue);
+        return;
+      case BINARY_FRAME_TRACE:
+        if(!trace) {
+          binary_frame_send(frame->request_id, BINARY_STATUS_UNKNOWN_TYPE, 0, 0);
+        } else {
+          length = binary_trace(frame->data, frame->data[0] >= 2, frame->data[1] | ((uint16_t)frame->data[2] << 8), trace);
+          binary_frame_send(frame->request_id, BINARY_STATUS_OK, frame->data, length);
+        }
+        binary_queue_pop(queue);
+        return;
+      case BINARY_FRAME_ZONE_READ:
+      case BINARY_FRAME_ZONE_WRITE:
+        if(binary_zone_access(frame, rx_buffer, sha204, &length, &ret_code) != BINARY_TRANSACTION_OK)
+          binary_frame_send(frame->request_id, BINARY_STATUS_PARAM_ERROR, 0, 0);
+        else if(ret_code == SHA204_SUCCESS)
+          binary_frame_send(frame->request_id, BINARY_STATUS_OK, frame->data, length);
+        else
+          binary_frame_send(frame->request_id, BINARY_STATUS_DEVICE_ERROR, &ret_code, 1);
+        binary_queue_pop(queue);
+        return;
+      default:
+        binary_frame_send(frame->request_id, BINARY_STATUS_UNKNOWN_TYPE, 0, 0);
+        binary_queue_pop(queue);
+        return;
+    }
+  } else if((ret_code = sha204->poll()) == SHA204_CMD_PENDING) {
+    return;
+  }
+  running = 0;
+  if(binary_transaction_end(ret_code, flags, sha204) == BINARY_TRANSACTION_OK)
+    binary_frame_send(frame->request_id, BINARY_STATUS_OK, rx_buffer, rx_buffer[0]);
+  else
+    binary_frame_send(frame->request_id, BINARY_STATUS_DEVICE_ERROR, &ret_code, 1);
+  binary_queue_pop(queue);
+}
+
+/* Keep USB going while the library waits for the bus (I2C transfers) */
+void sha204_hal_yield(void) {
+  usb_tasks();
+}
+
+/* Learned execution times in EEPROM */
+
+#if (SAVE_LATENCY_TO_EEPROM)
+void load_latency_estimates(SHA204CLASS *sha204) {
+  uint16_t estimates[SHA204_LATENCY_SLOTS];
+  if(eeprom_read_byte(&latency_eeprom_magic) != LATENCY_EEPROM_MAGIC)
+    return;
+  eeprom_read_block(estimates, latency_eeprom, sizeof(estimates));
+  sha204->set_latency_estimates(estimates);
+}
+
+// to save EEPROM wear, small drifts are not written
+void save_latency_estimates(SHA204CLASS *sha204) {
+  uint16_t estimates[SHA204_LATENCY_SLOTS];
+  uint16_t saved;
+  uint8_t i;
+  bool valid = (eeprom_read_byte(&latency_eeprom_magic) == LATENCY_EEPROM_MAGIC);
+
+  sha204->get_latency_estimates(estimates);
+  for(i=0; i<SHA204_LATENCY_SLOTS; i++) {
+    saved = valid ? eeprom_read_word(&latency_eeprom[i]) : 0;
+    if(estimates[i] > saved + (saved>>3) || estimates[i] + (saved>>3) < saved) {
+      eeprom_update_block(estimates, latency_eeprom, sizeof(estimates));
+      eeprom_update_byte(&latency_eeprom_magic, LATENCY_EEPROM_MAGIC);
+      return;
+    }
+  }
+}
+#endif
+
 /* Return code stuff */
 
 const char retcode_success[] PROGMEM            = "Success.";
@@ -809,6 +1359,7 @@ const char retcode_bad_crc[] PROGMEM            = "Bad CRC received.";
 const char retcode_rx_fail[] PROGMEM            = "Timeout while waiting for a response (got >0 bytes).";
 const char retcode_rx_no_response[] PROGMEM     = "Timeout (not an error while busy).";
 const char retcode_resync_with_wakeup[] PROGMEM = "Resync OK after wakeup.";
+const char retcode_wake_expired[] PROGMEM       = "Wake session expired (TempKey lost).";
 const char retcode_comm_fail[] PROGMEM          = "Communication failed";
 const char retcode_timeout[] PROGMEM            = "Timeout while waiting for a response (got no bytes).";
 const char retcode_unknown[] PROGMEM            = "Unknown error message.";
@@ -858,6 +1409,9 @@ void print_return_code(uint8_t code) {
     case(SHA204_RESYNC_WITH_WAKEUP):
       p = retcode_resync_with_wakeup;
       break;
+    case(SHA204_WAKE_EXPIRED):
+      p = retcode_wake_expired;
+      break;
     case(SHA204_COMM_FAIL):
       p = retcode_comm_fail;
       break;
@@ -17,9 +17,50 @@ import logging
 import argparse
 import ConfigParser
 import pprint
+import collections
+import struct
+import glob
+import shutil
+import multiprocessing
+import socket
+import SocketServer
+import threading
 
 BINARY_TRANSACTION_CODE = chr(0xFD)
 
+# binary mode v2 (framed): 0xFC, length (2, LSB first), request id, type/status, payload, CRC (2)
+BINARY_FRAME_SOF = chr(0xFC)
+BINARY_FRAME_HELLO = chr(0x01)
+BINARY_FRAME_TRANSACTION = chr(0x02)
+BINARY_FRAME_ZONE_READ = chr(0x03)   # v3: flags, zone, address (2), length (2) -> the bytes
+BINARY_FRAME_ZONE_WRITE = chr(0x04)  # v3: flags, zone, address (2), the bytes
+BINARY_FRAME_STATS = chr(0x05)       # v4: -> counters, 4 bytes each (LSB first)
+BINARY_FRAME_PING = chr(0x06)        # v5: -> as HELLO, interface, serial number (9)
+BINARY_FRAME_TRACE = chr(0x07)       # v7: [from (2)] -> first (2), next (2), the bus transactions from first on
+BINARY_TRACE_EVENTS = {1: 'wakeup', 2: 'send', 3: 'receive', 4: 'resync', 5: 'idle', 6: 'sleep'}
+BINARY_STATS_NAMES = ['cache hits', 'cache misses', 'acquires', 'wakes', 'wakes avoided', 'idles', 'sleeps',
+                      'wake failures', 'send retries', 'receive retries', 'CRC errors', 'command CRC errors',
+                      'resyncs', 'resyncs with wake-up', 'resync failures', 'frame CRC errors',
+                      'frame length errors', 'frame timeouts', 'unknown frame types', 'bad frame parameters',
+                      'bytes dropped between frames', 'stack never used']
+BINARY_STATS_PAGES = 16  # v6: 0 counters, 1 histograms, 2-15 per op-code
+BINARY_STATS_RESET = chr(0x01)
+BINARY_STATS_OPCODES = ['CheckMac', 'DeriveKey', 'DevRev', 'GenDig', 'HMAC', 'Lock', 'MAC', 'Nonce', 'Pause',
+                        'Random', 'Read', 'UpdateExtra', 'Write', 'SHA']
+BINARY_ZONE_MAX = 96  # bytes in one zone read/write frame
+BINARY_STATUS_OK = 0x00
+BINARY_STATUS_DEVICE_ERROR = 0x20
+BINARY_STATUS_FRAME_CRC = 0x10
+BINARY_STATUS_FRAME_TIMEOUT = 0x12
+BINARY_HELLO_TIMEOUT = 0.3  # seconds; v1 firmware never answers
+BINARY_PING_INTERVAL = 0.05  # seconds between PINGs while the firmware starts
+BINARY_ATTACH_TIMEOUT = 2.5  # seconds; after that, it's a v1 firmware (or an Arduino still in the bootloader)
+BINARY_INTERFACES = ['SWI', 'SWI UART', 'I2C']
+DAEMON_QUEUE_WAIT = 5.0  # seconds a client may wait for the others
+DAEMON_FRAME_TIMEOUT = 3.0  # seconds for the firmware to answer a frame
+DAEMON_SESSION_TIMEOUT = 1.5  # seconds; the ATSHA is asleep by then (watchdog)
+BINARY_FRAME_TIMEOUT = 0.1  # seconds, on top of the execution time of the command
+
 # command op-code definitions
 SHA204_CHECKMAC = chr(0x28)
 SHA204_DERIVE_KEY = chr(0x1C)
@@ -35,6 +76,20 @@ SHA204_READ = chr(0x02)
 SHA204_UPDATE_EXTRA = chr(0x20)
 SHA204_WRITE = chr(0x12)
 SHA204_SHA = chr(0x47)
+OPCODE_NAMES = {
+    SHA204_CHECKMAC: 'CheckMac', SHA204_DERIVE_KEY: 'DeriveKey', SHA204_DEVREV: 'DevRev', SHA204_GENDIG: 'GenDig',
+    SHA204_HMAC: 'HMAC', SHA204_LOCK: 'Lock', SHA204_MAC: 'MAC', SHA204_NONCE: 'Nonce', SHA204_PAUSE: 'Pause',
+    SHA204_RANDOM: 'Random', SHA204_READ: 'Read', SHA204_UPDATE_EXTRA: 'UpdateExtra', SHA204_WRITE: 'Write',
+    SHA204_SHA: 'SHA'
+}
+
+# SHA204 library return codes (SHA204ReturnCodes.h)
+SHA204_RETURN_CODES = {
+    0x00: 'SUCCESS', 0xD2: 'PARSE_ERROR', 0xD3: 'CMD_FAIL', 0xD4: 'STATUS_CRC', 0xD5: 'STATUS_UNKNOWN',
+    0xE0: 'FUNC_FAIL', 0xE1: 'GEN_FAIL', 0xE2: 'BAD_PARAM', 0xE3: 'INVALID_ID', 0xE4: 'INVALID_SIZE',
+    0xE5: 'BAD_CRC', 0xE6: 'RX_FAIL', 0xE7: 'RX_NO_RESPONSE', 0xE8: 'RESYNC_WITH_WAKEUP', 0xE9: 'CMD_PENDING',
+    0xEA: 'WAKE_EXPIRED', 0xF0: 'COMM_FAIL', 0xF1: 'TIMEOUT'
+}
 
 # firmware binary mode return codes
 BINARY_MODE_RETURN_CODES = {
@@ -42,15 +97,39 @@ BINARY_MODE_RETURN_CODES = {
     1: 'BINARY_TRANSACTION_RECEIVE_ERROR',
     2: 'BINARY_TRANSACTION_PARAM_ERROR',
     3: 'BINARY_TRANSACTION_EXECUTE_ERROR',
+    # v2: framing errors (the command was not run) ...
+    0x10: 'BINARY_STATUS_FRAME_CRC',
+    0x11: 'BINARY_STATUS_FRAME_LENGTH',
+    0x12: 'BINARY_STATUS_FRAME_TIMEOUT',
+    0x13: 'BINARY_STATUS_UNKNOWN_TYPE',
+    0x14: 'BINARY_STATUS_PARAM_ERROR',
+    # ... versus the ATSHA204 failing it
+    0x20: 'BINARY_STATUS_DEVICE_ERROR',
+    98: 'NO RESPONSE IN TIME',
     99: 'PROBLEM WITH SERIAL COMMUNICATION (BUFFERING?)'
 }
 
+# maximum execution times (ms), for the response timeouts
+EXECUTION_TIME_MAX = {
+    SHA204_CHECKMAC: 38, SHA204_DERIVE_KEY: 62, SHA204_DEVREV: 2, SHA204_GENDIG: 43,
+    SHA204_HMAC: 69, SHA204_LOCK: 24, SHA204_MAC: 35, SHA204_NONCE: 60, SHA204_PAUSE: 2,
+    SHA204_RANDOM: 50, SHA204_READ: 4, SHA204_UPDATE_EXTRA: 6, SHA204_WRITE: 42, SHA204_SHA: 22
+}
+
 # idle versus sleep instruction
 REQUEST_IDLE = chr(1)
 REQUEST_SLEEP = chr(0)
+# wake session flags, or'ed into the above: the transactions from BEGIN to
+# END share one wake-up, so TempKey survives between them
+REQUEST_SESSION_BEGIN = 0x02
+REQUEST_SESSION_END = 0x04
 
 # Parameters for MAC/checkMAC/offlineMAC
 MAC_SLOT = 0
+
+# write journal (see load_write_journal)
+WRITE_JOURNAL_ZONES = {'otp': 1, 'data': 2}  # option names (ConfigParser lowercases them)
+WRITE_JOURNAL_BLOCKS = {1: 2, 2: 16}  # 32-byte blocks in the zone
 MAC_MODE = chr(0)
 def MAC_OTHER_DATA(slot):
     return SHA204_MAC+MAC_MODE+chr(slot)+b'\x00\x00\x00\x00\x00\x00\x00\x00\x00\x00'
@@ -83,9 +162,349 @@ class TransactionError(Exception):
         return repr(self.message + ': ' + BINARY_MODE_RETURN_CODES[self.value])
 
 
+# protocol spoken by the firmware (see detect_protocol)
+binary_protocol = 1
+binary_queue_depth = 1  # requests the firmware takes in advance
+last_request_id = 0
+device_info = {}  # interface, serial number (from PING, v5)
+
+
+def binary_frame(frame_type, request_id, payload):
+    body = chr(len(payload) & 0xFF) + chr(len(payload) >> 8) + chr(request_id) + frame_type + payload
+    return BINARY_FRAME_SOF + body + crc16(body)
+
+
+def read_frame(serport, request_id, timeout):
+    # returns (status, payload) of the response to request_id; skips anything
+    # else (e.g. late responses to requests which timed out)
+    old_timeout = serport.timeout
+    deadline = time.time() + timeout
+    try:
+        while True:
+            remaining = deadline - time.time()
+            if remaining <= 0:
+                raise TransactionError("Waiting for the response", 98)
+            serport.timeout = remaining
+            if serport.read(1) != BINARY_FRAME_SOF:
+                continue
+            header = serport.read(4)
+            if len(header) != 4:
+                raise TransactionError("Serial communication problem: did not receive the whole response", 99)
+            length = ord(header[0]) + 256 * ord(header[1])
+            rest = serport.read(length + 2)
+            if len(rest) != length + 2:
+                raise TransactionError("Serial communication problem: did not receive the whole response", 99)
+            if crc16(header + rest[0:-2]) != rest[-2:]:
+                raise TransactionError("Frame CRC error", 99)
+            if ord(header[2]) != request_id:
+                logging.debug("Dropping a response to request " + str(ord(header[2])))
+                continue
+            return ord(header[3]), rest[0:-2]
+    finally:
+        serport.timeout = old_timeout
+
+
+def detect_protocol(serport):
+    # HELLO goes out with request id 0 (none of its bytes is a menu command,
+    # so a v1 firmware only prints some menu headers, thrown away below)
+    global binary_protocol, binary_queue_depth
+    serport.write(binary_frame(BINARY_FRAME_HELLO, 0, b''))
+    try:
+        status, payload = read_frame(serport, 0, BINARY_HELLO_TIMEOUT)
+        if status == BINARY_STATUS_OK and len(payload) >= 1 and ord(payload[0]) >= 2:
+            binary_protocol = ord(payload[0])
+            if len(payload) >= 4:
+                binary_queue_depth = max(1, ord(payload[3]))
+    except TransactionError:
+        pass
+    serport.flushInput()
+    logging.debug("Firmware binary mode v" + str(binary_protocol) + ", queue depth " + str(binary_queue_depth))
+
+
+def attach(serport):
+    # instead of sleeping until the firmware is surely up, PING it until it
+    # answers: v5 firmware tells everything in the answer, v2-v4 firmware
+    # answers with an unknown type status (and then gets HELLO), v1 firmware
+    # doesn't answer (the PING isn't a menu command either)
+    global binary_protocol, binary_queue_depth
+    deadline = time.time() + BINARY_ATTACH_TIMEOUT
+    while time.time() < deadline:
+        serport.write(binary_frame(BINARY_FRAME_PING, 0, b''))
+        try:
+            status, payload = read_frame(serport, 0, BINARY_PING_INTERVAL)
+        except TransactionError:
+            continue
+        if status == BINARY_STATUS_OK and len(payload) >= 14:
+            binary_protocol = ord(payload[0])
+            binary_queue_depth = max(1, ord(payload[3]))
+            device_info['interface'] = BINARY_INTERFACES[ord(payload[4])] if ord(payload[4]) < len(BINARY_INTERFACES) else hex(ord(payload[4]))
+            device_info['serial'] = binascii.hexlify(payload[5:14])
+            serport.flushInput()  # the help printed after connecting (DTR)
+            logging.debug("Firmware binary mode v" + str(binary_protocol) + ", queue depth " + str(binary_queue_depth) +
+                          ", " + device_info['interface'] + ", ATSHA204 " + device_info['serial'])
+            return
+        serport.flushInput()
+        detect_protocol(serport)
+        return
+    serport.flushInput()
+    logging.debug("No answer to PING, firmware binary mode v1")
+
+
+def send_transaction_v2(buf, serport):
+    # returns the request id
+    global last_request_id
+    last_request_id = last_request_id % 255 + 1  # 1..255, 0 is HELLO's
+    serport.write(binary_frame(BINARY_FRAME_TRANSACTION, last_request_id, buf))
+    return last_request_id
+
+
+def receive_transaction_v2(buf, request_id, serport):
+    timeout = BINARY_FRAME_TIMEOUT + 3 * EXECUTION_TIME_MAX.get(buf[1], 69) / 1000.0  # a few retries
+    status, payload = read_frame(serport, request_id, timeout)
+    if status == BINARY_STATUS_DEVICE_ERROR:
+        raise TransactionError("ATSHA204 library returned 0x" + binascii.hexlify(payload), status)
+    if status != BINARY_STATUS_OK:
+        raise TransactionError("Firmware returned", status)
+    if len(payload) < 3 or ord(payload[0]) != len(payload) or crc16(payload[0:-2]) != payload[-2:]:
+        raise TransactionError("CRC error", 99)
+    return payload[1:-2]
+
+
+def do_zone_request(frame_type, flags, payload, timeout, serport):
+    global last_request_id
+    last_request_id = last_request_id % 255 + 1
+    serport.write(binary_frame(frame_type, last_request_id, flags + payload))
+    status, response = read_frame(serport, last_request_id, BINARY_FRAME_TIMEOUT + timeout)
+    if status == BINARY_STATUS_DEVICE_ERROR:
+        raise TransactionError("ATSHA204 library returned 0x" + binascii.hexlify(response), status)
+    if status != BINARY_STATUS_OK:
+        raise TransactionError("Firmware returned", status)
+    return response
+
+
+def read_zone(zone, address, length, flags, serport):
+    # v3: the firmware reads a whole zone (up to BINARY_ZONE_MAX bytes per
+    # frame) in one wake-up; zone and address as in the ATSHA204 Read command
+    data = b''
+    while len(data) < length:
+        size = min(length - len(data), BINARY_ZONE_MAX)
+        offset = address + len(data)
+        reads = size / 4 + 1  # worst case: all 4-byte reads
+        data += do_zone_request(BINARY_FRAME_ZONE_READ, flags,
+                                chr(zone) + chr(offset & 0xFF) + chr(offset >> 8) + chr(size & 0xFF) + chr(size >> 8),
+                                reads * 3 * EXECUTION_TIME_MAX[SHA204_READ] / 1000.0, serport)
+    return data
+
+
+def write_zone(zone, address, data, flags, serport):
+    # v3: as read_zone, but written
+    if args.dry_run:
+        logging.info("Dry run! Not writing " + binascii.hexlify(data))
+        return
+    for start in range(0, len(data), BINARY_ZONE_MAX):
+        chunk = data[start:start + BINARY_ZONE_MAX]
+        offset = address + start
+        writes = len(chunk) / 4 + 1
+        do_zone_request(BINARY_FRAME_ZONE_WRITE, flags, chr(zone) + chr(offset & 0xFF) + chr(offset >> 8) + chunk,
+                        writes * 3 * EXECUTION_TIME_MAX[SHA204_WRITE] / 1000.0, serport)
+
+
+def stats_buckets(buckets, first, unit):
+    # names of the firmware's log2 histogram buckets (SHA204_STATS_BUCKETS,
+    # 8 by default): bucket i below first * 2**i, the last one the rest
+    if buckets == 1:
+        return ['all']
+    return (['<' + '%g' % (first * 2 ** i) + unit for i in range(0, buckets - 1)] +
+            ['>=' + '%g' % (first * 2 ** (buckets - 2)) + unit])
+
+
+def get_stats(serport, reset=False):
+    # v4: the firmware's counters (since it started, or the last reset), v6
+    # also the histograms and the per op-code ones; returns (counters,
+    # histograms, op-codes), the last two empty before v6
+    if binary_protocol < 4:
+        raise TransactionError("Firmware has no statistics (binary mode v" + str(binary_protocol) + ")", 0)
+    histograms = collections.OrderedDict()
+    opcodes = collections.OrderedDict()
+    if binary_protocol < 6:
+        if reset:
+            logging.warning("The firmware can't reset its statistics (binary mode v" + str(binary_protocol) + ")")
+        pages = [do_zone_request(BINARY_FRAME_STATS, b'', b'', 0, serport)]
+    else:
+        pages = [do_zone_request(BINARY_FRAME_STATS, chr(page),
+                                 BINARY_STATS_RESET if reset and page == BINARY_STATS_PAGES - 1 else b'', 0, serport)
+                 for page in range(0, BINARY_STATS_PAGES)]
+    values = struct.unpack('<' + str(len(pages[0]) / 4) + 'I', pages[0][0:len(pages[0]) / 4 * 4])
+    counters = collections.OrderedDict(zip(BINARY_STATS_NAMES, values))
+    if len(pages) > 1:
+        buckets = len(pages[1]) / 4
+        times = stats_buckets(buckets, 0.5, 'ms')
+        counts = stats_buckets(buckets, 2, '')
+        values = struct.unpack('<' + str(2 * buckets) + 'H', pages[1][0:4 * buckets])
+        histograms['wake time'] = collections.OrderedDict(zip(times, values[0:buckets]))
+        histograms['polls per command'] = collections.OrderedDict(zip(counts, values[buckets:2 * buckets]))
+        for name, page in zip(BINARY_STATS_OPCODES, pages[2:]):
+            values = struct.unpack('<' + str(2 + buckets) + 'H', page[0:4 + 2 * buckets])
+            opcodes[name] = {'commands': values[0], 'failures': values[1],
+                             'latency': collections.OrderedDict(zip(times, values[2:]))}
+    return counters, histograms, opcodes
+
+
+def format_histogram(histogram):
+    return " ".join(bucket + ":" + str(n) for bucket, n in histogram.items() if n > 0) or "-"
+
+
+def get_trace(serport):
+    # v7: the firmware's last bus transactions, oldest first, as (time (us),
+    # event, op-code, length, return code); fetched a frame at a time
+    if binary_protocol < 7:
+        raise TransactionError("Firmware has no trace (binary mode v" + str(binary_protocol) + ")", 0)
+    entries = []
+    response = do_zone_request(BINARY_FRAME_TRACE, b'', b'', 0, serport)
+    while True:
+        first, following = struct.unpack('<HH', response[0:4])
+        count = (len(response) - 4) / 8
+        for i in range(0, count):
+            entries.append(struct.unpack('<IBBBB', response[4 + 8 * i:12 + 8 * i]))
+        first = (first + count) & 0xFFFF
+        if count == 0 or first == following:
+            return entries
+        response = do_zone_request(BINARY_FRAME_TRACE, struct.pack('<H', first), b'', 0, serport)
+
+
+def print_trace(entries):
+    # a timeline: ms since the first entry and since the one before; a
+    # response also gets the time since its command was sent
+    print("   time ms      +ms  event    op-code      length  result")
+    start = previous = sent = entries[0][0] if entries else 0
+    for time, event, op_code, length, ret_code in entries:
+        line = "%10.3f %8.3f  %-8s %-12s %6u  %s" % (
+            ((time - start) & 0xFFFFFFFF) / 1000.0, ((time - previous) & 0xFFFFFFFF) / 1000.0,
+            BINARY_TRACE_EVENTS.get(event, hex(event)), OPCODE_NAMES.get(chr(op_code), '') if op_code else '',
+            length, SHA204_RETURN_CODES.get(ret_code, hex(ret_code)))
+        if BINARY_TRACE_EVENTS.get(event) == 'send':
+            sent = time
+        elif BINARY_TRACE_EVENTS.get(event) == 'receive':
+            line += "  (%.3f ms after send)" % (((time - sent) & 0xFFFFFFFF) / 1000.0)
+        print(line)
+        previous = time
+
+
+def open_serial_port(path):
+    serport = serial.Serial(port=path, baudrate=115200, timeout=2)  # timeout 2 seconds!
+    attach(serport)
+    return serport
+
+
+class DaemonPort:
+    # the client side of the daemon's socket; the rest of the script uses it
+    # as the serial port (the daemon passes the frames on, see DaemonHandler)
+    def __init__(self, sock):
+        self.sock = sock
+        self.timeout = 2
+        self.buffer = b''
+
+    def write(self, data):
+        self.sock.sendall(data)
+
+    def read(self, size):
+        # other clients may be served first, so wait a bit longer than asked
+        deadline = time.time() + self.timeout + DAEMON_QUEUE_WAIT
+        while len(self.buffer) < size:
+            remaining = deadline - time.time()
+            if remaining <= 0:
+                break
+            self.sock.settimeout(remaining)
+            try:
+                chunk = self.sock.recv(4096)
+            except socket.timeout:
+                break
+            if not chunk:
+                break
+            self.buffer += chunk
+        data, self.buffer = self.buffer[0:size], self.buffer[size:]
+        return data
+
+    def flushInput(self):
+        self.buffer = b''
+        self.sock.setblocking(0)
+        try:
+            while self.sock.recv(4096):
+                pass
+        except socket.error:
+            pass
+        self.sock.setblocking(1)
+
+    def flushOutput(self):
+        pass
+
+
+def connect_daemon(socket_path, serial_path):
+    # a DaemonPort for serial_path ('': the daemon's first port), or None if
+    # no daemon is running
+    if not os.path.exists(socket_path):
+        return None
+    sock = socket.socket(socket.AF_UNIX, socket.SOCK_STREAM)
+    try:
+        sock.connect(socket_path)
+        sock.sendall(chr(len(serial_path)) + serial_path)
+        sock.settimeout(DAEMON_QUEUE_WAIT)
+        answer = sock.recv(1)
+    except socket.error, e:
+        logging.debug("No daemon at " + socket_path + ": " + str(e))
+        sock.close()
+        return None
+    if answer != b'\x01':
+        logging.debug("The daemon doesn't have " + serial_path)
+        sock.close()
+        return None
+    serport = DaemonPort(sock)
+    detect_protocol(serport)
+    logging.debug("Using the daemon at " + socket_path)
+    return serport
+
+
+def do_transaction_v2(buf, serport):
+    return receive_transaction_v2(buf, send_transaction_v2(buf, serport), serport)
+
+
+def do_transactions(bufs, serport):
+    # pipelined do_transaction: keeps up to binary_queue_depth requests in
+    # the firmware, so that the next one is already there when the ATSHA
+    # finishes one; returns the responses (or TransactionError's) in order
+    if binary_protocol < 2 or args.dry_run:
+        results = []
+        for buf in bufs:
+            try:
+                results.append(do_transaction(buf, serport))
+            except TransactionError, e:
+                results.append(e)
+        return results
+    results = [None] * len(bufs)
+    in_flight = collections.deque()
+    sent = 0
+    for i in range(len(bufs)):
+        while sent < len(bufs) and len(in_flight) < binary_queue_depth:
+            in_flight.append(send_transaction_v2(bufs[sent], serport))
+            sent += 1
+        try:
+            results[i] = receive_transaction_v2(bufs[i], in_flight.popleft(), serport)
+        except TransactionError, e:
+            results[i] = e
+    return results
+
+
+def in_session(bufs):
+    # flag a sequence of transactions as one wake session
+    bufs = list(bufs)
+    bufs[0] = chr(ord(bufs[0][0]) | REQUEST_SESSION_BEGIN) + bufs[0][1:]
+    bufs[-1] = chr(ord(bufs[-1][0]) | REQUEST_SESSION_END) + bufs[-1][1:]
+    return bufs
+
+
 def do_transaction(buf, serport):
     # buf is assumed to have the following format:
-    #  1 byte:  idle or sleep after command?
+    #  1 byte:  idle or sleep after command? (+ wake session flags)
     #  1 byte:  opcode
     #  1 byte:  param1
     #  2 bytes: param2
@@ -99,6 +518,8 @@ def do_transaction(buf, serport):
     if args.dry_run and buf[1] in [SHA204_WRITE, SHA204_LOCK, SHA204_UPDATE_EXTRA]:
         logging.info("Dry run! Not sending " + binascii.hexlify(buf))
         return chr(0)
+    if binary_protocol >= 2:
+        return do_transaction_v2(buf, serport)
     message = b'' + BINARY_TRANSACTION_CODE + chr(len(buf)) + buf
     serport.write(message)
     status = serport.read(1)  # read on byte, with timeout
@@ -122,10 +543,16 @@ def do_transaction(buf, serport):
 ###############################
 
 def receive_config_area(serport):
-    config = do_transaction(REQUEST_SLEEP+SHA204_READ + b'\x80\x00\x00', serport)
-    config += do_transaction(REQUEST_SLEEP+SHA204_READ + b'\x80\x08\x00', serport)
+    if binary_protocol >= 3:
+        return read_zone(0, 0, 88, REQUEST_SLEEP, serport)
+    bufs = [REQUEST_SLEEP+SHA204_READ + b'\x80\x00\x00', REQUEST_SLEEP+SHA204_READ + b'\x80\x08\x00']
     for i in range(0x10, 0x16):
-        config += do_transaction(REQUEST_SLEEP+SHA204_READ + b'\x00' + chr(i) + b'\x00', serport)
+        bufs.append(REQUEST_SLEEP+SHA204_READ + b'\x00' + chr(i) + b'\x00')
+    config = b''
+    for response in do_transactions(in_session(bufs), serport):
+        if isinstance(response, TransactionError):
+            raise response
+        config += response
     return config
 
 
@@ -153,29 +580,6 @@ def write_config_word(address, word, serport):
         return response
 
 
-def write_otp_area(contents, serport):
-    if len(contents) != 64:
-        logging.error("Trying to write something else that 64 bytes to OTP!")
-        exit(1)
-    logging.debug("Writing to OTP zone, word address 0x0, data: 0x" + binascii.hexlify(contents[0:32]))
-    try:
-        response = do_transaction(REQUEST_SLEEP+SHA204_WRITE + b'\x81\x00\x00\x20' + contents[0:32], serport)
-    except TransactionError, e:
-        logging.error("ERROR communicating with firmware/ATSHA: " + str(e))
-        exit(1)
-    else:
-        logging.debug("Got response: " + ("OK" if response == chr(0) else "not OK"))
-    logging.debug("Writing to OTP zone, word address 0x8, data: 0x" + binascii.hexlify(contents[32:64]))
-    try:
-        response = do_transaction(REQUEST_SLEEP+SHA204_WRITE + b'\x81\x08\x00\x20' + contents[32:64], serport)
-    except TransactionError, e:
-        logging.error("ERROR communicating with firmware/ATSHA: " + str(e))
-        exit(1)
-    else:
-        logging.debug("Got response: " + ("OK" if response == chr(0) else "not OK"))
-        return response
-
-
 def update_config_area(config, serport):
     config_new = process_config_modifications(config)
     # determine differences and write them
@@ -193,7 +597,7 @@ def update_config_area(config, serport):
 
 def do_lock_config_area(expected_config, serport):
     logging.info("Verifying the config zone contents.")
-    config_verify = read_config_area(ser_port)
+    config_verify = read_config_area(serport)
     if not (expected_config == config_verify):
         logging.error(
             "The contents of the config zone is not what is expected! Problem with ATSHA or dry run? Not locking.")
@@ -234,19 +638,78 @@ def get_random(serport):
         return response
 
 
-def write_data_slot(slot, contents, serport):
-    if len(contents) != 32 or slot < 0 or slot > 15:
-        logging.error("Something went wrong, the call to write_data_slot has wrong params!")
-        exit(1)
-    logging.debug("Writing to data zone, slot " + hex(slot) + ", data: 0x" + binascii.hexlify(contents))
+def load_write_journal(serial):
+    # the data and OTP zones can't be read back before they are locked, so
+    # what earlier (interrupted) runs wrote to them is kept in a journal,
+    # per chip serial number: {(zone, block): 32 bytes}
+    journal = {}
+    journal_ini = ConfigParser.ConfigParser()
+    journal_ini.read(args.journal_file)
+    if not journal_ini.has_section(serial):
+        return journal
+    for name, zone in WRITE_JOURNAL_ZONES.items():
+        for block in range(0, WRITE_JOURNAL_BLOCKS[zone]):
+            if journal_ini.has_option(serial, name + str(block)):
+                t = get_ini_str(journal_ini, serial, name + str(block), validate_slot_contents)
+                if t is not None:
+                    journal[(zone, block)] = binascii.unhexlify(t)
+    logging.info("Journal " + args.journal_file + ": " + str(len(journal)) + " blocks already written to " + serial)
+    return journal
+
+
+def save_write_journal(serial, journal):
+    journal_ini = ConfigParser.ConfigParser()
+    journal_ini.read(args.journal_file)
+    if journal_ini.has_section(serial):
+        journal_ini.remove_section(serial)
+    if journal:
+        journal_ini.add_section(serial)
+        for name, zone in WRITE_JOURNAL_ZONES.items():
+            for block in range(0, WRITE_JOURNAL_BLOCKS[zone]):
+                if (zone, block) in journal:
+                    journal_ini.set(serial, name + str(block), binascii.hexlify(journal[(zone, block)]))
+    with open(args.journal_file, 'w') as f:
+        journal_ini.write(f)
+
+
+def write_zone_words(zone, address, contents, serport):
+    # one 32-byte block or one 4-byte word of the OTP (1) or data (2) zone
+    logging.debug("Writing to zone " + str(zone) + ", address " + hex(address) + ", data: 0x" + binascii.hexlify(contents))
     try:
-        response = do_transaction(REQUEST_SLEEP+SHA204_WRITE + b'\x82' + chr(slot * 8) + b'\x00\x20' + contents, serport)
+        if binary_protocol >= 3:
+            write_zone(zone, address, contents, REQUEST_SLEEP, serport)
+            return True
+        response = do_transaction(REQUEST_SLEEP+SHA204_WRITE + chr(zone | (0x80 if len(contents) == 32 else 0)) +
+                                  chr(address / 4) + b'\x00' + contents, serport)
     except TransactionError, e:
         logging.error("ERROR communicating with firmware/ATSHA: " + str(e))
-        exit(1)
+        return False
     else:
         logging.debug("Got response: " + ("OK" if response == chr(0) else "not OK"))
-        return response
+        return response == chr(0)
+
+
+def write_unlocked_zone(zone, contents, serial, journal, serport):
+    # write only the blocks (or, if just one word of a block differs, the
+    # word) which the journal doesn't already have on the chip
+    writes = 0
+    for block in range(0, len(contents) / 32):
+        new = contents[32 * block:32 * block + 32]
+        old = journal.get((zone, block))
+        if old == new:
+            continue
+        words = range(0, 8) if old is None else [i for i in range(0, 8) if old[4 * i:4 * i + 4] != new[4 * i:4 * i + 4]]
+        if len(words) == 1:
+            ok = write_zone_words(zone, 32 * block + 4 * words[0], new[4 * words[0]:4 * words[0] + 4], serport)
+        else:
+            ok = write_zone_words(zone, 32 * block, new, serport)
+        if not ok:
+            exit(1)
+        writes += 1
+        if not args.dry_run:
+            journal[(zone, block)] = new
+            save_write_journal(serial, journal)
+    logging.info("Zone " + str(zone) + ": " + str(writes) + " writes, " + str(len(contents) / 32 - writes) + " blocks already there")
 
 
 def mac(challenge, slot, serport):
@@ -266,6 +729,38 @@ def mac(challenge, slot, serport):
             print("data_sha256 : "+binascii.hexlify(challenge))
             print("mac         : "+binascii.hexlify(response))
 
+def bulk_mac(paths, slot, serport):
+    # MACs of many files, with the requests pipelined
+    challenges = []
+    for path in paths:
+        with open(path, 'r') as f:
+            file_sha = SHA256.new()
+            while True:
+                chunk = f.read(8192)
+                if len(chunk) == 0:
+                    break
+                file_sha.update(chunk)
+            challenges.append(file_sha.digest())
+    # stay idle between the commands, sleep after the last one
+    bufs = [(REQUEST_SLEEP if i == len(challenges) - 1 else REQUEST_IDLE) +
+            SHA204_MAC + MAC_MODE + chr(slot) + b'\x00\x20' + challenge
+            for i, challenge in enumerate(challenges)]
+    start = time.time()
+    responses = do_transactions(bufs, serport)
+    logging.info(str(len(bufs)) + " MACs in " + str(time.time() - start) + " s")
+    failed = 0
+    for path, challenge, response in zip(paths, challenges, responses):
+        if isinstance(response, TransactionError):
+            logging.error("ERROR communicating with firmware/ATSHA (" + path + "): " + str(response))
+            failed += 1
+        elif len(response) != 32:
+            logging.error("Received an unexpected response from mac command: " + binascii.hexlify(response))
+            failed += 1
+        else:
+            print(binascii.hexlify(challenge) + " " + binascii.hexlify(response) + " " + path)
+    return failed
+
+
 def check_mac(challenge, mac, slot, serport):
     if len(challenge) != 32 or len(mac) != 32 or slot < 0 or slot > 15:
         logging.error("Something went wrong, the call to mac has wrong params!")
@@ -289,8 +784,11 @@ def sha(message, serport):
         logging.error("Something went wrong, the call to mac has wrong params!")
         exit(1)
     logging.debug("Calling the SHA command, message "+binascii.hexlify(message))
+    # the SHA context lives in TempKey: init and compute in one session
+    bufs = in_session([REQUEST_IDLE+SHA204_SHA+chr(0)+b'\x00\x00',
+                       REQUEST_SLEEP+SHA204_SHA+chr(1)+b'\x00\x00'+b'\x40'+message])
     try:
-        response = do_transaction(REQUEST_IDLE+SHA204_SHA+chr(0)+b'\x00\x00', serport)
+        response = do_transaction(bufs[0], serport)
     except TransactionError, e:
         logging.error("ERROR communicating with firmware/ATSHA: " + str(e))
         exit(1)
@@ -298,7 +796,7 @@ def sha(message, serport):
         logging.error("ERROR initialising SHA computation: " + str(e))
         exit(1)
     try:
-        response = do_transaction(REQUEST_SLEEP+SHA204_SHA+chr(1)+b'\x00\x00'+b'\x40'+message,serport)
+        response = do_transaction(bufs[1], serport)
     except TransactionError, e:
         logging.error("ERROR communicating with firmware/ATSHA: " + str(e))
         exit(1)
@@ -514,6 +1012,7 @@ def lock_config(serport):
 
 def lock_data(serport):
     config_area = process_config_area(read_config_area(serport))
+    serial = config_area['serial']
     if not config_area['ConfigLocked']:
         logging.error("Config zone needs to be locked before locking data and OTP!")
         exit(1)
@@ -543,11 +1042,10 @@ def lock_data(serport):
     # write keys_ini
     with open(args.keys_file, 'w') as f:
         keys_ini.write(f)
-    # write the keys into slots
+    # the image of the data zone, used for writing and later for locking
     whole_data = b''
     for i in range(0, 16):
-        write_data_slot(i, keys[i], serport)
-        whole_data += keys[i]  # collect all the slots into one variable, used later for locking
+        whole_data += keys[i]
     # OTP stuff
     otp = b'\xFF' * 64
     if not os.path.isfile(args.personalize_file):
@@ -560,12 +1058,206 @@ def lock_data(serport):
                 "OTP zone contents not set in " + args.personalize_file + ". It will be filled with 0xFF's.")
         else:
             otp = get_ini_str(personalize_config, 'OTPzone', 'OTPcontents')[1:-1].replace('__DATE__', time.strftime('%Y%m%d'))[0:64].ljust(64, chr(0xFF))
-    write_otp_area(otp, serport)
-    # lock!
+    # write what isn't there yet
+    journal = load_write_journal(serial)
+    write_unlocked_zone(2, whole_data, serial, journal, serport)
+    write_unlocked_zone(1, otp, serial, journal, serport)
+    # lock! (the CRC is of the images, which are on the chip now); the journal
+    # is dropped first: if the Lock fails, the next run writes everything again
+    if not args.dry_run:
+        save_write_journal(serial, {})
     if chr(0) == do_lock_data_otp_area(whole_data, otp, serport):
         print "Data+OTP zones locked!"
 
 
+def personalize(serport):
+    config_area = process_config_area(read_config_area(serport))
+    if not config_area['ConfigLocked']:
+        lock_config(serport)
+    if not config_area['DataOTPlocked']:
+        lock_data(serport)
+
+
+def per_device_path(path, serial):
+    # keys.ini -> keys_<serial>.ini
+    root, ext = os.path.splitext(path)
+    return root + '_' + serial + ext
+
+
+def batch_worker(serial_path):
+    # personalizes the device on one port; runs in a process of its own (the
+    # communication state is global), so all the devices are done side by side
+    result = {'port': serial_path, 'serial': '', 'result': 'failed'}
+    try:
+        serport = open_serial_port(serial_path)
+        serial_number = process_config_area(read_config_area(serport))['serial']
+        result['serial'] = serial_number
+        # the keys-file is the template: each device gets a copy, to which
+        # its random keys are added
+        device_keys_file = per_device_path(args.keys_file, serial_number)
+        if not os.path.isfile(device_keys_file) and os.path.isfile(args.keys_file):
+            shutil.copyfile(args.keys_file, device_keys_file)
+        args.keys_file = device_keys_file
+        args.journal_file = per_device_path(args.journal_file, serial_number)
+        result['keys_file'] = device_keys_file
+        personalize(serport)
+        config_area = process_config_area(read_config_area(serport))
+        if config_area['ConfigLocked'] and config_area['DataOTPlocked']:
+            result['result'] = "personalized"
+        elif args.dry_run:
+            result['result'] = "dry run"
+    except SystemExit:
+        pass  # the command functions log the error and exit(1)
+    except (serial.SerialException, TransactionError, IOError), e:
+        logging.error(serial_path + ": " + str(e))
+    return result
+
+
+def batch_personalize(ports):
+    # one worker per port; writes a report, one section per chip serial number
+    if len(ports) == 0:
+        logging.error("No serial ports to personalize devices on!")
+        return False
+    logging.info("Personalizing on " + ", ".join(ports))
+    pool = multiprocessing.Pool(len(ports))
+    results = pool.map(batch_worker, ports)
+    pool.close()
+    report_ini = ConfigParser.ConfigParser()
+    for result in results:
+        section = result['serial'] or result['port']
+        report_ini.add_section(section)
+        for option, value in sorted(result.items()):
+            report_ini.set(section, option, value)
+        print(section + " " + result['port'] + " " + result['result'])
+    with open(args.report_file, 'w') as f:
+        report_ini.write(f)
+    return all(result['result'] == "personalized" for result in results)
+
+
+class DaemonDevice:
+    def __init__(self, path, serport):
+        self.path = path
+        self.serport = serport
+        self.lock = threading.Lock()  # held for one frame, or a whole wake session
+        self.request_id = 0
+
+    def relay(self, frame_type, payload):
+        # to the firmware under a request id of the port's own; returns (status, payload)
+        self.request_id = self.request_id % 255 + 1
+        self.serport.write(binary_frame(frame_type, self.request_id, payload))
+        try:
+            return read_frame(self.serport, self.request_id, DAEMON_FRAME_TIMEOUT)
+        except TransactionError, e:
+            logging.warning(self.path + ": " + str(e))
+            return BINARY_STATUS_FRAME_TIMEOUT, b''
+
+    def end_session(self):
+        # a client went away (or quiet) in the middle of a wake session
+        self.relay(BINARY_FRAME_HELLO, b'')
+
+
+daemon_devices = []
+
+
+def recv_exactly(sock, size):
+    data = b''
+    while len(data) < size:
+        chunk = sock.recv(size - len(data))
+        if not chunk:
+            raise EOFError
+        data += chunk
+    return data
+
+
+class DaemonHandler(SocketServer.BaseRequestHandler):
+    # one client: first the length of a serial port path and the path ('':
+    # the first port), answered with 1 (0: no such port); then binary mode v2
+    # frames, passed on to the firmware one at a time: the next request (of
+    # any client) goes out only after the answer to the last one came back,
+    # so only one of the firmware's BINARY_QUEUE_DEPTH slots is ever used
+    def handle(self):
+        sock = self.request
+        try:
+            path = recv_exactly(sock, ord(recv_exactly(sock, 1)))
+        except (EOFError, socket.error):
+            return
+        devices = [d for d in daemon_devices if not path or d.path == os.path.realpath(path)]
+        if not devices:
+            sock.sendall(b'\x00')
+            return
+        device = devices[0]
+        sock.sendall(b'\x01')
+        holding = False
+        in_session = False
+        try:
+            while True:
+                sock.settimeout(DAEMON_SESSION_TIMEOUT if in_session else None)
+                try:
+                    if recv_exactly(sock, 1) != BINARY_FRAME_SOF:
+                        continue
+                except socket.timeout:
+                    device.end_session()
+                    in_session = False
+                    holding = False
+                    device.lock.release()
+                    continue
+                header = recv_exactly(sock, 4)
+                rest = recv_exactly(sock, ord(header[0]) + 256 * ord(header[1]) + 2)
+                if crc16(header + rest[0:-2]) != rest[-2:]:
+                    sock.sendall(binary_frame(chr(BINARY_STATUS_FRAME_CRC), ord(header[2]), b''))
+                    continue
+                payload = rest[0:-2]
+                if not holding:
+                    device.lock.acquire()
+                    holding = True
+                status, response = device.relay(header[3], payload)
+                if header[3] in (BINARY_FRAME_TRANSACTION, BINARY_FRAME_ZONE_READ,
+                                 BINARY_FRAME_ZONE_WRITE) and len(payload) > 0:
+                    if ord(payload[0]) & REQUEST_SESSION_BEGIN:
+                        in_session = True
+                    if ord(payload[0]) & REQUEST_SESSION_END:
+                        in_session = False
+                if not in_session:
+                    holding = False
+                    device.lock.release()
+                sock.sendall(binary_frame(chr(status), ord(header[2]), response))
+        except (EOFError, socket.error):
+            pass
+        finally:
+            if holding:
+                if in_session:
+                    device.end_session()
+                device.lock.release()
+
+
+def run_daemon(ports, socket_path):
+    # keeps the serial ports open and serves clients over a Unix socket, so
+    # they don't have to open (and wait for) the port every time
+    if connect_daemon(socket_path, '') is not None:
+        logging.error("A daemon is already running at " + socket_path)
+        exit(1)
+    for path in ports:
+        if not os.path.exists(path):
+            logging.error("Specify a valid path to serial port either in the config file or on command line!")
+            exit(1)
+        serport = open_serial_port(path)
+        if binary_protocol < 2:
+            logging.error(path + ": the daemon needs a firmware with binary mode v2")
+            exit(1)
+        daemon_devices.append(DaemonDevice(os.path.realpath(path), serport))
+    if os.path.exists(socket_path):
+        os.remove(socket_path)  # left behind by a daemon which didn't exit cleanly
+    server = SocketServer.ThreadingUnixStreamServer(socket_path, DaemonHandler)
+    server.daemon_threads = True
+    logging.info("Serving " + ", ".join(ports) + " at " + socket_path)
+    try:
+        server.serve_forever()
+    except KeyboardInterrupt:
+        pass
+    finally:
+        os.remove(socket_path)
+
+
 def check_mac_offline(challenge, mac, slot):
     # try to get the key
     keys = {}
@@ -601,18 +1293,32 @@ def check_mac_offline(challenge, mac, slot):
 parser = argparse.ArgumentParser(description="Talk to ATSHA204 using sha204_playground firmware.",
                                  formatter_class=argparse.ArgumentDefaultsHelpFormatter)
 parser.add_argument("command", choices=['status', 'show_config', 'lock_config', 'lock_data', 'personalize', 'random', 'sha',
-                                        'mac', 'check_mac', 'offline_mac'], help='Command')
+                                        'mac', 'bulk_mac', 'check_mac', 'offline_mac', 'stats', 'trace',
+                                        'batch_personalize', 'daemon'],
+                    help='Command')
 parser.add_argument('-n', '--dry-run', dest='dry_run', action='store_true', help="Do not do actual write or lock.")
 parser.add_argument('-c', '--config-file', dest='config_file', nargs='?', default='talk_to_sha204.ini',
                     help="Path to config file.")
 parser.add_argument('-s', '--serial-port', dest='serial_path', nargs='?', help='Path to serial port.')
+parser.add_argument('-P', '--ports', dest='ports', nargs='*', default=[],
+                    help="Serial ports for batch_personalize (default: all /dev/ttyACM*).")
+parser.add_argument('-D', '--socket', dest='socket', nargs='?', default='/tmp/talk_to_sha204.sock',
+                    help="Path to the daemon's socket (used instead of the serial port when the daemon runs). "
+                         "The daemon passes the requests of its clients on to the firmware one at a time (a "
+                         "wake session as a whole), so it does not keep the firmware's request queue full.")
+parser.add_argument('-R', '--reset-stats', dest='reset_stats', action='store_true',
+                    help="With stats: zero the firmware's counters after reading them.")
+parser.add_argument('-r', '--report-file', dest='report_file', nargs='?', default='batch_report.ini',
+                    help="Path to the batch_personalize report (one section per chip serial number).")
 parser.add_argument('-p', '--personalize-file', dest='personalize_file', nargs='?', default='personalize.ini',
                     help="Path to file with data for personalizing.")
 parser.add_argument('-k', '--keys-file', dest='keys_file', nargs='?', default='keys.ini',
                     help="Path to file with slot contents (any new random keys will be added on personalize or lock_data).")
+parser.add_argument('-j', '--journal-file', dest='journal_file', nargs='?', default='write_journal.ini',
+                    help="Path to file recording what was already written to unlocked data/OTP zones (per chip).")
 parser.add_argument('--random-keys', dest='random_keys', action='store_true',
                     help="Do not read keys-file even if present, generate random keys (keys-file will be overwritten!).")
-parser.add_argument('-f', '--file', dest='file', nargs='?', help="Path to file to be used for MAC. Uses stdin if no file given.")
+parser.add_argument('-f', '--file', dest='file', nargs='?', help="Path to file to be used for MAC (for bulk_mac: a list of paths, one per line). Uses stdin if no file given.")
 parser.add_argument('-m', '--mac', dest='mac', nargs='?', help="MAC to be checked; for check_mac or offline_mac.")
 parser.add_argument('-C', '--challenge', dest='challenge', nargs='?', help="SHA256 of data (challenge) for check_mac or offline_mac.")
 parser.add_argument('-S', '--sha-message', dest='sha_message', nargs='?', help="Message to be hashed with SHA, <=64 bytes (will be padded with 0).")
@@ -645,19 +1351,25 @@ if args.command == 'offline_mac':
     else:
         check_mac_offline(checkmac_challenge, checkmac_mac, MAC_SLOT)
 
+# batch operations open their serial ports themselves
+if args.command == 'batch_personalize':
+    exit(0 if batch_personalize(args.ports or sorted(glob.glob('/dev/ttyACM*'))) else 1)
+
 # open serial port
 serial_path = ''
 if script_config.has_option('Communication', 'SerialPort'):
     serial_path = script_config.get('Communication', 'SerialPort')
 if args.serial_path:
     serial_path = args.serial_path
-if not os.path.exists(serial_path):
-    logging.error("Specify a valid path to serial port either in the config file or on command line!")
-    exit(1)
-ser_port = serial.Serial(port=serial_path, baudrate=115200, timeout=2)  # timeout 2 seconds!
-time.sleep(2) # putting 2 so that Arduinos have time to run the bootloader, exit from it and start the sketch
-              # for avr-gcc/LUFA, 0.5 is enough
-ser_port.flushInput()  # throw away the message received after connecting (DTR)
+if args.command == 'daemon':
+    run_daemon(args.ports or [serial_path], args.socket)
+    exit(0)
+ser_port = connect_daemon(args.socket, serial_path)  # if one has the port open already
+if ser_port is None:
+    if not os.path.exists(serial_path):
+        logging.error("Specify a valid path to serial port either in the config file or on command line!")
+        exit(1)
+    ser_port = open_serial_port(serial_path)
 
 # pretty printer
 pp = pprint.PrettyPrinter(indent=2)
@@ -684,11 +1396,7 @@ elif args.command == 'random':
 elif args.command == 'lock_data':
     lock_data(ser_port)
 elif args.command == 'personalize':
-    config_area = process_config_area(read_config_area(ser_port))
-    if not config_area['ConfigLocked']:
-        lock_config(ser_port)
-    if not config_area['DataOTPlocked']:
-        lock_data(ser_port)
+    personalize(ser_port)
     print("personalized")
 elif args.command == 'mac':
     mac_challenge = SHA256.new()
@@ -699,6 +1407,10 @@ elif args.command == 'mac':
                 break
             mac_challenge.update(chunk)
     mac(mac_challenge.digest(), MAC_SLOT, ser_port)
+elif args.command == 'bulk_mac':
+    with open(args.file,'r') if args.file else sys.stdin as f:
+        paths = [line.strip() for line in f if line.strip()]
+    exit(1 if bulk_mac(paths, MAC_SLOT, ser_port) else 0)
 elif args.command == 'check_mac':
     try:
         checkmac_challenge = binascii.unhexlify(args.challenge)
@@ -720,6 +1432,28 @@ elif args.command == 'sha':
         exit(1)
     else:
         sha(sha_message.ljust(64,'\x00'), ser_port)
+elif args.command == 'stats':
+    if binary_protocol < 4:
+        logging.error("The firmware does not keep statistics (binary mode v" + str(binary_protocol) + ").")
+        exit(1)
+    counters, histograms, opcodes = get_stats(ser_port, args.reset_stats)
+    for name, value in counters.items():
+        print(name + ": " + str(value))
+    for name, histogram in histograms.items():
+        print(name + ": " + format_histogram(histogram))
+    for name, opcode in opcodes.items():
+        if opcode['commands'] > 0:
+            print(name.ljust(12) + str(opcode['commands']).rjust(6) + " commands" + str(opcode['failures']).rjust(6) +
+                  " failed  latency " + format_histogram(opcode['latency']))
+elif args.command == 'trace':
+    if binary_protocol < 7:
+        logging.error("The firmware does not keep a trace (binary mode v" + str(binary_protocol) + ").")
+        exit(1)
+    try:
+        print_trace(get_trace(ser_port))
+    except TransactionError, e:
+        logging.error(str(e))  # a firmware built without SHA204_TRACE
+        exit(1)
 
 
 exit(0)